@@ -3017,14 +3017,6 @@ static void send_shutdown_complete(struct peer *peer)
 	close(MASTER_FD);
 }
 
-static void try_read_gossip_store(struct peer *peer)
-{
-	u8 *msg = gossip_store_next(tmpctx, peer->pps);
-
-	if (msg)
-		sync_crypto_write(peer->pps, take(msg));
-}
-
 int main(int argc, char *argv[])
 {
 	setup_locale();
@@ -3137,7 +3129,7 @@ int main(int argc, char *argv[])
 				peer_failed_connection_lost();
 			handle_gossip_msg(peer->pps, take(msg));
 		} else /* Lowest priority: stream from store. */
-			try_read_gossip_store(peer);
+			gossip_store_send(peer->pps);
 	}
 
 	/* We only exit when shutdown is complete. */
@@ -52,6 +52,57 @@ void sync_crypto_write(struct per_peer_state *pps, const void *msg TAKES)
 #endif
 }
 
+void sync_crypto_append(struct per_peer_state *pps, u8 **batch,
+			const u8 *msg, size_t msglen)
+{
+#if DEVELOPER
+	enum dev_disconnect dd = DEV_DISCONNECT_NORMAL;
+	be16 be_type;
+
+	if (msglen >= sizeof(be_type)) {
+		memcpy(&be_type, msg, sizeof(be_type));
+		dd = dev_disconnect(be16_to_cpu(be_type));
+	}
+
+	/* Anything unusual happens at exactly this message, so everything
+	 * before it goes out first. */
+	if (dd != DEV_DISCONNECT_NORMAL) {
+		sync_crypto_write_batch(pps, *batch);
+		tal_resize(batch, 0);
+	}
+	switch (dd) {
+	case DEV_DISCONNECT_BEFORE:
+		dev_sabotage_fd(pps->peer_fd);
+		peer_failed_connection_lost();
+	case DEV_DISCONNECT_BLACKHOLE:
+		dev_blackhole_fd(pps->peer_fd);
+		break;
+	case DEV_DISCONNECT_DROPPKT:
+	case DEV_DISCONNECT_AFTER:
+	case DEV_DISCONNECT_NORMAL:
+		break;
+	}
+#endif
+
+	status_io(LOG_IO_OUT, "", msg, msglen);
+	cryptomsg_encrypt_append(batch, &pps->cs, msg, msglen);
+
+#if DEVELOPER
+	if (dd == DEV_DISCONNECT_AFTER)
+		sync_crypto_write_batch(pps, *batch);
+	if (dd == DEV_DISCONNECT_AFTER || dd == DEV_DISCONNECT_DROPPKT) {
+		tal_resize(batch, 0);
+		dev_sabotage_fd(pps->peer_fd);
+	}
+#endif
+}
+
+void sync_crypto_write_batch(struct per_peer_state *pps, const u8 *batch)
+{
+	if (!write_all(pps->peer_fd, batch, tal_count(batch)))
+		peer_failed_connection_lost();
+}
+
 /* We're happy for the kernel to batch update and gossip messages, but a
  * commitment message, for example, should be instantly sent.  There's no
  * great way of doing this, unfortunately.
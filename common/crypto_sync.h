@@ -13,6 +13,15 @@ void sync_crypto_write(struct per_peer_state *pps, const void *msg TAKES);
 void sync_crypto_write_no_delay(struct per_peer_state *pps,
 				const void *msg TAKES);
 
+/* Encrypts @msglen bytes of @msg onto the end of @batch, for
+ * sync_crypto_write_batch() to send many messages in one write. */
+void sync_crypto_append(struct per_peer_state *pps, u8 **batch,
+			const u8 *msg, size_t msglen);
+
+/* Writes what sync_crypto_append() built up; exits with
+ * peer_failed_connection_lost() if write fails. */
+void sync_crypto_write_batch(struct per_peer_state *pps, const u8 *batch);
+
 /* Exits with peer_failed_connection_lost() if can't read packet. */
 u8 *sync_crypto_read(const tal_t *ctx, struct per_peer_state *pps);
 
@@ -156,17 +156,15 @@ bool cryptomsg_decrypt_header(struct crypto_state *cs, u8 hdr[18], u16 *lenp)
 	return true;
 }
 
-u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
-			  struct crypto_state *cs,
-			  const u8 *msg TAKES)
+/* Encrypts @mlen bytes of @msg into @out, which has room for
+ * CRYPTOMSG_HDR_SIZE + mlen + CRYPTOMSG_BODY_OVERHEAD bytes. */
+static void encrypt_msg_into(u8 *out, struct crypto_state *cs,
+			     const u8 *msg, unsigned long long mlen)
 {
 	unsigned char npub[crypto_aead_chacha20poly1305_ietf_NPUBBYTES];
-	unsigned long long clen, mlen = tal_count(msg);
+	unsigned long long clen;
 	be16 l;
 	int ret;
-	u8 *out;
-
-	out = tal_arr(ctx, u8, sizeof(l) + 16 + mlen + 16);
 
 	/* BOLT #8:
 	 *
@@ -237,8 +235,31 @@ u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
 #endif
 
 	maybe_rotate_key(&cs->sn, &cs->sk, &cs->s_ck);
+}
+
+u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
+			  struct crypto_state *cs,
+			  const u8 *msg TAKES)
+{
+	size_t mlen = tal_count(msg);
+	u8 *out;
+
+	out = tal_arr(ctx, u8,
+		      CRYPTOMSG_HDR_SIZE + mlen + CRYPTOMSG_BODY_OVERHEAD);
+	encrypt_msg_into(out, cs, msg, mlen);
 
 	if (taken(msg))
 		tal_free(msg);
 	return out;
 }
+
+void cryptomsg_encrypt_append(u8 **out,
+			      struct crypto_state *cs,
+			      const u8 *msg, size_t mlen)
+{
+	size_t off = tal_count(*out);
+
+	tal_resize(out,
+		   off + CRYPTOMSG_HDR_SIZE + mlen + CRYPTOMSG_BODY_OVERHEAD);
+	encrypt_msg_into(*out + off, cs, msg, mlen);
+}
@@ -26,6 +26,11 @@
 u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
 			  struct crypto_state *cs,
 			  const u8 *msg);
+/* Encrypts @mlen bytes of @msg onto the end of @out, so many messages can go
+ * out in a single write. */
+void cryptomsg_encrypt_append(u8 **out,
+			      struct crypto_state *cs,
+			      const u8 *msg, size_t mlen);
 bool cryptomsg_decrypt_header(struct crypto_state *cs, u8 hdr[18], u16 *lenp);
 u8 *cryptomsg_decrypt_body(const tal_t *ctx,
 			   struct crypto_state *cs, const u8 *in);
@@ -1,3 +1,4 @@
+#include <bitcoin/short_channel_id.h>
 #include <common/decode_short_channel_ids.h>
 #include <common/utils.h>
 #include <wire/wire.h>
@@ -21,6 +22,211 @@ static u8 *unzlib(const tal_t *ctx, const u8 *encoded, size_t len)
 	return unc;
 }
 
+/*~ SHORTIDS_RICE is the Golomb-Rice coding suggested for this in the comment
+ * above zencode_scids() in gossipd.  Each short_channel_id is split into its
+ * three parts, since they behave so differently:
+ *
+ *   blocknum: the difference from the previous blocknum.
+ *   txnum: the difference from the previous txnum if in the same block,
+ *          otherwise the txnum itself.
+ *   outnum: one less than the difference from the previous outnum if in the
+ *          same transaction, otherwise the outnum itself.
+ *
+ * Each of those three is Rice coded as in BIP 158 (the quotient in unary,
+ * then the remainder in a fixed number of bits), with the number of bits
+ * chosen per stream to make it smallest.  After the type byte:
+ *
+ *   u32 count, u32 first blocknum, u8 block bits, u8 tx bits, u8 out bits,
+ *   then the codes, most significant bit first, zero-padded to a byte.
+ */
+#define RICE_MAX_BITS 32
+/* Blocknums and txnums are 24 bits, so no quotient is ever longer. */
+#define RICE_MAX_QUOTIENT (1 << 24)
+
+enum rice_stream {
+	RICE_BLOCK,
+	RICE_TX,
+	RICE_OUT,
+	RICE_NUM_STREAMS
+};
+
+/* The three values we code for @scid, given the one before (if any). */
+static void rice_values(const struct short_channel_id *prev,
+			const struct short_channel_id *scid,
+			u32 first_blocknum,
+			u64 v[RICE_NUM_STREAMS])
+{
+	u32 block = short_channel_id_blocknum(scid);
+	u32 tx = short_channel_id_txnum(scid);
+	u16 out = short_channel_id_outnum(scid);
+
+	if (!prev) {
+		v[RICE_BLOCK] = block - first_blocknum;
+		v[RICE_TX] = tx;
+		v[RICE_OUT] = out;
+		return;
+	}
+
+	v[RICE_BLOCK] = block - short_channel_id_blocknum(prev);
+	if (v[RICE_BLOCK] != 0) {
+		v[RICE_TX] = tx;
+		v[RICE_OUT] = out;
+		return;
+	}
+	v[RICE_TX] = tx - short_channel_id_txnum(prev);
+	if (v[RICE_TX] != 0)
+		v[RICE_OUT] = out;
+	else
+		v[RICE_OUT] = out - short_channel_id_outnum(prev) - 1;
+}
+
+static void put_bit(u8 **encoded, size_t *bitpos, bool bit)
+{
+	if (*bitpos % 8 == 0)
+		towire_u8(encoded, 0);
+	if (bit)
+		(*encoded)[tal_count(*encoded) - 1] |= 0x80 >> (*bitpos % 8);
+	(*bitpos)++;
+}
+
+static void put_rice(u8 **encoded, size_t *bitpos, u64 v, u8 bits)
+{
+	for (u64 q = v >> bits; q; q--)
+		put_bit(encoded, bitpos, true);
+	put_bit(encoded, bitpos, false);
+	for (int i = bits - 1; i >= 0; i--)
+		put_bit(encoded, bitpos, (v >> i) & 1);
+}
+
+bool encode_short_ids_rice(u8 **encoded, const struct short_channel_id *scids)
+{
+	size_t n = tal_count(scids), bitpos = 0;
+	struct rice_values {
+		u64 v[RICE_NUM_STREAMS];
+	} *vals;
+	u8 bits[RICE_NUM_STREAMS];
+	u32 first_blocknum = n ? short_channel_id_blocknum(&scids[0]) : 0;
+
+	vals = tal_arr(tmpctx, struct rice_values, n);
+	for (size_t i = 0; i < n; i++) {
+		if (i > 0 && scids[i].u64 <= scids[i-1].u64)
+			return false;
+		rice_values(i ? &scids[i-1] : NULL, &scids[i],
+			    first_blocknum, vals[i].v);
+	}
+
+	/* Cost of each choice is easy to calculate, so pick the best. */
+	for (size_t s = 0; s < RICE_NUM_STREAMS; s++) {
+		u64 best = -1ULL;
+
+		bits[s] = 0;
+		for (u8 b = 0; b <= RICE_MAX_BITS; b++) {
+			u64 cost = 0;
+			for (size_t i = 0; i < n; i++)
+				cost += (vals[i].v[s] >> b) + 1 + b;
+			if (cost < best) {
+				best = cost;
+				bits[s] = b;
+			}
+		}
+	}
+
+	towire_u32(encoded, n);
+	towire_u32(encoded, first_blocknum);
+	for (size_t s = 0; s < RICE_NUM_STREAMS; s++)
+		towire_u8(encoded, bits[s]);
+	for (size_t i = 0; i < n; i++)
+		for (size_t s = 0; s < RICE_NUM_STREAMS; s++)
+			put_rice(encoded, &bitpos, vals[i].v[s], bits[s]);
+	tal_free(vals);
+	return true;
+}
+
+static bool get_bit(const u8 *p, size_t len, size_t *bitpos, bool *bit)
+{
+	if (*bitpos / 8 >= len)
+		return false;
+	*bit = p[*bitpos / 8] & (0x80 >> (*bitpos % 8));
+	(*bitpos)++;
+	return true;
+}
+
+static bool get_rice(const u8 *p, size_t len, size_t *bitpos, u8 bits,
+		     u64 *v)
+{
+	u64 q = 0, r = 0;
+	bool bit;
+
+	for (;;) {
+		if (!get_bit(p, len, bitpos, &bit))
+			return false;
+		if (!bit)
+			break;
+		if (++q > RICE_MAX_QUOTIENT)
+			return false;
+	}
+	for (u8 i = 0; i < bits; i++) {
+		if (!get_bit(p, len, bitpos, &bit))
+			return false;
+		r = (r << 1) | bit;
+	}
+	*v = (q << bits) | r;
+	return true;
+}
+
+static struct short_channel_id *unrice(const tal_t *ctx,
+				       const u8 *encoded, size_t max)
+{
+	struct short_channel_id *scids;
+	u32 count, first_blocknum;
+	u8 bits[RICE_NUM_STREAMS];
+	u64 block, tx = 0, out = 0;
+	size_t bitpos = 0;
+
+	count = fromwire_u32(&encoded, &max);
+	first_blocknum = fromwire_u32(&encoded, &max);
+	for (size_t s = 0; s < RICE_NUM_STREAMS; s++) {
+		bits[s] = fromwire_u8(&encoded, &max);
+		if (bits[s] > RICE_MAX_BITS)
+			return NULL;
+	}
+	/* Each one takes at least three bits. */
+	if (!encoded || count > max * 8 / 3)
+		return NULL;
+
+	block = first_blocknum;
+	scids = tal_arr(ctx, struct short_channel_id, count);
+	for (size_t i = 0; i < count; i++) {
+		u64 v[RICE_NUM_STREAMS];
+
+		for (size_t s = 0; s < RICE_NUM_STREAMS; s++)
+			if (!get_rice(encoded, max, &bitpos, bits[s], &v[s]))
+				return tal_free(scids);
+
+		/* Reverse of rice_values() */
+		block += v[RICE_BLOCK];
+		if (i == 0 || v[RICE_BLOCK] != 0) {
+			tx = v[RICE_TX];
+			out = v[RICE_OUT];
+		} else if (v[RICE_TX] != 0) {
+			tx += v[RICE_TX];
+			out = v[RICE_OUT];
+		} else
+			out += v[RICE_OUT] + 1;
+
+		if (block > 0xFFFFFF || tx > 0xFFFFFF || out > 0xFFFF
+		    || !mk_short_channel_id(&scids[i], block, tx, out))
+			return tal_free(scids);
+	}
+
+	/* Nothing but padding may follow. */
+	if ((bitpos + 7) / 8 != max)
+		return tal_free(scids);
+	if (bitpos % 8 && (encoded[max - 1] & (0xFF >> (bitpos % 8))))
+		return tal_free(scids);
+	return scids;
+}
+
 struct short_channel_id *decode_short_ids(const tal_t *ctx, const u8 *encoded)
 {
 	struct short_channel_id *scids;
@@ -57,6 +263,8 @@ struct short_channel_id *decode_short_ids(const tal_t *ctx, const u8 *encoded)
 		if (!encoded)
 			return tal_free(scids);
 		return scids;
+	case SHORTIDS_RICE:
+		return unrice(ctx, encoded, max);
 	}
 	return NULL;
 }
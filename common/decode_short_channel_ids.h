@@ -4,6 +4,8 @@
 #include <ccan/short_types/short_types.h>
 #include <ccan/tal/tal.h>
 
+struct short_channel_id;
+
 /* BOLT #7:
  *
  * Encoding types:
@@ -12,8 +14,15 @@
  */
 enum scid_encode_types {
 	SHORTIDS_UNCOMPRESSED = 0,
-	SHORTIDS_ZLIB = 1
+	SHORTIDS_ZLIB = 1,
+	/* Experimental: only used if LOCAL_GOSSIP_QUERIES_RICE negotiated */
+	SHORTIDS_RICE = 0x80
 };
 
 struct short_channel_id *decode_short_ids(const tal_t *ctx, const u8 *encoded);
+
+/* Append the SHORTIDS_RICE encoding of @scids (tal_count() of them) to
+ * *@encoded, after the type byte.  Returns false (leaving *@encoded alone)
+ * if they're not in ascending order, without duplicates. */
+bool encode_short_ids_rice(u8 **encoded, const struct short_channel_id *scids);
 #endif /* LIGHTNING_COMMON_DECODE_SHORT_CHANNEL_IDS_H */
@@ -36,4 +36,8 @@ bool global_feature_negotiated(const u8 *gfeatures, size_t f);
 #define LOCAL_UPFRONT_SHUTDOWN_SCRIPT		4
 #define LOCAL_GOSSIP_QUERIES			6
 
+/* Not in BOLT #9: we understand SHORTIDS_RICE in `encoded_short_ids`.
+ * Only offered with EXPERIMENTAL_FEATURES. */
+#define LOCAL_GOSSIP_QUERIES_RICE		100
+
 #endif /* LIGHTNING_COMMON_FEATURES_H */
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <ccan/crc32c/crc32c.h>
+#include <common/crypto_sync.h>
 #include <common/features.h>
 #include <common/gossip_store.h>
 #include <common/per_peer_state.h>
@@ -7,9 +8,17 @@
 #include <common/utils.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wire/gen_peer_wire.h>
 
+/* We stop adding to a batch once it's this big. */
+#define GOSSIP_STORE_BATCH_BYTES 65536
+
+/* How often (in bytes sent) we log our counters. */
+#define GOSSIP_STORE_LOG_BYTES (4 * 1024 * 1024)
+
 void gossip_setup_timestamp_filter(struct per_peer_state *pps,
 				   u32 first_timestamp,
 				   u32 timestamp_range)
@@ -39,7 +48,7 @@ void gossip_setup_timestamp_filter(struct per_peer_state *pps,
 	 */
 
 	/* Restart just after header. */
-	lseek(pps->gossip_store_fd, 1, SEEK_SET);
+	pps->gossip_store_off = 1;
 }
 
 static bool timestamp_filter(const struct per_peer_state *pps, u32 timestamp)
@@ -55,26 +64,67 @@ static bool timestamp_filter(const struct per_peer_state *pps, u32 timestamp)
 		&& timestamp <= pps->gs->timestamp_max;
 }
 
-static void undo_read(int fd, int len, size_t wanted)
+/* Drop our mapping of the store (eg. it's being replaced) */
+static void unmap_gossip_store(struct per_peer_state *pps)
 {
-	if (len < 0) {
-		/* Grab errno before lseek overrides it */
-		const char *err = strerror(errno);
+	if (pps->gossip_store_map)
+		munmap((void *)pps->gossip_store_map, pps->gossip_store_maplen);
+	pps->gossip_store_map = NULL;
+	pps->gossip_store_maplen = 0;
+	pps->gossip_store_len = 0;
+}
+
+/* Make sure the first @len bytes of the store are mapped: false if the
+ * file isn't that long (yet). */
+static bool map_gossip_store(struct per_peer_state *pps, u64 len)
+{
+	struct stat st;
+	void *map;
+
+	if (len <= pps->gossip_store_len)
+		return true;
+
+	if (fstat(pps->gossip_store_fd, &st) != 0)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "gossip_store: failed read @%"PRIu64": %s",
-			      (u64)lseek(fd, 0, SEEK_CUR), err);
+			      "gossip_store: failed stat: %s",
+			      strerror(errno));
+	if ((u64)st.st_size < len)
+		return false;
+
+	if ((u64)st.st_size > pps->gossip_store_maplen) {
+		/* Map well past the end, so we don't remap on every append:
+		 * pages past EOF fill in as gossipd writes them. */
+		size_t maplen = st.st_size * 2;
+
+		unmap_gossip_store(pps);
+		map = mmap(NULL, maplen, PROT_READ, MAP_SHARED,
+			   pps->gossip_store_fd, 0);
+		if (map == MAP_FAILED)
+			status_failed(STATUS_FAIL_INTERNAL_ERROR,
+				      "gossip_store: failed mmap of %zu: %s",
+				      maplen, strerror(errno));
+		pps->gossip_store_map = map;
+		pps->gossip_store_maplen = maplen;
 	}
+	pps->gossip_store_len = st.st_size;
+	return true;
+}
 
-	/* Shouldn't happen, but some filesystems are not as atomic as
-	 * they should be! */
-	status_unusual("gossip_store: short read %i of %zu @%"PRIu64,
-		       len, wanted, (u64)lseek(fd, 0, SEEK_CUR) - len);
-	lseek(fd, -len, SEEK_CUR);
+/* Offset 0 means "where the fd is" (ie. as handed to us). */
+static u64 gossip_store_offset(struct per_peer_state *pps)
+{
+	if (pps->gossip_store_off == 0)
+		pps->gossip_store_off = lseek(pps->gossip_store_fd,
+					      0, SEEK_CUR);
+	return pps->gossip_store_off;
 }
 
-u8 *gossip_store_next(const tal_t *ctx, struct per_peer_state *pps)
+/* Returns the next message for the peer, pointing into the map: it's only
+ * valid until we map again. */
+static const u8 *gossip_store_next_mapped(struct per_peer_state *pps,
+					  u32 *len)
 {
-	u8 *msg = NULL;
+	const u8 *msg = NULL;
 
 	/* Don't read until we're initialized. */
 	if (!pps->gs)
@@ -83,71 +133,135 @@ u8 *gossip_store_next(const tal_t *ctx, struct per_peer_state *pps)
 	while (!msg) {
 		struct gossip_hdr hdr;
 		u32 msglen, checksum, timestamp;
-		int type, r;
+		u64 off = gossip_store_offset(pps);
+		const u8 *p;
+		be16 be_type;
+		int type;
 
-		r = read(pps->gossip_store_fd, &hdr, sizeof(hdr));
-		if (r != sizeof(hdr)) {
-			/* We expect a 0 read here at EOF */
-			if (r != 0)
-				undo_read(pps->gossip_store_fd, r, sizeof(hdr));
+		/* We expect to run out here at EOF */
+		if (!map_gossip_store(pps, off + sizeof(hdr))) {
 			per_peer_state_reset_gossip_timer(pps);
 			return NULL;
 		}
 
-		/* Skip any deleted entries. */
-		if (be32_to_cpu(hdr.len) & GOSSIP_STORE_LEN_DELETED_BIT) {
-			/* Skip over it. */
-			lseek(pps->gossip_store_fd,
-			      be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT,
-			      SEEK_CUR);
-			continue;
-		}
-
-		msglen = be32_to_cpu(hdr.len);
-		checksum = be32_to_cpu(hdr.crc);
-		timestamp = be32_to_cpu(hdr.timestamp);
-		msg = tal_arr(ctx, u8, msglen);
-		r = read(pps->gossip_store_fd, msg, msglen);
-		if (r != msglen) {
-			undo_read(pps->gossip_store_fd, r, msglen);
+		memcpy(&hdr, pps->gossip_store_map + off, sizeof(hdr));
+		msglen = be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT;
+		if (!map_gossip_store(pps, off + sizeof(hdr) + msglen)) {
+			/* Shouldn't happen, but some filesystems are not as
+			 * atomic as they should be! */
+			status_unusual("gossip_store: short record of %u @%"
+				       PRIu64, msglen, off);
 			per_peer_state_reset_gossip_timer(pps);
 			return NULL;
 		}
+		p = pps->gossip_store_map + off + sizeof(hdr);
+		pps->gossip_store_off = off + sizeof(hdr) + msglen;
 
-		if (checksum != crc32c(be32_to_cpu(hdr.timestamp), msg, msglen))
-			status_failed(STATUS_FAIL_INTERNAL_ERROR,
-				      "gossip_store: bad checksum offset %"
-				      PRIi64": %s",
-				      (s64)lseek(pps->gossip_store_fd,
-						 0, SEEK_CUR) - msglen,
-				      tal_hex(tmpctx, msg));
+		/* Skip any deleted entries. */
+		if (be32_to_cpu(hdr.len) & GOSSIP_STORE_LEN_DELETED_BIT)
+			continue;
 
-		/* Ignore gossipd internal messages. */
-		type = fromwire_peektype(msg);
+		/* Ignore gossipd internal messages, and filtered ones: we
+		 * look at these in place, without copying. */
+		if (msglen < sizeof(be_type))
+			continue;
+		memcpy(&be_type, p, sizeof(be_type));
+		type = be16_to_cpu(be_type);
 		if (type != WIRE_CHANNEL_ANNOUNCEMENT
 		    && type != WIRE_CHANNEL_UPDATE
 		    && type != WIRE_NODE_ANNOUNCEMENT)
-			msg = tal_free(msg);
-		else if (!timestamp_filter(pps, timestamp))
-			msg = tal_free(msg);
+			continue;
+
+		timestamp = be32_to_cpu(hdr.timestamp);
+		if (!timestamp_filter(pps, timestamp))
+			continue;
+
+		checksum = be32_to_cpu(hdr.crc);
+		if (checksum != crc32c(timestamp, p, msglen))
+			status_failed(STATUS_FAIL_INTERNAL_ERROR,
+				      "gossip_store: bad checksum offset %"
+				      PRIu64": %s",
+				      off + sizeof(hdr),
+				      tal_hexstr(tmpctx, p, msglen));
+
+		msg = p;
+		*len = msglen;
 	}
 
 	return msg;
 }
 
+static void log_send_stats(struct per_peer_state *pps)
+{
+	struct gossip_send_stats *st = &pps->gossip_stats;
+	u64 bytes = st->bytes - st->logged_bytes;
+	u64 nsec = st->nsec - st->logged_nsec;
+
+	if (bytes < GOSSIP_STORE_LOG_BYTES)
+		return;
+
+	status_debug("gossip_store: sent %"PRIu64" msgs, %"PRIu64" bytes"
+		     " in %"PRIu64" writes, %"PRIu64" bytes/sec",
+		     st->msgs, st->bytes, st->writes,
+		     nsec ? bytes * 1000000000 / nsec : 0);
+	st->logged_bytes = st->bytes;
+	st->logged_nsec = st->nsec;
+}
+
+size_t gossip_store_send(struct per_peer_state *pps)
+{
+	struct timemono start = time_mono();
+	u8 *batch = tal_arr(NULL, u8, 0);
+	size_t n = 0;
+
+	/* Each message is encrypted straight from the map into the batch;
+	 * the map can move under us, but only once we've finished with the
+	 * previous one. */
+	while (tal_bytelen(batch) < GOSSIP_STORE_BATCH_BYTES) {
+		u32 len;
+		const u8 *msg = gossip_store_next_mapped(pps, &len);
+
+		if (!msg)
+			break;
+		sync_crypto_append(pps, &batch, msg, len);
+		n++;
+	}
+
+	if (n) {
+		sync_crypto_write_batch(pps, batch);
+		pps->gossip_stats.msgs += n;
+		pps->gossip_stats.bytes += tal_bytelen(batch);
+		pps->gossip_stats.writes++;
+		pps->gossip_stats.nsec += time_to_nsec(timemono_since(start));
+		log_send_stats(pps);
+	}
+	tal_free(batch);
+	return n;
+}
+
 /* newfd is at offset 1.  We need to adjust it to similar offset as our
  * current one. */
 void gossip_store_switch_fd(struct per_peer_state *pps,
 			    int newfd, u64 offset_shorter)
 {
-	u64 cur = lseek(pps->gossip_store_fd, SEEK_CUR, 0);
+	u64 cur = gossip_store_offset(pps);
+	struct stat st;
+
+	if (fstat(pps->gossip_store_fd, &st) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "gossip_store: failed stat: %s",
+			      strerror(errno));
+
+	unmap_gossip_store(pps);
+	close(pps->gossip_store_fd);
+	pps->gossip_store_fd = newfd;
 
 	/* If we're already at end (common), we know where to go in new one. */
-	if (cur == lseek(pps->gossip_store_fd, SEEK_END, 0)) {
+	if (cur == (u64)st.st_size) {
 		status_debug("gossip_store at end, new fd moved to %"PRIu64,
 			     cur - offset_shorter);
 		assert(cur > offset_shorter);
-		lseek(newfd, cur - offset_shorter, SEEK_SET);
+		pps->gossip_store_off = cur - offset_shorter;
 	} else if (cur > offset_shorter) {
 		/* We're part way through.  Worst case, we should move back by
 		 * offset_shorter (that's how much the *end* moved), but in
@@ -160,28 +274,27 @@ void gossip_store_switch_fd(struct per_peer_state *pps,
 			     cur, target);
 		cur = 1;
 		while (cur < target) {
-			u32 msglen;
 			struct gossip_hdr hdr;
 
-			if (read(newfd, &hdr, sizeof(hdr)) != sizeof(hdr))
+			if (!map_gossip_store(pps, cur + sizeof(hdr)))
 				status_failed(STATUS_FAIL_INTERNAL_ERROR,
 					      "gossip_store: "
 					      "can't read hdr offset %"PRIu64
 					      " in new store target %"PRIu64,
 					      cur, target);
+			memcpy(&hdr, pps->gossip_store_map + cur, sizeof(hdr));
 			/* Skip over it. */
-			msglen = (be32_to_cpu(hdr.len)
-				  & ~GOSSIP_STORE_LEN_DELETED_BIT);
-			cur = lseek(newfd, msglen, SEEK_CUR);
+			cur += sizeof(hdr) + (be32_to_cpu(hdr.len)
+					      & ~GOSSIP_STORE_LEN_DELETED_BIT);
 			num++;
 		}
 		status_debug("gossip_store: skipped %zu records to %"PRIu64,
 			     num, cur);
-	} else
+		pps->gossip_store_off = cur;
+	} else {
 		status_debug("gossip_store new fd moving back %"PRIu64
 			     " to start (offset_shorter=%"PRIu64")",
 			     cur, offset_shorter);
-
-	close(pps->gossip_store_fd);
-	pps->gossip_store_fd = newfd;
+		pps->gossip_store_off = 1;
+	}
 }
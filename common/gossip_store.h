@@ -27,12 +27,13 @@ struct gossip_hdr {
 };
 
 /**
- * Direct store accessor: loads gossip msg from store.
+ * Direct store accessor: sends the next gossip msgs from store to the peer.
  *
- * Returns NULL and resets time_to_next_gossip(pps) if there are no
- * more gossip msgs.
+ * Encrypts up to about 64k of them straight from the mapped store, and
+ * sends them with a single write.  Returns how many were sent: 0 if there
+ * were no more gossip msgs, in which case it resets time_to_next_gossip(pps).
  */
-u8 *gossip_store_next(const tal_t *ctx, struct per_peer_state *pps);
+size_t gossip_store_send(struct per_peer_state *pps);
 
 /**
  * Switches the gossip store fd, and gets to the correct offset.
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <bitcoin/pubkey.h>
 #include <ccan/build_assert/build_assert.h>
+#include <ccan/endian/endian.h>
 #include <ccan/mem/mem.h>
 #include <ccan/str/hex/hex.h>
 #include <ccan/tal/str/str.h>
@@ -210,50 +211,203 @@ const jsmntok_t *json_get_arr(const jsmntok_t tok[], size_t index)
 	return NULL;
 }
 
+/* jsmn carries on from parser->pos, so this only parses the new part of
+ * input.  Returns false if it's invalid, otherwise sets *complete if
+ * we've read at least one full root element, starting at toks[first]. */
+static bool json_parse_more(jsmn_parser *parser, jsmntok_t **toks,
+			    size_t first,
+			    const char *input, int len, bool *complete)
+{
+	int ret;
+
+again:
+	/* We keep one spare, so we can always terminate. */
+	ret = jsmn_parse(parser, input, len, *toks, tal_count(*toks) - 1);
+
+	switch (ret) {
+	case JSMN_ERROR_INVAL:
+		return false;
+	case JSMN_ERROR_NOMEM:
+		/* It leaves parser where the token was needed. */
+		tal_resize(toks, tal_count(*toks) * 2);
+		goto again;
+	}
+
+	/* Check whether we read at least one full root element, i.e., root
+	 * element has its end set.  If we read a partial element at the end
+	 * of the stream we'll get a ret=JSMN_ERROR_PART, which is fine. */
+	*complete = (first < parser->toknext && (*toks)[first].end != -1);
+	return true;
+}
+
+/* Terminate after the root element, returning number of tokens in it. */
+static size_t json_terminate_toks(jsmntok_t *toks)
+{
+	size_t n = json_next(toks) - toks;
+
+	/* Make sure last one is always referenceable. */
+	toks[n].type = -1;
+	toks[n].start = toks[n].end = toks[n].size = 0;
+	return n;
+}
+
 jsmntok_t *json_parse_input(const tal_t *ctx,
 			    const char *input, int len, bool *valid)
 {
 	jsmn_parser parser;
 	jsmntok_t *toks;
-	int ret;
+	bool complete;
 
 	toks = tal_arr(ctx, jsmntok_t, 10);
 	toks[0].type = JSMN_UNDEFINED;
 
 	jsmn_init(&parser);
-again:
-	ret = jsmn_parse(&parser, input, len, toks, tal_count(toks) - 1);
-
-	switch (ret) {
-	case JSMN_ERROR_INVAL:
-		*valid = false;
+	*valid = json_parse_more(&parser, &toks, 0, input, len, &complete);
+	if (!*valid || !complete)
 		return tal_free(toks);
-	case JSMN_ERROR_NOMEM:
-		tal_resize(&toks, tal_count(toks) * 2);
-		goto again;
+
+	/* Cut to length and return. */
+	tal_resize(&toks, json_terminate_toks(toks) + 1);
+	return toks;
+}
+
+struct json_parser *json_parser_new(const tal_t *ctx)
+{
+	struct json_parser *parser = tal(ctx, struct json_parser);
+
+	parser->toks = tal_arr(parser, jsmntok_t, 10);
+	json_parser_reset(parser);
+	return parser;
+}
+
+void json_parser_reset(struct json_parser *parser)
+{
+	jsmn_init(&parser->jsmn);
+	parser->toks[0].type = JSMN_UNDEFINED;
+	parser->len = 0;
+	parser->first = 0;
+	parser->consumed = 0;
+	parser->term = 0;
+}
+
+/* Put back the token we overwrote to terminate the last value returned:
+ * it may be the start of the next one. */
+static void json_parser_unterminate(struct json_parser *parser)
+{
+	if (parser->term) {
+		parser->toks[parser->term] = parser->saved;
+		parser->term = 0;
 	}
+}
 
-	/* Check whether we read at least one full root element, i.e., root
-	 * element has its end set. */
-	if (toks[0].type == JSMN_UNDEFINED || toks[0].end == -1) {
+const jsmntok_t *json_parser_parse(struct json_parser *parser,
+				   const char *input, int len, bool *valid)
+{
+	bool complete;
+	jsmntok_t *toks;
+	size_t n;
+
+	json_parser_unterminate(parser);
+
+	/* jsmn checks every token for completeness each time it's called, so
+	 * don't call it again for each value already in the buffer. */
+	if (len != parser->len) {
+		*valid = json_parse_more(&parser->jsmn, &parser->toks,
+					 parser->first, input, len, &complete);
+		if (!*valid)
+			return NULL;
+		parser->len = len;
+	} else {
 		*valid = true;
-		return tal_free(toks);
+		complete = (parser->first < parser->jsmn.toknext
+			    && parser->toks[parser->first].end != -1);
 	}
+	if (!complete)
+		return NULL;
 
-	/* If we read a partial element at the end of the stream we'll get a
-	 * ret=JSMN_ERROR_PART, but due to the previous check we know we read at
-	 * least one full element, so count tokens that are part of this root
-	 * element. */
-	ret = json_next(toks) - toks;
+	/* There may be tokens for the next value(s) after it: save the one
+	 * we're about to overwrite. */
+	toks = parser->toks + parser->first;
+	n = json_next(toks) - parser->toks;
+	parser->saved = parser->toks[n];
+	parser->term = n;
+	json_terminate_toks(toks);
+	return toks;
+}
 
-	/* Cut to length and return. */
-	*valid = true;
-	tal_resize(&toks, ret + 1);
-	/* Make sure last one is always referenceable. */
-	toks[ret].type = -1;
-	toks[ret].start = toks[ret].end = toks[ret].size = 0;
+void json_parser_consume(struct json_parser *parser)
+{
+	const jsmntok_t *toks = parser->toks + parser->first;
 
-	return toks;
+	json_parser_unterminate(parser);
+	assert(parser->first < parser->jsmn.toknext && toks->end != -1);
+	parser->consumed = toks->end;
+	parser->first = json_next(toks) - parser->toks;
+}
+
+void json_parser_skip_to(struct json_parser *parser, size_t offset)
+{
+	json_parser_unterminate(parser);
+	assert(parser->first == parser->jsmn.toknext);
+	assert(parser->jsmn.toksuper == -1);
+	assert(offset >= parser->consumed);
+
+	/* jsmn stops at a NUL, so it may be sitting at the start of it. */
+	parser->jsmn.pos = offset;
+	parser->consumed = offset;
+	parser->len = offset;
+}
+
+size_t json_parser_compact(struct json_parser *parser)
+{
+	size_t delta = parser->consumed, num;
+
+	json_parser_unterminate(parser);
+	if (!delta)
+		return 0;
+
+	/* Move what's left (part of the next value, perhaps) to the front,
+	 * as if we'd started parsing after the consumed values. */
+	num = parser->jsmn.toknext - parser->first;
+	memmove(parser->toks, parser->toks + parser->first,
+		num * sizeof(parser->toks[0]));
+	for (size_t i = 0; i < num; i++) {
+		parser->toks[i].start -= delta;
+		if (parser->toks[i].end != -1)
+			parser->toks[i].end -= delta;
+#ifdef JSMN_PARENT_LINKS
+		if (parser->toks[i].parent != -1)
+			parser->toks[i].parent -= parser->first;
+#endif
+	}
+
+	parser->jsmn.toknext = num;
+	if (parser->jsmn.toksuper != -1)
+		parser->jsmn.toksuper -= parser->first;
+	parser->jsmn.pos -= delta;
+	parser->len -= delta;
+	parser->first = 0;
+	parser->consumed = 0;
+	return delta;
+}
+
+void json_frame_hdr(char hdr[JSON_FRAME_HDR_LEN], u32 len)
+{
+	be32 belen = cpu_to_be32(len);
+
+	hdr[0] = '\0';
+	memcpy(hdr + 1, &belen, sizeof(belen));
+}
+
+bool json_frame_len(const char hdr[JSON_FRAME_HDR_LEN], u32 *len)
+{
+	be32 belen;
+
+	if (hdr[0] != '\0')
+		return false;
+	memcpy(&belen, hdr + 1, sizeof(belen));
+	*len = be32_to_cpu(belen);
+	return true;
 }
 
 const char *jsmntype_to_string(jsmntype_t t)
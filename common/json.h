@@ -2,6 +2,7 @@
 #define LIGHTNING_COMMON_JSON_H
 #include "config.h"
 #include <bitcoin/preimage.h>
+#include <ccan/short_types/short_types.h>
 #include <ccan/tal/tal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -65,6 +66,66 @@ const jsmntok_t *json_get_arr(const jsmntok_t tok[], size_t index);
 jsmntok_t *json_parse_input(const tal_t *ctx,
 			    const char *input, int len, bool *valid);
 
+/* For a connection which sends one JSON value after another: rather than
+ * reparsing the whole buffer every time more arrives, or every time a value
+ * is taken off the front, this remembers how far it got. */
+struct json_parser {
+	jsmn_parser jsmn;
+	/* Tokens so far: grows as needed, and is reused. */
+	jsmntok_t *toks;
+	/* How much input we've been given to parse. */
+	size_t len;
+	/* toks[first] is the value we're up to: those before are consumed. */
+	size_t first;
+	/* How much of the input those consumed values (and what's between
+	 * them) took up. */
+	size_t consumed;
+	/* We terminate the value we return by overwriting the token after it
+	 * (if term isn't 0): this is what was there. */
+	size_t term;
+	jsmntok_t saved;
+};
+
+struct json_parser *json_parser_new(const tal_t *ctx);
+
+/* Start again from the beginning of the buffer. */
+void json_parser_reset(struct json_parser *parser);
+
+/* Parse what's been added to @input since last time (it must otherwise be
+ * unchanged since json_parser_new/json_parser_reset/json_parser_compact).
+ * If the next unconsumed value is complete, returns its tokens (terminated
+ * as for json_parse_input), valid until the next call on @parser.
+ * Otherwise NULL, with *valid false if the input isn't JSON.
+ *
+ * The tokens' offsets are from the start of @input: call
+ * json_parser_consume() once you've handled the value, and leave it in the
+ * buffer until json_parser_compact(). */
+const jsmntok_t *json_parser_parse(struct json_parser *parser,
+				   const char *input, int len, bool *valid);
+
+/* Move on from the value json_parser_parse() returned. */
+void json_parser_consume(struct json_parser *parser);
+
+/* You've handled @input up to @offset yourself (it wasn't JSON): carry on
+ * parsing after it.  Everything parsed before it must have been consumed. */
+void json_parser_skip_to(struct json_parser *parser, size_t offset);
+
+/* Forget consumed values.  Returns how many bytes you must now remove from
+ * the front of the input before parsing again (usually before reading more,
+ * so it's done once however many values were in the buffer). */
+size_t json_parser_compact(struct json_parser *parser);
+
+/* lightningd and a plugin can agree to put the length in front of each JSON
+ * message they send, so the reader knows where it ends without looking.  The
+ * header is a 0 byte (which can't start JSON), then a big-endian u32. */
+#define JSON_FRAME_HDR_LEN 5
+
+/* Fill in a frame header for a message of @len bytes. */
+void json_frame_hdr(char hdr[JSON_FRAME_HDR_LEN], u32 len);
+
+/* If @hdr (JSON_FRAME_HDR_LEN bytes) is a frame header, set *len. */
+bool json_frame_len(const char hdr[JSON_FRAME_HDR_LEN], u32 *len);
+
 /* Convert a jsmntype_t enum to a human readable string. */
 const char *jsmntype_to_string(jsmntype_t t);
 
@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <ccan/fdpass/fdpass.h>
 #include <common/per_peer_state.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <wire/wire.h>
 
@@ -12,6 +14,8 @@ static void destroy_per_peer_state(struct per_peer_state *pps)
 		close(pps->gossip_fd);
 	if (pps->gossip_store_fd != -1)
 		close(pps->gossip_store_fd);
+	if (pps->gossip_store_map)
+		munmap((void *)pps->gossip_store_map, pps->gossip_store_maplen);
 }
 
 struct per_peer_state *new_per_peer_state(const tal_t *ctx,
@@ -22,6 +26,11 @@ struct per_peer_state *new_per_peer_state(const tal_t *ctx,
 	pps->cs = *cs;
 	pps->gs = NULL;
 	pps->peer_fd = pps->gossip_fd = pps->gossip_store_fd = -1;
+	pps->gossip_store_map = NULL;
+	pps->gossip_store_maplen = 0;
+	pps->gossip_store_len = 0;
+	pps->gossip_store_off = 0;
+	memset(&pps->gossip_stats, 0, sizeof(pps->gossip_stats));
 	tal_add_destructor(pps, destroy_per_peer_state);
 	return pps;
 }
@@ -77,11 +86,18 @@ void per_peer_state_fdpass_send(int fd, const struct per_peer_state *pps)
 	assert(pps->peer_fd != -1);
 	assert(pps->gossip_fd != -1);
 	assert(pps->gossip_store_fd != -1);
+	per_peer_state_sync_gossip_store(pps);
 	fdpass_send(fd, pps->peer_fd);
 	fdpass_send(fd, pps->gossip_fd);
 	fdpass_send(fd, pps->gossip_store_fd);
 }
 
+void per_peer_state_sync_gossip_store(const struct per_peer_state *pps)
+{
+	if (pps->gossip_store_off)
+		lseek(pps->gossip_store_fd, pps->gossip_store_off, SEEK_SET);
+}
+
 struct per_peer_state *fromwire_per_peer_state(const tal_t *ctx,
 					       const u8 **cursor, size_t *max)
 {
@@ -13,6 +13,15 @@ struct gossip_state {
 	u32 timestamp_min, timestamp_max;
 };
 
+/* What gossip_store_send() has streamed to the peer (not handed on). */
+struct gossip_send_stats {
+	u64 msgs, bytes, writes;
+	/* Time spent encrypting and writing */
+	u64 nsec;
+	/* As at the last time we logged them */
+	u64 logged_bytes, logged_nsec;
+};
+
 /* Things we hand between daemons to talk to peers. */
 struct per_peer_state {
 	/* Cryptographic state needed to exchange messages with the peer (as
@@ -26,6 +35,15 @@ struct per_peer_state {
 #endif /* DEVELOPER */
 	/* If not -1, closed on freeing */
 	int peer_fd, gossip_fd, gossip_store_fd;
+	/* Read-only mapping of gossip_store_fd (NULL until first read): we
+	 * know the first gossip_store_len bytes of it are valid. */
+	const u8 *gossip_store_map;
+	size_t gossip_store_maplen;
+	u64 gossip_store_len;
+	/* Where we're up to in the gossip_store, or 0 for wherever the fd
+	 * is: the fd itself is only moved when we hand it on. */
+	u64 gossip_store_off;
+	struct gossip_send_stats gossip_stats;
 };
 
 /* Allocate a new per-peer state and add destructor to close fds if set;
@@ -45,6 +63,9 @@ void per_peer_state_set_fds_arr(struct per_peer_state *pps, const int *fds);
 void towire_per_peer_state(u8 **pptr, const struct per_peer_state *pps);
 void per_peer_state_fdpass_send(int fd, const struct per_peer_state *pps);
 
+/* Move gossip_store_fd to where we're up to, before handing it on. */
+void per_peer_state_sync_gossip_store(const struct per_peer_state *pps);
+
 struct per_peer_state *fromwire_per_peer_state(const tal_t *ctx,
 					       const u8 **cursor, size_t *max);
 
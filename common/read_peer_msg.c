@@ -41,12 +41,9 @@ u8 *peer_or_gossip_sync_read(const tal_t *ctx,
 			   &readfds, NULL, NULL, tptr) != 0)
 			break;
 
-		/* We timed out; look in gossip_store.  Failure resets timer. */
-		msg = gossip_store_next(tmpctx, pps);
-		if (msg) {
-			*from_gossipd = true;
-			return msg;
-		}
+		/* We timed out; stream from gossip_store.  Failure resets
+		 * timer. */
+		gossip_store_send(pps);
 	}
 
 	if (FD_ISSET(pps->peer_fd, &readfds)) {
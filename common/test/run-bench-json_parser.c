@@ -0,0 +1,261 @@
+#include "../json.c"
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+/* Something like a db_write hook call: lots of small strings. */
+static char *big_json(const tal_t *ctx, size_t len)
+{
+	char *json = tal_fmt(ctx, "{\"jsonrpc\":\"2.0\",\"id\":7,"
+			     "\"method\":\"db_write\",\"params\":{"
+			     "\"writes\":[");
+
+	for (size_t i = 0; strlen(json) < len; i++)
+		tal_append_fmt(&json, "%s\"UPDATE vars SET intval=%zu"
+			       " WHERE name='bip32_max_index';\"",
+			       i ? "," : "", i);
+	tal_append_fmt(&json, "],\"ok\":true,\"n\":-1.5e3}}");
+	return json;
+}
+
+static void check_same(const jsmntok_t *a, const jsmntok_t *b)
+{
+	size_t n = json_next(a) - a;
+
+	assert(n == json_next(b) - b);
+	/* Including the terminator. */
+	for (size_t i = 0; i <= n; i++) {
+		assert(a[i].type == b[i].type);
+		assert(a[i].start == b[i].start);
+		assert(a[i].end == b[i].end);
+		assert(a[i].size == b[i].size);
+	}
+}
+
+/* What we used to do: parse the whole buffer again every time. */
+static const jsmntok_t *feed_reparse(const char *json, size_t chunk)
+{
+	jsmntok_t *toks;
+	bool valid;
+
+	for (size_t len = chunk;; len += chunk) {
+		if (len > strlen(json))
+			len = strlen(json);
+		toks = json_parse_input(tmpctx, json, len, &valid);
+		assert(valid);
+		if (toks)
+			return toks;
+		tal_free(toks);
+		assert(len < strlen(json));
+	}
+}
+
+static const jsmntok_t *feed_incremental(struct json_parser *parser,
+					 const char *json, size_t chunk)
+{
+	const jsmntok_t *toks;
+	bool valid;
+
+	json_parser_reset(parser);
+	for (size_t len = chunk;; len += chunk) {
+		if (len > strlen(json))
+			len = strlen(json);
+		toks = json_parser_parse(parser, json, len, &valid);
+		assert(valid);
+		if (toks)
+			return toks;
+		assert(len < strlen(json));
+	}
+}
+
+/* What we used to do with many requests in the buffer: take the first off
+ * the front, then parse the rest again from the start. */
+static size_t pipelined_reparse(struct json_parser *parser,
+				char *buf, size_t len)
+{
+	const jsmntok_t *toks;
+	bool valid;
+	size_t n = 0;
+
+	json_parser_reset(parser);
+	while ((toks = json_parser_parse(parser, buf, len, &valid)) != NULL) {
+		memmove(buf, buf + toks[0].end, len - toks[0].end);
+		len -= toks[0].end;
+		json_parser_reset(parser);
+		n++;
+	}
+	assert(valid);
+	return n;
+}
+
+/* What we do now: consume each in place, then compact once. */
+static size_t pipelined_consume(struct json_parser *parser,
+				char *buf, size_t len)
+{
+	const jsmntok_t *toks;
+	bool valid;
+	size_t n = 0, consumed;
+
+	json_parser_reset(parser);
+	while ((toks = json_parser_parse(parser, buf, len, &valid)) != NULL) {
+		json_parser_consume(parser);
+		n++;
+	}
+	assert(valid);
+	consumed = json_parser_compact(parser);
+	memmove(buf, buf + consumed, len - consumed);
+	return n;
+}
+
+/* Requests arriving a chunk at a time, several per chunk (or several
+ * chunks per request): each comes out just as it would alone. */
+static void check_pipelined(struct json_parser *parser,
+			    const char *one, size_t num, size_t chunk)
+{
+	const jsmntok_t *expect, *toks;
+	char *all = tal_strdup(tmpctx, ""), *buf;
+	size_t off = 0, used = 0, n = 0, consumed;
+	bool valid;
+
+	expect = json_parse_input(tmpctx, one, strlen(one), &valid);
+	for (size_t i = 0; i < num; i++)
+		tal_append_fmt(&all, "%s\n", one);
+
+	buf = tal_arr(tmpctx, char, strlen(all));
+	json_parser_reset(parser);
+	while (off < strlen(all)) {
+		size_t len = chunk;
+		if (off + len > strlen(all))
+			len = strlen(all) - off;
+		memcpy(buf + used, all + off, len);
+		used += len;
+		off += len;
+
+		while ((toks = json_parser_parse(parser, buf, used, &valid))) {
+			/* Same tokens, just further into buf. */
+			int start = toks[0].start;
+			size_t ntoks = json_next(expect) - expect;
+
+			for (size_t i = 0; i < ntoks; i++) {
+				assert(toks[i].type == expect[i].type);
+				assert(toks[i].size == expect[i].size);
+				assert(toks[i].start - start == expect[i].start);
+				assert(toks[i].end - start == expect[i].end);
+			}
+			assert(toks[ntoks].type == expect[ntoks].type);
+			assert(memeq(buf + start, toks[0].end - start,
+				     one, strlen(one)));
+			json_parser_consume(parser);
+			n++;
+		}
+		assert(valid);
+		consumed = json_parser_compact(parser);
+		memmove(buf, buf + consumed, used - consumed);
+		used -= consumed;
+	}
+	assert(n == num);
+	assert(used == 1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct json_parser *parser;
+	const jsmntok_t *toks, *expect;
+	char *json, *two;
+	struct timemono start;
+	size_t len = 256 * 1024, chunk = 1024, n;
+	u64 msec;
+	bool valid;
+
+	setup_locale();
+	setup_tmpctx();
+	opt_register_noarg("-h|--help", opt_usage_and_exit,
+			   "[bytes [chunk]]",
+			   "This message");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		len = atoi(argv[1]);
+	if (argc > 2)
+		chunk = atoi(argv[2]);
+	if (argc > 3)
+		opt_usage_and_exit("[bytes [chunk]]");
+
+	parser = json_parser_new(tmpctx);
+
+	/* Split anywhere (even inside strings and numbers), it's the same. */
+	json = big_json(tmpctx, 2000);
+	expect = json_parse_input(tmpctx, json, strlen(json), &valid);
+	assert(expect);
+	for (size_t c = 1; c < 50; c++)
+		check_same(feed_incremental(parser, json, c), expect);
+
+	/* Two at once: we get the first, then the second after a reset. */
+	two = tal_fmt(tmpctx, "%s  \n%s", json, json);
+	toks = feed_incremental(parser, two, 7);
+	check_same(toks, expect);
+	memmove(two, two + toks[0].end, strlen(two + toks[0].end) + 1);
+	toks = feed_incremental(parser, two, strlen(two));
+	assert(toks[0].start == 3);
+	assert(toks[0].end == strlen(two));
+
+	/* Many at once, however they arrive. */
+	for (size_t c = 1; c < 50; c++)
+		check_pipelined(parser, "{\"id\":1,\"a\":[\"x\",{\"b\":2}]}",
+				20, c);
+	check_pipelined(parser, json, 5, 1000);
+
+	/* Whitespace alone isn't anything yet. */
+	json_parser_reset(parser);
+	assert(!json_parser_parse(parser, " \n ", 3, &valid));
+	assert(valid);
+
+	/* Bad input is noticed as soon as it arrives. */
+	json_parser_reset(parser);
+	assert(!json_parser_parse(parser, "{\"a\":", 5, &valid));
+	assert(valid);
+	assert(!json_parser_parse(parser, "{\"a\":]", 6, &valid));
+	assert(!valid);
+
+	/* Now, how long does a big one take, a chunk at a time? */
+	json = big_json(tmpctx, len);
+	start = time_mono();
+	expect = feed_reparse(json, chunk);
+	msec = time_to_msec(timemono_since(start));
+	printf("%zu bytes in %zu byte chunks, reparsing: %"PRIu64" msec\n",
+	       strlen(json), chunk, msec);
+
+	start = time_mono();
+	toks = feed_incremental(parser, json, chunk);
+	msec = time_to_msec(timemono_since(start));
+	printf("%zu bytes in %zu byte chunks, incremental: %"PRIu64" msec\n",
+	       strlen(json), chunk, msec);
+	check_same(toks, expect);
+
+	/* Lots of small requests waiting in the buffer at once. */
+	json = tal_strdup(tmpctx, "");
+	for (size_t i = 0; strlen(json) < len; i++)
+		tal_append_fmt(&json, "{\"jsonrpc\":\"2.0\",\"id\":%zu,"
+			       "\"method\":\"getinfo\",\"params\":[]}\n", i);
+	two = tal_dup_arr(tmpctx, char, json, strlen(json), 0);
+	start = time_mono();
+	n = pipelined_reparse(parser, two, strlen(json));
+	msec = time_to_msec(timemono_since(start));
+	printf("%zu requests in %zu bytes, reparsing: %"PRIu64" msec\n",
+	       n, strlen(json), msec);
+
+	memcpy(two, json, strlen(json));
+	start = time_mono();
+	assert(pipelined_consume(parser, two, strlen(json)) == n);
+	msec = time_to_msec(timemono_since(start));
+	printf("%zu requests in %zu bytes, consuming: %"PRIu64" msec\n",
+	       n, strlen(json), msec);
+
+	tal_free(tmpctx);
+	opt_free_table();
+	return 0;
+}
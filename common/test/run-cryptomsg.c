@@ -46,7 +46,8 @@ int main(void)
 	struct crypto_state cs_out, cs_in;
 	struct secret sk, rk, ck;
 	const void *msg;
-	size_t i;
+	u8 *batch;
+	size_t i, enclen;
 
 	setup_tmpctx();
 	msg = tal_dup_arr(tmpctx, char, "hello", 5, 0);
@@ -121,6 +122,23 @@ int main(void)
 		dec = cryptomsg_decrypt_body(enc, &cs_in, enc);
 		assert(memeq(dec, tal_bytelen(dec), msg, tal_bytelen(msg)));
 	}
+
+	/* Same again, all appended into one buffer: across key rotations. */
+	cs_out.sn = 0;
+	cs_out.sk = sk;
+	cs_out.s_ck = ck;
+	batch = tal_arr(tmpctx, u8, 0);
+	for (i = 0; i < 1002; i++)
+		cryptomsg_encrypt_append(&batch, &cs_out, msg, tal_bytelen(msg));
+
+	enclen = CRYPTOMSG_HDR_SIZE + tal_bytelen(msg) + CRYPTOMSG_BODY_OVERHEAD;
+	assert(tal_bytelen(batch) == 1002 * enclen);
+	check_result(tal_dup_arr(tmpctx, u8, batch, enclen, 0),
+		     "cf2b30ddf0cf3f80e7c35a6e6730b59fe802473180f396d88a8fb0db8cbcf25d2f214cf9ea1d95");
+	check_result(tal_dup_arr(tmpctx, u8, batch + 501 * enclen, enclen, 0),
+		     "1b186c57d44eb6de4c057c49940d79bb838a145cb528d6e8fd26dbe50a60ca2c104b56b60e45bd");
+	check_result(tal_dup_arr(tmpctx, u8, batch + 1001 * enclen, enclen, 0),
+		     "2ecd8c8a5629d0d02ab457a0fdd0f7b90a192cd46be5ecb6ca570bfc5e268338b1a16cf4ef2d36");
 	tal_free(tmpctx);
 	return 0;
 }
@@ -0,0 +1,144 @@
+#include "../decode_short_channel_ids.c"
+#include "../../wire/fromwire.c"
+#include "../../wire/towire.c"
+#include <assert.h>
+#include <ccan/err/err.h>
+#include <stdio.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for bigsize_get */
+size_t bigsize_get(const u8 *p UNNEEDED, size_t max UNNEEDED, bigsize_t *val UNNEEDED)
+{ fprintf(stderr, "bigsize_get called!\n"); abort(); }
+/* Generated stub for bigsize_put */
+size_t bigsize_put(u8 buf[BIGSIZE_MAX_LEN] UNNEEDED, bigsize_t v UNNEEDED)
+{ fprintf(stderr, "bigsize_put called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static u8 *rice(const tal_t *ctx, const struct short_channel_id *scids)
+{
+	u8 *encoded = tal_arr(ctx, u8, 0);
+
+	towire_u8(&encoded, SHORTIDS_RICE);
+	if (!encode_short_ids_rice(&encoded, scids))
+		return tal_free(encoded);
+	return encoded;
+}
+
+static u8 *zlib(const tal_t *ctx, const struct short_channel_id *scids)
+{
+	u8 *raw = tal_arr(tmpctx, u8, 0), *encoded;
+	unsigned long len;
+
+	for (size_t i = 0; i < tal_count(scids); i++)
+		towire_short_channel_id(&raw, &scids[i]);
+	len = compressBound(tal_count(raw));
+	encoded = tal_arr(ctx, u8, 1 + len);
+	encoded[0] = SHORTIDS_ZLIB;
+	assert(compress2(encoded + 1, &len, raw, tal_count(raw),
+			 Z_BEST_COMPRESSION) == Z_OK);
+	tal_resize(&encoded, 1 + len);
+	return encoded;
+}
+
+static void check_decode(const u8 *encoded,
+			 const struct short_channel_id *scids)
+{
+	struct short_channel_id *decoded = decode_short_ids(tmpctx, encoded);
+
+	assert(decoded);
+	assert(tal_count(decoded) == tal_count(scids));
+	assert(memcmp(decoded, scids, tal_bytelen(scids)) == 0);
+}
+
+/* About @per_block channels in each of @num_blocks blocks. */
+static struct short_channel_id *random_scids(const tal_t *ctx,
+					     size_t num_blocks,
+					     size_t per_block)
+{
+	struct short_channel_id *scids = tal_arr(ctx, struct short_channel_id, 0);
+
+	for (size_t b = 0; b < num_blocks; b++) {
+		u32 txnum = 0;
+		size_t n = random() % (per_block * 2 + 1);
+
+		for (size_t i = 0; i < n; i++) {
+			struct short_channel_id scid;
+
+			txnum += random() % 300;
+			assert(mk_short_channel_id(&scid, 500000 + b, txnum,
+						   random() % 3));
+			/* Sometimes, two from one transaction */
+			if (tal_count(scids)
+			    && scid.u64 <= scids[tal_count(scids)-1].u64)
+				continue;
+			tal_arr_expand(&scids, scid);
+		}
+	}
+	return scids;
+}
+
+int main(void)
+{
+	struct short_channel_id *scids;
+	u8 *encoded;
+
+	setup_locale();
+	setup_tmpctx();
+
+	/* Empty, and just one. */
+	scids = tal_arr(tmpctx, struct short_channel_id, 0);
+	check_decode(rice(tmpctx, scids), scids);
+	tal_resize(&scids, 1);
+	assert(mk_short_channel_id(&scids[0], 0xFFFFFF, 0xFFFFFF, 0xFFFF));
+	check_decode(rice(tmpctx, scids), scids);
+
+	/* Several outputs of one transaction, then a big gap. */
+	tal_resize(&scids, 4);
+	assert(mk_short_channel_id(&scids[0], 1, 0, 0));
+	assert(mk_short_channel_id(&scids[1], 1, 0, 1));
+	assert(mk_short_channel_id(&scids[2], 1, 0, 7));
+	assert(mk_short_channel_id(&scids[3], 0xFFFFFF, 0, 0));
+	check_decode(rice(tmpctx, scids), scids);
+
+	/* Must be ascending, without duplicates. */
+	scids[3] = scids[2];
+	assert(!rice(tmpctx, scids));
+	scids[3] = scids[0];
+	assert(!rice(tmpctx, scids));
+
+	/* Sparse and dense. */
+	for (size_t per_block = 1; per_block < 100; per_block *= 3) {
+		size_t rlen, zlen;
+
+		scids = random_scids(tmpctx, 2000, per_block);
+		encoded = rice(tmpctx, scids);
+		check_decode(encoded, scids);
+		rlen = tal_count(encoded);
+		zlen = tal_count(zlib(tmpctx, scids));
+		printf("%zu scids: %zu bytes uncompressed, %zu zlib, %zu rice\n",
+		       tal_count(scids), tal_count(scids) * 8, zlen, rlen);
+		assert(rlen < zlen);
+	}
+
+	/* Corrupt ones are rejected. */
+	scids = random_scids(tmpctx, 100, 10);
+	encoded = rice(tmpctx, scids);
+	for (size_t len = 0; len < tal_count(encoded); len++) {
+		u8 *trunc = tal_dup_arr(tmpctx, u8, encoded, len, 0);
+		assert(!decode_short_ids(tmpctx, trunc));
+	}
+	/* Trailing garbage. */
+	tal_arr_expand(&encoded, 0);
+	assert(!decode_short_ids(tmpctx, encoded));
+	tal_resize(&encoded, tal_count(encoded) - 1);
+	/* Too many bits for the remainder. */
+	encoded[1 + 4 + 4] = 33;
+	assert(!decode_short_ids(tmpctx, encoded));
+	/* Count too large for what follows. */
+	encoded = rice(tmpctx, scids);
+	encoded[1] = 0xFF;
+	assert(!decode_short_ids(tmpctx, encoded));
+
+	tal_free(tmpctx);
+	return 0;
+}
@@ -190,6 +190,60 @@ static void test_json_delve(void)
 	assert(json_tok_streq(buf, t, "lightning-rpc"));
 }
 
+static void test_json_frame(void)
+{
+	char hdr[JSON_FRAME_HDR_LEN];
+	u32 len;
+
+	json_frame_hdr(hdr, 0x01020304);
+	assert(memcmp(hdr, "\0\x01\x02\x03\x04", sizeof(hdr)) == 0);
+	assert(json_frame_len(hdr, &len));
+	assert(len == 0x01020304);
+
+	/* JSON (even with whitespace in front) isn't a header. */
+	assert(!json_frame_len("{\"id\"", &len));
+	assert(!json_frame_len("\n\n{}\n", &len));
+}
+
+/* Plain JSON, a length-prefixed message, then plain JSON again, all at
+ * once: the parser gets past the frame without waiting for more input. */
+static void test_json_parser_skip_to(void)
+{
+	struct json_parser *parser = json_parser_new(tmpctx);
+	const char *plain1 = "{\"a\":1}\n\n", *frame = "{\"b\":2}";
+	const char *plain2 = "{\"c\":3}\n\n";
+	char hdr[JSON_FRAME_HDR_LEN];
+	char *buf = tal_arr(tmpctx, char, 0);
+	const jsmntok_t *toks;
+	size_t frame_end;
+	bool valid;
+
+	json_frame_hdr(hdr, strlen(frame));
+	tal_expand(&buf, plain1, strlen(plain1));
+	tal_expand(&buf, hdr, sizeof(hdr));
+	tal_expand(&buf, frame, strlen(frame));
+	frame_end = tal_count(buf);
+	tal_expand(&buf, plain2, strlen(plain2));
+
+	toks = json_parser_parse(parser, buf, tal_count(buf), &valid);
+	assert(valid && toks);
+	assert(json_get_member(buf, toks, "a"));
+	json_parser_consume(parser);
+
+	/* jsmn stops at the frame's 0 byte. */
+	toks = json_parser_parse(parser, buf, tal_count(buf), &valid);
+	assert(valid && !toks);
+
+	json_parser_skip_to(parser, frame_end);
+	toks = json_parser_parse(parser, buf, tal_count(buf), &valid);
+	assert(valid && toks);
+	assert(json_get_member(buf, toks, "c"));
+	json_parser_consume(parser);
+
+	/* Compacting drops all of it, frame included. */
+	assert(json_parser_compact(parser) == frame_end + strlen("{\"c\":3}"));
+}
+
 int main(void)
 {
 	setup_locale();
@@ -198,6 +252,8 @@ int main(void)
 	test_json_tok_size();
 	test_json_tok_bitcoin_amount();
 	test_json_delve();
+	test_json_frame();
+	test_json_parser_skip_to();
 	assert(!taken_any());
 	take_cleanup();
 	tal_free(tmpctx);
@@ -289,7 +289,8 @@ static bool get_gossipfds(struct daemon *daemon,
 			  const u8 *localfeatures,
 			  struct per_peer_state *pps)
 {
-	bool gossip_queries_feature, initial_routing_sync, success;
+	bool gossip_queries_feature, gossip_queries_rice;
+	bool initial_routing_sync, success;
 	u8 *msg;
 
 	/*~ The way features generally work is that both sides need to offer it;
@@ -297,6 +298,12 @@ static bool get_gossipfds(struct daemon *daemon,
 	gossip_queries_feature
 		= local_feature_negotiated(localfeatures, LOCAL_GOSSIP_QUERIES);
 
+	/*~ The experimental Rice encoding of short_channel_ids is only any
+	 * use if we're doing gossip queries at all. */
+	gossip_queries_rice = gossip_queries_feature
+		&& local_feature_negotiated(localfeatures,
+					    LOCAL_GOSSIP_QUERIES_RICE);
+
 	/*~ `initial_routing_sync is supported by every node, since it was in
 	 * the initial lightning specification: it means the peer wants the
 	 * backlog of existing gossip. */
@@ -306,7 +313,7 @@ static bool get_gossipfds(struct daemon *daemon,
 	/*~ We do this communication sync, since gossipd is our friend and
 	 * it's easier.  If gossipd fails, we fail. */
 	msg = towire_gossip_new_peer(NULL, id, gossip_queries_feature,
-				     initial_routing_sync);
+				     gossip_queries_rice, initial_routing_sync);
 	if (!wire_sync_write(GOSSIPCTL_FD, take(msg)))
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "Failed writing to gossipctl: %s",
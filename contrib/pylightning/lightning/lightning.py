@@ -566,6 +566,25 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("getroute", payload)
 
+    def getroutes(self, node_id, msatoshi, riskfactor, maxroutes=4, cltv=9, fromid=None, fuzzpercent=None, exclude=[], maxhops=20):
+        """
+        Show up to {maxroutes} routes to {id} for {msatoshi}, cheapest
+        first, each avoiding the channels used by the ones before it.
+        Other parameters are as for getroute.
+        """
+        payload = {
+            "id": node_id,
+            "msatoshi": msatoshi,
+            "riskfactor": riskfactor,
+            "maxroutes": maxroutes,
+            "cltv": cltv,
+            "fromid": fromid,
+            "fuzzpercent": fuzzpercent,
+            "exclude": exclude,
+            "maxhops": maxhops
+        }
+        return self.call("getroutes", payload)
+
     def help(self, command=None):
         """
         Show available commands, or just {command} if supplied.
@@ -591,13 +610,17 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("invoice", payload)
 
-    def listchannels(self, short_channel_id=None, source=None):
+    def listchannels(self, short_channel_id=None, source=None,
+                     start_scid=None, limit=None):
         """
-        Show all known channels, accept optional {short_channel_id} or {source}
+        Show all known channels, accept optional {short_channel_id} or {source},
+        or up to {limit} channels starting at {start_scid}
         """
         payload = {
             "short_channel_id": short_channel_id,
-            "source": source
+            "source": source,
+            "start_scid": start_scid,
+            "limit": limit
         }
         return self.call("listchannels", payload)
 
@@ -635,13 +658,15 @@ class LightningRpc(UnixDomainSocketRpc):
         }
         return self.call("listinvoices", payload)
 
-    def listnodes(self, node_id=None):
+    def listnodes(self, node_id=None, start_id=None, limit=None):
         """
         Show all nodes in our local network view, filter on node {id}
-        if provided
+        if provided, or up to {limit} nodes starting at {start_id}
         """
         payload = {
-            "id": node_id
+            "id": node_id,
+            "start_id": start_id,
+            "limit": limit
         }
         return self.call("listnodes", payload)
 
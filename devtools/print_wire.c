@@ -120,6 +120,9 @@ static void printwire_encoded_short_ids(const u8 **cursor, size_t *plen, size_t
 		case SHORTIDS_ZLIB:
 			printf(" (ZLIB)");
 			break;
+		case SHORTIDS_RICE:
+			printf(" (RICE)");
+			break;
 		default:
 			abort();
 		}
@@ -130,7 +133,8 @@ static void printwire_encoded_short_ids(const u8 **cursor, size_t *plen, size_t
 		/* If it was unknown, that's different from corrupt */
 		if (len == 0
 		    || arr[0] == SHORTIDS_UNCOMPRESSED
-		    || arr[0] == SHORTIDS_ZLIB) {
+		    || arr[0] == SHORTIDS_ZLIB
+		    || arr[0] == SHORTIDS_RICE) {
 			printf(" **CORRUPT**");
 			return;
 		} else {
@@ -14,7 +14,12 @@
 #include <gossipd/gen_gossip_peerd_wire.h>
 #include <gossipd/gen_gossip_store.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <gossipd/gossip_store_index.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <wire/gen_peer_wire.h>
@@ -22,6 +27,17 @@
 
 #define GOSSIP_STORE_FILENAME "gossip_store"
 #define GOSSIP_STORE_TEMP_FILENAME "gossip_store.tmp"
+#define GOSSIP_STORE_INDEX_FILENAME "gossip_store.index"
+
+/* Smallest mapping we bother with. */
+#define GOSSIP_STORE_MIN_MAP (1024 * 1024)
+
+/* Don't bother with a load thread for less than this many records. */
+#define GOSSIP_STORE_SCAN_MIN_RECS 50000
+#define GOSSIP_STORE_SCAN_MAX_THREADS 8
+
+/* Don't bother compacting small stores online. */
+#define GOSSIP_STORE_COMPACT_MIN_COUNT 1000
 
 struct gossip_store {
 	/* This is false when we're loading */
@@ -33,6 +49,22 @@ struct gossip_store {
 	/* Offset of current EOF */
 	u64 len;
 
+	/* Read-only mapping of fd (or NULL).  It's bigger than the file, so
+	 * we don't have to remap every time we append, but only the first
+	 * len bytes are valid. */
+	const u8 *map;
+	size_t maplen;
+
+	/* Don't check checksums in gossip_store_get(): gossip_store_load()
+	 * checked everything it read, and we wrote the rest. */
+	bool crc_once;
+
+	/* Up-to-date index we found at startup, until we load it. */
+	struct gossip_store_index *index;
+
+	/* Do we write an index on shutdown and after compaction? */
+	bool write_index;
+
 	/* Counters for entries in the gossip_store entries. This is used to
 	 * decide whether we should rewrite the on-disk store or not.
 	 * Note: count includes deleted. */
@@ -48,10 +80,62 @@ struct gossip_store {
 	/* Disable compaction if we encounter an error during a prior
 	 * compaction */
 	bool disable_compaction;
+
+	/* Compaction in progress (or NULL) */
+	struct compactor *compactor;
 };
 
+static void unmap_store(struct gossip_store *gs)
+{
+	if (gs->map)
+		munmap((void *)gs->map, gs->maplen);
+	gs->map = NULL;
+	gs->maplen = 0;
+}
+
+/* Make sure gs->map covers the first @len bytes of the store. */
+static void map_store(struct gossip_store *gs, u64 len)
+{
+	if (len <= gs->maplen)
+		return;
+
+	unmap_store(gs);
+	/* We never touch past the end of the file, so it's safe to map
+	 * more: as we append, the new records simply appear. */
+	gs->maplen = len * 2;
+	if (gs->maplen < GOSSIP_STORE_MIN_MAP)
+		gs->maplen = GOSSIP_STORE_MIN_MAP;
+	gs->map = mmap(NULL, gs->maplen, PROT_READ, MAP_SHARED, gs->fd, 0);
+	if (gs->map == MAP_FAILED)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "gossip_store: mapping %zu bytes: %s",
+			      gs->maplen, strerror(errno));
+}
+
+/* Get the header of the record at @off, and point *msg at the message
+ * after it.  False if that would go past @len. */
+static bool map_record(struct gossip_store *gs, u64 off, u64 len,
+		       struct gossip_hdr *hdr, const u8 **msg)
+{
+	u32 msglen;
+
+	if (off + sizeof(*hdr) > len)
+		return false;
+
+	map_store(gs, len);
+	/* It's not aligned, so copy it out. */
+	memcpy(hdr, gs->map + off, sizeof(*hdr));
+	msglen = be32_to_cpu(hdr->len) & ~GOSSIP_STORE_LEN_DELETED_BIT;
+	if (off + sizeof(*hdr) + msglen > len)
+		return false;
+
+	*msg = gs->map + off + sizeof(*hdr);
+	return true;
+}
+
 static void gossip_store_destroy(struct gossip_store *gs)
 {
+	unmap_store(gs);
 	close(gs->fd);
 }
 
@@ -165,7 +249,23 @@ struct gossip_store *gossip_store_new(struct routing_state *rstate,
 	struct gossip_store *gs = tal(rstate, struct gossip_store);
 	gs->count = gs->deleted = 0;
 	gs->writable = true;
-	gossip_store_compact_offline();
+	gs->map = NULL;
+	gs->maplen = 0;
+	gs->crc_once = false;
+	gs->write_index = false;
+
+	/* Compacting would make any index stale, so only do it if the index
+	 * is mostly pointing at deleted records anyway. */
+	gs->index = gossip_store_index_open(gs, GOSSIP_STORE_INDEX_FILENAME,
+					    GOSSIP_STORE_FILENAME);
+	if (gs->index && gs->index->deleted * 2 > gs->index->count) {
+		status_debug("gossip_store: %zu/%zu deleted, compacting"
+			     " rather than using index",
+			     gs->index->deleted, gs->index->count);
+		gs->index = tal_free(gs->index);
+	}
+	if (!gs->index)
+		gossip_store_compact_offline();
 	gs->fd = open(GOSSIP_STORE_FILENAME, O_RDWR|O_APPEND|O_CREAT, 0600);
 	if (gs->fd < 0)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
@@ -173,6 +273,7 @@ struct gossip_store *gossip_store_new(struct routing_state *rstate,
 			      strerror(errno));
 	gs->rstate = rstate;
 	gs->disable_compaction = false;
+	gs->compactor = NULL;
 	gs->len = sizeof(gs->version);
 	gs->peers = peers;
 
@@ -188,6 +289,7 @@ struct gossip_store *gossip_store_new(struct routing_state *rstate,
 
 		status_unusual("Gossip store version %u not %u: removing",
 			       gs->version, GOSSIP_STORE_VERSION);
+		gs->index = tal_free(gs->index);
 		if (ftruncate(gs->fd, 0) != 0)
 			status_failed(STATUS_FAIL_INTERNAL_ERROR,
 				      "Truncating store: %s", strerror(errno));
@@ -202,20 +304,18 @@ struct gossip_store *gossip_store_new(struct routing_state *rstate,
 }
 
 /* Returns bytes transferred, or 0 on error */
-static size_t transfer_store_msg(int from_fd, size_t from_off, int to_fd,
-				 int *type)
+static size_t transfer_store_msg(struct gossip_store *gs, size_t from_off,
+				 int to_fd, int *type)
 {
 	struct gossip_hdr hdr;
 	u32 msglen;
-	u8 *msg;
 	const u8 *p;
 	size_t tmplen;
 
 	*type = -1;
-	if (pread(from_fd, &hdr, sizeof(hdr), from_off) != sizeof(hdr)) {
-		status_broken("Failed reading header from to gossip store @%zu"
-			      ": %s",
-			      from_off, strerror(errno));
+	if (!map_record(gs, from_off, gs->len, &hdr, &p)) {
+		status_broken("Failed reading from gossip store @%zu/%"PRIu64,
+			      from_off, gs->len);
 		return 0;
 	}
 
@@ -226,36 +326,26 @@ static size_t transfer_store_msg(int from_fd, size_t from_off, int to_fd,
 		return 0;
 	}
 
-	/* FIXME: Reuse buffer? */
-	msg = tal_arr(tmpctx, u8, sizeof(hdr) + msglen);
-	memcpy(msg, &hdr, sizeof(hdr));
-	if (pread(from_fd, msg + sizeof(hdr), msglen, from_off + sizeof(hdr))
-	    != msglen) {
-		status_broken("Failed reading %u from to gossip store @%zu"
-			      ": %s",
-			      msglen, from_off, strerror(errno));
-		return 0;
-	}
-
-	if (write(to_fd, msg, msglen + sizeof(hdr)) != msglen + sizeof(hdr)) {
+	/* Straight from the mapping: header and message are contiguous. */
+	if (!write_all(to_fd, gs->map + from_off, sizeof(hdr) + msglen)) {
 		status_broken("Failed writing to gossip store: %s",
 			      strerror(errno));
 		return 0;
 	}
 
-	/* Can't use peektype here, since we have header on front */
-	p = msg + sizeof(hdr);
+	/* Can't use peektype here, since it's not a tal object */
 	tmplen = msglen;
 	*type = fromwire_u16(&p, &tmplen);
 	if (!p)
 		*type = -1;
-	tal_free(msg);
 	return sizeof(hdr) + msglen;
 }
 
 /* We keep a htable map of old gossip_store offsets to new ones. */
 struct offset_map {
 	size_t from, to;
+	/* Does something in the routing state point at it? */
+	bool tracked;
 };
 
 static size_t offset_map_key(const struct offset_map *omap)
@@ -299,117 +389,205 @@ static void destroy_offmap(struct offmap *offmap)
 	offmap_clear(offmap);
 }
 
-/**
- * Rewrite the on-disk gossip store, compacting it along the way
- *
- * Creates a new file, writes all the updates from the `broadcast_state`, and
- * then atomically swaps the files.
- */
-bool gossip_store_compact(struct gossip_store *gs)
-{
-	size_t count = 0, deleted = 0;
+/*~ Copying a big store takes a while, so we do it a chunk at a time
+ * (see gossip_store_compact_step()) while gossip carries on as normal.
+ * New records are still appended to the old store, and we copy those too
+ * once we get to them; records deleted before we get to them are simply
+ * skipped, and those deleted after we've copied them are marked deleted
+ * in the copy as well.  Once we've caught up with the end, we swap. */
+struct compactor {
+	/* The new store (-1 once it's been swapped in) */
 	int fd;
-	u64 off, len = sizeof(gs->version), idx;
+
+	/* Next record to copy from the old store, and end of the new one */
+	u64 from, len;
+
+	/* Records copied, skipped (deleted already), and deleted since. */
+	size_t copied, skipped, deleted;
+
+	/* Old offset -> new offset of everything copied. */
 	struct offmap *offmap;
-	struct gossip_hdr hdr;
-	struct offmap_iter oit;
-	struct node_map_iter nit;
-	struct offset_map *omap;
+};
+
+static void destroy_compactor(struct compactor *c)
+{
+	if (c->fd >= 0) {
+		close(c->fd);
+		unlink(GOSSIP_STORE_TEMP_FILENAME);
+	}
+}
 
-	if (gs->disable_compaction)
+static void compaction_failed(struct gossip_store *gs)
+{
+	gs->compactor = tal_free(gs->compactor);
+	status_trace("Encountered an error while compacting, disabling "
+		     "future compactions.");
+	gs->disable_compaction = true;
+}
+
+bool gossip_store_compact_start(struct gossip_store *gs)
+{
+	struct compactor *c;
+
+	if (gs->disable_compaction || gs->compactor)
 		return false;
 
 	status_trace(
 	    "Compacting gossip_store with %zu entries, %zu of which are stale",
 	    gs->count, gs->deleted);
 
-	fd = open(GOSSIP_STORE_TEMP_FILENAME, O_RDWR|O_TRUNC|O_CREAT, 0600);
-
-	if (fd < 0) {
+	c = tal(gs, struct compactor);
+	c->fd = open(GOSSIP_STORE_TEMP_FILENAME, O_RDWR|O_TRUNC|O_CREAT, 0600);
+	c->from = c->len = sizeof(gs->version);
+	c->copied = c->skipped = c->deleted = 0;
+	c->offmap = tal(c, struct offmap);
+	offmap_init_sized(c->offmap, gs->count - gs->deleted);
+	tal_add_destructor(c->offmap, destroy_offmap);
+	tal_add_destructor(c, destroy_compactor);
+	gs->compactor = c;
+
+	if (c->fd < 0) {
 		status_broken(
 		    "Could not open file for gossip_store compaction");
-		goto disable;
+		compaction_failed(gs);
+		return false;
 	}
 
-	if (write(fd, &gs->version, sizeof(gs->version))
+	if (write(c->fd, &gs->version, sizeof(gs->version))
 	    != sizeof(gs->version)) {
 		status_broken("Writing version to store: %s", strerror(errno));
-		goto unlink_disable;
+		compaction_failed(gs);
+		return false;
 	}
+	return true;
+}
+
+bool gossip_store_compacting(const struct gossip_store *gs)
+{
+	return gs->compactor != NULL;
+}
 
-	/* Walk old file, copy everything and remember new offsets. */
-	offmap = tal(tmpctx, struct offmap);
-	offmap_init_sized(offmap, gs->count);
-	tal_add_destructor(offmap, destroy_offmap);
+bool gossip_store_maybe_compact_start(struct gossip_store *gs)
+{
+	if (gs->count < GOSSIP_STORE_COMPACT_MIN_COUNT
+	    || gs->deleted < gs->count / 4)
+		return false;
+	return gossip_store_compact_start(gs);
+}
 
-	/* Start by writing all channel announcements and updates. */
-	off = 1;
-	while (pread(gs->fd, &hdr, sizeof(hdr), off) == sizeof(hdr)) {
+/* Copy up to @max_bytes worth of records (at least one). */
+static bool compact_copy(struct gossip_store *gs, struct compactor *c,
+			 size_t max_bytes)
+{
+	struct gossip_hdr hdr;
+	const u8 *p;
+	size_t done = 0;
+
+	while (done < max_bytes && map_record(gs, c->from, gs->len, &hdr, &p)) {
 		u32 msglen, wlen;
 		int msgtype;
+		struct offset_map *omap;
 
 		msglen = (be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT);
 		if (be32_to_cpu(hdr.len) & GOSSIP_STORE_LEN_DELETED_BIT) {
-			off += sizeof(hdr) + msglen;
-			deleted++;
+			c->from += sizeof(hdr) + msglen;
+			c->skipped++;
 			continue;
 		}
 
-		count++;
-		wlen = transfer_store_msg(gs->fd, off, fd, &msgtype);
+		wlen = transfer_store_msg(gs, c->from, c->fd, &msgtype);
 		if (wlen == 0)
-			goto unlink_disable;
-
-		/* We track location of all these message types. */
-		if (msgtype == WIRE_GOSSIPD_LOCAL_ADD_CHANNEL
-		    || msgtype == WIRE_GOSSIP_STORE_PRIVATE_UPDATE
-		    || msgtype == WIRE_CHANNEL_ANNOUNCEMENT
-		    || msgtype == WIRE_CHANNEL_UPDATE
-		    || msgtype == WIRE_NODE_ANNOUNCEMENT) {
-			omap = tal(offmap, struct offset_map);
-			omap->from = off;
-			omap->to = len;
-			offmap_add(offmap, omap);
-		}
-		len += wlen;
-		off += wlen;
+			return false;
+
+		/* We track location of all these message types; but we
+		 * need to find everything, in case it's deleted later. */
+		omap = tal(c->offmap, struct offset_map);
+		omap->from = c->from;
+		omap->to = c->len;
+		omap->tracked = (msgtype == WIRE_GOSSIPD_LOCAL_ADD_CHANNEL
+				 || msgtype == WIRE_GOSSIP_STORE_PRIVATE_UPDATE
+				 || msgtype == WIRE_CHANNEL_ANNOUNCEMENT
+				 || msgtype == WIRE_CHANNEL_UPDATE
+				 || msgtype == WIRE_NODE_ANNOUNCEMENT);
+		offmap_add(c->offmap, omap);
+
+		c->copied++;
+		c->len += wlen;
+		c->from += wlen;
+		done += wlen;
 	}
+	return true;
+}
+
+/* Someone deleted a record we've already copied: delete the copy too. */
+static void compact_deleted(struct compactor *c, u32 index, beint32_t belen)
+{
+	struct offset_map *omap = offmap_get(c->offmap, index);
+
+	if (!omap)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "gossip_store: deleted %u not in compacted store",
+			      index);
+
+	/* c->fd isn't O_APPEND, so pwrite works as it should. */
+	if (pwrite(c->fd, &belen, sizeof(belen), omap->to) != sizeof(belen))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Failed writing len to delete compacted @%zu: %s",
+			      omap->to, strerror(errno));
+	offmap_del(c->offmap, omap);
+	tal_free(omap);
+	c->deleted++;
+}
+
+/* We've copied everything: point the routing state at the new store, and
+ * swap it in. */
+static void compact_finish(struct gossip_store *gs, struct compactor *c)
+{
+	u64 off, idx;
+	struct offmap_iter oit;
+	struct node_map_iter nit;
+	struct offset_map *omap;
 
-	/* OK, now we've written file successfully, we can move broadcasts. */
 	/* Remap node announcements. */
 	for (struct node *n = node_map_first(gs->rstate->nodes, &nit);
 	     n;
 	     n = node_map_next(gs->rstate->nodes, &nit)) {
-		move_broadcast(offmap, &n->bcast, "node_announce");
+		move_broadcast(c->offmap, &n->bcast, "node_announce");
 	}
 
 	/* Remap channel announcements and updates */
-	for (struct chan *c = uintmap_first(&gs->rstate->chanmap, &idx);
-	     c;
-	     c = uintmap_after(&gs->rstate->chanmap, &idx)) {
-		move_broadcast(offmap, &c->bcast, "channel_announce");
-		move_broadcast(offmap, &c->half[0].bcast, "channel_update");
-		move_broadcast(offmap, &c->half[1].bcast, "channel_update");
+	for (struct chan *chan = uintmap_first(&gs->rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&gs->rstate->chanmap, &idx)) {
+		move_broadcast(c->offmap, &chan->bcast, "channel_announce");
+		move_broadcast(c->offmap, &chan->half[0].bcast,
+			       "channel_update");
+		move_broadcast(c->offmap, &chan->half[1].bcast,
+			       "channel_update");
 	}
 
 	/* That should be everything. */
-	omap = offmap_first(offmap, &oit);
-	if (omap)
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "gossip_store: Entry at %zu->%zu not updated?",
-			      omap->from, omap->to);
+	for (omap = offmap_first(c->offmap, &oit);
+	     omap;
+	     omap = offmap_next(c->offmap, &oit)) {
+		if (omap->tracked)
+			status_failed(STATUS_FAIL_INTERNAL_ERROR,
+				      "gossip_store: Entry at %zu->%zu"
+				      " not updated?",
+				      omap->from, omap->to);
+	}
 
-	if (count != gs->count - gs->deleted)
+	if (c->copied + c->skipped != gs->count)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "gossip_store: Expected %zu msgs in new"
+			      "gossip_store: Expected %zu msgs in old"
 			      " gossip store, got %zu",
-			      gs->count - gs->deleted, count);
+			      gs->count, c->copied + c->skipped);
 
-	if (deleted != gs->deleted)
+	if (c->skipped + c->deleted != gs->deleted)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "gossip_store: Expected %zu deleted msgs in old"
 			      " gossip store, got %zu",
-			      gs->deleted, deleted);
+			      gs->deleted, c->skipped + c->deleted);
 
 	if (rename(GOSSIP_STORE_TEMP_FILENAME, GOSSIP_STORE_FILENAME) == -1)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
@@ -419,26 +597,61 @@ bool gossip_store_compact(struct gossip_store *gs)
 
 	status_trace(
 	    "Compaction completed: dropped %zu messages, new count %zu, len %"PRIu64,
-	    deleted, count, len);
-	gs->count = count;
-	gs->deleted = 0;
-	off = gs->len - len;
-	gs->len = len;
+	    c->skipped, c->copied, c->len);
+	gs->count = c->copied;
+	gs->deleted = c->deleted;
+	off = gs->len - c->len;
+	gs->len = c->len;
+	unmap_store(gs);
 	close(gs->fd);
-	gs->fd = fd;
+	gs->fd = c->fd;
+	c->fd = -1;
+	gs->compactor = tal_free(c);
 
 	update_peers_broadcast_index(gs->peers, off);
-	return true;
 
-unlink_disable:
-	unlink(GOSSIP_STORE_TEMP_FILENAME);
-disable:
-	status_trace("Encountered an error while compacting, disabling "
-		     "future compactions.");
-	gs->disable_compaction = true;
+	/* All the offsets moved, so an old index is useless now. */
+	if (gs->write_index && !gossip_store_write_index(gs))
+		status_broken("Failed writing %s: %s",
+			      GOSSIP_STORE_INDEX_FILENAME, strerror(errno));
+}
+
+bool gossip_store_compact_step(struct gossip_store *gs, size_t max_bytes)
+{
+	struct compactor *c = gs->compactor;
+
+	if (!c)
+		return false;
+
+	if (!compact_copy(gs, c, max_bytes)) {
+		compaction_failed(gs);
+		return false;
+	}
+
+	/* Still catching up? */
+	if (c->from < gs->len)
+		return true;
+
+	compact_finish(gs, c);
 	return false;
 }
 
+/**
+ * Rewrite the on-disk gossip store, compacting it along the way
+ *
+ * Creates a new file, writes all the updates from the `broadcast_state`, and
+ * then atomically swaps the files.  If a compaction is already under way,
+ * this finishes it.
+ */
+bool gossip_store_compact(struct gossip_store *gs)
+{
+	if (!gs->compactor && !gossip_store_compact_start(gs))
+		return false;
+
+	while (gossip_store_compact_step(gs, SIZE_MAX));
+	return !gs->disable_compaction;
+}
+
 u64 gossip_store_add(struct gossip_store *gs, const u8 *gossip_msg,
 		     u32 timestamp,
 		     const u8 *addendum)
@@ -476,22 +689,25 @@ u64 gossip_store_add_private_update(struct gossip_store *gs, const u8 *update)
 /* Returns index of following entry. */
 static u32 delete_by_index(struct gossip_store *gs, u32 index, int type)
 {
+	struct gossip_hdr hdr;
+	const u8 *p;
 	beint32_t belen;
 	int flags;
 
 	/* Should never get here during loading! */
 	assert(gs->writable);
 
+	if (!map_record(gs, index, gs->len, &hdr, &p))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Failed reading record to delete @%u/%"PRIu64,
+			      index, gs->len);
+
 #if DEVELOPER
-	const u8 *msg = gossip_store_get(tmpctx, gs, index);
-	assert(fromwire_peektype(msg) == type);
+	size_t max = be32_to_cpu(hdr.len);
+	assert(fromwire_u16(&p, &max) == type);
 #endif
 
-	if (pread(gs->fd, &belen, sizeof(belen), index) != sizeof(belen))
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Failed reading len to delete @%u: %s",
-			      index, strerror(errno));
-
+	belen = hdr.len;
 	assert((be32_to_cpu(belen) & GOSSIP_STORE_LEN_DELETED_BIT) == 0);
 	belen |= cpu_to_be32(GOSSIP_STORE_LEN_DELETED_BIT);
 	/* From man pwrite(2):
@@ -512,6 +728,9 @@ static u32 delete_by_index(struct gossip_store *gs, u32 index, int type)
 	fcntl(gs->fd, F_SETFL, flags);
 	gs->deleted++;
 
+	if (gs->compactor && index < gs->compactor->from)
+		compact_deleted(gs->compactor, index, belen);
+
 	return index + sizeof(struct gossip_hdr)
 		+ (be32_to_cpu(belen) & ~GOSSIP_STORE_LEN_DELETED_BIT);
 }
@@ -542,34 +761,49 @@ const u8 *gossip_store_get(const tal_t *ctx,
 {
 	struct gossip_hdr hdr;
 	u32 msglen, checksum;
-	u8 *msg;
+	const u8 *p;
 
 	if (offset == 0)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "gossip_store: can't access offset %"PRIu64,
 			      offset);
-	if (pread(gs->fd, &hdr, sizeof(hdr), offset) != sizeof(hdr)) {
+	if (!map_record(gs, offset, gs->len, &hdr, &p))
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "gossip_store: can't read hdr offset %"PRIu64
-			      "/%"PRIu64": %s",
-			      offset, gs->len, strerror(errno));
-	}
+			      "gossip_store: can't read offset %"PRIu64
+			      "/%"PRIu64, offset, gs->len);
 
 	/* FIXME: We should skip over these deleted entries! */
 	msglen = be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT;
 	checksum = be32_to_cpu(hdr.crc);
-	msg = tal_arr(ctx, u8, msglen);
-	if (pread(gs->fd, msg, msglen, offset + sizeof(hdr)) != msglen)
-		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "gossip_store: can't read len %u offset %"PRIu64
-			      "/%"PRIu64, msglen, offset, gs->len);
 
-	if (checksum != crc32c(be32_to_cpu(hdr.timestamp), msg, msglen))
+	if (!gs->crc_once
+	    && checksum != crc32c(be32_to_cpu(hdr.timestamp), p, msglen))
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "gossip_store: bad checksum offset %"PRIu64": %s",
-			      offset, tal_hex(tmpctx, msg));
+			      offset, tal_hexstr(tmpctx, p, msglen));
 
-	return msg;
+	return tal_dup_arr(ctx, u8, p, msglen, 0);
+}
+
+void gossip_store_set_crc_once(struct gossip_store *gs, bool crc_once)
+{
+	gs->crc_once = crc_once;
+}
+
+void gossip_store_set_write_index(struct gossip_store *gs, bool write_index)
+{
+	gs->write_index = write_index;
+}
+
+bool gossip_store_write_index(struct gossip_store *gs)
+{
+	if (!gs->write_index)
+		return true;
+
+	map_store(gs, gs->len);
+	return gossip_store_index_write(GOSSIP_STORE_INDEX_FILENAME,
+					gs->rstate, gs->map, gs->len,
+					gs->count, gs->deleted);
 }
 
 const u8 *gossip_store_get_private_update(const tal_t *ctx,
@@ -598,45 +832,229 @@ int gossip_store_readonly_fd(struct gossip_store *gs)
 	return fd;
 }
 
-bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
+/* What the scan pass finds out about each record in the store. */
+struct store_rec {
+	u64 off;
+	u32 msglen;
+	u32 crc;
+	u32 timestamp;
+	int type;
+	bool deleted;
+	/* Filled in by scan_records() */
+	bool crc_ok;
+};
+
+/* One slice of the records, for one scan thread. */
+struct store_scan {
+	pthread_t thread;
+	const u8 *map;
+	struct store_rec *recs;
+	size_t start, end;
+};
+
+/* Checksum and peek at type of recs[start..end): these only read the
+ * mapping, so they can run in parallel. */
+static void scan_records(const u8 *map, struct store_rec *recs,
+			 size_t start, size_t end)
+{
+	for (size_t i = start; i < end; i++) {
+		const u8 *p = map + recs[i].off + sizeof(struct gossip_hdr);
+		be16 be_type;
+
+		recs[i].crc_ok = (recs[i].crc
+				  == crc32c(recs[i].timestamp, p,
+					    recs[i].msglen));
+		if (recs[i].msglen < sizeof(be_type))
+			recs[i].type = -1;
+		else {
+			memcpy(&be_type, p, sizeof(be_type));
+			recs[i].type = be16_to_cpu(be_type);
+		}
+	}
+}
+
+static void *scan_thread(void *arg)
+{
+	struct store_scan *scan = arg;
+	sigset_t all;
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	scan_records(scan->map, scan->recs, scan->start, scan->end);
+	return NULL;
+}
+
+/* Walk the headers from gs->len to @size: this is cheap (no checksums),
+ * and tells us where to split the work.  Sets *truncated if the last
+ * record runs off the end. */
+static struct store_rec *index_records(const tal_t *ctx,
+				       struct gossip_store *gs,
+				       u64 size, bool *truncated)
 {
+	struct store_rec *recs = tal_arr(ctx, struct store_rec, 0);
+	size_t n = 0;
+	u64 off = gs->len;
 	struct gossip_hdr hdr;
-	u32 msglen, checksum;
+	const u8 *p;
+
+	*truncated = false;
+	if (size > off) {
+		map_store(gs, size);
+		/* We're about to read all of it. */
+		madvise((void *)gs->map, size, MADV_WILLNEED);
+	}
+
+	/* A partial header at the end is simply ignored. */
+	while (off + sizeof(hdr) <= size) {
+		if (!map_record(gs, off, size, &hdr, &p)) {
+			*truncated = true;
+			break;
+		}
+		if (n == tal_count(recs))
+			tal_resize(&recs, n * 2 + 1024);
+		recs[n].off = off;
+		recs[n].msglen = be32_to_cpu(hdr.len)
+			& ~GOSSIP_STORE_LEN_DELETED_BIT;
+		recs[n].deleted = be32_to_cpu(hdr.len)
+			& GOSSIP_STORE_LEN_DELETED_BIT;
+		recs[n].crc = be32_to_cpu(hdr.crc);
+		recs[n].timestamp = be32_to_cpu(hdr.timestamp);
+		off += sizeof(hdr) + recs[n].msglen;
+		n++;
+	}
+	tal_resize(&recs, n);
+	return recs;
+}
+
+/* Split the checksumming across threads, if it's worth it.  Returns the
+ * number of threads used. */
+static size_t scan_all_records(const u8 *map, struct store_rec *recs)
+{
+	size_t n = tal_count(recs), nthreads, per;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct store_scan *scans;
+
+	nthreads = n / GOSSIP_STORE_SCAN_MIN_RECS;
+	if (cpus > 0 && nthreads > (size_t)cpus)
+		nthreads = cpus;
+	if (nthreads > GOSSIP_STORE_SCAN_MAX_THREADS)
+		nthreads = GOSSIP_STORE_SCAN_MAX_THREADS;
+	if (nthreads < 2) {
+		scan_records(map, recs, 0, n);
+		return 1;
+	}
+
+	/* We do the last slice ourselves. */
+	scans = tal_arr(tmpctx, struct store_scan, nthreads);
+	per = n / nthreads;
+	for (size_t i = 0; i < nthreads; i++) {
+		scans[i].map = map;
+		scans[i].recs = recs;
+		scans[i].start = i * per;
+		scans[i].end = (i == nthreads - 1) ? n : (i + 1) * per;
+	}
+	for (size_t i = 0; i < nthreads - 1; i++) {
+		/* If we can't start a thread, do it ourselves. */
+		if (pthread_create(&scans[i].thread, NULL,
+				   scan_thread, &scans[i]) != 0) {
+			scan_records(map, recs, scans[i].start, scans[i].end);
+			scans[i].map = NULL;
+		}
+	}
+	scan_records(map, recs, scans[nthreads-1].start, scans[nthreads-1].end);
+	for (size_t i = 0; i < nthreads - 1; i++) {
+		if (scans[i].map)
+			pthread_join(scans[i].thread, NULL);
+	}
+	return nthreads;
+}
+
+bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
+{
 	u8 *msg;
 	struct amount_sat satoshis;
 	const char *bad;
 	size_t stats[] = {0, 0, 0, 0};
-	struct timeabs start = time_now();
+	struct timeabs start = time_now(), phase;
 	const u8 *chan_ann = NULL;
-	bool contents_ok;
+	bool contents_ok, truncated;
 	u32 last_timestamp = 0;
 	u64 chan_ann_off = 0; /* Spurious gcc-9 (Ubuntu 9-20190402-1ubuntu1) 9.0.1 20190402 (experimental) warning */
+	struct stat st;
+	struct store_rec *recs;
+	size_t nthreads;
+
+	if (fstat(gs->fd, &st) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "gossip_store: stat: %s", strerror(errno));
 
 	gs->writable = false;
-	while (pread(gs->fd, &hdr, sizeof(hdr), gs->len) == sizeof(hdr)) {
-		msglen = be32_to_cpu(hdr.len) & ~GOSSIP_STORE_LEN_DELETED_BIT;
-		checksum = be32_to_cpu(hdr.crc);
-		msg = tal_arr(tmpctx, u8, msglen);
-
-		if (pread(gs->fd, msg, msglen, gs->len+sizeof(hdr)) != msglen) {
-			bad = "gossip_store: truncated file?";
-			goto corrupt;
-		}
 
-		if (checksum != crc32c(be32_to_cpu(hdr.timestamp), msg, msglen)) {
+	/*~ If we have an index, that gives us everything up to some point
+	 * in the store, and we only need to replay what's after it. */
+	if (gs->index) {
+		if (gossip_store_index_restore(rstate, gs->index)) {
+			gs->len = gs->index->store_len;
+			gs->count = gs->index->count;
+			gs->deleted = gs->index->deleted;
+			last_timestamp = gs->index->last_timestamp;
+			status_trace("gossip_store: restored index covering %"
+				     PRIu64" bytes in %"PRIu64" msec",
+				     gs->len,
+				     time_to_msec(time_between(time_now(),
+							       start)));
+		} else {
+			status_unusual("gossip_store: malformed %s,"
+				       " replaying whole store",
+				       GOSSIP_STORE_INDEX_FILENAME);
+			remove_all_gossip(rstate);
+		}
+		gs->index = tal_free(gs->index);
+	}
+	/* Don't leave an index lying around if we won't keep it current. */
+	if (!gs->write_index)
+		unlink(GOSSIP_STORE_INDEX_FILENAME);
+
+	/*~ Loading is two passes: first we checksum every record, which
+	 * only needs the mapping, so we can spread it across CPUs.  Then we
+	 * feed them into the routing state in order, which has to be done
+	 * by us alone. */
+	phase = time_now();
+	recs = index_records(tmpctx, gs, (u64)st.st_size, &truncated);
+	nthreads = scan_all_records(gs->map, recs);
+	status_trace("gossip_store: scanned %zu records in %"PRIu64
+		     " msec (%zu threads)",
+		     tal_count(recs),
+		     time_to_msec(time_between(time_now(), phase)), nthreads);
+
+	/* We free tmpctx as we go, so take the records off it. */
+	tal_steal(gs, recs);
+	phase = time_now();
+	for (size_t i = 0; i < tal_count(recs); i++) {
+		const struct store_rec *rec = &recs[i];
+		const u8 *p = gs->map + rec->off + sizeof(struct gossip_hdr);
+
+		msg = NULL;
+		gs->len = rec->off;
+		if (!rec->crc_ok) {
+			msg = tal_dup_arr(tmpctx, u8, p, rec->msglen, 0);
 			bad = "Checksum verification failed";
 			goto badmsg;
 		}
 
 		/* Skip deleted entries */
-		if (be32_to_cpu(hdr.len) & GOSSIP_STORE_LEN_DELETED_BIT) {
+		if (rec->deleted) {
 			/* Count includes deleted! */
 			gs->count++;
 			gs->deleted++;
-			goto next;
+			continue;
 		}
 
-		switch (fromwire_peektype(msg)) {
+		msg = tal_dup_arr(tmpctx, u8, p, rec->msglen, 0);
+
+		switch (rec->type) {
 		case WIRE_GOSSIP_STORE_CHANNEL_AMOUNT:
 			if (!fromwire_gossip_store_channel_amount(msg,
 								  &satoshis)) {
@@ -666,7 +1084,7 @@ bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 			chan_ann_off = gs->len;
 			/* If we have a channel_announcement, that's a reasonable
 			 * timestamp to use. */
-			last_timestamp = be32_to_cpu(hdr.timestamp);
+			last_timestamp = rec->timestamp;
 			break;
 		case WIRE_GOSSIP_STORE_PRIVATE_UPDATE:
 			if (!fromwire_gossip_store_private_update(tmpctx, msg, &msg)) {
@@ -702,10 +1120,20 @@ bool gossip_store_load(struct routing_state *rstate, struct gossip_store *gs)
 		}
 
 		gs->count++;
-	next:
-		gs->len += sizeof(hdr) + msglen;
 		clean_tmpctx();
 	}
+	if (tal_count(recs)) {
+		const struct store_rec *last = &recs[tal_count(recs)-1];
+		gs->len = last->off + sizeof(struct gossip_hdr) + last->msglen;
+	}
+	recs = tal_free(recs);
+	status_trace("gossip_store: inserted records in %"PRIu64" msec",
+		     time_to_msec(time_between(time_now(), phase)));
+
+	if (truncated) {
+		bad = "gossip_store: truncated file?";
+		goto corrupt;
+	}
 
 	if (chan_ann) {
 		bad = "dangling channel_announcement";
@@ -726,9 +1154,11 @@ badmsg:
 corrupt:
 	status_broken("gossip_store: %s. Moving to %s.corrupt and truncating",
 		      bad, GOSSIP_STORE_FILENAME);
+	tal_free(recs);
 
 	/* FIXME: Debug partial truncate case. */
 	rename(GOSSIP_STORE_FILENAME, GOSSIP_STORE_FILENAME ".corrupt");
+	unmap_store(gs);
 	close(gs->fd);
 	gs->fd = open(GOSSIP_STORE_FILENAME,
 		      O_RDWR|O_APPEND|O_TRUNC|O_CREAT, 0600);
@@ -67,9 +67,53 @@ const u8 *gossip_store_get_private_update(const tal_t *ctx,
 					  struct gossip_store *gs,
 					  u64 offset);
 
-/* Exposed for dev-compact-gossip-store to force compaction. */
+/**
+ * Only check checksums when loading, not on every gossip_store_get().
+ */
+void gossip_store_set_crc_once(struct gossip_store *gs, bool crc_once);
+
+/**
+ * Keep an index of the graph next to the store, so startup only has to
+ * replay what was appended since it was written.
+ */
+void gossip_store_set_write_index(struct gossip_store *gs, bool write_index);
+
+/**
+ * Write the index now (if we're keeping one).  Doesn't log, so it's
+ * safe to call as we shut down.  Returns false on failure.
+ */
+bool gossip_store_write_index(struct gossip_store *gs);
+
+/* Exposed for dev-compact-gossip-store to force compaction (finishes
+ * one already under way). */
 bool gossip_store_compact(struct gossip_store *gs);
 
+/**
+ * Start compacting the store in the background, if it's worth it.
+ * @gs: the gossip store.
+ *
+ * Returns true if it started: call gossip_store_compact_step() until it
+ * returns false.
+ */
+bool gossip_store_maybe_compact_start(struct gossip_store *gs);
+
+/* Start compacting in the background: false if we can't. */
+bool gossip_store_compact_start(struct gossip_store *gs);
+
+/**
+ * Copy the next part of the store being compacted.
+ * @gs: the gossip store.
+ * @max_bytes: roughly how much to copy.
+ *
+ * Once it has caught up, it swaps in the new store (telling the peers),
+ * which takes time proportional to the number of channels, but needs no
+ * more copying.  Returns true if there's more to do.
+ */
+bool gossip_store_compact_step(struct gossip_store *gs, size_t max_bytes);
+
+/* Is there a compaction under way? */
+bool gossip_store_compacting(const struct gossip_store *gs);
+
 /**
  * Get a readonly fd for the gossip_store.
  * @gs: the gossip store.
@@ -0,0 +1,324 @@
+#include <ccan/crc32c/crc32c.h>
+#include <ccan/endian/endian.h>
+#include <ccan/noerr/noerr.h>
+#include <ccan/read_write_all/read_write_all.h>
+#include <ccan/tal/str/str.h>
+#include <common/status.h>
+#include <common/utils.h>
+#include <fcntl.h>
+#include <gossipd/gossip_store_index.h>
+#include <gossipd/routing.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wire/wire.h>
+
+/* Bump this if the layout (or what it means) changes. */
+#define GOSSIP_STORE_INDEX_VERSION 1
+
+/* How much we buffer before writing out. */
+#define GOSSIP_STORE_INDEX_BUFSIZE (1024 * 1024)
+
+/*~ The index is towire-encoded, with a trailing crc32c over everything
+ * before it:
+ *
+ *   u8 version
+ *   u64 store_len, u32 store_crc, u64 count, u64 deleted
+ *   u32 last_timestamp
+ *   u32 num_chans, then for each:
+ *     short_channel_id, node_id[2], amount_sat sat, u32 index, u32 timestamp
+ *     and for each half_chan: u32 index, u32 timestamp, u32 base_fee,
+ *       u32 proportional_fee, u32 delay, u8 channel_flags, u8 message_flags,
+ *       amount_msat htlc_minimum, amount_msat htlc_maximum
+ *   u32 num_nodes, then for each node which has a node_announcement:
+ *     node_id, u32 index, u32 timestamp
+ *   u32 crc
+ *
+ * Channels come first, since they create the nodes.
+ */
+struct index_writer {
+	int fd;
+	u8 *buf;
+	u32 crc;
+	bool ok;
+};
+
+static void index_flush(struct index_writer *w, bool force)
+{
+	if (!force && tal_count(w->buf) < GOSSIP_STORE_INDEX_BUFSIZE)
+		return;
+
+	w->crc = crc32c(w->crc, w->buf, tal_count(w->buf));
+	if (w->ok && !write_all(w->fd, w->buf, tal_count(w->buf)))
+		w->ok = false;
+	tal_resize(&w->buf, 0);
+}
+
+static void towire_bcast(u8 **pptr, const struct broadcastable *bcast)
+{
+	towire_u32(pptr, bcast->index);
+	towire_u32(pptr, bcast->timestamp);
+}
+
+static void fromwire_bcast(const u8 **cursor, size_t *max,
+			   struct broadcastable *bcast)
+{
+	bcast->index = fromwire_u32(cursor, max);
+	bcast->timestamp = fromwire_u32(cursor, max);
+}
+
+static void towire_index_half_chan(u8 **pptr,
+				   const struct routing_state *rstate,
+				   const struct chan *chan, int dir)
+{
+	const struct half_chan *hc = &chan->half[dir];
+
+	towire_bcast(pptr, &hc->bcast);
+	towire_u32(pptr, hc->base_fee);
+	towire_u32(pptr, hc->proportional_fee);
+	towire_u32(pptr, hc->delay);
+	towire_u8(pptr, hc->channel_flags);
+	towire_u8(pptr, hc->message_flags);
+	towire_amount_msat(pptr, half_chan_htlc_minimum(rstate, chan, dir));
+	towire_amount_msat(pptr, half_chan_htlc_maximum(rstate, chan, dir));
+}
+
+static void fromwire_index_half_chan(const u8 **cursor, size_t *max,
+				     struct routing_state *rstate,
+				     struct chan *chan, int dir)
+{
+	struct half_chan *hc = &chan->half[dir];
+	struct amount_msat htlc_minimum, htlc_maximum;
+
+	fromwire_bcast(cursor, max, &hc->bcast);
+	hc->base_fee = fromwire_u32(cursor, max);
+	hc->proportional_fee = fromwire_u32(cursor, max);
+	hc->delay = fromwire_u32(cursor, max);
+	hc->channel_flags = fromwire_u8(cursor, max);
+	hc->message_flags = fromwire_u8(cursor, max);
+	htlc_minimum = fromwire_amount_msat(cursor, max);
+	htlc_maximum = fromwire_amount_msat(cursor, max);
+	set_half_chan_htlc_limits(rstate, chan, dir,
+				  htlc_minimum, htlc_maximum);
+}
+
+bool gossip_store_index_write(const char *filename,
+			      struct routing_state *rstate,
+			      const u8 *store, u64 store_len,
+			      size_t count, size_t deleted)
+{
+	struct index_writer w;
+	const char *tmpname = tal_fmt(tmpctx, "%s.tmp", filename);
+	struct node_map_iter nit;
+	u32 num_chans = 0, num_nodes = 0, last_timestamp = 0;
+	u64 idx;
+
+	w.fd = open(tmpname, O_WRONLY|O_TRUNC|O_CREAT, 0600);
+	if (w.fd < 0)
+		return false;
+	w.buf = tal_arr(tmpctx, u8, 0);
+	w.crc = 0;
+	w.ok = true;
+
+	for (struct chan *c = uintmap_first(&rstate->chanmap, &idx);
+	     c;
+	     c = uintmap_after(&rstate->chanmap, &idx)) {
+		num_chans++;
+		if (is_chan_public(c) && c->bcast.timestamp > last_timestamp)
+			last_timestamp = c->bcast.timestamp;
+	}
+	for (struct node *n = node_map_first(rstate->nodes, &nit);
+	     n;
+	     n = node_map_next(rstate->nodes, &nit)) {
+		if (n->bcast.index)
+			num_nodes++;
+	}
+
+	towire_u8(&w.buf, GOSSIP_STORE_INDEX_VERSION);
+	towire_u64(&w.buf, store_len);
+	towire_u32(&w.buf, crc32c(0, store, store_len));
+	towire_u64(&w.buf, count);
+	towire_u64(&w.buf, deleted);
+	towire_u32(&w.buf, last_timestamp);
+
+	towire_u32(&w.buf, num_chans);
+	for (struct chan *c = uintmap_first(&rstate->chanmap, &idx);
+	     c;
+	     c = uintmap_after(&rstate->chanmap, &idx)) {
+		towire_short_channel_id(&w.buf, &c->scid);
+		towire_node_id(&w.buf, &c->nodes[0]->id);
+		towire_node_id(&w.buf, &c->nodes[1]->id);
+		towire_amount_sat(&w.buf, c->sat);
+		towire_bcast(&w.buf, &c->bcast);
+		towire_index_half_chan(&w.buf, rstate, c, 0);
+		towire_index_half_chan(&w.buf, rstate, c, 1);
+		index_flush(&w, false);
+	}
+
+	towire_u32(&w.buf, num_nodes);
+	for (struct node *n = node_map_first(rstate->nodes, &nit);
+	     n;
+	     n = node_map_next(rstate->nodes, &nit)) {
+		if (!n->bcast.index)
+			continue;
+		towire_node_id(&w.buf, &n->id);
+		towire_bcast(&w.buf, &n->bcast);
+		index_flush(&w, false);
+	}
+	index_flush(&w, true);
+
+	towire_u32(&w.buf, w.crc);
+	if (!write_all(w.fd, w.buf, tal_count(w.buf)))
+		w.ok = false;
+	tal_free(w.buf);
+
+	if (close(w.fd) != 0)
+		w.ok = false;
+	if (!w.ok || rename(tmpname, filename) != 0) {
+		unlink_noerr(tmpname);
+		return false;
+	}
+	return true;
+}
+
+/* Does the first @len bytes of the store still have the crc we saw? */
+static bool store_matches(const char *store_filename, u64 len, u32 crc)
+{
+	struct stat st;
+	void *map;
+	bool ok;
+	int fd = open(store_filename, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || (u64)st.st_size < len || len == 0) {
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	ok = (crc32c(0, map, len) == crc);
+	munmap(map, len);
+	return ok;
+}
+
+static void destroy_gossip_store_index(struct gossip_store_index *idx)
+{
+	munmap((void *)idx->map, idx->maplen);
+}
+
+struct gossip_store_index *gossip_store_index_open(const tal_t *ctx,
+						   const char *filename,
+						   const char *store_filename)
+{
+	struct gossip_store_index *idx;
+	struct stat st;
+	void *map;
+	const u8 *cursor;
+	size_t max;
+	be32 crc;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(crc)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	idx = tal(ctx, struct gossip_store_index);
+	idx->map = map;
+	idx->maplen = st.st_size;
+	tal_add_destructor(idx, destroy_gossip_store_index);
+
+	memcpy(&crc, idx->map + idx->maplen - sizeof(crc), sizeof(crc));
+	if (be32_to_cpu(crc)
+	    != crc32c(0, idx->map, idx->maplen - sizeof(crc))) {
+		status_unusual("%s: bad checksum, ignoring", filename);
+		return tal_free(idx);
+	}
+
+	cursor = idx->map;
+	max = idx->maplen - sizeof(crc);
+	if (fromwire_u8(&cursor, &max) != GOSSIP_STORE_INDEX_VERSION) {
+		status_debug("%s: unknown version, ignoring", filename);
+		return tal_free(idx);
+	}
+	idx->store_len = fromwire_u64(&cursor, &max);
+	idx->store_crc = fromwire_u32(&cursor, &max);
+	idx->count = fromwire_u64(&cursor, &max);
+	idx->deleted = fromwire_u64(&cursor, &max);
+	idx->last_timestamp = fromwire_u32(&cursor, &max);
+	if (!cursor) {
+		status_unusual("%s: truncated, ignoring", filename);
+		return tal_free(idx);
+	}
+	idx->tables = cursor;
+	idx->tableslen = max;
+
+	if (!store_matches(store_filename, idx->store_len, idx->store_crc)) {
+		status_debug("%s: %s has changed, ignoring",
+			     filename, store_filename);
+		return tal_free(idx);
+	}
+	return idx;
+}
+
+bool gossip_store_index_restore(struct routing_state *rstate,
+				const struct gossip_store_index *idx)
+{
+	const u8 *cursor = idx->tables;
+	size_t max = idx->tableslen;
+	u32 num;
+
+	num = fromwire_u32(&cursor, &max);
+	for (u32 i = 0; i < num; i++) {
+		struct short_channel_id scid;
+		struct node_id id[2];
+		struct amount_sat sat;
+		struct chan *chan;
+
+		fromwire_short_channel_id(&cursor, &max, &scid);
+		fromwire_node_id(&cursor, &max, &id[0]);
+		fromwire_node_id(&cursor, &max, &id[1]);
+		sat = fromwire_amount_sat(&cursor, &max);
+		if (!cursor
+		    || get_channel(rstate, &scid)
+		    || node_id_cmp(&id[0], &id[1]) >= 0)
+			return false;
+
+		chan = new_chan(rstate, &scid, &id[0], &id[1], sat);
+		fromwire_bcast(&cursor, &max, &chan->bcast);
+		fromwire_index_half_chan(&cursor, &max, rstate, chan, 0);
+		fromwire_index_half_chan(&cursor, &max, rstate, chan, 1);
+		routing_chan_timestamps_changed(rstate, chan);
+
+		if (is_chan_public(chan)
+		    && (node_id_eq(&id[0], &rstate->local_id)
+			|| node_id_eq(&id[1], &rstate->local_id)))
+			rstate->local_channel_announced = true;
+	}
+
+	num = fromwire_u32(&cursor, &max);
+	for (u32 i = 0; i < num; i++) {
+		struct node_id id;
+		struct node *node;
+
+		fromwire_node_id(&cursor, &max, &id);
+		if (!cursor)
+			return false;
+		/* Nodes only exist while they have channels. */
+		node = get_node(rstate, &id);
+		if (!node)
+			return false;
+		fromwire_bcast(&cursor, &max, &node->bcast);
+	}
+
+	return cursor && max == 0;
+}
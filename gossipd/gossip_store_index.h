@@ -0,0 +1,66 @@
+#ifndef LIGHTNING_GOSSIPD_GOSSIP_STORE_INDEX_H
+#define LIGHTNING_GOSSIPD_GOSSIP_STORE_INDEX_H
+#include "config.h"
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+
+struct routing_state;
+
+/* A copy of the routing graph written next to the gossip_store, so on
+ * startup we only have to replay what was appended since. */
+struct gossip_store_index {
+	/* How much of the store it covers, and the crc32c of that. */
+	u64 store_len;
+	u32 store_crc;
+	/* The gossip_store counters at that point (count includes deleted) */
+	size_t count, deleted;
+	/* Newest channel_announcement timestamp */
+	u32 last_timestamp;
+
+	/* The mmapped file, and the channel and node tables within it. */
+	const u8 *map;
+	size_t maplen;
+	const u8 *tables;
+	size_t tableslen;
+};
+
+/**
+ * gossip_store_index_write - write out an index for @rstate.
+ * @filename: where to put it (we write to a temporary file and rename).
+ * @rstate: the routing state, which must be what @store describes.
+ * @store: the (mapped) gossip_store.
+ * @store_len: the length of the gossip_store.
+ * @count: number of records in the store, including deleted.
+ * @deleted: number of deleted records in the store.
+ *
+ * This doesn't log, as it's called as we shut down.  Returns false on
+ * failure.
+ */
+bool gossip_store_index_write(const char *filename,
+			      struct routing_state *rstate,
+			      const u8 *store, u64 store_len,
+			      size_t count, size_t deleted);
+
+/**
+ * gossip_store_index_open - map an index and check it's for this store.
+ * @ctx: context to allocate from.
+ * @filename: the index.
+ * @store_filename: the gossip_store it's supposed to describe.
+ *
+ * Returns NULL if it's missing, stale or corrupt.
+ */
+struct gossip_store_index *gossip_store_index_open(const tal_t *ctx,
+						   const char *filename,
+						   const char *store_filename);
+
+/**
+ * gossip_store_index_restore - add the index's channels and nodes.
+ * @rstate: the (empty) routing state.
+ * @idx: the index from gossip_store_index_open().
+ *
+ * Returns false if the index is malformed, in which case @rstate may
+ * hold some of it: use remove_all_gossip().
+ */
+bool gossip_store_index_restore(struct routing_state *rstate,
+				const struct gossip_store_index *idx);
+#endif /* LIGHTNING_GOSSIPD_GOSSIP_STORE_INDEX_H */
@@ -52,6 +52,10 @@
 #include <gossipd/broadcast.h>
 #include <gossipd/gen_gossip_peerd_wire.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <gossipd/range_cache.h>
+#include <gossipd/route_cache.h>
+#include <gossipd/route_workers.h>
+#include <gossipd/sig_workers.h>
 #include <gossipd/routing.h>
 #include <hsmd/gen_hsm_wire.h>
 #include <inttypes.h>
@@ -75,6 +79,24 @@
 /* connectd asks us for help finding nodes, and gossip fds for new peers */
 #define CONNECTD_FD 4
 
+/* How often we check whether route finding needs new landmarks */
+#define LANDMARK_REFRESH_SECS 60
+
+/* How often we check whether the gossip_store needs compacting, and how
+ * much we copy at a time once it does. */
+#define COMPACT_CHECK_SECS 60
+#define COMPACT_STEP_MSEC 10
+#define COMPACT_STEP_BYTES (1024 * 1024)
+
+/* How long we collect channel_announcements before asking lightningd about
+ * their outputs, unless we get this many first. */
+#define TXOUTS_BATCH_MSEC 100
+#define TXOUTS_BATCH_MAX 1000
+
+/* Most channels/nodes we hand lightningd in one message. */
+#define GETCHANNELS_CHUNK 4096
+#define GETNODES_CHUNK 1024
+
 /* In developer mode we provide hooks for whitebox testing */
 #if DEVELOPER
 static u32 max_scids_encode_bytes = -1U;
@@ -98,6 +120,14 @@ struct daemon {
 	/* Routing information */
 	struct routing_state *rstate;
 
+	/* Threads for getroute requests (NULL if we do them ourselves) */
+	struct route_workers *route_workers;
+
+	/* Threads for gossip signature checks (NULL if we do them ourselves) */
+	struct sig_workers *sig_workers;
+	/* Have we stopped reading gossip from peers until they catch up? */
+	bool sig_workers_full;
+
 	/* chainhash for checking/making gossip msgs */
 	struct bitcoin_blkid chain_hash;
 
@@ -119,6 +149,11 @@ struct daemon {
 
 	/* Channels we've heard about, but don't know. */
 	struct short_channel_id *unknown_scids;
+
+	/* Announced channels we're about to ask lightningd to look up, and
+	 * the timer which asks. */
+	struct short_channel_id *txouts_to_ask;
+	struct oneshot *txouts_timer;
 };
 
 /*~ How gossipy do we ask a peer to be? */
@@ -151,8 +186,10 @@ struct peer {
 	/* The ID of the peer (always unique) */
 	struct node_id id;
 
-	/* The two features gossip cares about (so far) */
+	/* The features gossip cares about (so far) */
 	bool gossip_queries_feature, initial_routing_sync_feature;
+	/* Can we send them SHORTIDS_RICE? */
+	bool gossip_queries_rice;
 
 	/* Are there outstanding responses for queries on short_channel_ids? */
 	const struct short_channel_id *scid_queries;
@@ -181,6 +218,9 @@ struct peer {
 
 	/* The daemon_conn used to queue messages to/from the peer. */
 	struct daemon_conn *dc;
+
+	/* What happened to the gossip they sent us. */
+	u64 gossip_accepted, gossip_suppressed, gossip_invalid;
 };
 
 /*~ A channel consists of a `struct half_chan` for each direction, each of
@@ -260,13 +300,22 @@ static void queue_peer_from_store(struct peer *peer,
  * simple compression scheme: the first byte indicates the encoding, the
  * rest contains the data.
  */
-static u8 *encode_short_channel_ids_start(const tal_t *ctx)
+static u8 *encode_short_channel_ids_start(const tal_t *ctx,
+					  enum scid_encode_types type)
 {
 	u8 *encoded = tal_arr(ctx, u8, 0);
-	towire_u8(&encoded, SHORTIDS_ZLIB);
+	towire_u8(&encoded, type);
 	return encoded;
 }
 
+/* We only use the experimental encoding if they said they understand it. */
+static enum scid_encode_types peer_scid_encoding(const struct peer *peer)
+{
+	if (peer->gossip_queries_rice)
+		return SHORTIDS_RICE;
+	return SHORTIDS_ZLIB;
+}
+
 /* Marshal a single short_channel_id */
 static void encode_add_short_channel_id(u8 **encoded,
 					const struct short_channel_id *scid)
@@ -300,6 +349,27 @@ static u8 *zencode_scids(const tal_t *ctx, const u8 *scids, size_t len)
 	return NULL;
 }
 
+/* Returns NULL if they're not in order (the encoding relies on it). */
+static u8 *riceencode_scids(const tal_t *ctx, const u8 *scids, size_t len)
+{
+	struct short_channel_id *arr = tal_arr(tmpctx, struct short_channel_id,
+					       0);
+	u8 *r = tal_arr(ctx, u8, 0);
+
+	while (len) {
+		struct short_channel_id scid;
+		fromwire_short_channel_id(&scids, &len, &scid);
+		tal_arr_expand(&arr, scid);
+	}
+	if (!encode_short_ids_rice(&r, arr)) {
+		status_trace("short_ids not in order: not using rice");
+		return tal_free(r);
+	}
+	status_trace("short_ids rice encoded %zu into %zu",
+		     tal_count(arr) * 8, tal_count(r));
+	return r;
+}
+
 /* Once we've assembled */
 static bool encode_short_channel_ids_end(u8 **encoded, size_t max_bytes)
 {
@@ -307,6 +377,17 @@ static bool encode_short_channel_ids_end(u8 **encoded, size_t max_bytes)
 
 	/* First byte says what encoding we want. */
 	switch ((enum scid_encode_types)(*encoded)[0]) {
+	case SHORTIDS_RICE:
+		z = riceencode_scids(tmpctx, *encoded + 1,
+				     tal_count(*encoded) - 1);
+		if (z) {
+			tal_resize(encoded, 1 + tal_count(z));
+			memcpy((*encoded) + 1, z, tal_count(z));
+			goto check_length;
+		}
+		/* Otherwise, zlib will do */
+		(*encoded)[0] = SHORTIDS_ZLIB;
+		/* Fall thru */
 	case SHORTIDS_ZLIB:
 		/* compress */
 		z = zencode_scids(tmpctx, *encoded + 1, tal_count(*encoded) - 1);
@@ -608,7 +689,8 @@ static bool query_short_channel_ids(struct daemon *daemon,
 	if (peer->scid_query_outstanding)
 		return false;
 
-	encoded = encode_short_channel_ids_start(tmpctx);
+	encoded = encode_short_channel_ids_start(tmpctx,
+						 peer_scid_encoding(peer));
 	for (size_t i = 0; i < tal_count(scids); i++)
 		encode_add_short_channel_id(&encoded, &scids[i]);
 
@@ -659,6 +741,43 @@ static void query_unknown_channel(struct daemon *daemon,
  * case.
  */
 
+/*~ Looking up an output can mean several bitcoin-cli calls for lightningd,
+ * and an initial sync brings tens of thousands of channel_announcements.  So
+ * we ask in batches, sorted so each block's channels are together: then it
+ * only has to fetch each block once. */
+static int scid_cmp(const struct short_channel_id *a,
+		    const struct short_channel_id *b,
+		    void *unused UNUSED)
+{
+	if (a->u64 < b->u64)
+		return -1;
+	return a->u64 > b->u64;
+}
+
+static void ask_txouts(struct daemon *daemon)
+{
+	daemon->txouts_timer = tal_free(daemon->txouts_timer);
+	asort(daemon->txouts_to_ask, tal_count(daemon->txouts_to_ask),
+	      scid_cmp, NULL);
+	daemon_conn_send(daemon->master,
+			 take(towire_gossip_get_txouts(NULL,
+						       daemon->txouts_to_ask)));
+	tal_resize(&daemon->txouts_to_ask, 0);
+}
+
+static void ask_txout(struct daemon *daemon,
+		      const struct short_channel_id *scid)
+{
+	tal_arr_expand(&daemon->txouts_to_ask, *scid);
+	if (tal_count(daemon->txouts_to_ask) >= TXOUTS_BATCH_MAX)
+		ask_txouts(daemon);
+	else if (!daemon->txouts_timer)
+		daemon->txouts_timer
+			= new_reltimer(&daemon->timers, daemon,
+				       time_from_msec(TXOUTS_BATCH_MSEC),
+				       ask_txouts, daemon);
+}
+
 /* The routing code checks that it's basically valid, returning an
  * error message for the peer or NULL.  NULL means it's OK, but the
  * message might be redundant, in which case scid is also NULL.
@@ -666,7 +785,7 @@ static void query_unknown_channel(struct daemon *daemon,
  * message, and puts the announcemnt on an internal 'pending'
  * queue.  We'll send a request to lightningd to look it up, and continue
  * processing in `handle_txout_reply`. */
-static const u8 *handle_channel_announcement_msg(struct peer *peer,
+static const u8 *handle_channel_announcement_msg(struct daemon *daemon,
 						 const u8 *msg)
 {
 	const struct short_channel_id *scid;
@@ -675,27 +794,44 @@ static const u8 *handle_channel_announcement_msg(struct peer *peer,
 	/* If it's OK, tells us the short_channel_id to lookup; it notes
 	 * if this is the unknown channel the peer was looking for (in
 	 * which case, it frees and NULLs that ptr) */
-	err = handle_channel_announcement(peer->daemon->rstate, msg, &scid);
+	err = handle_channel_announcement(daemon->rstate, msg, &scid);
 	if (err)
 		return err;
 	else if (scid)
-		daemon_conn_send(peer->daemon->master,
-				 take(towire_gossip_get_txout(NULL, scid)));
+		ask_txout(daemon, scid);
 	return NULL;
 }
 
-static u8 *handle_channel_update_msg(struct peer *peer, const u8 *msg)
+/*~ So we can tell which peers are sending us junk, or far too much. */
+static void count_peer_gossip(struct peer *peer, const u8 *err,
+			      bool suppressed)
+{
+	if (err)
+		peer->gossip_invalid++;
+	else if (suppressed)
+		peer->gossip_suppressed++;
+	else
+		peer->gossip_accepted++;
+}
+
+/* peer is NULL if they've gone while this was waiting in sig_workers. */
+static u8 *handle_channel_update_msg(struct daemon *daemon,
+				     struct peer *peer,
+				     const u8 *msg)
 {
 	struct short_channel_id unknown_scid;
 	/* Hand the channel_update to the routing code */
 	u8 *err;
+	bool suppressed;
 
 	unknown_scid.u64 = 0;
-	err = handle_channel_update(peer->daemon->rstate, msg, "subdaemon",
-				    &unknown_scid);
+	err = handle_channel_update(daemon->rstate, msg, "subdaemon",
+				    &unknown_scid, &suppressed);
+	if (peer)
+		count_peer_gossip(peer, err, suppressed);
 	if (err) {
-		if (unknown_scid.u64 != 0)
-			query_unknown_channel(peer->daemon, peer, &unknown_scid);
+		if (unknown_scid.u64 != 0 && peer)
+			query_unknown_channel(daemon, peer, &unknown_scid);
 		return err;
 	}
 
@@ -704,7 +840,7 @@ static u8 *handle_channel_update_msg(struct peer *peer, const u8 *msg)
 	 * routing until you have both anyway.  For this reason, we might have
 	 * just sent out our own channel_announce, so we check if it's time to
 	 * send a node_announcement too. */
-	maybe_send_own_node_announce(peer->daemon);
+	maybe_send_own_node_announce(daemon);
 	return NULL;
 }
 
@@ -833,7 +969,8 @@ static bool queue_channel_ranges(struct peer *peer,
 				 u32 tail_blocks)
 {
 	struct routing_state *rstate = peer->daemon->rstate;
-	u8 *encoded = encode_short_channel_ids_start(tmpctx);
+	u8 *encoded;
+	const u8 *cached;
 	struct short_channel_id scid;
 	bool scid_ok;
 
@@ -851,6 +988,22 @@ static bool queue_channel_ranges(struct peer *peer,
 	const size_t reply_overhead = 32 + 4 + 4 + 1 + 2;
 	const size_t max_encoded_bytes = 65535 - 2 - reply_overhead;
 
+	/*~ Compressing thousands of short_channel_ids isn't cheap, and every
+	 * peer which connects asks for the same blocks.  So we remember what
+	 * we sent (even if it didn't fit, in which case we split it the same
+	 * way again), until a channel in those blocks is added or removed. */
+	if (range_cache_get(rstate->range_cache, peer_scid_encoding(peer),
+			    first_blocknum, number_of_blocks,
+			    max_encoded_bytes, &cached)) {
+		if (cached) {
+			reply_channel_range(peer, first_blocknum,
+					    number_of_blocks + tail_blocks,
+					    cached);
+			return true;
+		}
+		goto split;
+	}
+
 	/* Avoid underflow: we don't use block 0 anyway */
 	if (first_blocknum == 0)
 		scid_ok = mk_short_channel_id(&scid, 1, 0, 0);
@@ -866,6 +1019,8 @@ static bool queue_channel_ranges(struct peer *peer,
 	 * integer.
 	 *
 	 * First we iteraate and gather all the short channel ids. */
+	encoded = encode_short_channel_ids_start(tmpctx,
+						 peer_scid_encoding(peer));
 	while (uintmap_after(&rstate->chanmap, &scid.u64)) {
 		u32 blocknum = short_channel_id_blocknum(&scid);
 		if (blocknum >= first_blocknum + number_of_blocks)
@@ -876,12 +1031,19 @@ static bool queue_channel_ranges(struct peer *peer,
 
 	/* If we can encode that, fine: send it */
 	if (encode_short_channel_ids_end(&encoded, max_encoded_bytes)) {
+		range_cache_add(rstate->range_cache, peer_scid_encoding(peer),
+				first_blocknum, number_of_blocks,
+				max_encoded_bytes, encoded);
 		reply_channel_range(peer, first_blocknum,
 				    number_of_blocks + tail_blocks,
 				    encoded);
 		return true;
 	}
+	range_cache_add(rstate->range_cache, peer_scid_encoding(peer),
+			first_blocknum, number_of_blocks,
+			max_encoded_bytes, NULL);
 
+split:
 	/* It wouldn't all fit: divide in half */
 	/* We assume we can always send one block! */
 	if (number_of_blocks <= 1) {
@@ -1400,7 +1562,8 @@ static void update_local_channel(struct daemon *daemon,
 	/* We feed it into routing.c like any other channel_update; it may
 	 * discard it (eg. non-public channel), but it should not complain
 	 * about it being invalid! */
-	msg = handle_channel_update(daemon->rstate, take(update), caller, NULL);
+	msg = handle_channel_update(daemon->rstate, take(update), caller,
+				    NULL, NULL);
 	if (msg)
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "%s: rejected local channel update %s: %s",
@@ -1436,10 +1599,12 @@ static void maybe_update_local_channel(struct daemon *daemon,
 	update_local_channel(daemon, chan, direction,
 			     local_disabled,
 			     hc->delay,
-			     hc->htlc_minimum,
+			     half_chan_htlc_minimum(daemon->rstate, chan,
+						    direction),
 			     hc->base_fee,
 			     hc->proportional_fee,
-			     hc->htlc_maximum,
+			     half_chan_htlc_maximum(daemon->rstate, chan,
+						    direction),
 			     /* Note this magic C macro which expands to the
 			      * function name, for debug messages */
 			     __func__);
@@ -1525,19 +1690,26 @@ out:
 /*~ Return true if the channel information has changed.  This can only
 * currently happen if the user restarts with different fee options, but we
 * don't assume that. */
-static bool halfchan_new_info(const struct half_chan *hc,
+static bool halfchan_new_info(const struct routing_state *rstate,
+			      const struct chan *chan, int direction,
 			      u16 cltv_delta, struct amount_msat htlc_minimum,
 			      u32 fee_base_msat, u32 fee_proportional_millionths,
 			      struct amount_msat htlc_maximum)
 {
+	const struct half_chan *hc = &chan->half[direction];
+
 	if (!is_halfchan_defined(hc))
 		return true;
 
 	return hc->delay != cltv_delta
-		|| !amount_msat_eq(hc->htlc_minimum, htlc_minimum)
+		|| !amount_msat_eq(half_chan_htlc_minimum(rstate, chan,
+							  direction),
+				   htlc_minimum)
 		|| hc->base_fee != fee_base_msat
 		|| hc->proportional_fee != fee_proportional_millionths
-		|| !amount_msat_eq(hc->htlc_maximum, htlc_maximum);
+		|| !amount_msat_eq(half_chan_htlc_maximum(rstate, chan,
+							  direction),
+				   htlc_maximum);
 }
 
 /*~ channeld asks us to update the local channel. */
@@ -1591,7 +1763,7 @@ static bool handle_local_channel_update(struct peer *peer, const u8 *msg)
 	/* We could change configuration on restart; update immediately.
 	 * Or, if we're *enabling* an announced-disabled channel.
 	 * Or, if it's an unannounced channel (only sending to peer). */
-	if (halfchan_new_info(&chan->half[direction],
+	if (halfchan_new_info(peer->daemon->rstate, chan, direction,
 			      cltv_expiry_delta, htlc_minimum,
 			      fee_base_msat, fee_proportional_millionths,
 			      htlc_maximum)
@@ -1618,6 +1790,99 @@ static bool handle_local_channel_update(struct peer *peer, const u8 *msg)
 	return true;
 }
 
+/*~ Checking signatures is most of the work of taking in gossip: during
+ * initial sync we can get hundreds of thousands of messages, and each
+ * channel_announcement has four signatures.  With --gossip-verify-threads,
+ * we hand the signatures to sig_workers and apply the messages (in the
+ * order we got them) once they come back; the routing code then only checks
+ * signatures the workers didn't.
+ *
+ * If the workers fall too far behind, we stop reading from any peer which
+ * sends us more gossip, until they've caught up halfway: a peer can't make
+ * us queue more than one message past the limit. */
+#define SIG_WORKERS_MAX_QUEUE 10000
+
+struct pending_gossip {
+	struct daemon *daemon;
+	/* The peer may be gone by the time this is applied. */
+	struct node_id peer_id;
+	const u8 *msg;
+};
+
+static void gossip_verified(const struct gossip_sigs *verified,
+			    struct pending_gossip *pg)
+{
+	struct daemon *daemon = pg->daemon;
+	struct peer *peer = find_peer(daemon, &pg->peer_id);
+	const u8 *err;
+
+	daemon->rstate->verified = verified;
+	switch ((enum wire_type)fromwire_peektype(pg->msg)) {
+	case WIRE_CHANNEL_ANNOUNCEMENT:
+		err = handle_channel_announcement_msg(daemon, pg->msg);
+		if (peer)
+			count_peer_gossip(peer, err, false);
+		break;
+	case WIRE_CHANNEL_UPDATE:
+		err = handle_channel_update_msg(daemon, peer, pg->msg);
+		break;
+	case WIRE_NODE_ANNOUNCEMENT:
+		err = handle_node_announcement(daemon->rstate, pg->msg);
+		if (peer)
+			count_peer_gossip(peer, err, false);
+		break;
+	default:
+		abort();
+	}
+	daemon->rstate->verified = NULL;
+
+	if (err && peer)
+		queue_peer_msg(peer, take(err));
+	else
+		tal_free(err);
+	tal_free(pg);
+
+	/* Let peers we stopped reading from carry on. */
+	if (daemon->sig_workers_full
+	    && sig_workers_queued(daemon->sig_workers)
+	    < SIG_WORKERS_MAX_QUEUE / 2) {
+		daemon->sig_workers_full = false;
+		io_wake(daemon->sig_workers);
+	}
+}
+
+/* Returns false if we're not using sig_workers, so caller should handle it
+ * now. */
+static bool verify_later(struct peer *peer, const u8 *msg)
+{
+	struct daemon *daemon = peer->daemon;
+	struct pending_gossip *pg;
+	struct gossip_sigs sigs;
+	const struct gossip_sigs *to_check = NULL;
+
+	if (!daemon->sig_workers)
+		return false;
+
+	pg = tal(daemon, struct pending_gossip);
+	pg->daemon = daemon;
+	pg->peer_id = peer->id;
+	pg->msg = tal_dup_arr(pg, u8, msg, tal_count(msg), 0);
+
+	/* If we can't tell who signed it yet (eg. the channel_announcement
+	 * is ahead of it in the queue), it gets checked as it's applied. */
+	if (gossip_sigs_get(daemon->rstate, pg->msg, &sigs))
+		to_check = &sigs;
+
+	sig_workers_submit(daemon->sig_workers, to_check, gossip_verified, pg);
+	return true;
+}
+
+static struct io_plan *peer_read_next(struct io_conn *conn,
+				      struct peer *peer)
+{
+	return daemon_conn_read_next(conn, peer->dc);
+}
+
 /*~ This is where the per-peer daemons send us messages.  It's either forwarded
  * gossip, or a request for information.  We deliberately use non-overlapping
  * message types so we can distinguish them. */
@@ -1631,13 +1896,21 @@ static struct io_plan *peer_msg_in(struct io_conn *conn,
 	/* These are messages relayed from peer */
 	switch ((enum wire_type)fromwire_peektype(msg)) {
 	case WIRE_CHANNEL_ANNOUNCEMENT:
-		err = handle_channel_announcement_msg(peer, msg);
+		if (verify_later(peer, msg))
+			goto verifying;
+		err = handle_channel_announcement_msg(peer->daemon, msg);
+		count_peer_gossip(peer, err, false);
 		goto handled_relay;
 	case WIRE_CHANNEL_UPDATE:
-		err = handle_channel_update_msg(peer, msg);
+		if (verify_later(peer, msg))
+			goto verifying;
+		err = handle_channel_update_msg(peer->daemon, peer, msg);
 		goto handled_relay;
 	case WIRE_NODE_ANNOUNCEMENT:
+		if (verify_later(peer, msg))
+			goto verifying;
 		err = handle_node_announcement(peer->daemon->rstate, msg);
+		count_peer_gossip(peer, err, false);
 		goto handled_relay;
 	case WIRE_QUERY_CHANNEL_RANGE:
 		err = handle_query_channel_range(peer, msg);
@@ -1720,6 +1993,16 @@ handled_cmd:
 handled_relay:
 	if (err)
 		queue_peer_msg(peer, take(err));
+	goto done;
+
+	/* Don't take more from them until the workers catch up. */
+verifying:
+	if (sig_workers_queued(peer->daemon->sig_workers)
+	    >= SIG_WORKERS_MAX_QUEUE) {
+		peer->daemon->sig_workers_full = true;
+		return io_wait(conn, peer->daemon->sig_workers,
+			       peer_read_next, peer);
+	}
 done:
 	return daemon_conn_read_next(conn, peer->dc);
 }
@@ -1766,6 +2049,7 @@ static struct io_plan *connectd_new_peer(struct io_conn *conn,
 
 	if (!fromwire_gossip_new_peer(msg, &peer->id,
 				      &peer->gossip_queries_feature,
+				      &peer->gossip_queries_rice,
 				      &peer->initial_routing_sync_feature)) {
 		status_broken("Bad new_peer msg from connectd: %s",
 			      tal_hex(tmpctx, msg));
@@ -1809,6 +2093,9 @@ static struct io_plan *connectd_new_peer(struct io_conn *conn,
 	peer->num_pings_outstanding = 0;
 	peer->gossip_level = peer_gossip_level(daemon,
 					       peer->gossip_queries_feature);
+	peer->gossip_accepted = 0;
+	peer->gossip_suppressed = 0;
+	peer->gossip_invalid = 0;
 
 	/* We keep a list so we can find peer by id */
 	list_add_tail(&peer->daemon->peers, &peer->list);
@@ -1927,16 +2214,19 @@ static void gossip_send_keepalive_update(struct daemon *daemon,
 		     type_to_string(tmpctx, struct short_channel_id,
 				    &chan->scid));
 
+	int direction = hc->channel_flags & ROUTING_FLAGS_DIRECTION;
+
 	/* As a side-effect, this will create an update which matches the
 	 * local_disabled state */
-	update_local_channel(daemon, chan,
-			     hc->channel_flags & ROUTING_FLAGS_DIRECTION,
+	update_local_channel(daemon, chan, direction,
 			     is_chan_local_disabled(daemon->rstate, chan),
 			     hc->delay,
-			     hc->htlc_minimum,
+			     half_chan_htlc_minimum(daemon->rstate, chan,
+						    direction),
 			     hc->base_fee,
 			     hc->proportional_fee,
-			     hc->htlc_maximum,
+			     half_chan_htlc_maximum(daemon->rstate, chan,
+						    direction),
 			     __func__);
 }
 
@@ -1997,6 +2287,18 @@ static void gossip_refresh_network(struct daemon *daemon)
 	route_prune(daemon->rstate);
 }
 
+/*~ Route finding is much faster with landmark distances, but they take a
+ * while to work out, and adding a channel invalidates them.  So rather than
+ * doing it every time the graph changes, we catch up every so often. */
+static void refresh_landmarks(struct daemon *daemon)
+{
+	notleak(new_reltimer(&daemon->timers, daemon,
+			     time_from_sec(LANDMARK_REFRESH_SECS),
+			     refresh_landmarks, daemon));
+
+	routing_refresh_landmarks(daemon->rstate);
+}
+
 /* Disables all channels connected to our node. */
 static void gossip_disable_local_channels(struct daemon *daemon)
 {
@@ -2088,12 +2390,46 @@ static void gossip_not_missing(struct daemon *daemon)
 	}
 }
 
+/*~ Deleted records pile up in the gossip_store as gossip is replaced.
+ * Rewriting the store takes a while once it's large, so we do it a little
+ * at a time, letting everything else run in between. */
+static void compact_store_timer(struct daemon *daemon)
+{
+	struct gossip_store *gs = daemon->rstate->gs;
+	struct timerel next;
+
+	if (gossip_store_compacting(gs)
+	    || gossip_store_maybe_compact_start(gs))
+		gossip_store_compact_step(gs, COMPACT_STEP_BYTES);
+
+	if (gossip_store_compacting(gs))
+		next = time_from_msec(COMPACT_STEP_MSEC);
+	else
+		next = time_from_sec(COMPACT_CHECK_SECS);
+	notleak(new_reltimer(&daemon->timers, daemon, next,
+			     compact_store_timer, daemon));
+}
+
+/*~ Held back channel_updates go out as their tokens come back. */
+static void release_suppressed_timer(struct daemon *daemon)
+{
+	routing_release_suppressed(daemon->rstate);
+	notleak(new_reltimer(&daemon->timers, daemon,
+			     time_from_sec(daemon->rstate->ratelimit_refill),
+			     release_suppressed_timer, daemon));
+}
+
 /*~ Parse init message from lightningd: starts the daemon properly. */
 static struct io_plan *gossip_init(struct io_conn *conn,
 				   struct daemon *daemon,
 				   const u8 *msg)
 {
 	u32 update_channel_interval;
+	u32 route_threads;
+	u32 route_cache_size;
+	bool store_crc_once, store_index;
+	u32 verify_threads;
+	u32 ratelimit_burst, ratelimit_node_burst, ratelimit_refill;
 	u32 *dev_gossip_time;
 
 	if (!fromwire_gossipctl_init(daemon, msg,
@@ -2105,6 +2441,14 @@ static struct io_plan *gossip_init(struct io_conn *conn,
 				      * (unless --dev-channel-update-interval) */
 				     &update_channel_interval,
 				     &daemon->announcable,
+				     &route_threads,
+				     &route_cache_size,
+				     &store_crc_once,
+				     &store_index,
+				     &verify_threads,
+				     &ratelimit_burst,
+				     &ratelimit_node_burst,
+				     &ratelimit_refill,
 				     &dev_gossip_time)) {
 		master_badmsg(WIRE_GOSSIPCTL_INIT, msg);
 	}
@@ -2117,7 +2461,44 @@ static struct io_plan *gossip_init(struct io_conn *conn,
 					   &daemon->peers,
 					   dev_gossip_time);
 
+	/*~ Route finding can take a while on a big graph, and lightningd
+	 * (especially the pay plugin) can ask for a lot of routes at once.
+	 * Rather than stall gossip while we think, we can farm them out. */
+	if (route_threads)
+		daemon->route_workers = route_workers_new(daemon->rstate,
+							  daemon->rstate,
+							  route_threads);
+
+	/*~ The pay plugin tends to ask for the same route over and over, and
+	 * most of the graph doesn't change between asks: so we can remember
+	 * routes, as long as we forget them when one of their channels
+	 * changes. */
+	if (route_cache_size)
+		daemon->rstate->route_cache = route_cache_new(daemon->rstate,
+							      route_cache_size);
+
+	/*~ Peers which connect ask for every channel since some block, and
+	 * the answer is the same every time unless a channel in those blocks
+	 * came or went: see queue_channel_ranges(). */
+	daemon->rstate->range_cache = range_cache_new(daemon->rstate);
+
+	/*~ Similarly, checking gossip signatures can be spread over CPUs:
+	 * see verify_later(). */
+	if (verify_threads)
+		daemon->sig_workers = sig_workers_new(daemon, verify_threads);
+
+	/*~ A node flapping its channels makes us store, and pass on, every
+	 * flap: we only let through a few quickly, and hold the latest of the
+	 * rest until it's time.  See handle_channel_update(). */
+	daemon->rstate->ratelimit_burst = ratelimit_burst;
+	daemon->rstate->ratelimit_node_burst = ratelimit_node_burst;
+	daemon->rstate->ratelimit_refill = ratelimit_refill;
+	if (ratelimit_burst)
+		release_suppressed_timer(daemon);
+
 	/* Load stored gossip messages */
+	gossip_store_set_crc_once(daemon->rstate->gs, store_crc_once);
+	gossip_store_set_write_index(daemon->rstate->gs, store_index);
 	if (!gossip_store_load(daemon->rstate, daemon->rstate->gs))
 		gossip_missing(daemon);
 
@@ -2133,9 +2514,24 @@ static struct io_plan *gossip_init(struct io_conn *conn,
 			     time_from_sec(daemon->rstate->prune_timeout/4),
 			     gossip_refresh_network, daemon));
 
+	notleak(new_reltimer(&daemon->timers, daemon,
+			     time_from_sec(LANDMARK_REFRESH_SECS),
+			     refresh_landmarks, daemon));
+
+	notleak(new_reltimer(&daemon->timers, daemon,
+			     time_from_sec(COMPACT_CHECK_SECS),
+			     compact_store_timer, daemon));
+
 	return daemon_conn_read_next(conn, daemon->master);
 }
 
+/*~ Worker threads call this back (in order) when they find a route. */
+static void getroute_done(const struct route_hop *hops, struct daemon *daemon)
+{
+	daemon_conn_send(daemon->master,
+			 take(towire_gossip_getroute_reply(NULL, hops)));
+}
+
 /*~ lightningd can ask for a route between nodes. */
 static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 				    const u8 *msg)
@@ -2175,6 +2571,23 @@ static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 		     type_to_string(tmpctx, struct node_id, &destination),
 		     type_to_string(tmpctx, struct amount_msat, &msat));
 
+	/* We snapshot the graph as it is now, and let a worker search it. */
+	if (daemon->route_workers) {
+		struct route_query rq;
+
+		if (route_query_init(tmpctx, &rq, daemon->rstate,
+				     source, &destination,
+				     msat, riskfactor_by_million / 1000000.0,
+				     final_cltv, fuzz, pseudorand_u64(),
+				     excluded, max_hops))
+			route_workers_submit(daemon->route_workers, &rq,
+					     getroute_done, daemon);
+		else
+			route_workers_submit(daemon->route_workers, NULL,
+					     getroute_done, daemon);
+		return daemon_conn_read_next(conn, daemon->master);
+	}
+
 	/* routing.c does all the hard work; can return NULL. */
 	hops = get_route(tmpctx, daemon->rstate, source, &destination,
 			 msat, riskfactor_by_million / 1000000.0, final_cltv,
@@ -2185,12 +2598,66 @@ static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 	return daemon_conn_read_next(conn, daemon->master);
 }
 
+/*~ The pay plugin wants something to fall back on if a route fails, without
+ * coming back and asking us every time.  Each search depends on the routes
+ * found before it, so these don't go to route_workers; the reply is a
+ * different message, so it doesn't matter if it overtakes getroute replies. */
+static struct io_plan *getroutes_req(struct io_conn *conn,
+				     struct daemon *daemon,
+				     const u8 *msg)
+{
+	struct node_id *source, destination;
+	struct amount_msat msat;
+	u32 final_cltv;
+	u64 riskfactor_by_million;
+	u32 max_hops;
+	u16 num_routes;
+	double fuzz;
+	struct short_channel_id_dir *excluded;
+	struct route_hop **routes, *hops;
+	u16 *route_lens;
+
+	if (!fromwire_gossip_getroutes_request(msg, msg,
+					       &source, &destination,
+					       &msat, &riskfactor_by_million,
+					       &final_cltv, &fuzz,
+					       &excluded,
+					       &max_hops, &num_routes))
+		master_badmsg(WIRE_GOSSIP_GETROUTES_REQUEST, msg);
+
+	status_trace("Trying to find %u routes from %s to %s for %s",
+		     num_routes,
+		     source
+		     ? type_to_string(tmpctx, struct node_id, source) : "(me)",
+		     type_to_string(tmpctx, struct node_id, &destination),
+		     type_to_string(tmpctx, struct amount_msat, &msat));
+
+	routes = get_routes(tmpctx, daemon->rstate, source, &destination,
+			    msat, riskfactor_by_million / 1000000.0,
+			    final_cltv, fuzz, pseudorand_u64(), excluded,
+			    max_hops, num_routes);
+
+	/* We can't nest arrays on the wire, so they go end to end. */
+	route_lens = tal_arr(tmpctx, u16, tal_count(routes));
+	hops = tal_arr(tmpctx, struct route_hop, 0);
+	for (size_t i = 0; i < tal_count(routes); i++) {
+		route_lens[i] = tal_count(routes[i]);
+		for (size_t j = 0; j < tal_count(routes[i]); j++)
+			tal_arr_expand(&hops, routes[i][j]);
+	}
+
+	msg = towire_gossip_getroutes_reply(NULL, route_lens, hops);
+	daemon_conn_send(daemon->master, take(msg));
+	return daemon_conn_read_next(conn, daemon->master);
+}
+
 /*~ When someone asks lightningd to `listchannels`, gossipd does the work:
  * marshalling the channel information for all channels into an array of
  * gossip_getchannels_entry, which lightningd converts to JSON.  Each channel
  * is represented by two half_chan; one in each direction.
  */
 static struct gossip_halfchannel_entry *hc_entry(const tal_t *ctx,
+						 const struct routing_state *rstate,
 						 const struct chan *chan,
 						 int idx)
 {
@@ -2214,8 +2681,8 @@ static struct gossip_halfchannel_entry *hc_entry(const tal_t *ctx,
 	e->base_fee_msat = c->base_fee;
 	e->fee_per_millionth = c->proportional_fee;
 	e->delay = c->delay;
-	e->min = c->htlc_minimum;
-	e->max = c->htlc_maximum;
+	e->min = half_chan_htlc_minimum(rstate, chan, idx);
+	e->max = half_chan_htlc_maximum(rstate, chan, idx);
 
 	return e;
 }
@@ -2235,11 +2702,11 @@ static void append_channel(struct routing_state *rstate,
 	e->public = is_chan_public(chan);
 	e->short_channel_id = chan->scid;
 	if (!srcfilter || node_id_eq(&e->node[0], srcfilter))
-		e->e[0] = hc_entry(*entries, chan, 0);
+		e->e[0] = hc_entry(*entries, rstate, chan, 0);
 	else
 		e->e[0] = NULL;
 	if (!srcfilter || node_id_eq(&e->node[1], srcfilter))
-		e->e[1] = hc_entry(*entries, chan, 1);
+		e->e[1] = hc_entry(*entries, rstate, chan, 1);
 	else
 		e->e[1] = NULL;
 
@@ -2250,7 +2717,8 @@ static void append_channel(struct routing_state *rstate,
 		tal_arr_expand(entries, e);
 }
 
-/*~ This is where lightningd asks for all channels we know about. */
+/*~ This is where lightningd asks for all channels we know about.  It asks
+ * for them a chunk at a time, so neither of us ever holds them all. */
 static struct io_plan *getchannels_req(struct io_conn *conn,
 				       struct daemon *daemon,
 				       const u8 *msg)
@@ -2258,13 +2726,14 @@ static struct io_plan *getchannels_req(struct io_conn *conn,
 	u8 *out;
 	const struct gossip_getchannels_entry **entries;
 	struct chan *chan;
-	struct short_channel_id *scid, *prev;
+	struct short_channel_id *scid, *start;
+	const struct short_channel_id *next = NULL;
 	struct node_id *source;
-	bool complete = true;
+	u32 limit;
 
 	/* Note: scid is marked optional in gossip_wire.csv */
 	if (!fromwire_gossip_getchannels_request(msg, msg, &scid, &source,
-						 &prev))
+						 &start, &limit))
 		master_badmsg(WIRE_GOSSIP_GETCHANNELS_REQUEST, msg);
 
 	entries = tal_arr(tmpctx, const struct gossip_getchannels_entry *, 0);
@@ -2287,21 +2756,24 @@ static struct io_plan *getchannels_req(struct io_conn *conn,
 	} else {
 		u64 idx;
 
+		/* Limit how many we do at once. */
+		if (limit > GETCHANNELS_CHUNK)
+			limit = GETCHANNELS_CHUNK;
+
 		/* For the more general case, we just iterate through every
-		 * short channel id, starting with previous if any (there is
+		 * short channel id, starting with start if any (there is
 		 * no scid 0). */
-		idx = prev ? prev->u64 : 0;
+		idx = start && start->u64 ? start->u64 - 1 : 0;
 		while ((chan = uintmap_after(&daemon->rstate->chanmap, &idx))) {
-			append_channel(daemon->rstate, &entries, chan, NULL);
-			/* Limit how many we do at once. */
-			if (tal_count(entries) == 4096) {
-				complete = false;
+			if (tal_count(entries) == limit) {
+				next = &chan->scid;
 				break;
 			}
+			append_channel(daemon->rstate, &entries, chan, NULL);
 		}
 	}
 
-	out = towire_gossip_getchannels_reply(NULL, complete, entries);
+	out = towire_gossip_getchannels_reply(NULL, next, entries);
 	daemon_conn_send(daemon->master, take(out));
 	return daemon_conn_read_next(conn, daemon->master);
 }
@@ -2327,7 +2799,8 @@ static void add_node_entry(const tal_t *ctx,
 	}
 }
 
-/* Simply routine when they ask for `listnodes` */
+/* Simply routine when they ask for `listnodes`: like channels, they ask for
+ * all of them a chunk at a time, in order of id. */
 static struct io_plan *getnodes(struct io_conn *conn, struct daemon *daemon,
 				const u8 *msg)
 {
@@ -2335,9 +2808,11 @@ static struct io_plan *getnodes(struct io_conn *conn, struct daemon *daemon,
 	struct node *n;
 	const struct gossip_getnodes_entry **nodes;
 	struct gossip_getnodes_entry *node_arr;
-	struct node_id *id;
+	struct node_id *id, *start;
+	const struct node_id *next = NULL;
+	u32 limit;
 
-	if (!fromwire_gossip_getnodes_request(tmpctx, msg, &id))
+	if (!fromwire_gossip_getnodes_request(tmpctx, msg, &id, &start, &limit))
 		master_badmsg(WIRE_GOSSIP_GETNODES_REQUEST, msg);
 
 	/* Format of reply is the same whether they ask for a specific node
@@ -2354,16 +2829,24 @@ static struct io_plan *getnodes(struct io_conn *conn, struct daemon *daemon,
 			node_arr = NULL;
 		}
 	} else {
-		struct node_map_iter it;
-		size_t i = 0;
-		node_arr = tal_arr(tmpctx, struct gossip_getnodes_entry,
-				   daemon->rstate->nodes->raw.elems);
-		n = node_map_first(daemon->rstate->nodes, &it);
-		while (n != NULL) {
-			add_node_entry(node_arr, daemon, n, &node_arr[i++]);
-			n = node_map_next(daemon->rstate->nodes, &it);
+		struct node **sorted;
+		size_t i, first, num;
+
+		sorted = routing_nodes_by_id(daemon->rstate);
+		first = start ? routing_nodes_from(sorted, start) : 0;
+
+		if (limit > GETNODES_CHUNK)
+			limit = GETNODES_CHUNK;
+		num = tal_count(sorted) - first;
+		if (num > limit) {
+			num = limit;
+			next = &sorted[first + num]->id;
 		}
-		assert(i == daemon->rstate->nodes->raw.elems);
+
+		node_arr = tal_arr(tmpctx, struct gossip_getnodes_entry, num);
+		for (i = 0; i < num; i++)
+			add_node_entry(node_arr, daemon, sorted[first + i],
+				       &node_arr[i]);
 	}
 
 	/* FIXME: towire wants array of pointers. */
@@ -2371,7 +2854,7 @@ static struct io_plan *getnodes(struct io_conn *conn, struct daemon *daemon,
 			tal_count(node_arr));
 	for (size_t i = 0; i < tal_count(node_arr); i++)
 		nodes[i] = &node_arr[i];
-	out = towire_gossip_getnodes_reply(NULL, nodes);
+	out = towire_gossip_getnodes_reply(NULL, next, nodes);
 	daemon_conn_send(daemon->master, take(out));
 	return daemon_conn_read_next(conn, daemon->master);
 }
@@ -2529,6 +3012,96 @@ static struct io_plan *get_incoming_channels(struct io_conn *conn,
 	return daemon_conn_read_next(conn, daemon->master);
 }
 
+/*~ So we can tell if the route cache is worth its memory. */
+static struct io_plan *route_cache_stats_req(struct io_conn *conn,
+					     struct daemon *daemon,
+					     const u8 *msg)
+{
+	struct route_cache_stats stats;
+
+	if (!fromwire_gossip_route_cache_stats(msg))
+		master_badmsg(WIRE_GOSSIP_ROUTE_CACHE_STATS, msg);
+
+	if (daemon->rstate->route_cache)
+		stats = *route_cache_stats(daemon->rstate->route_cache);
+	else
+		memset(&stats, 0, sizeof(stats));
+
+	msg = towire_gossip_route_cache_stats_reply(NULL,
+						    stats.hits,
+						    stats.misses,
+						    stats.invalidations,
+						    stats.evictions,
+						    stats.entries,
+						    stats.max_entries);
+	daemon_conn_send(daemon->master, take(msg));
+	return daemon_conn_read_next(conn, daemon->master);
+}
+
+/*~ So we can tell if --gossip-verify-threads is keeping up. */
+static struct io_plan *verify_stats_req(struct io_conn *conn,
+					struct daemon *daemon,
+					const u8 *msg)
+{
+	struct sig_workers_stats stats;
+
+	if (!fromwire_gossip_verify_stats(msg))
+		master_badmsg(WIRE_GOSSIP_VERIFY_STATS, msg);
+
+	if (daemon->sig_workers)
+		stats = *sig_workers_stats(daemon->sig_workers);
+	else
+		memset(&stats, 0, sizeof(stats));
+
+	msg = towire_gossip_verify_stats_reply(NULL,
+					       stats.submitted,
+					       stats.checked,
+					       stats.failed,
+					       stats.queued,
+					       stats.max_queued,
+					       stats.verify_nsec);
+	daemon_conn_send(daemon->master, take(msg));
+	return daemon_conn_read_next(conn, daemon->master);
+}
+
+/*~ So we can tell which peers are flooding us, or sending us junk. */
+static struct io_plan *peer_stats_req(struct io_conn *conn,
+				      struct daemon *daemon,
+				      const u8 *msg)
+{
+	struct node_id *ids;
+	u64 *accepted, *suppressed, *invalid;
+	struct peer *peer;
+	size_t i;
+
+	if (!fromwire_gossip_peer_stats(msg))
+		master_badmsg(WIRE_GOSSIP_PEER_STATS, msg);
+
+	i = 0;
+	list_for_each(&daemon->peers, peer, list)
+		i++;
+
+	ids = tal_arr(tmpctx, struct node_id, i);
+	accepted = tal_arr(tmpctx, u64, i);
+	suppressed = tal_arr(tmpctx, u64, i);
+	invalid = tal_arr(tmpctx, u64, i);
+
+	i = 0;
+	list_for_each(&daemon->peers, peer, list) {
+		ids[i] = peer->id;
+		accepted[i] = peer->gossip_accepted;
+		suppressed[i] = peer->gossip_suppressed;
+		invalid[i] = peer->gossip_invalid;
+		i++;
+	}
+
+	msg = towire_gossip_peer_stats_reply(NULL, ids, accepted, suppressed,
+					     invalid,
+					     routing_num_suppressed(daemon->rstate));
+	daemon_conn_send(daemon->master, take(msg));
+	return daemon_conn_read_next(conn, daemon->master);
+}
+
 #if DEVELOPER
 static struct io_plan *query_scids_req(struct io_conn *conn,
 				       struct daemon *daemon,
@@ -2671,6 +3244,10 @@ static struct io_plan *dev_set_max_scids_encode_size(struct io_conn *conn,
 							   &max_scids_encode_bytes))
 		master_badmsg(WIRE_GOSSIP_DEV_SET_MAX_SCIDS_ENCODE_SIZE, msg);
 
+	/* What we remembered was encoded with the old limit. */
+	tal_free(daemon->rstate->range_cache);
+	daemon->rstate->range_cache = range_cache_new(daemon->rstate);
+
 	status_trace("Set max_scids_encode_bytes to %u", max_scids_encode_bytes);
 	return daemon_conn_read_next(conn, daemon->master);
 }
@@ -2700,6 +3277,7 @@ static struct io_plan *dev_gossip_memleak(struct io_conn *conn,
 	/* Now delete daemon and those which it has pointers to. */
 	memleak_remove_referenced(memtable, daemon);
 	memleak_remove_routing_tables(memtable, daemon->rstate);
+	log_routing_memory(daemon->rstate);
 
 	found_leak = dump_memleak(memtable);
 	daemon_conn_send(daemon->master,
@@ -2753,21 +3331,16 @@ static struct io_plan *get_channel_peer(struct io_conn *conn,
 
 /*~ We queue incoming channel_announcement pending confirmation from lightningd
  * that it really is an unspent output.  Here's its reply. */
-static struct io_plan *handle_txout_reply(struct io_conn *conn,
-					  struct daemon *daemon, const u8 *msg)
+static void handle_txout(struct daemon *daemon,
+			 const struct gossip_txout *txout)
 {
-	struct short_channel_id scid;
-	u8 *outscript;
-	struct amount_sat sat;
 	bool was_unknown;
 
-	if (!fromwire_gossip_get_txout_reply(msg, msg, &scid, &sat, &outscript))
-		master_badmsg(WIRE_GOSSIP_GET_TXOUT_REPLY, msg);
-
 	/* Were we looking specifically for this? */
 	was_unknown = false;
 	for (size_t i = 0; i < tal_count(daemon->unknown_scids); i++) {
-		if (short_channel_id_eq(&daemon->unknown_scids[i], &scid)) {
+		if (short_channel_id_eq(&daemon->unknown_scids[i],
+					&txout->scid)) {
 			was_unknown = true;
 			tal_arr_remove(&daemon->unknown_scids, i);
 			break;
@@ -2775,11 +3348,25 @@ static struct io_plan *handle_txout_reply(struct io_conn *conn,
 	}
 
 	/* Outscript is NULL if it's not an unspent output */
-	if (handle_pending_cannouncement(daemon->rstate, &scid, sat, outscript)
+	if (handle_pending_cannouncement(daemon->rstate, &txout->scid,
+					 txout->sat, txout->outscript)
 	    && was_unknown) {
 		/* It was real: we're missing gossip. */
 		gossip_missing(daemon);
 	}
+}
+
+static struct io_plan *handle_txouts_reply(struct io_conn *conn,
+					   struct daemon *daemon,
+					   const u8 *msg)
+{
+	struct gossip_txout **txouts;
+
+	if (!fromwire_gossip_get_txouts_reply(msg, msg, &txouts))
+		master_badmsg(WIRE_GOSSIP_GET_TXOUTS_REPLY, msg);
+
+	for (size_t i = 0; i < tal_count(txouts); i++)
+		handle_txout(daemon, txouts[i]);
 
 	/* Anywhere we might have announced a channel, we check if it's time to
 	 * announce ourselves (ie. if we just announced our own first channel) */
@@ -2951,14 +3538,17 @@ static struct io_plan *recv_req(struct io_conn *conn,
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
 		return getroute_req(conn, daemon, msg);
 
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
+		return getroutes_req(conn, daemon, msg);
+
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 		return getchannels_req(conn, daemon, msg);
 
 	case WIRE_GOSSIP_GET_CHANNEL_PEER:
 		return get_channel_peer(conn, daemon, msg);
 
-	case WIRE_GOSSIP_GET_TXOUT_REPLY:
-		return handle_txout_reply(conn, daemon, msg);
+	case WIRE_GOSSIP_GET_TXOUTS_REPLY:
+		return handle_txouts_reply(conn, daemon, msg);
 
 	case WIRE_GOSSIP_PAYMENT_FAILURE:
 		return handle_payment_failure(conn, daemon, msg);
@@ -2975,6 +3565,15 @@ static struct io_plan *recv_req(struct io_conn *conn,
 	case WIRE_GOSSIP_GET_INCOMING_CHANNELS:
 		return get_incoming_channels(conn, daemon, msg);
 
+	case WIRE_GOSSIP_ROUTE_CACHE_STATS:
+		return route_cache_stats_req(conn, daemon, msg);
+
+	case WIRE_GOSSIP_VERIFY_STATS:
+		return verify_stats_req(conn, daemon, msg);
+
+	case WIRE_GOSSIP_PEER_STATS:
+		return peer_stats_req(conn, daemon, msg);
+
 #if DEVELOPER
 	case WIRE_GOSSIP_QUERY_SCIDS:
 		return query_scids_req(conn, daemon, msg);
@@ -3007,15 +3606,19 @@ static struct io_plan *recv_req(struct io_conn *conn,
 	/* We send these, we don't receive them */
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_PING_REPLY:
 	case WIRE_GOSSIP_SCIDS_REPLY:
 	case WIRE_GOSSIP_QUERY_CHANNEL_RANGE_REPLY:
 	case WIRE_GOSSIP_GET_CHANNEL_PEER_REPLY:
 	case WIRE_GOSSIP_GET_INCOMING_CHANNELS_REPLY:
-	case WIRE_GOSSIP_GET_TXOUT:
+	case WIRE_GOSSIP_GET_TXOUTS:
 	case WIRE_GOSSIP_DEV_MEMLEAK_REPLY:
 	case WIRE_GOSSIP_DEV_COMPACT_STORE_REPLY:
+	case WIRE_GOSSIP_ROUTE_CACHE_STATS_REPLY:
+	case WIRE_GOSSIP_VERIFY_STATS_REPLY:
+	case WIRE_GOSSIP_PEER_STATS_REPLY:
 		break;
 	}
 
@@ -3025,9 +3628,13 @@ static struct io_plan *recv_req(struct io_conn *conn,
 }
 
 /* This is called when lightningd closes its connection to us.  We simply
- * exit. */
-static void master_gone(struct daemon_conn *master UNUSED)
+ * exit (but first write out an index of the gossip_store, if we keep one:
+ * this is a clean shutdown, so it'll be up-to-date next time). */
+static void master_gone(struct daemon_conn *master UNUSED,
+			struct daemon *daemon)
 {
+	if (daemon->rstate)
+		gossip_store_write_index(daemon->rstate->gs);
 	daemon_shutdown();
 	/* Can't tell master, it's gone. */
 	exit(2);
@@ -3045,6 +3652,12 @@ int main(int argc, char *argv[])
 	list_head_init(&daemon->peers);
 	daemon->unknown_scids = tal_arr(daemon, struct short_channel_id, 0);
 	daemon->gossip_missing = NULL;
+	daemon->txouts_to_ask = tal_arr(daemon, struct short_channel_id, 0);
+	daemon->txouts_timer = NULL;
+	daemon->route_workers = NULL;
+	daemon->sig_workers = NULL;
+	daemon->sig_workers_full = false;
+	daemon->rstate = NULL;
 
 	/* Note the use of time_mono() here.  That's a monotonic clock, which
 	 * is really useful: it can only be used to measure relative events
@@ -3056,7 +3669,7 @@ int main(int argc, char *argv[])
 	/* Our daemons always use STDIN for commands from lightningd. */
 	daemon->master = daemon_conn_new(daemon, STDIN_FILENO,
 					 recv_req, NULL, daemon);
-	tal_add_destructor(daemon->master, master_gone);
+	tal_add_destructor2(daemon->master, master_gone, daemon);
 
 	status_setup_async(daemon->master);
 
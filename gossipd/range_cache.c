@@ -0,0 +1,158 @@
+#include "range_cache.h"
+#include <common/utils.h>
+#include <string.h>
+
+/* Channels come and go in a block's worth of gossip at a time, so we
+ * count changes per bucket of blocks rather than per block. */
+#define RANGE_CACHE_BUCKET_SHIFT 10
+
+/* Peers ask for the same few ranges (everything, or the last few days),
+ * and our replies split those in the same places, so this is plenty. */
+#define RANGE_CACHE_MAX_ENTRIES 1024
+
+struct range_entry {
+	/* What was asked for (what we actually used can differ) */
+	enum scid_encode_types type;
+	u32 first_blocknum, number_of_blocks;
+	size_t max_bytes;
+	/* Sums of rc->added[] and rc->removed[] over our buckets when we
+	 * were encoded: since those only go up, if either is different,
+	 * something changed. */
+	u64 added, removed;
+	/* NULL if it didn't fit */
+	u8 *encoded;
+};
+
+struct range_cache {
+	/* How many channels have come and gone, per bucket of blocks */
+	u32 *added, *removed;
+	struct range_entry *entries;
+	struct range_cache_stats stats;
+};
+
+struct range_cache *range_cache_new(const tal_t *ctx)
+{
+	struct range_cache *rc = tal(ctx, struct range_cache);
+
+	rc->added = tal_arr(rc, u32, 0);
+	rc->removed = tal_arr(rc, u32, 0);
+	rc->entries = tal_arr(rc, struct range_entry, 0);
+	memset(&rc->stats, 0, sizeof(rc->stats));
+	return rc;
+}
+
+static u64 range_changes(const u32 *changes,
+			 u32 first_blocknum, u32 number_of_blocks)
+{
+	u64 last = ((u64)first_blocknum + number_of_blocks - 1)
+		>> RANGE_CACHE_BUCKET_SHIFT;
+	u64 sum = 0;
+
+	/* Nothing has changed in buckets we don't have yet. */
+	if (tal_count(changes) == 0)
+		return 0;
+	if (last >= tal_count(changes))
+		last = tal_count(changes) - 1;
+	for (u64 b = first_blocknum >> RANGE_CACHE_BUCKET_SHIFT; b <= last; b++)
+		sum += changes[b];
+	return sum;
+}
+
+static void del_entry(struct range_cache *rc, size_t i)
+{
+	size_t n = tal_count(rc->entries);
+
+	tal_free(rc->entries[i].encoded);
+	rc->entries[i] = rc->entries[n - 1];
+	tal_resize(&rc->entries, n - 1);
+	rc->stats.entries--;
+}
+
+bool range_cache_get(struct range_cache *rc,
+		     enum scid_encode_types type,
+		     u32 first_blocknum, u32 number_of_blocks,
+		     size_t max_bytes, const u8 **encoded)
+{
+	for (size_t i = 0; i < tal_count(rc->entries); i++) {
+		const struct range_entry *e = &rc->entries[i];
+
+		if (e->type != type
+		    || e->first_blocknum != first_blocknum
+		    || e->number_of_blocks != number_of_blocks
+		    || e->max_bytes != max_bytes)
+			continue;
+
+		/* If it didn't fit, more channels won't help: the split
+		 * replies are still correct, even if they're no longer
+		 * all full. */
+		if ((e->encoded
+		     && e->added != range_changes(rc->added, first_blocknum,
+						  number_of_blocks))
+		    || e->removed != range_changes(rc->removed, first_blocknum,
+						   number_of_blocks)) {
+			rc->stats.invalidations++;
+			del_entry(rc, i);
+			break;
+		}
+		rc->stats.hits++;
+		*encoded = e->encoded;
+		return true;
+	}
+	rc->stats.misses++;
+	return false;
+}
+
+void range_cache_add(struct range_cache *rc,
+		     enum scid_encode_types type,
+		     u32 first_blocknum, u32 number_of_blocks,
+		     size_t max_bytes, const u8 *encoded)
+{
+	struct range_entry e;
+
+	/* They're cheap enough to recreate that we don't bother with LRU */
+	if (tal_count(rc->entries) == RANGE_CACHE_MAX_ENTRIES) {
+		for (size_t i = 0; i < tal_count(rc->entries); i++)
+			tal_free(rc->entries[i].encoded);
+		tal_resize(&rc->entries, 0);
+		rc->stats.entries = 0;
+	}
+
+	e.type = type;
+	e.first_blocknum = first_blocknum;
+	e.number_of_blocks = number_of_blocks;
+	e.max_bytes = max_bytes;
+	e.added = range_changes(rc->added, first_blocknum, number_of_blocks);
+	e.removed = range_changes(rc->removed, first_blocknum,
+				  number_of_blocks);
+	e.encoded = encoded ? tal_dup_arr(rc, u8, encoded, tal_count(encoded), 0)
+		: NULL;
+	tal_arr_expand(&rc->entries, e);
+	rc->stats.entries++;
+}
+
+static void count_change(u32 **changes, u32 blocknum)
+{
+	size_t bucket = blocknum >> RANGE_CACHE_BUCKET_SHIFT;
+	size_t n = tal_count(*changes);
+
+	if (bucket >= n) {
+		tal_resize(changes, bucket + 1);
+		memset(*changes + n, 0, (bucket + 1 - n) * sizeof(u32));
+	}
+	(*changes)[bucket]++;
+}
+
+void range_cache_chan_added(struct range_cache *rc, u32 blocknum)
+{
+	count_change(&rc->added, blocknum);
+}
+
+void range_cache_chan_removed(struct range_cache *rc, u32 blocknum)
+{
+	count_change(&rc->removed, blocknum);
+}
+
+const struct range_cache_stats *range_cache_stats(const struct range_cache *rc)
+{
+	return &rc->stats;
+}
@@ -0,0 +1,42 @@
+#ifndef LIGHTNING_GOSSIPD_RANGE_CACHE_H
+#define LIGHTNING_GOSSIPD_RANGE_CACHE_H
+#include "config.h"
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <common/decode_short_channel_ids.h>
+
+/* Remembers the encoded_short_ids we sent in reply_channel_range, so the
+ * next peer to ask about the same blocks doesn't make us walk the chanmap
+ * and compress it all again. */
+struct range_cache;
+
+struct range_cache_stats {
+	u64 hits, misses;
+	/* Entries found stale because a channel in their blocks came or went */
+	u64 invalidations;
+	u32 entries;
+};
+
+struct range_cache *range_cache_new(const tal_t *ctx);
+
+/* Did we encode blocks @first_blocknum to @first_blocknum +
+ * @number_of_blocks - 1 (as @type, into at most @max_bytes) since any
+ * channel in them changed?  If so, *encoded is set: NULL means they didn't
+ * fit. */
+bool range_cache_get(struct range_cache *rc,
+		     enum scid_encode_types type,
+		     u32 first_blocknum, u32 number_of_blocks,
+		     size_t max_bytes, const u8 **encoded);
+
+/* This is what those blocks encode to (NULL if it didn't fit).  Copied. */
+void range_cache_add(struct range_cache *rc,
+		     enum scid_encode_types type,
+		     u32 first_blocknum, u32 number_of_blocks,
+		     size_t max_bytes, const u8 *encoded);
+
+/* A channel in this block was added, or removed. */
+void range_cache_chan_added(struct range_cache *rc, u32 blocknum);
+void range_cache_chan_removed(struct range_cache *rc, u32 blocknum);
+
+const struct range_cache_stats *range_cache_stats(const struct range_cache *rc);
+#endif /* LIGHTNING_GOSSIPD_RANGE_CACHE_H */
@@ -0,0 +1,281 @@
+#include "route_cache.h"
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/htable/htable_type.h>
+#include <ccan/ilog/ilog.h>
+#include <ccan/intmap/intmap.h>
+#include <ccan/list/list.h>
+#include <common/memleak.h>
+#include <common/pseudorand.h>
+#include <gossipd/routing.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each channel of a cached route is on the list for that channel. */
+struct route_cache_link {
+	struct list_node list;
+	struct route_cache_entry *entry;
+};
+
+struct route_cache_entry {
+	/* In rc->lru */
+	struct list_node lru;
+	struct route_cache_key *key;
+	struct short_channel_id_dir *route;
+	/* One for each of route[]. */
+	struct route_cache_link *links;
+};
+
+static const struct route_cache_key *
+entry_key(const struct route_cache_entry *e)
+{
+	return e->key;
+}
+
+static size_t key_hash(const struct route_cache_key *key)
+{
+	struct siphash24_ctx ctx;
+
+	/* Field by field: excluded[] has padding. */
+	siphash24_init(&ctx, siphash_seed());
+	siphash24_update(&ctx, &key->from_us, sizeof(key->from_us));
+	siphash24_update(&ctx, &key->source, sizeof(key->source));
+	siphash24_update(&ctx, &key->destination, sizeof(key->destination));
+	siphash24_update(&ctx, &key->amount_bucket, sizeof(key->amount_bucket));
+	siphash24_update(&ctx, &key->riskfactor, sizeof(key->riskfactor));
+	siphash24_update(&ctx, &key->fuzz, sizeof(key->fuzz));
+	siphash24_update(&ctx, &key->max_hops, sizeof(key->max_hops));
+	for (size_t i = 0; i < tal_count(key->excluded); i++) {
+		siphash24_update(&ctx, &key->excluded[i].scid,
+				 sizeof(key->excluded[i].scid));
+		siphash24_update(&ctx, &key->excluded[i].dir,
+				 sizeof(key->excluded[i].dir));
+	}
+	return siphash24_done(&ctx);
+}
+
+static bool entry_eq_key(const struct route_cache_entry *e,
+			 const struct route_cache_key *key)
+{
+	const struct route_cache_key *k = e->key;
+
+	if (k->from_us != key->from_us
+	    || !node_id_eq(&k->source, &key->source)
+	    || !node_id_eq(&k->destination, &key->destination)
+	    || k->amount_bucket != key->amount_bucket
+	    || k->riskfactor != key->riskfactor
+	    || k->fuzz != key->fuzz
+	    || k->max_hops != key->max_hops
+	    || tal_count(k->excluded) != tal_count(key->excluded))
+		return false;
+
+	for (size_t i = 0; i < tal_count(k->excluded); i++) {
+		if (!short_channel_id_eq(&k->excluded[i].scid,
+					 &key->excluded[i].scid)
+		    || k->excluded[i].dir != key->excluded[i].dir)
+			return false;
+	}
+	return true;
+}
+
+HTABLE_DEFINE_TYPE(struct route_cache_entry, entry_key, key_hash,
+		   entry_eq_key, route_cache_map);
+
+struct route_cache {
+	struct route_cache_map map;
+	/* Most recently used first. */
+	struct list_head lru;
+	/* Lists of route_cache_link, by short_channel_id. */
+	UINTMAP(struct list_head *) by_chan;
+	size_t max_entries;
+	struct route_cache_stats stats;
+};
+
+static void destroy_route_cache(struct route_cache *rc)
+{
+	route_cache_map_clear(&rc->map);
+}
+
+struct route_cache *route_cache_new(const tal_t *ctx, size_t max_entries)
+{
+	struct route_cache *rc = tal(ctx, struct route_cache);
+
+	route_cache_map_init(&rc->map);
+	list_head_init(&rc->lru);
+	uintmap_init(&rc->by_chan);
+	rc->max_entries = max_entries;
+	memset(&rc->stats, 0, sizeof(rc->stats));
+	rc->stats.max_entries = max_entries;
+	tal_add_destructor(rc, destroy_route_cache);
+	return rc;
+}
+
+static int scidd_cmp(const void *a, const void *b)
+{
+	const struct short_channel_id_dir *sa = a, *sb = b;
+
+	if (sa->scid.u64 != sb->scid.u64)
+		return sa->scid.u64 < sb->scid.u64 ? -1 : 1;
+	return sa->dir - sb->dir;
+}
+
+struct route_cache_key *route_cache_key_new(const tal_t *ctx,
+					    const struct node_id *source,
+					    const struct node_id *destination,
+					    struct amount_msat msat,
+					    double riskfactor,
+					    double fuzz,
+					    const struct short_channel_id_dir *excluded,
+					    u32 max_hops)
+{
+	struct route_cache_key *key = tal(ctx, struct route_cache_key);
+
+	key->from_us = (source == NULL);
+	if (source)
+		key->source = *source;
+	else
+		memset(&key->source, 0, sizeof(key->source));
+	key->destination = *destination;
+	key->amount_bucket = ilog64(msat.millisatoshis); /* Raw: bucketing */
+	key->riskfactor = riskfactor;
+	key->fuzz = fuzz;
+	key->max_hops = max_hops;
+	key->excluded = tal_dup_arr(key, struct short_channel_id_dir,
+				    excluded, tal_count(excluded), 0);
+	qsort(key->excluded, tal_count(key->excluded),
+	      sizeof(key->excluded[0]), scidd_cmp);
+	return key;
+}
+
+static struct route_cache_key *key_dup(const tal_t *ctx,
+				       const struct route_cache_key *key)
+{
+	struct route_cache_key *dup = tal_dup(ctx, struct route_cache_key, key);
+
+	dup->excluded = tal_dup_arr(dup, struct short_channel_id_dir,
+				    key->excluded, tal_count(key->excluded), 0);
+	return dup;
+}
+
+static void remove_entry(struct route_cache *rc, struct route_cache_entry *e)
+{
+	list_del_from(&rc->lru, &e->lru);
+	route_cache_map_del(&rc->map, e);
+
+	for (size_t i = 0; i < tal_count(e->links); i++) {
+		u64 scid = e->route[i].scid.u64;
+		struct list_head *head = uintmap_get(&rc->by_chan, scid);
+
+		list_del_from(head, &e->links[i].list);
+		if (list_empty(head)) {
+			uintmap_del(&rc->by_chan, scid);
+			tal_free(head);
+		}
+	}
+	tal_free(e);
+	rc->stats.entries--;
+}
+
+const struct short_channel_id_dir *route_cache_get(struct route_cache *rc,
+						   const struct route_cache_key *key)
+{
+	struct route_cache_entry *e = route_cache_map_get(&rc->map, key);
+
+	if (!e) {
+		rc->stats.misses++;
+		return NULL;
+	}
+
+	rc->stats.hits++;
+	list_del_from(&rc->lru, &e->lru);
+	list_add(&rc->lru, &e->lru);
+	return e->route;
+}
+
+void route_cache_add(struct route_cache *rc,
+		     const struct route_cache_key *key,
+		     const struct route_hop *hops)
+{
+	struct route_cache_entry *e;
+
+	if (rc->max_entries == 0)
+		return;
+
+	/* Two requests may have been searching for it at once. */
+	e = route_cache_map_get(&rc->map, key);
+	if (e)
+		remove_entry(rc, e);
+
+	if (rc->stats.entries == rc->max_entries) {
+		remove_entry(rc, list_tail(&rc->lru, struct route_cache_entry,
+					   lru));
+		rc->stats.evictions++;
+	}
+
+	e = tal(rc, struct route_cache_entry);
+	e->key = key_dup(e, key);
+	e->route = tal_arr(e, struct short_channel_id_dir, tal_count(hops));
+	e->links = tal_arr(e, struct route_cache_link, tal_count(hops));
+	for (size_t i = 0; i < tal_count(hops); i++) {
+		struct list_head *head;
+
+		e->route[i].scid = hops[i].channel_id;
+		e->route[i].dir = hops[i].direction;
+
+		head = uintmap_get(&rc->by_chan, hops[i].channel_id.u64);
+		if (!head) {
+			head = tal(rc, struct list_head);
+			list_head_init(head);
+			uintmap_add(&rc->by_chan, hops[i].channel_id.u64, head);
+		}
+		e->links[i].entry = e;
+		list_add(head, &e->links[i].list);
+	}
+
+	route_cache_map_add(&rc->map, e);
+	list_add(&rc->lru, &e->lru);
+	rc->stats.entries++;
+}
+
+void route_cache_forget(struct route_cache *rc,
+			const struct route_cache_key *key)
+{
+	struct route_cache_entry *e = route_cache_map_get(&rc->map, key);
+
+	if (!e)
+		return;
+
+	/* We counted it as a hit, but it wasn't. */
+	rc->stats.hits--;
+	rc->stats.misses++;
+	rc->stats.invalidations++;
+	remove_entry(rc, e);
+}
+
+void route_cache_chan_changed(struct route_cache *rc,
+			      const struct short_channel_id *scid)
+{
+	struct list_head *head;
+
+	/* The list goes away with the last route on it. */
+	while ((head = uintmap_get(&rc->by_chan, scid->u64)) != NULL) {
+		struct route_cache_link *link;
+
+		link = list_top(head, struct route_cache_link, list);
+		remove_entry(rc, link->entry);
+		rc->stats.invalidations++;
+	}
+}
+
+const struct route_cache_stats *route_cache_stats(const struct route_cache *rc)
+{
+	return &rc->stats;
+}
+
+#if DEVELOPER
+void memleak_remove_route_cache(struct htable *memtable,
+				const struct route_cache *rc)
+{
+	memleak_remove_htable(memtable, &rc->map.raw);
+	memleak_remove_uintmap(memtable, &rc->by_chan);
+}
+#endif /* DEVELOPER */
@@ -0,0 +1,78 @@
+#ifndef LIGHTNING_GOSSIPD_ROUTE_CACHE_H
+#define LIGHTNING_GOSSIPD_ROUTE_CACHE_H
+#include "config.h"
+#include <bitcoin/short_channel_id.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <common/amount.h>
+#include <common/node_id.h>
+
+struct htable;
+struct route_hop;
+
+/* What a route was asked for: requests with the same key share a route. */
+struct route_cache_key {
+	/* We pay no fee on the first hop of our own routes. */
+	bool from_us;
+	/* Zero if from_us. */
+	struct node_id source;
+	struct node_id destination;
+	/* Amounts within a factor of two are close enough. */
+	u32 amount_bucket;
+	double riskfactor;
+	/* Not the seed: that's random per payment, and a route fuzzed this
+	 * much with another seed is just as good. */
+	double fuzz;
+	u32 max_hops;
+	/* Sorted, so the order they were given in doesn't matter. */
+	struct short_channel_id_dir *excluded;
+};
+
+struct route_cache_stats {
+	u64 hits, misses;
+	/* Routes dropped because a channel on them changed (or they turned
+	 * out to be unusable when we looked). */
+	u64 invalidations;
+	/* Routes dropped to make room for newer ones. */
+	u64 evictions;
+	u32 entries, max_entries;
+};
+
+/* Remembers up to @max_entries routes, dropping the least recently used. */
+struct route_cache *route_cache_new(const tal_t *ctx, size_t max_entries);
+
+/* @source is NULL for routes from us. */
+struct route_cache_key *route_cache_key_new(const tal_t *ctx,
+					    const struct node_id *source,
+					    const struct node_id *destination,
+					    struct amount_msat msat,
+					    double riskfactor,
+					    double fuzz,
+					    const struct short_channel_id_dir *excluded,
+					    u32 max_hops);
+
+/* Returns the channels of the route for @key (tal_count() of them), or
+ * NULL if we don't have one. */
+const struct short_channel_id_dir *route_cache_get(struct route_cache *rc,
+						   const struct route_cache_key *key);
+
+/* We found this route for @key (both are copied). */
+void route_cache_add(struct route_cache *rc,
+		     const struct route_cache_key *key,
+		     const struct route_hop *hops);
+
+/* The route route_cache_get() returned was no use after all. */
+void route_cache_forget(struct route_cache *rc,
+			const struct route_cache_key *key);
+
+/* This channel changed (or went away): drop every route using it. */
+void route_cache_chan_changed(struct route_cache *rc,
+			      const struct short_channel_id *scid);
+
+const struct route_cache_stats *route_cache_stats(const struct route_cache *rc);
+
+#if DEVELOPER
+void memleak_remove_route_cache(struct htable *memtable,
+				const struct route_cache *rc);
+#endif
+#endif /* LIGHTNING_GOSSIPD_ROUTE_CACHE_H */
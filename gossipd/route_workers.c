@@ -0,0 +1,270 @@
+#include "route_workers.h"
+#include <ccan/io/io.h>
+#include <ccan/list/list.h>
+#include <common/status.h>
+#include <common/utils.h>
+#include <errno.h>
+#include <gossipd/routing.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+/*~ Threads need some care: tal isn't thread-safe, nor is status_*().  So
+ * the main thread allocates everything a job needs up front, the worker
+ * searches using only its own (malloc'ed) snap_query, and copies the result
+ * and anything it wants logged into the job for the main thread to handle. */
+struct route_job {
+	/* In rw->jobs, in the order they were submitted (main thread only) */
+	struct list_node list;
+	/* In rw->todo, until a worker takes it (under rw->lock) */
+	struct list_node todo;
+
+	struct route_query rq;
+
+	/* Set by worker, under rw->lock */
+	bool done;
+	bool found;
+	/* Room for the longest route rq allows */
+	u32 *route;
+	size_t route_len;
+	struct snap_log log[SNAP_LOG_MAX];
+	size_t num_log;
+
+	void (*cb)(const struct route_hop *hops, void *arg);
+	void *arg;
+};
+
+struct route_worker {
+	struct route_workers *rw;
+	pthread_t thread;
+	/* Only this thread uses this. */
+	struct snap_query *q;
+};
+
+struct route_workers {
+	struct routing_state *rstate;
+
+	/* Protects todo, job->done/hops/log, wake_pending and shutdown */
+	pthread_mutex_t lock;
+	/* Signalled when something is added to todo, or on shutdown. */
+	pthread_cond_t cond;
+	struct list_head todo;
+	bool shutdown;
+
+	/* Every job not yet handed back to its caller. */
+	struct list_head jobs;
+
+	struct route_worker **workers;
+
+	/* A byte is written to (nonblocking) wake_fd[1] when a job is done,
+	 * unless one is already pending. */
+	int wake_fd[2];
+	bool wake_pending;
+	char wake_buf[64];
+	size_t wake_len;
+};
+
+/* Caller holds rw->lock.  There's only ever one byte in the pipe, so a
+ * burst of cache hits handed back by the main thread can't block it. */
+static void wake_main(struct route_workers *rw)
+{
+	if (rw->wake_pending)
+		return;
+	rw->wake_pending = true;
+	/* If this fails, main thread is gone anyway. */
+	if (write(rw->wake_fd[1], "", 1))
+		;
+}
+
+static void *route_worker_thread(void *arg)
+{
+	struct route_worker *w = arg;
+	struct route_workers *rw = w->rw;
+	sigset_t all;
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	pthread_mutex_lock(&rw->lock);
+	for (;;) {
+		struct route_job *job;
+		bool found;
+
+		while (!rw->shutdown
+		       && !(job = list_pop(&rw->todo, struct route_job, todo)))
+			pthread_cond_wait(&rw->cond, &rw->lock);
+		if (rw->shutdown)
+			break;
+		pthread_mutex_unlock(&rw->lock);
+
+		found = route_query_run(&job->rq, w->q);
+
+		pthread_mutex_lock(&rw->lock);
+		job->found = found;
+		if (found) {
+			job->route_len = w->q->route_len;
+			memcpy(job->route, w->q->route,
+			       sizeof(job->route[0]) * job->route_len);
+		}
+		job->num_log = w->q->num_log;
+		memcpy(job->log, w->q->log, sizeof(job->log[0]) * job->num_log);
+		job->done = true;
+		wake_main(rw);
+	}
+	pthread_mutex_unlock(&rw->lock);
+	return NULL;
+}
+
+/* Hand back finished jobs, in order: a later one may finish first. */
+static struct io_plan *jobs_done(struct io_conn *conn,
+				 struct route_workers *rw)
+{
+	struct route_job *job;
+	struct route_hop *hops;
+
+	/* Anything finished after this will wake us again. */
+	pthread_mutex_lock(&rw->lock);
+	rw->wake_pending = false;
+	pthread_mutex_unlock(&rw->lock);
+
+	for (;;) {
+		bool done;
+
+		job = list_top(&rw->jobs, struct route_job, list);
+		if (!job)
+			break;
+
+		pthread_mutex_lock(&rw->lock);
+		done = job->done;
+		pthread_mutex_unlock(&rw->lock);
+		if (!done)
+			break;
+
+		list_del_from(&rw->jobs, &job->list);
+		snap_query_flush_log(job->log, job->num_log);
+		if (job->rq.snap && job->rq.hops)
+			hops = job->rq.hops;
+		else if (job->found)
+			hops = route_query_hops(tmpctx, rw->rstate, &job->rq,
+						job->route, job->route_len);
+		else
+			hops = NULL;
+		if (job->rq.snap)
+			route_query_done(rw->rstate, &job->rq);
+		job->cb(hops, job->arg);
+		tal_free(job);
+	}
+
+	return io_read_partial(conn, rw->wake_buf, sizeof(rw->wake_buf),
+			       &rw->wake_len, jobs_done, rw);
+}
+
+static struct io_plan *wake_conn_init(struct io_conn *conn,
+				      struct route_workers *rw)
+{
+	return jobs_done(conn, rw);
+}
+
+static void destroy_route_workers(struct route_workers *rw)
+{
+	pthread_mutex_lock(&rw->lock);
+	rw->shutdown = true;
+	pthread_cond_broadcast(&rw->cond);
+	pthread_mutex_unlock(&rw->lock);
+
+	for (size_t i = 0; i < tal_count(rw->workers); i++)
+		pthread_join(rw->workers[i]->thread, NULL);
+
+	close(rw->wake_fd[1]);
+	pthread_cond_destroy(&rw->cond);
+	pthread_mutex_destroy(&rw->lock);
+}
+
+struct route_workers *route_workers_new(const tal_t *ctx,
+					struct routing_state *rstate,
+					size_t num_threads)
+{
+	struct route_workers *rw = tal(ctx, struct route_workers);
+
+	assert(num_threads > 0);
+	rw->rstate = rstate;
+	list_head_init(&rw->todo);
+	list_head_init(&rw->jobs);
+	rw->shutdown = false;
+	rw->wake_pending = false;
+	if (pipe(rw->wake_fd) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "route_workers: pipe: %s", strerror(errno));
+	io_fd_block(rw->wake_fd[1], false);
+	pthread_mutex_init(&rw->lock, NULL);
+	pthread_cond_init(&rw->cond, NULL);
+
+	/* Each worker gets its own tal tree: set them all up before any
+	 * thread starts, so we never touch them again. */
+	rw->workers = tal_arr(rw, struct route_worker *, num_threads);
+	for (size_t i = 0; i < num_threads; i++) {
+		rw->workers[i] = tal(rw->workers, struct route_worker);
+		rw->workers[i]->rw = rw;
+		rw->workers[i]->q = snap_query_new(rw->workers[i]);
+	}
+
+	for (size_t i = 0; i < num_threads; i++) {
+		errno = pthread_create(&rw->workers[i]->thread, NULL,
+				       route_worker_thread, rw->workers[i]);
+		if (errno != 0)
+			status_failed(STATUS_FAIL_INTERNAL_ERROR,
+				      "route_workers: pthread_create: %s",
+				      strerror(errno));
+	}
+	tal_add_destructor(rw, destroy_route_workers);
+
+	io_new_conn(rw, rw->wake_fd[0], wake_conn_init, rw);
+	return rw;
+}
+
+void route_workers_submit_(struct route_workers *rw,
+			   const struct route_query *rq,
+			   void (*cb)(const struct route_hop *hops, void *arg),
+			   void *arg)
+{
+	struct route_job *job = tal(rw, struct route_job);
+
+	job->done = false;
+	job->found = false;
+	job->num_log = 0;
+	job->cb = cb;
+	job->arg = arg;
+	list_add_tail(&rw->jobs, &job->list);
+
+	/* Nothing to do, but it still has to wait its turn. */
+	if (!rq || rq->hops) {
+		if (rq) {
+			job->rq = *rq;
+			tal_steal(job, job->rq.hops);
+		} else
+			job->rq.snap = NULL;
+		pthread_mutex_lock(&rw->lock);
+		job->done = true;
+		wake_main(rw);
+		pthread_mutex_unlock(&rw->lock);
+		return;
+	}
+
+	job->rq = *rq;
+	job->rq.excluded = tal_dup_arr(job, u32, rq->excluded,
+				       rq->num_excluded, 0);
+	if (rq->cache_key)
+		job->rq.cache_key = tal_steal(job, rq->cache_key);
+	/* A route is never longer than max_hops, and can't visit a node
+	 * twice. */
+	if (rq->max_hops < rq->snap->num_nodes)
+		job->route = tal_arr(job, u32, rq->max_hops);
+	else
+		job->route = tal_arr(job, u32, rq->snap->num_nodes);
+	pthread_mutex_lock(&rw->lock);
+	list_add_tail(&rw->todo, &job->todo);
+	pthread_cond_signal(&rw->cond);
+	pthread_mutex_unlock(&rw->lock);
+}
@@ -0,0 +1,36 @@
+#ifndef LIGHTNING_GOSSIPD_ROUTE_WORKERS_H
+#define LIGHTNING_GOSSIPD_ROUTE_WORKERS_H
+#include "config.h"
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+
+struct route_hop;
+struct route_query;
+struct routing_state;
+
+/* A pool of threads which run route queries.  Each query only reads the
+ * (reference counted) snapshot it was resolved against, so the main thread
+ * can carry on changing the graph underneath. */
+struct route_workers;
+
+/* Start @num_threads workers (must be > 0). */
+struct route_workers *route_workers_new(const tal_t *ctx,
+					struct routing_state *rstate,
+					size_t num_threads);
+
+/* Takes over @rq: calls @cb in the main thread once it has run.
+ * Callbacks are made in the order queries were submitted; a NULL @rq
+ * (no route possible), or one the route cache answered, simply waits its
+ * turn. */
+#define route_workers_submit(rw, rq, cb, arg)				\
+	route_workers_submit_((rw), (rq),				\
+			      typesafe_cb_preargs(void, void *,		\
+						  (cb), (arg),		\
+						  const struct route_hop *), \
+			      (arg))
+
+void route_workers_submit_(struct route_workers *rw,
+			   const struct route_query *rq,
+			   void (*cb)(const struct route_hop *hops, void *arg),
+			   void *arg);
+#endif /* LIGHTNING_GOSSIPD_ROUTE_WORKERS_H */
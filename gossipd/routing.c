@@ -6,6 +6,7 @@
 #include <ccan/endian/endian.h>
 #include <ccan/mem/mem.h>
 #include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
 #include <common/features.h>
 #include <common/memleak.h>
 #include <common/pseudorand.h>
@@ -16,6 +17,9 @@
 #include <gossipd/gen_gossip_peerd_wire.h>
 #include <gossipd/gen_gossip_store.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <gossipd/range_cache.h>
+#include <gossipd/route_cache.h>
+#include <gossipd/slab.h>
 #include <inttypes.h>
 #include <wire/gen_peer_wire.h>
 
@@ -26,6 +30,29 @@
 /* 365.25 * 24 * 60 / 10 */
 #define BLOCKS_PER_YEAR 52596
 
+/* How many chans/nodes we allocate at once. */
+#define CHAN_SLAB_PAGE 4096
+#define NODE_SLAB_PAGE 1024
+
+/* For the (few) half_chans whose htlc limits don't fit in struct half_chan */
+struct half_chan_limits {
+	struct amount_msat htlc_minimum, htlc_maximum;
+};
+
+/* A channel direction's rate-limit bucket (see take_update_tokens). */
+struct update_tokens {
+	/* When we last refilled */
+	u32 time;
+	/* How many channel_updates it's used */
+	u32 used;
+};
+
+/* A channel_update we've checked, but which came too fast. */
+struct suppressed_update {
+	u32 timestamp;
+	const u8 *update;
+};
+
 struct pending_node_announce {
 	struct routing_state *rstate;
 	struct node_id nodeid;
@@ -66,6 +93,8 @@ struct unupdated_channel {
 	u32 index;
 	/* Channel capacity */
 	struct amount_sat sat;
+	/* In rstate->unupdated_by_age */
+	struct list_node age_list;
 };
 
 static struct unupdated_channel *
@@ -79,6 +108,7 @@ static void destroy_unupdated_channel(struct unupdated_channel *uc,
 				      struct routing_state *rstate)
 {
 	uintmap_del(&rstate->unupdated_chanmap, uc->scid.u64);
+	list_del_from(&rstate->unupdated_by_age, &uc->age_list);
 }
 
 static struct node_map *new_node_map(const tal_t *ctx)
@@ -174,16 +204,35 @@ struct routing_state *new_routing_state(const tal_t *ctx,
 {
 	struct routing_state *rstate = tal(ctx, struct routing_state);
 	rstate->nodes = new_node_map(rstate);
+	rstate->nodes_by_id = NULL;
 	rstate->gs = gossip_store_new(rstate, peers);
 	rstate->chainparams = chainparams;
 	rstate->local_id = *local_id;
 	rstate->prune_timeout = prune_timeout;
 	rstate->local_channel_announced = false;
+	rstate->snapshot = NULL;
+	rstate->query = snap_query_new(rstate);
+	rstate->route_cache = NULL;
+	rstate->range_cache = NULL;
+	rstate->verified = NULL;
 
 	pending_cannouncement_map_init(&rstate->pending_cannouncements);
 
 	uintmap_init(&rstate->chanmap);
+	rstate->chan_slab = slab_new(rstate, struct chan, CHAN_SLAB_PAGE);
+	rstate->node_slab = slab_new(rstate, struct node, NODE_SLAB_PAGE);
+	uintmap_init(&rstate->htlc_limits[0]);
+	uintmap_init(&rstate->htlc_limits[1]);
+	rstate->ratelimit_burst = 0;
+	rstate->ratelimit_node_burst = 0;
+	rstate->ratelimit_refill = 0;
+	uintmap_init(&rstate->update_tokens[0]);
+	uintmap_init(&rstate->update_tokens[1]);
+	uintmap_init(&rstate->suppressed[0]);
+	uintmap_init(&rstate->suppressed[1]);
 	uintmap_init(&rstate->unupdated_chanmap);
+	list_head_init(&rstate->unupdated_by_age);
+	uintmap_init(&rstate->prune_buckets);
 	chan_map_init(&rstate->local_disabled_map);
 	uintmap_init(&rstate->txout_failures);
 
@@ -220,19 +269,16 @@ bool node_map_node_eq(const struct node *n, const struct node_id *pc)
 }
 
 
-static void destroy_node(struct node *node, struct routing_state *rstate)
+/* Nodes go when their last channel does (see remove_chan_from_node). */
+static void free_node(struct routing_state *rstate, struct node *node)
 {
-	struct chan_map_iter i;
-	struct chan *c;
 	node_map_del(rstate->nodes, node);
-
-	/* These remove themselves from chans[]. */
-	while ((c = first_chan(node, &i)) != NULL)
-		free_chan(rstate, c);
+	rstate->nodes_by_id = tal_free(rstate->nodes_by_id);
 
 	/* Free htable if we need. */
 	if (node_uses_chan_map(node))
 		chan_map_clear(&node->chans.map);
+	slab_free(rstate->node_slab, node);
 }
 
 struct node *get_node(struct routing_state *rstate,
@@ -241,6 +287,67 @@ struct node *get_node(struct routing_state *rstate,
 	return node_map_get(rstate->nodes, id);
 }
 
+static int node_ptr_order(const void *a, const void *b)
+{
+	struct node *const *na = a, *const *nb = b;
+
+	return node_id_cmp(&(*na)->id, &(*nb)->id);
+}
+
+/*~ The node map is a hash table, so has no order; `listnodes` pages through
+ * them by id, so we keep a sorted array until the set of nodes changes.
+ * Nodes come and go far less often than they're listed. */
+struct node **routing_nodes_by_id(struct routing_state *rstate)
+{
+	struct node_map_iter it;
+	struct node *node;
+
+	if (rstate->nodes_by_id)
+		return rstate->nodes_by_id;
+
+	rstate->nodes_by_id = tal_arr(rstate, struct node *, 0);
+	for (node = node_map_first(rstate->nodes, &it);
+	     node;
+	     node = node_map_next(rstate->nodes, &it))
+		tal_arr_expand(&rstate->nodes_by_id, node);
+	qsort(rstate->nodes_by_id, tal_count(rstate->nodes_by_id),
+	      sizeof(rstate->nodes_by_id[0]), node_ptr_order);
+	return rstate->nodes_by_id;
+}
+
+size_t routing_nodes_from(struct node **nodes, const struct node_id *id)
+{
+	size_t lo = 0, hi = tal_count(nodes);
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (node_id_cmp(&nodes[mid]->id, id) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Queries may still be searching the old snapshot: if so, the last one
+ * frees it (see route_query_done). */
+static void discard_snapshot(struct routing_state *rstate)
+{
+	if (rstate->snapshot && rstate->snapshot->refs == 0)
+		tal_free(rstate->snapshot);
+	rstate->snapshot = NULL;
+}
+
+/* We can't change a snapshot under a query, so copy it first. */
+static struct routing_snapshot *writable_snapshot(struct routing_state *rstate)
+{
+	if (rstate->snapshot->refs != 0)
+		rstate->snapshot = routing_snapshot_dup(rstate,
+							rstate->snapshot);
+	return rstate->snapshot;
+}
+
 static struct node *new_node(struct routing_state *rstate,
 			     const struct node_id *id)
 {
@@ -248,12 +355,13 @@ static struct node *new_node(struct routing_state *rstate,
 
 	assert(!get_node(rstate, id));
 
-	n = tal(rstate, struct node);
+	n = slab_alloc(rstate->node_slab, struct node);
 	n->id = *id;
+	n->key_valid = false;
 	memset(n->chans.arr, 0, sizeof(n->chans.arr));
 	broadcastable_init(&n->bcast);
 	node_map_add(rstate->nodes, n);
-	tal_add_destructor2(n, destroy_node, rstate);
+	rstate->nodes_by_id = tal_free(rstate->nodes_by_id);
 
 	return n;
 }
@@ -329,7 +437,7 @@ static void remove_chan_from_node(struct routing_state *rstate,
 		gossip_store_delete(rstate->gs,
 				    &node->bcast,
 				    WIRE_NODE_ANNOUNCEMENT);
-		tal_free(node);
+		free_node(rstate, node);
 		return;
 	}
 
@@ -361,18 +469,165 @@ static void remove_chan_from_node(struct routing_state *rstate,
 	}
 }
 
+/*~ route_prune() used to look at every channel, every time.  Instead we
+ * file each one by the hour of its newer channel_update, so it only needs to
+ * look at the hours old enough to hold something it should prune. */
+#define PRUNE_BUCKET_SECS 3600
+
+struct prune_bucket {
+	/* Timestamp / PRUNE_BUCKET_SECS */
+	u64 key;
+	struct list_head chans;
+};
+
+/* route_prune() prunes a channel if every channel_update it has is old. */
+static u32 chan_newest_timestamp(const struct chan *chan)
+{
+	u32 newest = 0;
+
+	for (int i = 0; i < 2; i++) {
+		if (is_halfchan_defined(&chan->half[i])
+		    && chan->half[i].bcast.timestamp > newest)
+			newest = chan->half[i].bcast.timestamp;
+	}
+	return newest;
+}
+
+static void prune_index_del(struct routing_state *rstate, struct chan *chan)
+{
+	struct prune_bucket *b = chan->prune_bucket;
+
+	if (!b)
+		return;
+
+	list_del_from(&b->chans, &chan->prune_list);
+	chan->prune_bucket = NULL;
+	if (list_empty(&b->chans)) {
+		uintmap_del(&rstate->prune_buckets, b->key);
+		tal_free(b);
+	}
+}
+
+void routing_chan_timestamps_changed(struct routing_state *rstate,
+				     struct chan *chan)
+{
+	u64 key = chan_newest_timestamp(chan) / PRUNE_BUCKET_SECS;
+	struct prune_bucket *b;
+
+	if (chan->prune_bucket && chan->prune_bucket->key == key)
+		return;
+
+	prune_index_del(rstate, chan);
+	b = uintmap_get(&rstate->prune_buckets, key);
+	if (!b) {
+		b = tal(rstate, struct prune_bucket);
+		b->key = key;
+		list_head_init(&b->chans);
+		uintmap_add(&rstate->prune_buckets, key, b);
+	}
+	list_add_tail(&b->chans, &chan->prune_list);
+	chan->prune_bucket = b;
+}
+
 /* We used to make this a tal_add_destructor2, but that costs 40 bytes per
  * chan, and we only ever explicitly free it anyway. */
 void free_chan(struct routing_state *rstate, struct chan *chan)
 {
+	prune_index_del(rstate, chan);
+	if (rstate->snapshot)
+		routing_snapshot_remove_chan(writable_snapshot(rstate), chan);
+	if (rstate->route_cache)
+		route_cache_chan_changed(rstate->route_cache, &chan->scid);
+	if (rstate->range_cache)
+		range_cache_chan_removed(rstate->range_cache,
+					 short_channel_id_blocknum(&chan->scid));
+
 	remove_chan_from_node(rstate, chan->nodes[0], chan);
 	remove_chan_from_node(rstate, chan->nodes[1], chan);
 
 	uintmap_del(&rstate->chanmap, chan->scid.u64);
+	for (int i = 0; i < 2; i++) {
+		tal_free(uintmap_del(&rstate->htlc_limits[i], chan->scid.u64));
+		tal_free(uintmap_del(&rstate->update_tokens[i],
+				     chan->scid.u64));
+		tal_free(uintmap_del(&rstate->suppressed[i], chan->scid.u64));
+	}
 
 	/* Remove from local_disabled_map if it's there. */
 	chan_map_del(&rstate->local_disabled_map, chan);
-	tal_free(chan);
+	slab_free(rstate->chan_slab, chan);
+}
+
+/* If they don't say, it's the channel capacity (but no more than a payment
+ * can be). */
+static struct amount_msat default_htlc_maximum(const struct routing_state *rstate,
+					       const struct chan *chan)
+{
+	struct amount_msat max;
+
+	if (!amount_sat_to_msat(&max, chan->sat))
+		max = AMOUNT_MSAT(-1ULL);
+	if (rstate->chainparams
+	    && amount_msat_greater(max, rstate->chainparams->max_payment))
+		max = rstate->chainparams->max_payment;
+	return max;
+}
+
+struct amount_msat half_chan_htlc_minimum(const struct routing_state *rstate,
+					  const struct chan *chan, int dir)
+{
+	const struct half_chan *hc = &chan->half[dir];
+	const struct half_chan_limits *l;
+	struct amount_msat min;
+
+	if (hc->htlc_minimum_msat != HALF_CHAN_HTLC_LIMITS_ELSEWHERE) {
+		min.millisatoshis = hc->htlc_minimum_msat; /* Raw: compact */
+		return min;
+	}
+	l = uintmap_get(&rstate->htlc_limits[dir], chan->scid.u64);
+	return l->htlc_minimum;
+}
+
+struct amount_msat half_chan_htlc_maximum(const struct routing_state *rstate,
+					  const struct chan *chan, int dir)
+{
+	const struct half_chan *hc = &chan->half[dir];
+	const struct half_chan_limits *l;
+
+	if (hc->htlc_minimum_msat != HALF_CHAN_HTLC_LIMITS_ELSEWHERE)
+		return default_htlc_maximum(rstate, chan);
+	l = uintmap_get(&rstate->htlc_limits[dir], chan->scid.u64);
+	return l->htlc_maximum;
+}
+
+void set_half_chan_htlc_limits(struct routing_state *rstate,
+			       struct chan *chan, int dir,
+			       struct amount_msat htlc_minimum,
+			       struct amount_msat htlc_maximum)
+{
+	struct half_chan *hc = &chan->half[dir];
+	struct half_chan_limits *l;
+	u64 min_msat = htlc_minimum.millisatoshis; /* Raw: compact */
+
+	l = uintmap_get(&rstate->htlc_limits[dir], chan->scid.u64);
+	if (min_msat < HALF_CHAN_HTLC_LIMITS_ELSEWHERE
+	    && amount_msat_eq(htlc_maximum,
+			      default_htlc_maximum(rstate, chan))) {
+		hc->htlc_minimum_msat = min_msat;
+		if (l) {
+			uintmap_del(&rstate->htlc_limits[dir], chan->scid.u64);
+			tal_free(l);
+		}
+		return;
+	}
+
+	if (!l) {
+		l = tal(rstate, struct half_chan_limits);
+		uintmap_add(&rstate->htlc_limits[dir], chan->scid.u64, l);
+	}
+	l->htlc_minimum = htlc_minimum;
+	l->htlc_maximum = htlc_maximum;
+	hc->htlc_minimum_msat = HALF_CHAN_HTLC_LIMITS_ELSEWHERE;
 }
 
 static void init_half_chan(struct routing_state *rstate,
@@ -385,6 +640,7 @@ static void init_half_chan(struct routing_state *rstate,
 	c->channel_flags = channel_idx;
 	// TODO: wireup message_flags
 	c->message_flags = 0;
+	c->htlc_minimum_msat = 0;
 	broadcastable_init(&c->bcast);
 }
 
@@ -402,13 +658,15 @@ struct chan *new_chan(struct routing_state *rstate,
 		      const struct node_id *id2,
 		      struct amount_sat satoshis)
 {
-	struct chan *chan = tal(rstate, struct chan);
+	struct chan *chan = slab_alloc(rstate->chan_slab, struct chan);
 	int n1idx = node_id_idx(id1, id2);
 	struct node *n1, *n2;
 
 	/* We should never add a channel twice */
 	assert(!uintmap_get(&rstate->chanmap, scid->u64));
 
+	/* The snapshot doesn't need to know yet: see routing_chan_updated. */
+
 	/* Create nodes on demand */
 	n1 = get_node(rstate, id1);
 	if (!n1)
@@ -432,764 +690,180 @@ struct chan *new_chan(struct routing_state *rstate,
 	init_half_chan(rstate, chan, n1idx);
 	init_half_chan(rstate, chan, !n1idx);
 
+	chan->prune_bucket = NULL;
+	routing_chan_timestamps_changed(rstate, chan);
+
 	uintmap_add(&rstate->chanmap, scid->u64, chan);
+	if (rstate->range_cache)
+		range_cache_chan_added(rstate->range_cache,
+				       short_channel_id_blocknum(scid));
 	return chan;
 }
 
-/* Too big to reach, but don't overflow if added. */
-#define INFINITE AMOUNT_MSAT(0x3FFFFFFFFFFFFFFFULL)
-
-/* We hack a multimap into a uintmap to implement a minheap by cost.
- * This is relatively inefficient, containing an array for each cost
- * value, assuming there aren't too many at same cost.
- *
- * We further optimize by never freeing or shrinking these entries,
- * but delete by replacing with NULL.  This means that we cache the
- * lowest index which actually contains something, since others may
- * contain empty arrays. */
-struct unvisited {
-	u64 min_index;
-	UINTMAP(struct node **) map;
-};
-
-
-/* Risk of passing through this channel.
- *
- * There are two ways this function is used:
- *
- * 1. Normally, riskbias = 1.  A tiny bias here in order to prefer
- *    shorter routes, all things equal.
- * 2. Trying to find a shorter route, riskbias > 1.  By adding an extra
- *    cost to every hop, we're trying to bias against overlength routes.
- */
-static WARN_UNUSED_RESULT bool risk_add_fee(struct amount_msat *risk,
-					    struct amount_msat msat,
-					    u32 delay, double riskfactor,
-					    u64 riskbias)
-{
-	double r;
-
-	/* Won't overflow on add, just lose precision */
-	r = (double)riskbias + riskfactor * delay * msat.millisatoshis + risk->millisatoshis; /* Raw: to double */
-	if (r > UINT64_MAX)
-		return false;
-	risk->millisatoshis = r; /* Raw: from double */
-	return true;
-}
-
-/* Check that we can fit through this channel's indicated
- * maximum_ and minimum_msat requirements.
- */
-static bool hc_can_carry(const struct half_chan *hc,
-			 struct amount_msat requiredcap)
+/* Route finding works on a compact snapshot of the graph.  The first
+ * update for a new channel throws it away, so we rebuild it lazily here. */
+static struct routing_snapshot *get_snapshot(struct routing_state *rstate)
 {
-	return amount_msat_greater_eq(hc->htlc_maximum, requiredcap) &&
-		amount_msat_less_eq(hc->htlc_minimum, requiredcap);
+	if (!rstate->snapshot)
+		rstate->snapshot = routing_snapshot_new(rstate, rstate);
+	return rstate->snapshot;
 }
 
-/* Theoretically, this could overflow. */
-static bool fuzz_fee(u64 *fee,
-		     const struct short_channel_id *scid,
-		     double fuzz, const struct siphash_seed *base_seed)
+void routing_refresh_landmarks(struct routing_state *rstate)
 {
-	u64 fuzzed_fee, h;
- 	double fee_scale;
-
-	if (fuzz == 0.0)
-		return true;
-
-	h = siphash24(base_seed, scid, sizeof(*scid));
-
-	/* Scale fees for this channel */
-	/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
-	 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
-	 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
-	 */
-	fee_scale = 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
-	fuzzed_fee = *fee * fee_scale;
-	if (fee_scale > 1.0 && fuzzed_fee < *fee)
-		return false;
-	*fee = fuzzed_fee;
-	return true;
-}
-
-/* Can we carry this amount across the channel?  If so, returns true and
- * sets newtotal and newrisk */
-static bool can_reach(const struct half_chan *c,
-		      const struct short_channel_id *scid,
-		      bool no_charge,
-		      struct amount_msat total,
-		      struct amount_msat risk,
-		      double riskfactor,
-		      u64 riskbias,
-		      double fuzz, const struct siphash_seed *base_seed,
-		      struct amount_msat *newtotal, struct amount_msat *newrisk)
-{
-	/* FIXME: Bias against smaller channels. */
-	struct amount_msat fee;
-
-	if (!amount_msat_fee(&fee, total, c->base_fee, c->proportional_fee))
-		return false;
-
-  	if (!fuzz_fee(&fee.millisatoshis, scid, fuzz, base_seed)) /* Raw: double manipulation */
-		return false;
-
-	if (no_charge) {
-		*newtotal = total;
-
-		/* We still want to consider the "charge", since it's indicative
-		 * of a bias (we discounted one channel for a reason), but we
-		 * don't pay it.  So we count it as additional risk. */
-		if (!amount_msat_add(newrisk, risk, fee))
-			return false;
-	} else {
-		*newrisk = risk;
-
-		if (!amount_msat_add(newtotal, total, fee))
-			return false;
-	}
-
-	/* Skip a channel if it indicated that it won't route the
-	 * requested amount. */
-	if (!hc_can_carry(c, *newtotal))
-		return false;
-
-	if (!risk_add_fee(newrisk, *newtotal, c->delay, riskfactor, riskbias))
-		return false;
+	/* No snapshot means nobody has asked for a route since it changed */
+	if (!rstate->snapshot || rstate->snapshot->landmarks)
+		return;
 
-	return true;
+	routing_snapshot_add_landmarks(writable_snapshot(rstate));
 }
 
-/* Returns false on overflow (shouldn't happen!) */
-typedef bool WARN_UNUSED_RESULT costfn_t(struct amount_msat *,
-					 struct amount_msat,
-					 struct amount_msat);
-
-static WARN_UNUSED_RESULT bool
-normal_cost_function(struct amount_msat *cost,
-		     struct amount_msat total, struct amount_msat risk)
+void routing_chan_updated(struct routing_state *rstate,
+			  const struct chan *chan)
 {
-	if (amount_msat_add(cost, total, risk))
-		return true;
+	if (rstate->snapshot) {
+		if (routing_snapshot_has_chan(rstate->snapshot, &chan->scid))
+			routing_snapshot_update_chan(writable_snapshot(rstate),
+						     rstate, chan);
+		/* A new channel (or node) is no use for routing until it's
+		 * had an update, so only then do we need a new snapshot. */
+		else if (is_halfchan_enabled(&chan->half[0])
+			 || is_halfchan_enabled(&chan->half[1]))
+			discard_snapshot(rstate);
+	}
 
-	status_broken("Can't add cost of node %s + %s",
-		      type_to_string(tmpctx, struct amount_msat, &total),
-		      type_to_string(tmpctx, struct amount_msat, &risk));
-	return false;
+	if (rstate->route_cache)
+		route_cache_chan_changed(rstate->route_cache, &chan->scid);
 }
 
-static WARN_UNUSED_RESULT bool
-shortest_cost_function(struct amount_msat *cost,
-		       struct amount_msat total, struct amount_msat risk)
+/* Find the snapshot indices of the endpoints: false if no route possible. */
+static bool route_endpoints(struct routing_state *rstate,
+			    const struct routing_snapshot *snap,
+			    const struct node_id *from,
+			    const struct node_id *to,
+			    u32 *src, u32 *dst, u32 *me)
 {
-	/* We add 1, so cost is never 0, for our hacky uintmap-as-minheap. */
-	if (amount_msat_add(cost, risk, AMOUNT_MSAT(1)))
-		return true;
+	*dst = routing_snapshot_node(snap, to);
 
-	status_broken("Can't add 1 to risk of node %s",
-		      type_to_string(tmpctx, struct amount_msat, &risk));
-	return false;
-}
-
-/* Does totala+riska add up to less than totalb+riskb?
- * Saves sums if you want them.
- */
-static bool costs_less(struct amount_msat totala,
-		       struct amount_msat riska,
-		       struct amount_msat *costa,
-		       struct amount_msat totalb,
-		       struct amount_msat riskb,
-		       struct amount_msat *costb,
-		       costfn_t *costfn)
-{
-	struct amount_msat suma, sumb;
+	/* If from is NULL, that's means it's us. */
+	if (!from)
+		*me = *src = routing_snapshot_node(snap, &rstate->local_id);
+	else {
+		*src = routing_snapshot_node(snap, from);
+		*me = SNAP_NONE;
+	}
 
-	if (!costfn(&suma, totala, riska))
+	if (*dst == SNAP_NONE) {
+		status_info("find_route: cannot find %s",
+			    type_to_string(tmpctx, struct node_id, to));
 		return false;
-	if (!costfn(&sumb, totalb, riskb))
+	} else if (*src == SNAP_NONE) {
+		status_info("find_route: cannot find source (%s)",
+			    type_to_string(tmpctx, struct node_id, to));
 		return false;
-
-	if (costa)
-		*costa = suma;
-	if (costb)
-		*costb = sumb;
-	return amount_msat_less(suma, sumb);
-}
-
-/* Determine if the given half_chan is routable */
-static bool hc_is_routable(struct routing_state *rstate,
-			   const struct chan *chan, int idx)
-{
-	return is_halfchan_enabled(&chan->half[idx])
-		&& !is_chan_local_disabled(rstate, chan);
-}
-
-static void unvisited_add(struct unvisited *unvisited, struct amount_msat cost,
-			  struct node **arr)
-{
-	u64 idx = cost.millisatoshis; /* Raw: uintmap needs u64 index */
-	if (idx < unvisited->min_index) {
-		assert(idx); /* We don't allow sending 0 satoshis */
-		unvisited->min_index = idx - 1;
-	}
-	uintmap_add(&unvisited->map, idx, arr);
-}
-
-static struct node **unvisited_get(const struct unvisited *unvisited,
-				   struct amount_msat cost)
-{
-	return uintmap_get(&unvisited->map, cost.millisatoshis); /* Raw: uintmap */
-}
-
-static struct node **unvisited_del(struct unvisited *unvisited,
-				   struct amount_msat cost)
-{
-	return uintmap_del(&unvisited->map, cost.millisatoshis); /* Raw: uintmap */
-}
-
-static bool is_unvisited(const struct node *node,
-			 const struct unvisited *unvisited,
-			 costfn_t *costfn)
-{
-	struct node **arr;
-	struct amount_msat cost;
-
-	/* If it's infinite, definitely unvisited */
-	if (amount_msat_eq(node->dijkstra.total, INFINITE))
-		return true;
-
-	/* Shouldn't happen! */
-	if (!costfn(&cost, node->dijkstra.total, node->dijkstra.risk))
+	} else if (*dst == *src) {
+		status_info("find_route: this is %s, refusing to create empty route",
+			    type_to_string(tmpctx, struct node_id, to));
 		return false;
-
-	arr = unvisited_get(unvisited, cost);
-	for (size_t i = 0; i < tal_count(arr); i++) {
-		if (arr[i] == node)
-			return true;
-	}
-	return false;
-}
-
-static void unvisited_del_node(struct unvisited *unvisited,
-			       struct amount_msat cost,
-			       const struct node *node)
-{
-	struct node **arr;
-
-	arr = unvisited_get(unvisited, cost);
-	for (size_t i = 0; i < tal_count(arr); i++) {
-		if (arr[i] == node) {
-			arr[i] = NULL;
-			return;
-		}
-	}
-	abort();
-}
-
-static void adjust_unvisited(struct node *node,
-			     struct unvisited *unvisited,
-			     struct amount_msat cost_before,
-			     struct amount_msat total,
-			     struct amount_msat risk,
-			     struct amount_msat cost_after)
-{
-	struct node **arr;
-
-	/* If it was in unvisited map, remove it. */
-	if (!amount_msat_eq(node->dijkstra.total, INFINITE))
-		unvisited_del_node(unvisited, cost_before, node);
-
-	/* Update node */
-	node->dijkstra.total = total;
-	node->dijkstra.risk = risk;
-
-	SUPERVERBOSE("%s now cost %s",
-		     type_to_string(tmpctx, struct node_id, &node->id),
-		     type_to_string(tmpctx, struct amount_msat, &cost_after));
-
-	/* Update map of unvisited nodes */
-	arr = unvisited_get(unvisited, cost_after);
-	if (arr) {
-		struct node **old_arr;
-		/* Try for empty slot */
-		for (size_t i = 0; i < tal_count(arr); i++) {
-			if (arr[i] == NULL) {
-				arr[i] = node;
-				return;
-			}
-		}
-		/* Nope, expand */
-		old_arr = arr;
-		tal_arr_expand(&arr, node);
-		if (arr == old_arr)
-			return;
-
-		/* Realloc moved it; del and add again. */
-		unvisited_del(unvisited, cost_after);
-	} else {
-		arr = tal_arr(unvisited, struct node *, 1);
-		arr[0] = node;
-	}
-
-	unvisited_add(unvisited, cost_after, arr);
-}
-
-static void remove_unvisited(struct node *node, struct unvisited *unvisited,
-			     costfn_t *costfn)
-{
-	struct amount_msat cost;
-
-	/* Shouldn't happen! */
-	if (!costfn(&cost, node->dijkstra.total, node->dijkstra.risk))
-		return;
-
-	unvisited_del_node(unvisited, cost, node);
-}
-
-static void update_unvisited_neighbors(struct routing_state *rstate,
-				       struct node *cur,
-				       const struct node *me,
-				       double riskfactor,
-				       u64 riskbias,
-				       double fuzz,
-				       const struct siphash_seed *base_seed,
-				       struct unvisited *unvisited,
-				       costfn_t *costfn)
-{
-	struct chan_map_iter i;
-	struct chan *chan;
-
-	/* Consider all neighbors */
-	for (chan = first_chan(cur, &i); chan; chan = next_chan(cur, &i)) {
-		struct amount_msat total, risk, cost_before, cost_after;
-		int idx = half_chan_to(cur, chan);
-		struct node *peer = chan->nodes[idx];
-
-		SUPERVERBOSE("CONSIDERING: %s -> %s (%s/%s)",
-			     type_to_string(tmpctx, struct node_id,
-					    &cur->id),
-			     type_to_string(tmpctx, struct node_id,
-					    &peer->id),
-			     type_to_string(tmpctx, struct amount_msat,
-					    &peer->dijkstra.total),
-			     type_to_string(tmpctx, struct amount_msat,
-					    &peer->dijkstra.risk));
-
-		if (!hc_is_routable(rstate, chan, idx)) {
-			SUPERVERBOSE("... not routable");
-			continue;
-		}
-
-		if (!is_unvisited(peer, unvisited, costfn)) {
-			SUPERVERBOSE("... already visited");
-			continue;
-		}
-
-		/* We're looking at channels *backwards*, so peer == me
-		 * is the right test here for whether we don't charge fees. */
-		if (!can_reach(&chan->half[idx], &chan->scid, peer == me,
-			       cur->dijkstra.total, cur->dijkstra.risk,
-			       riskfactor, riskbias, fuzz, base_seed,
-			       &total, &risk)) {
-			SUPERVERBOSE("... can't reach");
-			continue;
-		}
-
-		/* This effectively adds it to the map if it was infinite */
-		if (costs_less(total, risk, &cost_after,
-			       peer->dijkstra.total, peer->dijkstra.risk,
-			       &cost_before,
-			       costfn)) {
-			SUPERVERBOSE("...%s can reach %s"
-				     " total %s risk %s",
-				     type_to_string(tmpctx, struct node_id,
-						    &cur->id),
-				     type_to_string(tmpctx, struct node_id,
-						    &peer->id),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &total),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &risk));
-			adjust_unvisited(peer, unvisited,
-					 cost_before, total, risk, cost_after);
-		}
 	}
+	return true;
 }
 
-static struct node *first_unvisited(struct unvisited *unvisited)
+/* riskfactor is already scaled to per-block amount */
+static struct chan **
+find_route(const tal_t *ctx, struct routing_state *rstate,
+	   const struct node_id *from, const struct node_id *to,
+	   struct amount_msat msat,
+	   double riskfactor,
+	   double fuzz, const struct siphash_seed *base_seed,
+	   size_t max_hops,
+	   struct amount_msat *fee)
 {
-	struct node **arr;
-
-	while ((arr = uintmap_after(&unvisited->map, &unvisited->min_index))) {
-		for (size_t i = 0; i < tal_count(arr); i++) {
-			if (arr[i]) {
-				unvisited->min_index--;
-				return arr[i];
-			}
-		}
-	}
-
-	return NULL;
-}
+	struct routing_snapshot *snap = get_snapshot(rstate);
+	struct snap_query *q = rstate->query;
+	u32 src, dst, me;
+	bool found;
+	struct chan **route;
 
-static void dijkstra(struct routing_state *rstate,
-		     const struct node *dst,
-		     const struct node *me,
-		     double riskfactor,
-		     u64 riskbias,
-		     double fuzz, const struct siphash_seed *base_seed,
-		     struct unvisited *unvisited,
-		     costfn_t *costfn)
-{
-	struct node *cur;
-
-	while ((cur = first_unvisited(unvisited)) != NULL) {
-		update_unvisited_neighbors(rstate, cur, me,
-					   riskfactor, riskbias,
-					   fuzz, base_seed, unvisited, costfn);
-		remove_unvisited(cur, unvisited, costfn);
-		if (cur == dst)
-			return;
-	}
-}
-
-/* Note that we calculated route *backwards*, for fees.  So "from"
- * here has a high cost, "to" has a cost of exact amount sent. */
-static struct chan **build_route(const tal_t *ctx,
-				 struct routing_state *rstate,
-				 const struct node *from,
-				 const struct node *to,
-				 const struct node *me,
-				 double riskfactor,
-				 u64 riskbias,
-				 double fuzz,
-				 const struct siphash_seed *base_seed,
-				 struct amount_msat *fee)
-{
-	const struct node *i;
-	struct chan **route, *chan;
-
-	SUPERVERBOSE("Building route from %s (%s) -> %s (%s)",
-		     type_to_string(tmpctx, struct node_id, &from->id),
-		     type_to_string(tmpctx, struct amount_msat,
-				    &from->dijkstra.total),
-		     type_to_string(tmpctx, struct node_id, &to->id),
-		     type_to_string(tmpctx, struct amount_msat,
-				    &to->dijkstra.total));
-	/* Never reached? */
-	if (amount_msat_eq(from->dijkstra.total, INFINITE))
+	if (!route_endpoints(rstate, snap, from, to, &src, &dst, &me))
 		return NULL;
 
-	/* Walk to find which neighbors we used */
-	route = tal_arr(ctx, struct chan *, 0);
-	for (i = from; i != to; i = other_node(i, chan)) {
-		struct chan_map_iter it;
-
-		/* Consider all neighbors */
-		for (chan = first_chan(i, &it); chan; chan = next_chan(i, &it)) {
-			struct node *peer = other_node(i, chan);
-			struct half_chan *hc = half_chan_from(i, chan);
-			struct amount_msat total, risk;
-
-			SUPERVERBOSE("CONSIDER: %s -> %s (%s/%s)",
-				     type_to_string(tmpctx, struct node_id,
-						    &i->id),
-				     type_to_string(tmpctx, struct node_id,
-						    &peer->id),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &peer->dijkstra.total),
-				     type_to_string(tmpctx, struct amount_msat,
-						    &peer->dijkstra.risk));
-
-			/* If traversing this wasn't possible, ignore */
-			if (!hc_is_routable(rstate, chan, !half_chan_to(i, chan))) {
-				continue;
-			}
-
-			if (!can_reach(hc, &chan->scid, i == me,
-				       peer->dijkstra.total, peer->dijkstra.risk,
-				       riskfactor,
-				       riskbias,
-				       fuzz, base_seed,
-				       &total, &risk))
-				continue;
-
-			/* If this was the path we took, we're done (if there are
-			 * two identical ones, it doesn't matter which) */
-			if (amount_msat_eq(total, i->dijkstra.total)
-			    && amount_msat_eq(risk, i->dijkstra.risk))
-				break;
-		}
-
-		if (!chan) {
-			status_broken("Could not find hop to %s",
-				      type_to_string(tmpctx, struct node_id,
-						     &i->id));
-			return tal_free(route);
-		}
-		tal_arr_expand(&route, chan);
-	}
-
-	/* We don't charge ourselves fees, so skip first hop */
-	if (!amount_msat_sub(fee,
-			     other_node(from, route[0])->dijkstra.total,
-			     to->dijkstra.total)) {
-		status_broken("Could not subtract %s - %s for fee",
-			      type_to_string(tmpctx, struct amount_msat,
-					     &other_node(from, route[0])
-					     ->dijkstra.total),
-			      type_to_string(tmpctx, struct amount_msat,
-					     &to->dijkstra.total));
-		return tal_free(route);
-	}
+	found = routing_snapshot_find_route(snap, q, src, dst, me, msat,
+					    riskfactor, fuzz, base_seed,
+					    max_hops, NULL, 0, fee);
+	snap_query_flush_log(q->log, q->num_log);
+	if (!found)
+		return NULL;
 
+	route = tal_arr(ctx, struct chan *, q->route_len);
+	for (size_t i = 0; i < q->route_len; i++)
+		route[i] = get_channel(rstate, &snap->edges[q->route[i]].scid);
 	return route;
 }
 
-static struct unvisited *dijkstra_prepare(const tal_t *ctx,
-					  struct routing_state *rstate,
-					  struct node *src,
-					  struct amount_msat msat,
-					  costfn_t *costfn)
+/* Decompressing a node_id costs about as much as a third of the signature
+ * check itself, and the same few nodes sign most of what we see: keep the
+ * result in the node, if it has one. */
+static bool node_pubkey(struct routing_state *rstate,
+			const struct node_id *id, struct pubkey *key)
 {
-	struct node_map_iter it;
-	struct unvisited *unvisited;
-	struct node *n;
-	struct node **arr;
-	struct amount_msat cost;
+	struct node *node = get_node(rstate, id);
 
-	unvisited = tal(tmpctx, struct unvisited);
-	uintmap_init(&unvisited->map);
-	unvisited->min_index = UINT64_MAX;
-
-	/* Reset all the information. */
-	for (n = node_map_first(rstate->nodes, &it);
-	     n;
-	     n = node_map_next(rstate->nodes, &it)) {
-		if (n == src)
-			continue;
-		n->dijkstra.total = INFINITE;
-		n->dijkstra.risk = INFINITE;
+	if (node && node->key_valid) {
+		*key = node->key;
+		return true;
 	}
-
-	/* Mark start cost: place in unvisited map. */
-	src->dijkstra.total = msat;
-	src->dijkstra.risk = AMOUNT_MSAT(0);
-	arr = tal_arr(unvisited, struct node *, 1);
-	arr[0] = src;
-	/* Adding 0 can never fail */
-	if (!costfn(&cost, src->dijkstra.total, src->dijkstra.risk))
-		abort();
-	unvisited_add(unvisited, cost, arr);
-
-	return unvisited;
+	if (!pubkey_from_node_id(key, id))
+		return false;
+	if (node) {
+		node->key = *key;
+		node->key_valid = true;
+	}
+	return true;
 }
 
-static void dijkstra_cleanup(struct unvisited *unvisited)
+/* Did the verify workers already check this exact signature? */
+static bool sig_verified(const struct routing_state *rstate,
+			 const struct sha256_double *hash,
+			 const secp256k1_ecdsa_signature *signature,
+			 const struct pubkey *key)
 {
-	struct node **arr;
-	u64 idx;
+	const struct gossip_sigs *v = rstate->verified;
 
-	/* uintmap uses malloc, so manual cleaning needed */
-	while ((arr = uintmap_first(&unvisited->map, &idx)) != NULL) {
-		tal_free(arr);
-		uintmap_del(&unvisited->map, idx);
-	}
-	tal_free(unvisited);
-}
-
-/* We need to start biassing against long routes. */
-static struct chan **
-find_shorter_route(const tal_t *ctx, struct routing_state *rstate,
-		   struct node *src, struct node *dst,
-		   const struct node *me,
-		   struct amount_msat msat,
-		   size_t max_hops,
-		   double fuzz, const struct siphash_seed *base_seed,
-		   struct chan **long_route,
-		   struct amount_msat *fee)
-{
-	struct unvisited *unvisited;
-	struct chan **short_route = NULL;
-	struct amount_msat long_cost, short_cost, cost_diff;
-	u64 min_bias, max_bias;
-	double riskfactor;
-
-	/* We traverse backwards, so dst has largest total */
-	if (!amount_msat_sub(&long_cost,
-			     dst->dijkstra.total, src->dijkstra.total))
-		goto bad_total;
-	tal_free(long_route);
-
-	/* FIXME: It's hard to juggle both the riskfactor and riskbias here,
-	 * so we set our riskfactor to rougly equate to 1 millisatoshi
-	 * per block delay, which is close enough to zero to not break
-	 * this algorithm, but still provide some bias towards
-	 * low-delay routes. */
-	riskfactor = (double)1.0 / msat.millisatoshis; /* Raw: inversion */
-
-	/* First, figure out if a short route is even possible.
-	 * We set the cost function to ignore total, riskbias 1 and riskfactor
-	 * ~0 so risk simply operates as a simple hop counter. */
-	unvisited = dijkstra_prepare(tmpctx, rstate, src, msat,
-				     shortest_cost_function);
-	SUPERVERBOSE("Running shortest path from %s -> %s",
-		     type_to_string(tmpctx, struct node_id, &dst->id),
-		     type_to_string(tmpctx, struct node_id, &src->id));
-	dijkstra(rstate, dst, NULL, riskfactor, 1, fuzz, base_seed,
-		 unvisited, shortest_cost_function);
-	dijkstra_cleanup(unvisited);
-
-	/* This must succeed, since we found a route before */
-	short_route = build_route(ctx, rstate, dst, src, me, riskfactor, 1,
-				  fuzz, base_seed, fee);
-	assert(short_route);
-	if (!amount_msat_sub(&short_cost,
-			     dst->dijkstra.total, src->dijkstra.total))
-		goto bad_total;
-
-	/* Still too long?  Oh well. */
-	if (tal_count(short_route) > max_hops) {
-		status_info("Minimal possible route %s->%s is %zu",
-			    type_to_string(tmpctx, struct node_id, &dst->id),
-			    type_to_string(tmpctx, struct node_id, &src->id),
-			    tal_count(short_route));
-		goto out;
-	}
-
-	/* OK, so it's possible, just more expensive. */
-	min_bias = 0;
-
-	if (!amount_msat_sub(&cost_diff, short_cost, long_cost)) {
-		status_broken("Short cost %s < long cost %s?",
-			      type_to_string(tmpctx, struct amount_msat,
-					     &short_cost),
-			      type_to_string(tmpctx, struct amount_msat,
-					     &long_cost));
-		goto out;
-	}
-
-	/* This is a gross overestimate, but it works. */
-	max_bias = cost_diff.millisatoshis; /* Raw: bias calc */
-
-	SUPERVERBOSE("maxbias %"PRIu64" gave rlen %zu",
-		     max_bias, tal_count(short_route));
-
-	/* Now, binary search */
-	while (min_bias < max_bias) {
-		struct chan **route;
-		struct amount_msat this_fee;
-		u64 riskbias = (min_bias + max_bias) / 2;
-
-		unvisited = dijkstra_prepare(tmpctx, rstate, src, msat,
-					     normal_cost_function);
-		dijkstra(rstate, dst, me, riskfactor, riskbias, fuzz, base_seed,
-			 unvisited, normal_cost_function);
-		dijkstra_cleanup(unvisited);
-
-		route = build_route(ctx, rstate, dst, src, me,
-				    riskfactor, riskbias,
-				    fuzz, base_seed, &this_fee);
-
-		SUPERVERBOSE("riskbias %"PRIu64" rlen %zu",
-			     riskbias, tal_count(route));
-		/* Too long still?  This is our new min_bias */
-		if (tal_count(route) > max_hops) {
-			tal_free(route);
-			min_bias = riskbias + 1;
-		} else {
-			/* This route is acceptable. */
-			tal_free(short_route);
-			short_route = route;
-			/* Save this fee in case we exit loop */
-			*fee = this_fee;
-			max_bias = riskbias;
-		}
+	if (!v || memcmp(&v->hash, hash, sizeof(*hash)) != 0)
+		return false;
+	for (size_t i = 0; i < v->num; i++) {
+		if (memcmp(&v->sig[i], signature, sizeof(*signature)) == 0
+		    && pubkey_eq(&v->key[i], key))
+			return true;
 	}
-
-	return short_route;
-
-bad_total:
-	status_broken("dst total %s < src total %s?",
-		      type_to_string(tmpctx, struct amount_msat,
-				     &dst->dijkstra.total),
-		      type_to_string(tmpctx, struct amount_msat,
-				     &src->dijkstra.total));
-out:
-	tal_free(short_route);
-	return NULL;
+	return false;
 }
 
-/* riskfactor is already scaled to per-block amount */
-static struct chan **
-find_route(const tal_t *ctx, struct routing_state *rstate,
-	   const struct node_id *from, const struct node_id *to,
-	   struct amount_msat msat,
-	   double riskfactor,
-	   double fuzz, const struct siphash_seed *base_seed,
-	   size_t max_hops,
-	   struct amount_msat *fee)
+static bool check_signed_hash_rstate(const struct routing_state *rstate,
+				     const struct sha256_double *hash,
+				     const secp256k1_ecdsa_signature *signature,
+				     const struct pubkey *key)
 {
-	struct node *src, *dst;
-	const struct node *me;
-	struct unvisited *unvisited;
-	struct chan **route;
-
-	/* Note: we map backwards, since we know the amount of satoshi we want
-	 * at the end, and need to derive how much we need to send. */
-	src = get_node(rstate, to);
-
-	/* If from is NULL, that's means it's us. */
-	if (!from)
-		me = dst = get_node(rstate, &rstate->local_id);
-	else {
-		dst = get_node(rstate, from);
-		me = NULL;
-	}
-
-	if (!src) {
-		status_info("find_route: cannot find %s",
-			    type_to_string(tmpctx, struct node_id, to));
-		return NULL;
-	} else if (!dst) {
-		status_info("find_route: cannot find source (%s)",
-			    type_to_string(tmpctx, struct node_id, to));
-		return NULL;
-	} else if (dst == src) {
-		status_info("find_route: this is %s, refusing to create empty route",
-			    type_to_string(tmpctx, struct node_id, to));
-		return NULL;
-	}
-
-	unvisited = dijkstra_prepare(tmpctx, rstate, src, msat,
-				     normal_cost_function);
-	dijkstra(rstate, dst, me, riskfactor, 1, fuzz, base_seed,
-		 unvisited, normal_cost_function);
-	dijkstra_cleanup(unvisited);
-
-	route = build_route(ctx, rstate, dst, src, me, riskfactor, 1,
-			    fuzz, base_seed, fee);
-	if (tal_count(route) <= max_hops)
-		return route;
-
-	/* This is the far more unlikely case */
-	return find_shorter_route(ctx, rstate, src, dst, me, msat,
-				  max_hops, fuzz, base_seed, route, fee);
+	return sig_verified(rstate, hash, signature, key)
+		|| check_signed_hash(hash, signature, key);
 }
 
 /* Checks that key is valid, and signed this hash */
-static bool check_signed_hash_nodeid(const struct sha256_double *hash,
+static bool check_signed_hash_nodeid(struct routing_state *rstate,
+				     const struct sha256_double *hash,
 				     const secp256k1_ecdsa_signature *signature,
 				     const struct node_id *id)
 {
 	struct pubkey key;
 
-	return pubkey_from_node_id(&key, id)
-		&& check_signed_hash(hash, signature, &key);
+	return node_pubkey(rstate, id, &key)
+		&& check_signed_hash_rstate(rstate, hash, signature, &key);
 }
 
 /* Verify the signature of a channel_update message */
 static u8 *check_channel_update(const tal_t *ctx,
+				struct routing_state *rstate,
 				const struct node_id *node_id,
 				const secp256k1_ecdsa_signature *node_sig,
 				const u8 *update)
@@ -1199,7 +873,7 @@ static u8 *check_channel_update(const tal_t *ctx,
 	struct sha256_double hash;
 	sha256_double(&hash, update + offset, tal_count(update) - offset);
 
-	if (!check_signed_hash_nodeid(&hash, node_sig, node_id))
+	if (!check_signed_hash_nodeid(rstate, &hash, node_sig, node_id))
 		return towire_errorfmt(ctx, NULL,
 				       "Bad signature for %s hash %s"
 				       " on channel_update %s",
@@ -1214,6 +888,7 @@ static u8 *check_channel_update(const tal_t *ctx,
 }
 
 static u8 *check_channel_announcement(const tal_t *ctx,
+	struct routing_state *rstate,
 	const struct node_id *node1_id, const struct node_id *node2_id,
 	const struct pubkey *bitcoin1_key, const struct pubkey *bitcoin2_key,
 	const secp256k1_ecdsa_signature *node1_sig,
@@ -1227,7 +902,7 @@ static u8 *check_channel_announcement(const tal_t *ctx,
 	sha256_double(&hash, announcement + offset,
 		      tal_count(announcement) - offset);
 
-	if (!check_signed_hash_nodeid(&hash, node1_sig, node1_id)) {
+	if (!check_signed_hash_nodeid(rstate, &hash, node1_sig, node1_id)) {
 		return towire_errorfmt(ctx, NULL,
 				       "Bad node_signature_1 %s hash %s"
 				       " on node_announcement %s",
@@ -1239,7 +914,7 @@ static u8 *check_channel_announcement(const tal_t *ctx,
 						      &hash),
 				       tal_hex(ctx, announcement));
 	}
-	if (!check_signed_hash_nodeid(&hash, node2_sig, node2_id)) {
+	if (!check_signed_hash_nodeid(rstate, &hash, node2_sig, node2_id)) {
 		return towire_errorfmt(ctx, NULL,
 				       "Bad node_signature_2 %s hash %s"
 				       " on node_announcement %s",
@@ -1251,7 +926,8 @@ static u8 *check_channel_announcement(const tal_t *ctx,
 						      &hash),
 				       tal_hex(ctx, announcement));
 	}
-	if (!check_signed_hash(&hash, bitcoin1_sig, bitcoin1_key)) {
+	if (!check_signed_hash_rstate(rstate, &hash,
+				      bitcoin1_sig, bitcoin1_key)) {
 		return towire_errorfmt(ctx, NULL,
 				       "Bad bitcoin_signature_1 %s hash %s"
 				       " on node_announcement %s",
@@ -1263,7 +939,8 @@ static u8 *check_channel_announcement(const tal_t *ctx,
 						      &hash),
 				       tal_hex(ctx, announcement));
 	}
-	if (!check_signed_hash(&hash, bitcoin2_sig, bitcoin2_key)) {
+	if (!check_signed_hash_rstate(rstate, &hash,
+				      bitcoin2_sig, bitcoin2_key)) {
 		return towire_errorfmt(ctx, NULL,
 				       "Bad bitcoin_signature_2 %s hash %s"
 				       " on node_announcement %s",
@@ -1468,6 +1145,7 @@ bool routing_add_channel_announcement(struct routing_state *rstate,
 	uc->id[0] = node_id_1;
 	uc->id[1] = node_id_2;
 	uintmap_add(&rstate->unupdated_chanmap, scid.u64, uc);
+	list_add_tail(&rstate->unupdated_by_age, &uc->age_list);
 	tal_add_destructor2(uc, destroy_unupdated_channel, rstate);
 
 	/* If a node_announcement comes along, save it for once we're updated */
@@ -1594,7 +1272,7 @@ u8 *handle_channel_announcement(struct routing_state *rstate,
 	}
 
 	/* Note that if node_id_1 or node_id_2 are malformed, it's caught here */
-	err = check_channel_announcement(rstate,
+	err = check_channel_announcement(rstate, rstate,
 					 &pending->node_id_1,
 					 &pending->node_id_2,
 					 &pending->bitcoin_key_1,
@@ -1654,7 +1332,8 @@ static void process_pending_channel_update(struct routing_state *rstate,
 		return;
 
 	/* FIXME: We don't remember who sent us updates, so can't error them */
-	err = handle_channel_update(rstate, cupdate, "pending update", NULL);
+	err = handle_channel_update(rstate, cupdate, "pending update", NULL,
+				    NULL);
 	if (err) {
 		status_trace("Pending channel_update for %s: %s",
 			     type_to_string(tmpctx, struct short_channel_id, scid),
@@ -1748,11 +1427,12 @@ static void update_pending(struct pending_cannouncement *pending,
 	}
 }
 
-static void set_connection_values(struct chan *chan,
+static void set_connection_values(struct routing_state *rstate,
+				  struct chan *chan,
 				  int idx,
 				  u32 base_fee,
 				  u32 proportional_fee,
-				  u32 delay,
+				  u16 delay,
 				  u8 message_flags,
 				  u8 channel_flags,
 				  u32 timestamp,
@@ -1762,8 +1442,8 @@ static void set_connection_values(struct chan *chan,
 	struct half_chan *c = &chan->half[idx];
 
 	c->delay = delay;
-	c->htlc_minimum = htlc_minimum;
-	c->htlc_maximum = htlc_maximum;
+	set_half_chan_htlc_limits(rstate, chan, idx,
+				  htlc_minimum, htlc_maximum);
 	c->base_fee = base_fee;
 	c->proportional_fee = proportional_fee;
 	c->message_flags = message_flags;
@@ -1876,7 +1556,7 @@ bool routing_add_channel_update(struct routing_state *rstate,
 	if (amount_msat_greater(htlc_maximum, rstate->chainparams->max_payment))
 		htlc_maximum = rstate->chainparams->max_payment;
 
-	set_connection_values(chan, direction, fee_base_msat,
+	set_connection_values(rstate, chan, direction, fee_base_msat,
 			      fee_proportional_millionths, expiry,
 			      message_flags, channel_flags,
 			      timestamp, htlc_minimum, htlc_maximum);
@@ -1910,6 +1590,8 @@ bool routing_add_channel_update(struct routing_state *rstate,
 								  update);
 		} else
 			hc->bcast.index = index;
+		routing_chan_timestamps_changed(rstate, chan);
+		routing_chan_updated(rstate, chan);
 		return true;
 	}
 
@@ -1922,6 +1604,9 @@ bool routing_add_channel_update(struct routing_state *rstate,
 					   hc->bcast.timestamp,
 					   NULL);
 
+	routing_chan_timestamps_changed(rstate, chan);
+	routing_chan_updated(rstate, chan);
+
 	if (uc) {
 		/* If we were waiting for these nodes to appear (or gain a
 		   public channel), process node_announcements now */
@@ -1949,6 +1634,76 @@ static const struct node_id *get_channel_owner(struct routing_state *rstate,
 	return NULL;
 }
 
+bool gossip_sigs_get(struct routing_state *rstate, const u8 *msg,
+		     struct gossip_sigs *sigs)
+{
+	struct bitcoin_blkid chain_hash;
+	struct short_channel_id scid;
+	struct node_id id[2];
+	const struct node_id *owner;
+	u8 *features, *addresses;
+	u8 rgb[3], alias[32];
+	u8 message_flags, channel_flags;
+	u16 cltv_expiry_delta;
+	struct amount_msat htlc_minimum;
+	u32 timestamp, fee_base_msat, fee_proportional_millionths;
+	size_t offset;
+
+	switch (fromwire_peektype(msg)) {
+	case WIRE_CHANNEL_ANNOUNCEMENT:
+		if (!fromwire_channel_announcement(tmpctx, msg,
+						   &sigs->sig[0], &sigs->sig[1],
+						   &sigs->sig[2], &sigs->sig[3],
+						   &features, &chain_hash,
+						   &scid, &id[0], &id[1],
+						   &sigs->key[2], &sigs->key[3])
+		    || !node_pubkey(rstate, &id[0], &sigs->key[0])
+		    || !node_pubkey(rstate, &id[1], &sigs->key[1]))
+			return false;
+		sigs->num = 4;
+		offset = 258;
+		break;
+	case WIRE_CHANNEL_UPDATE:
+		if (!fromwire_channel_update(msg, &sigs->sig[0], &chain_hash,
+					     &scid, &timestamp,
+					     &message_flags, &channel_flags,
+					     &cltv_expiry_delta, &htlc_minimum,
+					     &fee_base_msat,
+					     &fee_proportional_millionths))
+			return false;
+		owner = get_channel_owner(rstate, &scid, channel_flags & 0x1);
+		if (!owner || !node_pubkey(rstate, owner, &sigs->key[0]))
+			return false;
+		sigs->num = 1;
+		offset = 66;
+		break;
+	case WIRE_NODE_ANNOUNCEMENT:
+		if (!fromwire_node_announcement(tmpctx, msg, &sigs->sig[0],
+						&features, &timestamp, &id[0],
+						rgb, alias, &addresses)
+		    || !node_pubkey(rstate, &id[0], &sigs->key[0]))
+			return false;
+		sigs->num = 1;
+		offset = 66;
+		break;
+	default:
+		return false;
+	}
+
+	sha256_double(&sigs->hash, msg + offset, tal_count(msg) - offset);
+	return true;
+}
+
+bool gossip_sigs_check(const struct gossip_sigs *sigs)
+{
+	for (size_t i = 0; i < sigs->num; i++) {
+		if (!check_signed_hash(&sigs->hash, &sigs->sig[i],
+				       &sigs->key[i]))
+			return false;
+	}
+	return true;
+}
+
 void remove_channel_from_store(struct routing_state *rstate,
 			       struct chan *chan)
 {
@@ -1971,9 +1726,208 @@ void remove_channel_from_store(struct routing_state *rstate,
 			    &chan->half[1].bcast, update_type);
 }
 
+/*~ A node flapping a channel (or all its channels) costs us store space,
+ * and costs every peer we send it to bandwidth.  So each channel direction,
+ * and each node, has a bucket of tokens: an update takes one, and they refill
+ * with time.  We count tokens used, so an empty struct is a full bucket:
+ * channel directions only get a struct update_tokens while theirs isn't. */
+static u32 ratelimit_now(void)
+{
+	return time_mono().ts.tv_sec;
+}
+
+/* Refill a bucket of @burst tokens, which fills completely in @period
+ * seconds: returns how many are used now. */
+static u32 refill_tokens(u32 used, u32 *tokens_time, u32 now,
+			 u32 burst, u64 period)
+{
+	u64 refill;
+
+	if (now <= *tokens_time)
+		return used;
+
+	refill = (u64)(now - *tokens_time) * burst / period;
+	if (refill >= used) {
+		*tokens_time = now;
+		return 0;
+	}
+	/* Keep the part of a token we haven't earned yet. */
+	*tokens_time += refill * period / burst;
+	return used - refill;
+}
+
+/* Returns true (and uses a token from each) if this update isn't too soon. */
+static bool take_update_tokens(struct routing_state *rstate,
+			       struct chan *chan, int direction)
+{
+	struct update_tokens *ut;
+	struct node *node = chan->nodes[direction];
+	/* Both are user-set u32s: this doesn't fit in one. */
+	u64 period = (u64)rstate->ratelimit_burst * rstate->ratelimit_refill;
+	u32 now = ratelimit_now(), chan_used, node_used;
+
+	ut = uintmap_get(&rstate->update_tokens[direction], chan->scid.u64);
+	if (ut) {
+		chan_used = refill_tokens(ut->used, &ut->time, now,
+					  rstate->ratelimit_burst, period);
+		ut->used = chan_used;
+	} else
+		chan_used = 0;
+	node_used = refill_tokens(node->tokens_used, &node->tokens_time, now,
+				  rstate->ratelimit_node_burst, period);
+	node->tokens_used = node_used;
+
+	if (chan_used >= rstate->ratelimit_burst
+	    || node_used >= rstate->ratelimit_node_burst)
+		return false;
+
+	if (!ut) {
+		ut = tal(rstate, struct update_tokens);
+		ut->time = now;
+		ut->used = 0;
+		uintmap_add(&rstate->update_tokens[direction],
+			    chan->scid.u64, ut);
+	}
+	ut->used++;
+	node->tokens_used++;
+	return true;
+}
+
+/* Forget buckets which have filled up again. */
+static void prune_update_tokens(struct routing_state *rstate)
+{
+	u64 period = (u64)rstate->ratelimit_burst * rstate->ratelimit_refill;
+	u32 now = ratelimit_now();
+
+	for (int dir = 0; dir < 2; dir++) {
+		struct update_tokens *ut;
+		u64 *full = tal_arr(tmpctx, u64, 0);
+		u64 idx;
+
+		for (ut = uintmap_first(&rstate->update_tokens[dir], &idx);
+		     ut;
+		     ut = uintmap_after(&rstate->update_tokens[dir], &idx)) {
+			ut->used = refill_tokens(ut->used, &ut->time, now,
+						 rstate->ratelimit_burst,
+						 period);
+			if (ut->used == 0)
+				tal_arr_expand(&full, idx);
+		}
+		for (size_t i = 0; i < tal_count(full); i++)
+			tal_free(uintmap_del(&rstate->update_tokens[dir],
+					     full[i]));
+	}
+}
+
+/* Hold onto it (if it's the newest) until there's a token for it. */
+static void suppress_update(struct routing_state *rstate,
+			    const struct chan *chan, int direction,
+			    u32 timestamp, const u8 *update)
+{
+	struct suppressed_update *su;
+
+	su = uintmap_get(&rstate->suppressed[direction], chan->scid.u64);
+	if (!su) {
+		su = tal(rstate, struct suppressed_update);
+		su->update = NULL;
+		uintmap_add(&rstate->suppressed[direction], chan->scid.u64, su);
+	} else if (su->timestamp >= timestamp)
+		return;
+
+	su->timestamp = timestamp;
+	tal_free(su->update);
+	su->update = tal_dup_arr(su, u8, update, tal_count(update), 0);
+}
+
+/* Returns true if this (newer) update has to wait. */
+static bool ratelimit_update(struct routing_state *rstate,
+			     const struct short_channel_id *scid,
+			     int direction, u32 timestamp,
+			     const u8 *update)
+{
+	struct chan *chan = get_channel(rstate, scid);
+	const struct half_chan *hc;
+
+	if (!rstate->ratelimit_burst || !chan)
+		return false;
+
+	/* The first update is always welcome, and old ones are ignored
+	 * anyway. */
+	hc = &chan->half[direction];
+	if (!is_halfchan_defined(hc) || timestamp <= hc->bcast.timestamp)
+		return false;
+
+	if (!take_update_tokens(rstate, chan, direction)) {
+		suppress_update(rstate, chan, direction, timestamp, update);
+		return true;
+	}
+
+	/* This one replaces anything we were holding. */
+	tal_free(uintmap_del(&rstate->suppressed[direction], scid->u64));
+	return false;
+}
+
+size_t routing_release_suppressed(struct routing_state *rstate)
+{
+	size_t held = 0;
+
+	for (int dir = 0; dir < 2; dir++) {
+		struct suppressed_update *su, **ready;
+		u64 idx;
+
+		/* Applying them changes the map, so gather them first. */
+		ready = tal_arr(tmpctx, struct suppressed_update *, 0);
+		for (su = uintmap_first(&rstate->suppressed[dir], &idx);
+		     su;
+		     su = uintmap_after(&rstate->suppressed[dir], &idx)) {
+			struct short_channel_id scid;
+			struct chan *chan;
+
+			scid.u64 = idx;
+			chan = get_channel(rstate, &scid);
+			if (!take_update_tokens(rstate, chan, dir)) {
+				held++;
+				continue;
+			}
+			uintmap_del(&rstate->suppressed[dir], idx);
+			tal_arr_expand(&ready, su);
+		}
+
+		for (size_t i = 0; i < tal_count(ready); i++) {
+			/* We checked it when it came in: if it's been
+			 * overtaken since, this ignores it. */
+			if (!routing_add_channel_update(rstate,
+							ready[i]->update, 0))
+				status_broken("Failed adding suppressed"
+					      " channel_update %s",
+					      tal_hex(tmpctx,
+						      ready[i]->update));
+			tal_free(ready[i]);
+		}
+	}
+	return held;
+}
+
+size_t routing_num_suppressed(const struct routing_state *rstate)
+{
+	size_t num = 0;
+
+	for (int dir = 0; dir < 2; dir++) {
+		u64 idx;
+
+		for (const struct suppressed_update *su
+			     = uintmap_first(&rstate->suppressed[dir], &idx);
+		     su;
+		     su = uintmap_after(&rstate->suppressed[dir], &idx))
+			num++;
+	}
+	return num;
+}
+
 u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 			  const char *source,
-			  struct short_channel_id *unknown_scid)
+			  struct short_channel_id *unknown_scid,
+			  bool *suppressed)
 {
 	u8 *serialized;
 	const struct node_id *owner;
@@ -1991,6 +1945,9 @@ u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 	struct pending_cannouncement *pending;
 	u8 *err;
 
+	if (suppressed)
+		*suppressed = false;
+
 	serialized = tal_dup_arr(tmpctx, u8, update, len, 0);
 	if (!fromwire_channel_update(serialized, &signature,
 				     &chain_hash, &short_channel_id,
@@ -2053,7 +2010,7 @@ u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 		return NULL;
 	}
 
-	err = check_channel_update(rstate, owner, &signature, serialized);
+	err = check_channel_update(rstate, rstate, owner, &signature, serialized);
 	if (err) {
 		/* BOLT #7:
 		 *
@@ -2067,6 +2024,18 @@ u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 		return err;
 	}
 
+	/* Only peers get rate limited: we trust ourselves. */
+	if (suppressed
+	    && ratelimit_update(rstate, &short_channel_id, direction,
+				timestamp, serialized)) {
+		SUPERVERBOSE("Suppressing channel_update for %s/%u",
+			     type_to_string(tmpctx, struct short_channel_id,
+					    &short_channel_id),
+			     direction);
+		*suppressed = true;
+		return NULL;
+	}
+
 	status_trace("Received channel_update for channel %s/%d now %s (from %s)",
 		     type_to_string(tmpctx, struct short_channel_id,
 				    &short_channel_id),
@@ -2251,7 +2220,7 @@ u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node_ann)
 
 	sha256_double(&hash, serialized + 66, tal_count(serialized) - 66);
 	/* If node_id is invalid, it fails here */
-	if (!check_signed_hash_nodeid(&hash, &signature, &node_id)) {
+	if (!check_signed_hash_nodeid(rstate, &hash, &signature, &node_id)) {
 		/* BOLT #7:
 		 *
 		 * - if `signature` is not a valid signature, using
@@ -2295,6 +2264,132 @@ u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node_ann)
 	return NULL;
 }
 
+/* Any change to a channel drops the routes using it from the cache, but
+ * the amount may differ from the one the route was found for. */
+static struct route_hop *cached_route(const tal_t *ctx,
+				      struct routing_state *rstate,
+				      const struct route_query *rq)
+{
+	const struct short_channel_id_dir *route;
+	const struct snap_edge *e;
+	struct route_hop *hops;
+	u32 *edges;
+
+	route = route_cache_get(rstate->route_cache, rq->cache_key);
+	if (!route)
+		return NULL;
+
+	edges = tal_arr(tmpctx, u32, tal_count(route));
+	for (size_t i = 0; i < tal_count(route); i++) {
+		edges[i] = routing_snapshot_edge(rq->snap, &route[i]);
+		if (edges[i] == SNAP_NONE || !rq->snap->edges[edges[i]].enabled)
+			goto unusable;
+	}
+
+	hops = routing_snapshot_route_hops(ctx, rq->snap, edges,
+					   tal_count(edges), rq->dst,
+					   rq->msat, rq->final_cltv);
+	if (!hops)
+		goto unusable;
+
+	for (size_t i = 0; i < tal_count(hops); i++) {
+		e = &rq->snap->edges[edges[i]];
+		if (amount_msat_less(hops[i].amount, e->htlc_minimum)
+		    || amount_msat_greater(hops[i].amount, e->htlc_maximum)) {
+			tal_free(hops);
+			goto unusable;
+		}
+	}
+	return hops;
+
+unusable:
+	route_cache_forget(rstate->route_cache, rq->cache_key);
+	return NULL;
+}
+
+bool route_query_init(const tal_t *ctx,
+		      struct route_query *rq,
+		      struct routing_state *rstate,
+		      const struct node_id *source,
+		      const struct node_id *destination,
+		      struct amount_msat msat, double riskfactor,
+		      u32 final_cltv,
+		      double fuzz, u64 seed,
+		      const struct short_channel_id_dir *excluded,
+		      size_t max_hops)
+{
+	rq->cache_key = NULL;
+	rq->hops = NULL;
+
+	if (amount_msat_eq(msat, AMOUNT_MSAT(0)))
+		return false;
+
+	rq->snap = get_snapshot(rstate);
+	if (!route_endpoints(rstate, rq->snap, source, destination,
+			     &rq->src, &rq->dst, &rq->me))
+		return false;
+	rq->snap->refs++;
+
+	/* The search skips these edges, rather than us touching the graph. */
+	rq->excluded = tal_arr(ctx, u32, tal_count(excluded));
+	rq->num_excluded = 0;
+	for (size_t i = 0; i < tal_count(excluded); i++) {
+		u32 e = routing_snapshot_edge(rq->snap, &excluded[i]);
+		if (e != SNAP_NONE)
+			rq->excluded[rq->num_excluded++] = e;
+	}
+
+	rq->msat = msat;
+	rq->riskfactor = riskfactor / BLOCKS_PER_YEAR / 100;
+	rq->fuzz = fuzz;
+	rq->base_seed.u.u64[0] = rq->base_seed.u.u64[1] = seed;
+	rq->max_hops = max_hops;
+	rq->final_cltv = final_cltv;
+
+	if (rstate->route_cache) {
+		rq->cache_key = route_cache_key_new(ctx, source, destination,
+						    msat, riskfactor, fuzz,
+						    excluded, max_hops);
+		rq->hops = cached_route(ctx, rstate, rq);
+	}
+	return true;
+}
+
+bool route_query_run(const struct route_query *rq, struct snap_query *q)
+{
+	struct amount_msat fee;
+
+	return routing_snapshot_find_route(rq->snap, q,
+					   rq->src, rq->dst, rq->me,
+					   rq->msat, rq->riskfactor,
+					   rq->fuzz, &rq->base_seed,
+					   rq->max_hops,
+					   rq->excluded, rq->num_excluded,
+					   &fee);
+}
+
+struct route_hop *route_query_hops(const tal_t *ctx,
+				   struct routing_state *rstate,
+				   const struct route_query *rq,
+				   const u32 *route, size_t len)
+{
+	struct route_hop *hops;
+
+	hops = routing_snapshot_route_hops(ctx, rq->snap, route, len,
+					   rq->dst, rq->msat, rq->final_cltv);
+	if (hops && rq->cache_key && rstate->route_cache)
+		route_cache_add(rstate->route_cache, rq->cache_key, hops);
+	return hops;
+}
+
+void route_query_done(struct routing_state *rstate, struct route_query *rq)
+{
+	assert(rq->snap->refs > 0);
+	if (--rq->snap->refs == 0 && rq->snap != rstate->snapshot)
+		tal_free(rq->snap);
+	rq->snap = NULL;
+}
+
 struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    const struct node_id *source,
 			    const struct node_id *destination,
@@ -2304,80 +2399,100 @@ struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    const struct short_channel_id_dir *excluded,
 			    size_t max_hops)
 {
-	struct chan **route;
-	struct amount_msat total_amount;
-	unsigned int total_delay;
-	struct amount_msat fee;
-	struct route_hop *hops;
-	struct node *n;
-	struct amount_msat *saved_capacity;
-	struct siphash_seed base_seed;
-
-	saved_capacity = tal_arr(tmpctx, struct amount_msat, tal_count(excluded));
-
-	base_seed.u.u64[0] = base_seed.u.u64[1] = seed;
+	struct route_query rq;
+	struct snap_query *q = rstate->query;
+	struct route_hop *hops = NULL;
 
-	if (amount_msat_eq(msat, AMOUNT_MSAT(0)))
+	if (!route_query_init(tmpctx, &rq, rstate, source, destination, msat,
+			      riskfactor, final_cltv, fuzz, seed, excluded,
+			      max_hops))
 		return NULL;
 
-	/* Temporarily set excluded channels' capacity to zero. */
-	for (size_t i = 0; i < tal_count(excluded); i++) {
-		struct chan *chan = get_channel(rstate, &excluded[i].scid);
-		if (!chan)
-			continue;
-		saved_capacity[i] = chan->half[excluded[i].dir].htlc_maximum;
-		chan->half[excluded[i].dir].htlc_maximum = AMOUNT_MSAT(0);
+	if (rq.hops) {
+		route_query_done(rstate, &rq);
+		return tal_steal(ctx, rq.hops);
 	}
 
-	route = find_route(ctx, rstate, source, destination, msat,
-			   riskfactor / BLOCKS_PER_YEAR / 100,
-			   fuzz, &base_seed, max_hops, &fee);
+	if (route_query_run(&rq, q))
+		hops = route_query_hops(ctx, rstate, &rq,
+					q->route, q->route_len);
+	snap_query_flush_log(q->log, q->num_log);
+	route_query_done(rstate, &rq);
 
-	/* Now restore the capacity. */
-	for (size_t i = 0; i < tal_count(excluded); i++) {
-		struct chan *chan = get_channel(rstate, &excluded[i].scid);
-		if (!chan)
-			continue;
-		chan->half[excluded[i].dir].htlc_maximum = saved_capacity[i];
-	}
+	return hops;
+}
 
-	if (!route) {
-		return NULL;
-	}
+/*~ Finding the k shortest loopless paths (Yen's algorithm) gives routes
+ * which mostly differ in a single channel: if a payment fails on one, the
+ * next probably goes through the same bottleneck.  Making each route avoid
+ * the channels of the ones before is cheaper, and gives the payer genuine
+ * alternatives. */
+struct route_hop **get_routes(const tal_t *ctx, struct routing_state *rstate,
+			      const struct node_id *source,
+			      const struct node_id *destination,
+			      struct amount_msat msat, double riskfactor,
+			      u32 final_cltv,
+			      double fuzz, u64 seed,
+			      const struct short_channel_id_dir *excluded,
+			      size_t max_hops,
+			      size_t num_routes)
+{
+	struct route_query rq;
+	struct snap_query *q = rstate->query;
+	struct route_hop **routes = tal_arr(ctx, struct route_hop *, 0);
+	size_t num_excluded;
+
+	if (!route_query_init(tmpctx, &rq, rstate, source, destination, msat,
+			      riskfactor, final_cltv, fuzz, seed, excluded,
+			      max_hops))
+		return routes;
+
+	while (tal_count(routes) < num_routes) {
+		struct route_hop *hops;
+
+		if (rq.hops) {
+			hops = tal_steal(routes, rq.hops);
+			rq.hops = NULL;
+		} else {
+			bool found = route_query_run(&rq, q);
 
-	/* Fees, delays need to be calculated backwards along route. */
-	hops = tal_arr(ctx, struct route_hop, tal_count(route));
-	total_amount = msat;
-	total_delay = final_cltv;
-
-	/* Start at destination node. */
-	n = get_node(rstate, destination);
-	for (int i = tal_count(route) - 1; i >= 0; i--) {
-		const struct half_chan *c;
-
-		int idx = half_chan_to(n, route[i]);
-		c = &route[i]->half[idx];
-		hops[i].channel_id = route[i]->scid;
-		hops[i].nodeid = n->id;
-		hops[i].amount = total_amount;
-		hops[i].delay = total_delay;
-		hops[i].direction = idx;
-
-		/* Since we calculated this route, it should not overflow! */
-		if (!amount_msat_add_fee(&total_amount,
-					 c->base_fee, c->proportional_fee)) {
-			status_broken("Route overflow step %i: %s + %u/%u!?",
-				      i, type_to_string(tmpctx, struct amount_msat,
-							&total_amount),
-				      c->base_fee, c->proportional_fee);
-			return tal_free(hops);
+			snap_query_flush_log(q->log, q->num_log);
+			if (!found)
+				break;
+			hops = route_query_hops(routes, rstate, &rq,
+						q->route, q->route_len);
+			if (!hops)
+				break;
 		}
-		total_delay += c->delay;
-		n = other_node(n, route[i]);
+		tal_arr_expand(&routes, hops);
+
+		/* Only the first is what anyone else asking would get. */
+		rq.cache_key = NULL;
+
+		/* Our own channels don't count: we know if they can carry
+		 * it, and we may only have one. */
+		num_excluded = rq.num_excluded;
+		tal_resize(&rq.excluded, rq.num_excluded + tal_count(hops));
+		for (size_t i = (rq.me == SNAP_NONE ? 0 : 1);
+		     i < tal_count(hops);
+		     i++) {
+			struct short_channel_id_dir scidd;
+			u32 e;
+
+			scidd.scid = hops[i].channel_id;
+			scidd.dir = hops[i].direction;
+			e = routing_snapshot_edge(rq.snap, &scidd);
+			if (e != SNAP_NONE)
+				rq.excluded[rq.num_excluded++] = e;
+		}
+
+		/* Straight to our peer?  There's no other way then. */
+		if (rq.num_excluded == num_excluded)
+			break;
 	}
-	assert(node_id_eq(&n->id, source ? source : &rstate->local_id));
+	route_query_done(rstate, &rq);
 
-	return hops;
+	return routes;
 }
 
 void routing_failure(struct routing_state *rstate,
@@ -2400,7 +2515,7 @@ void routing_failure(struct routing_state *rstate,
 	/* lightningd will only extract this if UPDATE is set. */
 	if (channel_update) {
 		u8 *err = handle_channel_update(rstate, channel_update, "error",
-						NULL);
+						NULL, NULL);
 		if (err) {
 			status_unusual("routing_failure: "
 				       "bad channel_update %s",
@@ -2476,20 +2591,24 @@ void route_prune(struct routing_state *rstate)
 	/* Anything below this highwater mark ought to be pruned */
 	const s64 highwater = now - rstate->prune_timeout;
 	struct chan **pruned = tal_arr(tmpctx, struct chan *, 0);
+	struct unupdated_channel *uc;
 	u64 idx;
 
-	/* Now iterate through all channels and see if it is still alive */
-	for (struct chan *chan = uintmap_first(&rstate->chanmap, &idx);
-	     chan;
-	     chan = uintmap_after(&rstate->chanmap, &idx)) {
-		/* Local-only?  Don't prune. */
-		if (!is_chan_public(chan))
-			continue;
+	/* Only buckets which start below the highwater mark can hold
+	 * channels to prune: the last of those may hold some which aren't. */
+	for (struct prune_bucket *b = uintmap_first(&rstate->prune_buckets, &idx);
+	     b && (s64)(idx * PRUNE_BUCKET_SECS) < highwater;
+	     b = uintmap_after(&rstate->prune_buckets, &idx)) {
+		struct chan *chan;
+
+		list_for_each(&b->chans, chan, prune_list) {
+			/* Local-only?  Don't prune. */
+			if (!is_chan_public(chan))
+				continue;
+
+			if (chan_newest_timestamp(chan) >= highwater)
+				continue;
 
-		if ((!is_halfchan_defined(&chan->half[0])
-		     || chan->half[0].bcast.timestamp < highwater)
-		    && (!is_halfchan_defined(&chan->half[1])
-			|| chan->half[1].bcast.timestamp < highwater)) {
 			status_trace(
 			    "Pruning channel %s from network view (ages %"PRIu64" and %"PRIu64"s)",
 			    type_to_string(tmpctx, struct short_channel_id,
@@ -2505,20 +2624,18 @@ void route_prune(struct routing_state *rstate)
 	}
 
 	/* Look for channels we had an announcement for, but no update. */
-	for (struct unupdated_channel *uc
-		     = uintmap_first(&rstate->unupdated_chanmap, &idx);
-	     uc;
-	     uc = uintmap_after(&rstate->unupdated_chanmap, &idx)) {
-		if (uc->added.ts.tv_sec < highwater) {
-			tal_free(uc);
-		}
-	}
+	while ((uc = list_top(&rstate->unupdated_by_age,
+			      struct unupdated_channel, age_list)) != NULL
+	       && uc->added.ts.tv_sec < highwater)
+		tal_free(uc);
 
 	/* Now free all the chans and maybe even nodes. */
 	for (size_t i = 0; i < tal_count(pruned); i++) {
 		remove_channel_from_store(rstate, pruned[i]);
 		free_chan(rstate, pruned[i]);
 	}
+
+	prune_update_tokens(rstate);
 }
 
 #if DEVELOPER
@@ -2538,9 +2655,43 @@ void memleak_remove_routing_tables(struct htable *memtable,
 		if (node_uses_chan_map(n))
 			memleak_remove_htable(memtable, &n->chans.map.raw);
 	}
+	if (rstate->route_cache)
+		memleak_remove_route_cache(memtable, rstate->route_cache);
+	memleak_remove_uintmap(memtable, &rstate->prune_buckets);
+	memleak_remove_uintmap(memtable, &rstate->htlc_limits[0]);
+	memleak_remove_uintmap(memtable, &rstate->htlc_limits[1]);
+	memleak_remove_uintmap(memtable, &rstate->update_tokens[0]);
+	memleak_remove_uintmap(memtable, &rstate->update_tokens[1]);
+	memleak_remove_uintmap(memtable, &rstate->suppressed[0]);
+	memleak_remove_uintmap(memtable, &rstate->suppressed[1]);
 }
 #endif /* DEVELOPER */
 
+void log_routing_memory(const struct routing_state *rstate)
+{
+	struct slab_stats chans, nodes;
+	size_t limits = 0;
+	u64 idx;
+
+	slab_get_stats(rstate->chan_slab, &chans);
+	slab_get_stats(rstate->node_slab, &nodes);
+	for (int i = 0; i < 2; i++) {
+		for (struct half_chan_limits *l
+			     = uintmap_first(&rstate->htlc_limits[i], &idx);
+		     l;
+		     l = uintmap_after(&rstate->htlc_limits[i], &idx))
+			limits++;
+	}
+
+	status_debug("routing memory: %zu chans of %zu bytes (%zu bytes"
+		     " in %zu pages), %zu nodes of %zu bytes (%zu bytes"
+		     " in %zu pages), %zu half_chans with htlc limits of"
+		     " %zu bytes elsewhere",
+		     chans.in_use, chans.objsize, chans.bytes, chans.pages,
+		     nodes.in_use, nodes.objsize, nodes.bytes, nodes.pages,
+		     limits, sizeof(struct half_chan_limits));
+}
+
 bool handle_local_add_channel(struct routing_state *rstate,
 			      const u8 *msg, u64 index)
 {
@@ -2616,21 +2767,21 @@ void remove_all_gossip(struct routing_state *rstate)
 
 	/* We don't want them to try to delete from store, so do this
 	 * manually. */
-	while ((n = node_map_first(rstate->nodes, &nit)) != NULL) {
-		tal_del_destructor2(n, destroy_node, rstate);
-		if (node_uses_chan_map(n))
-			chan_map_clear(&n->chans.map);
-		node_map_del(rstate->nodes, n);
-		tal_free(n);
-	}
+	while ((n = node_map_first(rstate->nodes, &nit)) != NULL)
+		free_node(rstate, n);
 
 	/* Now free all the channels. */
 	while ((c = uintmap_first(&rstate->chanmap, &index)) != NULL) {
 		uintmap_del(&rstate->chanmap, index);
+		for (int i = 0; i < 2; i++) {
+			tal_free(uintmap_del(&rstate->htlc_limits[i], index));
+			tal_free(uintmap_del(&rstate->update_tokens[i], index));
+			tal_free(uintmap_del(&rstate->suppressed[i], index));
+		}
 
 		/* Remove from local_disabled_map if it's there. */
 		chan_map_del(&rstate->local_disabled_map, c);
-		tal_free(c);
+		slab_free(rstate->chan_slab, c);
 	}
 
 	while ((uc = uintmap_first(&rstate->unupdated_chanmap, &index)) != NULL)
@@ -2,32 +2,50 @@
 #define LIGHTNING_GOSSIPD_ROUTING_H
 #include "config.h"
 #include <bitcoin/pubkey.h>
+#include <bitcoin/shadouble.h>
 #include <ccan/crypto/siphash24/siphash24.h>
 #include <ccan/htable/htable_type.h>
 #include <ccan/intmap/intmap.h>
+#include <ccan/list/list.h>
 #include <ccan/time/time.h>
 #include <common/amount.h>
 #include <common/node_id.h>
 #include <gossipd/broadcast.h>
 #include <gossipd/gossip_constants.h>
 #include <gossipd/gossip_store.h>
+#include <gossipd/routing_snapshot.h>
 #include <wire/gen_onion_wire.h>
 #include <wire/wire.h>
 
+struct half_chan_limits;
+struct suppressed_update;
+struct update_tokens;
+struct prune_bucket;
+struct range_cache;
+struct route_cache;
+struct route_cache_key;
 struct routing_state;
 
+/*~ There are two of these for each of a million channels, so we squeeze
+ * them: the htlc limits almost always fit in 32 bits (minimum) and are the
+ * channel capacity (maximum), so we only keep the rest elsewhere; use
+ * half_chan_htlc_minimum() and friends to get at them. */
 struct half_chan {
 	/* millisatoshi. */
 	u32 base_fee;
 	/* millionths */
 	u32 proportional_fee;
 
-	/* Delay for HTLC in blocks.*/
-	u32 delay;
-
 	/* Timestamp and index into store file */
 	struct broadcastable bcast;
 
+	/* Minimum msatoshi in an HTLC, or HALF_CHAN_HTLC_LIMITS_ELSEWHERE if
+	 * the limits are in rstate->htlc_limits. */
+	u32 htlc_minimum_msat;
+
+	/* Delay for HTLC in blocks.*/
+	u16 delay;
+
 	/* Flags as specified by the `channel_update`s, among other
 	 * things indicated direction wrt the `channel_id` */
 	u8 channel_flags;
@@ -35,11 +53,10 @@ struct half_chan {
 	/* Flags as specified by the `channel_update`s, indicates
 	 * optional fields.  */
 	u8 message_flags;
-
-	/* Minimum and maximum number of msatoshi in an HTLC */
-	struct amount_msat htlc_minimum, htlc_maximum;
 };
 
+#define HALF_CHAN_HTLC_LIMITS_ELSEWHERE 0xFFFFFFFF
+
 struct chan {
 	struct short_channel_id scid;
 
@@ -55,11 +72,36 @@ struct chan {
 	struct broadcastable bcast;
 
 	struct amount_sat sat;
+
+	/* Filed by the newer half_chan timestamp, for route_prune() */
+	struct prune_bucket *prune_bucket;
+	struct list_node prune_list;
 };
 
 /* Use this instead of tal_free(chan)! */
 void free_chan(struct routing_state *rstate, struct chan *chan);
 
+/* Minimum and maximum number of msatoshi in an HTLC */
+struct amount_msat half_chan_htlc_minimum(const struct routing_state *rstate,
+					  const struct chan *chan, int dir);
+struct amount_msat half_chan_htlc_maximum(const struct routing_state *rstate,
+					  const struct chan *chan, int dir);
+void set_half_chan_htlc_limits(struct routing_state *rstate,
+			       struct chan *chan, int dir,
+			       struct amount_msat htlc_minimum,
+			       struct amount_msat htlc_maximum);
+
+/* Call this if you alter a chan's half_chan timestamps. */
+void routing_chan_timestamps_changed(struct routing_state *rstate,
+				     struct chan *chan);
+
+/* Call this if you alter a chan's half_chans or local disable state. */
+void routing_chan_updated(struct routing_state *rstate,
+			  const struct chan *chan);
+
+/* Work out landmarks for route finding, if they're missing (slow). */
+void routing_refresh_landmarks(struct routing_state *rstate);
+
 /* A local channel can exist which isn't announced: we abuse timestamp
  * to indicate this. */
 static inline bool is_chan_public(const struct chan *chan)
@@ -109,19 +151,19 @@ struct node {
 	/* Timestamp and index into store file */
 	struct broadcastable bcast;
 
+	/* id, decompressed, once we've needed it for a signature check */
+	bool key_valid;
+	struct pubkey key;
+
+	/* channel_update rate limiting, for all its channels together. */
+	u16 tokens_used;
+	u32 tokens_time;
+
 	/* Channels connecting us to other nodes */
 	union {
 		struct chan_map map;
 		struct chan *arr[NUM_IMMEDIATE_CHANS+1];
 	} chans;
-
-	/* Temporary data for routefinding. */
-	struct {
-		/* Total to get to here from target. */
-		struct amount_msat total;
-		/* Total risk premium of this route. */
-		struct amount_msat risk;
-	} dijkstra;
 };
 
 const struct node_id *node_map_keyof_node(const struct node *n);
@@ -215,6 +257,10 @@ struct routing_state {
 	/* All known nodes. */
 	struct node_map *nodes;
 
+	/* The same, sorted by id (NULL if nodes have come or gone since):
+	 * use routing_nodes_by_id(). */
+	struct node **nodes_by_id;
+
 	/* node_announcements which are waiting on pending_cannouncement */
 	struct pending_node_map *pending_node_map;
 
@@ -233,9 +279,33 @@ struct routing_state {
         /* A map of channels indexed by short_channel_ids */
 	UINTMAP(struct chan *) chanmap;
 
+	/* Where the chans and nodes live */
+	struct slab *chan_slab, *node_slab;
+
+	/* The unusual half_chan htlc limits, for each direction */
+	UINTMAP(struct half_chan_limits *) htlc_limits[2];
+
+	/* channel_update rate limits (burst 0 means none): buckets of burst
+	 * tokens per channel direction, node_burst per node, each taking
+	 * burst * refill seconds to fill. */
+	u32 ratelimit_burst, ratelimit_node_burst, ratelimit_refill;
+
+	/* Each channel direction's bucket, if it's not full: most never
+	 * update often enough to need one. */
+	UINTMAP(struct update_tokens *) update_tokens[2];
+
+	/* Newest rate-limited channel_update for each direction, which we'll
+	 * apply once its buckets refill. */
+	UINTMAP(struct suppressed_update *) suppressed[2];
+
         /* A map of channel_announcements indexed by short_channel_ids:
 	 * we haven't got a channel_update for these yet. */
 	UINTMAP(struct unupdated_channel *) unupdated_chanmap;
+	/* The same, oldest first */
+	struct list_head unupdated_by_age;
+
+	/* Channels by the hour of their newest channel_update */
+	UINTMAP(struct prune_bucket *) prune_buckets;
 
 	/* Has one of our own channels been announced? */
 	bool local_channel_announced;
@@ -247,6 +317,22 @@ struct routing_state {
         /* A map of (local) disabled channels by short_channel_ids */
 	struct chan_map local_disabled_map;
 
+	/* Compact copy of the graph for route finding (NULL if stale) */
+	struct routing_snapshot *snapshot;
+
+	/* Scratch space for route finding in the main thread */
+	struct snap_query *query;
+
+	/* Routes we found recently (NULL if not caching) */
+	struct route_cache *route_cache;
+
+	/* Replies to query_channel_range we encoded recently (or NULL) */
+	struct range_cache *range_cache;
+
+	/* Signatures already checked for the message being handled (or
+	 * NULL): see gossip_sigs_get(). */
+	const struct gossip_sigs *verified;
+
 #if DEVELOPER
 	/* Override local time for gossip messages */
 	struct timeabs *gossip_time;
@@ -315,18 +401,62 @@ struct chan *next_chan(const struct node *node, struct chan_map_iter *i);
 
 /* Returns NULL if all OK, otherwise an error for the peer which sent.
  * If the error is that the channel is unknown, fills in *unknown_scid
- * (if not NULL). */
+ * (if not NULL).  If suppressed is not NULL, the update is rate limited,
+ * and *suppressed says whether it was held back. */
 u8 *handle_channel_update(struct routing_state *rstate, const u8 *update TAKES,
 			  const char *source,
-			  struct short_channel_id *unknown_scid);
+			  struct short_channel_id *unknown_scid,
+			  bool *suppressed);
+
+/* Apply held-back channel_updates whose buckets have refilled.  Returns how
+ * many are still held. */
+size_t routing_release_suppressed(struct routing_state *rstate);
+
+/* How many channel_updates are waiting for tokens. */
+size_t routing_num_suppressed(const struct routing_state *rstate);
 
 /* Returns NULL if all OK, otherwise an error for the peer which sent. */
 u8 *handle_node_announcement(struct routing_state *rstate, const u8 *node);
 
+/* The signatures in a channel_announcement, channel_update or
+ * node_announcement, with the keys which should have made them. */
+struct gossip_sigs {
+	struct sha256_double hash;
+	size_t num;
+	secp256k1_ecdsa_signature sig[4];
+	struct pubkey key[4];
+};
+
+/**
+ * gossip_sigs_get - extract the signatures from a gossip message.
+ * @rstate: the routing state (to find who owns a channel_update)
+ * @msg: the channel_announcement, channel_update or node_announcement.
+ * @sigs: the signatures to fill in.
+ *
+ * Returns false if we can't say who should have signed it (eg. an update
+ * for an unknown channel): just hand that to the handler as normal.
+ *
+ * gossip_sigs_check() can be called on the result from any thread, and if
+ * it passes, setting rstate->verified to @sigs while calling the handler
+ * means it won't check them again.
+ */
+bool gossip_sigs_get(struct routing_state *rstate, const u8 *msg,
+		     struct gossip_sigs *sigs);
+
+/* Are all the signatures good? */
+bool gossip_sigs_check(const struct gossip_sigs *sigs);
+
 /* Get a node: use this instead of node_map_get() */
 struct node *get_node(struct routing_state *rstate,
 		      const struct node_id *id);
 
+/* All the nodes, sorted by id: valid until a node is added or removed. */
+struct node **routing_nodes_by_id(struct routing_state *rstate);
+
+/* Index of the first node in @nodes (from routing_nodes_by_id) whose id is
+ * at least @id. */
+size_t routing_nodes_from(struct node **nodes, const struct node_id *id);
+
 /* Compute a route to a destination, for a given amount and riskfactor. */
 struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    const struct node_id *source,
@@ -337,6 +467,71 @@ struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    u64 seed,
 			    const struct short_channel_id_dir *excluded,
 			    size_t max_hops);
+
+/* Up to @num_routes routes, cheapest first, each avoiding every channel
+ * the ones before it used (except our own, if we're the source).  Returns
+ * an empty array if there's no route at all. */
+struct route_hop **get_routes(const tal_t *ctx, struct routing_state *rstate,
+			      const struct node_id *source,
+			      const struct node_id *destination,
+			      struct amount_msat msat, double riskfactor,
+			      u32 final_cltv,
+			      double fuzz, u64 seed,
+			      const struct short_channel_id_dir *excluded,
+			      size_t max_hops,
+			      size_t num_routes);
+
+/* A get_route() request resolved against the current snapshot, so the
+ * search itself can run outside the main thread. */
+struct route_query {
+	/* We hold a reference to this. */
+	struct routing_snapshot *snap;
+	/* Node indices in snap. */
+	u32 src, dst, me;
+	struct amount_msat msat;
+	/* Already scaled to per-block amount */
+	double riskfactor;
+	double fuzz;
+	struct siphash_seed base_seed;
+	size_t max_hops;
+	u32 final_cltv;
+	/* Edge indices in snap not to use. */
+	u32 *excluded;
+	size_t num_excluded;
+	/* What to file the route under in rstate->route_cache (or NULL) */
+	struct route_cache_key *cache_key;
+	/* Non-NULL if the cache already had the answer: no need to run. */
+	struct route_hop *hops;
+};
+
+/* Returns false if there can't be a route (logging why, if unexpected).
+ * rq->excluded, rq->cache_key and rq->hops are allocated off @ctx. */
+bool route_query_init(const tal_t *ctx,
+		      struct route_query *rq,
+		      struct routing_state *rstate,
+		      const struct node_id *source,
+		      const struct node_id *destination,
+		      struct amount_msat msat, double riskfactor,
+		      u32 final_cltv,
+		      double fuzz,
+		      u64 seed,
+		      const struct short_channel_id_dir *excluded,
+		      size_t max_hops);
+
+/* Safe in any thread, given your own @q.  If it returns true, the route
+ * is in q->route.  Either way, the caller should log q->log. */
+bool route_query_run(const struct route_query *rq, struct snap_query *q);
+
+/* Turn a route from route_query_run() into hops (before route_query_done!),
+ * and remember it in the route cache. */
+struct route_hop *route_query_hops(const tal_t *ctx,
+				   struct routing_state *rstate,
+				   const struct route_query *rq,
+				   const u32 *route, size_t len);
+
+/* Main thread: release rq's hold on the snapshot. */
+void route_query_done(struct routing_state *rstate, struct route_query *rq);
+
 /* Disable channel(s) based on the given routing failure. */
 void routing_failure(struct routing_state *rstate,
 		     const struct node_id *erring_node,
@@ -401,6 +596,9 @@ void memleak_remove_routing_tables(struct htable *memtable,
 				   const struct routing_state *rstate);
 #endif
 
+/* Log how much memory the chans and nodes are taking. */
+void log_routing_memory(const struct routing_state *rstate);
+
 /**
  * Get the local time.
  *
@@ -420,14 +618,17 @@ static inline bool is_chan_local_disabled(struct routing_state *rstate,
 static inline void local_disable_chan(struct routing_state *rstate,
 				      const struct chan *chan)
 {
-	if (!is_chan_local_disabled(rstate, chan))
+	if (!is_chan_local_disabled(rstate, chan)) {
 		chan_map_add(&rstate->local_disabled_map, chan);
+		routing_chan_updated(rstate, chan);
+	}
 }
 
 static inline void local_enable_chan(struct routing_state *rstate,
 				     const struct chan *chan)
 {
-	chan_map_del(&rstate->local_disabled_map, chan);
+	if (chan_map_del(&rstate->local_disabled_map, chan))
+		routing_chan_updated(rstate, chan);
 }
 
 /* Helper to convert on-wire addresses format to wireaddrs array */
@@ -0,0 +1,1239 @@
+#include "routing_snapshot.h"
+#include <ccan/str/hex/hex.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <gossipd/routing.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef SUPERVERBOSE
+#define SUPERVERBOSE(...)
+#endif
+
+/* Too big to reach, but don't overflow if added. */
+#define INFINITE AMOUNT_MSAT(0x3FFFFFFFFFFFFFFFULL)
+
+static int node_id_order(const void *a, const void *b)
+{
+	return node_id_cmp(a, b);
+}
+
+/* Route finding may not be in the main thread, so it can't use tal (or
+ * tmpctx, or status_*()): everything below which takes a snap_query has to
+ * make do with plain malloc, and leave messages in q->log. */
+static void *snap_realloc(void *p, size_t num, size_t size)
+{
+	p = realloc(p, num * size);
+	if (!p && num)
+		abort();
+	return p;
+}
+
+static void PRINTF_FMT(3,4) snap_log(struct snap_query *q,
+				     enum log_level level,
+				     const char *fmt, ...)
+{
+	va_list ap;
+
+	/* If we say this much, something else is badly wrong anyway. */
+	if (q->num_log == SNAP_LOG_MAX)
+		return;
+
+	va_start(ap, fmt);
+	q->log[q->num_log].level = level;
+	vsnprintf(q->log[q->num_log].msg, sizeof(q->log[q->num_log].msg),
+		  fmt, ap);
+	va_end(ap);
+	q->num_log++;
+}
+
+/* Like type_to_string, without the allocation. */
+struct node_str {
+	char s[PUBKEY_CMPR_LEN * 2 + 1];
+};
+
+static const char *fmt_node(struct node_str *str, const struct node_id *id)
+{
+	hex_encode(id->k, sizeof(id->k), str->s, sizeof(str->s));
+	return str->s;
+}
+
+void snap_query_flush_log(const struct snap_log *log, size_t num_log)
+{
+	for (size_t i = 0; i < num_log; i++)
+		status_fmt(log[i].level, "%s", log[i].msg);
+}
+
+u32 routing_snapshot_node(const struct routing_snapshot *snap,
+			  const struct node_id *id)
+{
+	size_t lo = 0, hi = snap->num_nodes;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		int cmp = node_id_cmp(id, &snap->ids[mid]);
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return SNAP_NONE;
+}
+
+static struct snap_chan *snap_chan_get(const struct routing_snapshot *snap,
+				       const struct short_channel_id *scid)
+{
+	size_t lo = 0, hi = tal_count(snap->chans);
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (snap->chans[mid].scid.u64 == scid->u64)
+			return &snap->chans[mid];
+		if (scid->u64 < snap->chans[mid].scid.u64)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+bool routing_snapshot_has_chan(const struct routing_snapshot *snap,
+			       const struct short_channel_id *scid)
+{
+	return snap_chan_get(snap, scid) != NULL;
+}
+
+u32 routing_snapshot_edge(const struct routing_snapshot *snap,
+			  const struct short_channel_id_dir *scidd)
+{
+	const struct snap_chan *sc = snap_chan_get(snap, &scidd->scid);
+
+	if (!sc)
+		return SNAP_NONE;
+	return sc->edge[scidd->dir];
+}
+
+/* Copy everything but src from the half_chan. */
+static void fill_edge(struct snap_edge *e,
+		      struct routing_state *rstate,
+		      const struct chan *chan, int dir)
+{
+	const struct half_chan *hc = &chan->half[dir];
+
+	e->base_fee = hc->base_fee;
+	e->proportional_fee = hc->proportional_fee;
+	e->delay = hc->delay;
+	e->dir = dir;
+	e->enabled = is_halfchan_enabled(hc)
+		&& !is_chan_local_disabled(rstate, chan);
+	e->htlc_minimum = half_chan_htlc_minimum(rstate, chan, dir);
+	e->htlc_maximum = half_chan_htlc_maximum(rstate, chan, dir);
+	e->scid = chan->scid;
+}
+
+struct routing_snapshot *routing_snapshot_new(const tal_t *ctx,
+					      struct routing_state *rstate)
+{
+	struct routing_snapshot *snap = tal(ctx, struct routing_snapshot);
+	struct node_map_iter nit;
+	struct node *node;
+	struct chan *chan;
+	size_t num_nodes, k;
+	u32 *fill;
+	u64 idx;
+
+	snap->ids = tal_arr(snap, struct node_id, 0);
+	for (node = node_map_first(rstate->nodes, &nit);
+	     node;
+	     node = node_map_next(rstate->nodes, &nit))
+		tal_arr_expand(&snap->ids, node->id);
+	qsort(snap->ids, tal_count(snap->ids), sizeof(snap->ids[0]),
+	      node_id_order);
+	snap->num_nodes = num_nodes = tal_count(snap->ids);
+
+	/* First pass: count edges into each node.  We temporarily keep the
+	 * node indices in chans[].edge[]. */
+	snap->first_in = tal_arrz(snap, u32, num_nodes + 1);
+	snap->chans = tal_arr(snap, struct snap_chan, 0);
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx)) {
+		struct snap_chan sc;
+
+		sc.scid = chan->scid;
+		for (size_t i = 0; i < 2; i++) {
+			sc.edge[i] = routing_snapshot_node(snap,
+							   &chan->nodes[i]->id);
+			assert(sc.edge[i] != SNAP_NONE);
+			snap->first_in[sc.edge[i] + 1]++;
+		}
+		tal_arr_expand(&snap->chans, sc);
+	}
+
+	for (size_t i = 1; i < tal_count(snap->first_in); i++)
+		snap->first_in[i] += snap->first_in[i-1];
+
+	/* Second pass: fill in edges, in the same (scid) order. */
+	snap->num_edges = snap->first_in[num_nodes];
+	snap->edges = tal_arr(snap, struct snap_edge, snap->num_edges);
+	fill = tal_dup_arr(tmpctx, u32, snap->first_in, num_nodes, 0);
+	k = 0;
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx), k++) {
+		struct snap_chan *sc = &snap->chans[k];
+		u32 nodes[2] = { sc->edge[0], sc->edge[1] };
+
+		for (int dir = 0; dir < 2; dir++) {
+			/* half[dir] goes from nodes[dir] to nodes[!dir] */
+			u32 e = fill[nodes[!dir]]++;
+			snap->edges[e].src = nodes[dir];
+			fill_edge(&snap->edges[e], rstate, chan, dir);
+			sc->edge[dir] = e;
+		}
+	}
+	tal_free(fill);
+	snap->landmarks = NULL;
+	snap->refs = 0;
+
+	return snap;
+}
+
+struct routing_snapshot *routing_snapshot_dup(const tal_t *ctx,
+					      const struct routing_snapshot *snap)
+{
+	struct routing_snapshot *dup = tal(ctx, struct routing_snapshot);
+
+	dup->ids = tal_dup_arr(dup, struct node_id, snap->ids,
+			       tal_count(snap->ids), 0);
+	dup->first_in = tal_dup_arr(dup, u32, snap->first_in,
+				    tal_count(snap->first_in), 0);
+	dup->edges = tal_dup_arr(dup, struct snap_edge, snap->edges,
+				 tal_count(snap->edges), 0);
+	dup->chans = tal_dup_arr(dup, struct snap_chan, snap->chans,
+				 tal_count(snap->chans), 0);
+	dup->num_nodes = snap->num_nodes;
+	dup->num_edges = snap->num_edges;
+	if (snap->landmarks) {
+		const struct snap_landmarks *lm = snap->landmarks;
+
+		dup->landmarks = tal_dup(dup, struct snap_landmarks, lm);
+		dup->landmarks->from = tal_dup_arr(dup->landmarks, u32, lm->from,
+						   tal_count(lm->from), 0);
+		dup->landmarks->to = tal_dup_arr(dup->landmarks, u32, lm->to,
+						 tal_count(lm->to), 0);
+	} else
+		dup->landmarks = NULL;
+	dup->refs = 0;
+	return dup;
+}
+
+static void destroy_snap_query(struct snap_query *q)
+{
+	free(q->scratch);
+	free(q->heap);
+	free(q->route);
+	free(q->excluded);
+	free(q->hop_edge);
+	free(q->layer);
+	free(q->changed);
+}
+
+struct snap_query *snap_query_new(const tal_t *ctx)
+{
+	struct snap_query *q = tal(ctx, struct snap_query);
+
+	q->scratch = NULL;
+	q->heap = NULL;
+	q->route = NULL;
+	q->excluded = NULL;
+	q->lm = NULL;
+	q->hop_edge = NULL;
+	q->layer = NULL;
+	q->changed = NULL;
+	q->num_nodes = q->num_edges = q->heap_num = q->route_len = 0;
+	q->max_hops = 0;
+	q->epoch = 0;
+	q->num_log = 0;
+	tal_add_destructor(q, destroy_snap_query);
+	return q;
+}
+
+/* Make room for a search of this snapshot. */
+static void snap_query_reserve(struct snap_query *q,
+			       const struct routing_snapshot *snap)
+{
+	if (q->num_edges != snap->num_edges) {
+		/* We always clear the bits we set, so this stays zero. */
+		q->excluded = bitmap_realloc0(q->excluded, q->num_edges,
+					      snap->num_edges);
+		if (!q->excluded && snap->num_edges)
+			abort();
+		q->num_edges = snap->num_edges;
+	}
+
+	if (q->num_nodes == snap->num_nodes)
+		return;
+
+	q->num_nodes = snap->num_nodes;
+	/* A node can only be in the heap once. */
+	q->scratch = snap_realloc(q->scratch, q->num_nodes,
+				  sizeof(q->scratch[0]));
+	q->heap = snap_realloc(q->heap, q->num_nodes, sizeof(q->heap[0]));
+	/* A route can't visit a node twice. */
+	q->route = snap_realloc(q->route, q->num_nodes, sizeof(q->route[0]));
+
+	/* These are sized for the old graph: get them again if we need them */
+	free(q->hop_edge);
+	free(q->layer);
+	free(q->changed);
+	q->hop_edge = NULL;
+	q->layer = NULL;
+	q->changed = NULL;
+	q->max_hops = 0;
+
+	/* Make sure no stale entry looks current. */
+	for (size_t i = 0; i < q->num_nodes; i++)
+		q->scratch[i].epoch = 0;
+	q->epoch = 0;
+}
+
+/* Make room for a search limited to max_hops. */
+static void snap_query_reserve_hops(struct snap_query *q, size_t max_hops)
+{
+	if (!q->layer) {
+		q->layer = snap_realloc(NULL, q->num_nodes, sizeof(q->layer[0]));
+		q->changed = snap_realloc(NULL, q->num_nodes,
+					  sizeof(q->changed[0]));
+	}
+	if (q->max_hops < max_hops) {
+		q->hop_edge = snap_realloc(q->hop_edge,
+					   (max_hops + 1) * q->num_nodes,
+					   sizeof(q->hop_edge[0]));
+		q->max_hops = max_hops;
+	}
+}
+
+/* Lower bound on the cost of getting from q->lm_src to node.  Since
+ * d(src, n) >= d(L, n) - d(L, src), and d(src, n) >= d(src, L) - d(n, L)
+ * for any landmark L, we use whichever is best. */
+static struct amount_msat landmark_bound(const struct snap_query *q, u32 node)
+{
+	const struct snap_landmarks *lm = q->lm;
+	const u32 *from_n, *to_n, *from_s, *to_s;
+	struct amount_msat bound;
+	u32 best = 0;
+
+	if (!lm)
+		return AMOUNT_MSAT(0);
+
+	from_n = lm->from + (size_t)node * lm->num;
+	to_n = lm->to + (size_t)node * lm->num;
+	from_s = lm->from + (size_t)q->lm_src * lm->num;
+	to_s = lm->to + (size_t)q->lm_src * lm->num;
+	for (size_t i = 0; i < lm->num; i++) {
+		if (from_n[i] != SNAP_FAR && from_s[i] < from_n[i]
+		    && from_n[i] - from_s[i] > best)
+			best = from_n[i] - from_s[i];
+		if (to_s[i] != SNAP_FAR && to_n[i] < to_s[i]
+		    && to_s[i] - to_n[i] > best)
+			best = to_s[i] - to_n[i];
+	}
+
+	/* Fuzz can reduce fees: each channel's fee rounds down by less than
+	 * the riskbias it adds, so scaling is enough. */
+	bound.millisatoshis = best * q->lm_scale; /* Raw: landmark bound */
+	return bound;
+}
+
+/* A node's scratch entry, reset if it's left over from an earlier search. */
+static struct snap_scratch *node_scratch(struct snap_query *q, u32 node)
+{
+	struct snap_scratch *s = &q->scratch[node];
+
+	if (s->epoch != q->epoch) {
+		s->epoch = q->epoch;
+		s->total = INFINITE;
+		s->risk = INFINITE;
+		s->bound = landmark_bound(q, node);
+		s->heap_index = SNAP_NONE;
+		s->edge = s->next = SNAP_NONE;
+	}
+	return s;
+}
+
+/* Make every node's information stale, so node_scratch() resets them as
+ * they're reached, rather than all of them here. */
+static void new_search(struct snap_query *q)
+{
+	if (++q->epoch == 0) {
+		/* Wrapped: old stamps could match again. */
+		for (size_t i = 0; i < q->num_nodes; i++)
+			q->scratch[i].epoch = 0;
+		q->epoch = 1;
+	}
+	q->heap_num = 0;
+}
+
+void routing_snapshot_update_chan(struct routing_snapshot *snap,
+				  struct routing_state *rstate,
+				  const struct chan *chan)
+{
+	struct snap_chan *sc = snap_chan_get(snap, &chan->scid);
+
+	assert(snap->refs == 0);
+
+	/* Callers check routing_snapshot_has_chan() first. */
+	if (!sc) {
+		status_broken("routing_snapshot: unknown channel %s",
+			      type_to_string(tmpctx, struct short_channel_id,
+					     &chan->scid));
+		return;
+	}
+
+	for (int dir = 0; dir < 2; dir++) {
+		struct snap_edge *e = &snap->edges[sc->edge[dir]];
+
+		/* Landmark distances are only a lower bound while fees
+		 * don't drop. */
+		if (snap->landmarks && chan->half[dir].base_fee < e->base_fee)
+			snap->landmarks = tal_free(snap->landmarks);
+		fill_edge(e, rstate, chan, dir);
+	}
+}
+
+void routing_snapshot_remove_chan(struct routing_snapshot *snap,
+				  const struct chan *chan)
+{
+	struct snap_chan *sc = snap_chan_get(snap, &chan->scid);
+
+	assert(snap->refs == 0);
+	if (!sc)
+		return;
+
+	for (int dir = 0; dir < 2; dir++)
+		snap->edges[sc->edge[dir]].enabled = false;
+}
+
+/* Risk of passing through this channel.
+ *
+ * There are two ways this function is used:
+ *
+ * 1. Normally, riskbias = 1.  A tiny bias here in order to prefer
+ *    shorter routes, all things equal.
+ * 2. Trying to find a shorter route, riskbias > 1.  By adding an extra
+ *    cost to every hop, we're trying to bias against overlength routes.
+ */
+static WARN_UNUSED_RESULT bool risk_add_fee(struct amount_msat *risk,
+					    struct amount_msat msat,
+					    u32 delay, double riskfactor,
+					    u64 riskbias)
+{
+	double r;
+
+	/* Won't overflow on add, just lose precision */
+	r = (double)riskbias + riskfactor * delay * msat.millisatoshis + risk->millisatoshis; /* Raw: to double */
+	if (r > UINT64_MAX)
+		return false;
+	risk->millisatoshis = r; /* Raw: from double */
+	return true;
+}
+
+/* Check that we can fit through this channel's indicated
+ * maximum_ and minimum_msat requirements.
+ */
+static bool edge_can_carry(const struct snap_edge *e,
+			   struct amount_msat requiredcap)
+{
+	return amount_msat_greater_eq(e->htlc_maximum, requiredcap) &&
+		amount_msat_less_eq(e->htlc_minimum, requiredcap);
+}
+
+/* Theoretically, this could overflow. */
+static bool fuzz_fee(u64 *fee,
+		     const struct short_channel_id *scid,
+		     double fuzz, const struct siphash_seed *base_seed)
+{
+	u64 fuzzed_fee, h;
+ 	double fee_scale;
+
+	if (fuzz == 0.0)
+		return true;
+
+	h = siphash24(base_seed, scid, sizeof(*scid));
+
+	/* Scale fees for this channel */
+	/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
+	 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
+	 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
+	 */
+	fee_scale = 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
+	fuzzed_fee = *fee * fee_scale;
+	if (fee_scale > 1.0 && fuzzed_fee < *fee)
+		return false;
+	*fee = fuzzed_fee;
+	return true;
+}
+
+/* Can we carry this amount across the channel?  If so, returns true and
+ * sets newtotal and newrisk */
+static bool can_reach(const struct snap_edge *e,
+		      bool no_charge,
+		      struct amount_msat total,
+		      struct amount_msat risk,
+		      double riskfactor,
+		      u64 riskbias,
+		      double fuzz, const struct siphash_seed *base_seed,
+		      struct amount_msat *newtotal, struct amount_msat *newrisk)
+{
+	/* FIXME: Bias against smaller channels. */
+	struct amount_msat fee;
+
+	if (!amount_msat_fee(&fee, total, e->base_fee, e->proportional_fee))
+		return false;
+
+  	if (!fuzz_fee(&fee.millisatoshis, &e->scid, fuzz, base_seed)) /* Raw: double manipulation */
+		return false;
+
+	if (no_charge) {
+		*newtotal = total;
+
+		/* We still want to consider the "charge", since it's indicative
+		 * of a bias (we discounted one channel for a reason), but we
+		 * don't pay it.  So we count it as additional risk. */
+		if (!amount_msat_add(newrisk, risk, fee))
+			return false;
+	} else {
+		*newrisk = risk;
+
+		if (!amount_msat_add(newtotal, total, fee))
+			return false;
+	}
+
+	/* Skip a channel if it indicated that it won't route the
+	 * requested amount. */
+	if (!edge_can_carry(e, *newtotal))
+		return false;
+
+	if (!risk_add_fee(newrisk, *newtotal, e->delay, riskfactor, riskbias))
+		return false;
+
+	return true;
+}
+
+/* Returns false on overflow (shouldn't happen!) */
+typedef bool WARN_UNUSED_RESULT costfn_t(struct snap_query *,
+					 struct amount_msat *,
+					 struct amount_msat,
+					 struct amount_msat);
+
+static WARN_UNUSED_RESULT bool
+normal_cost_function(struct snap_query *q,
+		     struct amount_msat *cost,
+		     struct amount_msat total, struct amount_msat risk)
+{
+	if (amount_msat_add(cost, total, risk))
+		return true;
+
+	snap_log(q, LOG_BROKEN,
+		 "Can't add cost of node %"PRIu64"msat + %"PRIu64"msat",
+		 total.millisatoshis, risk.millisatoshis); /* Raw: logging */
+	return false;
+}
+
+/* Does totala+riska add up to less than totalb+riskb?
+ * Saves sums if you want them.
+ */
+static bool costs_less(struct snap_query *q,
+		       struct amount_msat totala,
+		       struct amount_msat riska,
+		       struct amount_msat *costa,
+		       struct amount_msat totalb,
+		       struct amount_msat riskb,
+		       struct amount_msat *costb,
+		       costfn_t *costfn)
+{
+	struct amount_msat suma, sumb;
+
+	if (!costfn(q, &suma, totala, riska))
+		return false;
+	if (!costfn(q, &sumb, totalb, riskb))
+		return false;
+
+	if (costa)
+		*costa = suma;
+	if (costb)
+		*costb = sumb;
+	return amount_msat_less(suma, sumb);
+}
+
+/* A binary minheap of nodes by cost.  Each node remembers where it is in
+ * the heap (scratch[].heap_index), so we can find it and lower its cost
+ * in place, rather than searching for it. */
+static void unvisited_set(struct snap_query *q, size_t i,
+			  const struct snap_heap_entry *e)
+{
+	q->heap[i] = *e;
+	q->scratch[e->node].heap_index = i;
+}
+
+/* Move entry at i towards root until its parent is cheaper. */
+static void unvisited_sift_up(struct snap_query *q, size_t i)
+{
+	struct snap_heap_entry e = q->heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!amount_msat_less(e.cost, q->heap[parent].cost))
+			break;
+		unvisited_set(q, i, &q->heap[parent]);
+		i = parent;
+	}
+	unvisited_set(q, i, &e);
+}
+
+/* Move entry at i towards leaves until both children are dearer. */
+static void unvisited_sift_down(struct snap_query *q, size_t i)
+{
+	struct snap_heap_entry e = q->heap[i];
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= q->heap_num)
+			break;
+		if (child + 1 < q->heap_num
+		    && amount_msat_less(q->heap[child + 1].cost,
+					q->heap[child].cost))
+			child++;
+		if (!amount_msat_less(q->heap[child].cost, e.cost))
+			break;
+		unvisited_set(q, i, &q->heap[child]);
+		i = child;
+	}
+	unvisited_set(q, i, &e);
+}
+
+static void unvisited_add(struct snap_query *q,
+			  struct amount_msat cost, u32 node)
+{
+	struct snap_heap_entry e;
+
+	assert(q->scratch[node].heap_index == SNAP_NONE);
+	assert(q->heap_num < q->num_nodes);
+
+	e.cost = cost;
+	e.node = node;
+	unvisited_set(q, q->heap_num++, &e);
+	unvisited_sift_up(q, q->heap_num - 1);
+}
+
+/* Cost of a node already in the heap went down. */
+static void unvisited_lower(struct snap_query *q,
+			    u32 node, struct amount_msat cost)
+{
+	size_t i = q->scratch[node].heap_index;
+
+	assert(i < q->heap_num);
+	assert(q->heap[i].node == node);
+	assert(amount_msat_less_eq(cost, q->heap[i].cost));
+	q->heap[i].cost = cost;
+	unvisited_sift_up(q, i);
+}
+
+/* Remove and return cheapest node, or SNAP_NONE if empty. */
+static u32 unvisited_pop(struct snap_query *q)
+{
+	u32 node;
+
+	if (q->heap_num == 0)
+		return SNAP_NONE;
+
+	node = q->heap[0].node;
+	q->scratch[node].heap_index = SNAP_NONE;
+	if (--q->heap_num) {
+		unvisited_set(q, 0, &q->heap[q->heap_num]);
+		unvisited_sift_down(q, 0);
+	}
+	return node;
+}
+
+/* What the heap is ordered by: cost so far, plus the least still to come.
+ * With no landmarks, that's just plain Dijkstra. */
+static struct amount_msat heap_key(const struct snap_scratch *s,
+				   struct amount_msat cost)
+{
+	struct amount_msat key;
+
+	if (!amount_msat_add(&key, cost, s->bound))
+		return INFINITE;
+	return key;
+}
+
+static bool is_unvisited(const struct snap_scratch *s)
+{
+	/* If it's infinite, definitely unvisited */
+	if (amount_msat_eq(s->total, INFINITE))
+		return true;
+
+	/* Otherwise, it's unvisited if it's still queued */
+	return s->heap_index != SNAP_NONE;
+}
+
+static void adjust_unvisited(const struct routing_snapshot *snap,
+			     struct snap_query *q, u32 node,
+			     struct amount_msat total,
+			     struct amount_msat risk,
+			     struct amount_msat cost_after)
+{
+	struct snap_scratch *s = node_scratch(q, node);
+	/* If it was in unvisited heap, it just got cheaper. */
+	bool queued = !amount_msat_eq(s->total, INFINITE);
+
+	s->total = total;
+	s->risk = risk;
+
+	SUPERVERBOSE("%s now cost %s",
+		     type_to_string(tmpctx, struct node_id, &snap->ids[node]),
+		     type_to_string(tmpctx, struct amount_msat, &cost_after));
+
+	if (queued)
+		unvisited_lower(q, node, heap_key(s, cost_after));
+	else
+		unvisited_add(q, heap_key(s, cost_after), node);
+}
+
+static void update_unvisited_neighbors(const struct routing_snapshot *snap,
+				       struct snap_query *q,
+				       u32 cur, u32 me,
+				       double riskfactor,
+				       u64 riskbias,
+				       double fuzz,
+				       const struct siphash_seed *base_seed,
+				       costfn_t *costfn)
+{
+	const struct snap_scratch *c = node_scratch(q, cur);
+
+	/* Consider all channels into cur. */
+	for (u32 e = snap->first_in[cur]; e < snap->first_in[cur+1]; e++) {
+		const struct snap_edge *edge = &snap->edges[e];
+		struct snap_scratch *peer = node_scratch(q, edge->src);
+		struct amount_msat total, risk, cost_after;
+
+		SUPERVERBOSE("CONSIDERING: %s -> %s (%s/%s)",
+			     type_to_string(tmpctx, struct node_id,
+					    &snap->ids[cur]),
+			     type_to_string(tmpctx, struct node_id,
+					    &snap->ids[edge->src]),
+			     type_to_string(tmpctx, struct amount_msat,
+					    &peer->total),
+			     type_to_string(tmpctx, struct amount_msat,
+					    &peer->risk));
+
+		if (!edge->enabled || bitmap_test_bit(q->excluded, e)) {
+			SUPERVERBOSE("... not routable");
+			continue;
+		}
+
+		if (!is_unvisited(peer)) {
+			SUPERVERBOSE("... already visited");
+			continue;
+		}
+
+		/* We're looking at channels *backwards*, so peer == me
+		 * is the right test here for whether we don't charge fees. */
+		if (!can_reach(edge, edge->src == me,
+			       c->total, c->risk,
+			       riskfactor, riskbias, fuzz, base_seed,
+			       &total, &risk)) {
+			SUPERVERBOSE("... can't reach");
+			continue;
+		}
+
+		/* This effectively adds it to the heap if it was infinite */
+		if (costs_less(q, total, risk, &cost_after,
+			       peer->total, peer->risk, NULL,
+			       costfn)) {
+			SUPERVERBOSE("...%s can reach %s"
+				     " total %s risk %s",
+				     type_to_string(tmpctx, struct node_id,
+						    &snap->ids[cur]),
+				     type_to_string(tmpctx, struct node_id,
+						    &snap->ids[edge->src]),
+				     type_to_string(tmpctx, struct amount_msat,
+						    &total),
+				     type_to_string(tmpctx, struct amount_msat,
+						    &risk));
+			/* Remember how we got here, for build_route */
+			peer->edge = e;
+			peer->next = cur;
+			adjust_unvisited(snap, q, edge->src, total, risk,
+					 cost_after);
+		}
+	}
+}
+
+static void dijkstra_prepare(const struct routing_snapshot *snap,
+			     struct snap_query *q,
+			     u32 src,
+			     struct amount_msat msat,
+			     costfn_t *costfn)
+{
+	struct amount_msat cost;
+	struct snap_scratch *s;
+
+	new_search(q);
+
+	/* Mark start cost: place in unvisited heap. */
+	s = node_scratch(q, src);
+	s->total = msat;
+	s->risk = AMOUNT_MSAT(0);
+	/* Adding 0 can never fail */
+	if (!costfn(q, &cost, msat, AMOUNT_MSAT(0)))
+		abort();
+	unvisited_add(q, heap_key(s, cost), src);
+}
+
+static void dijkstra(const struct routing_snapshot *snap,
+		     struct snap_query *q,
+		     u32 dst, u32 me,
+		     double riskfactor,
+		     u64 riskbias,
+		     double fuzz, const struct siphash_seed *base_seed,
+		     costfn_t *costfn)
+{
+	u32 cur;
+
+	while ((cur = unvisited_pop(q)) != SNAP_NONE) {
+		if (cur == dst)
+			return;
+		update_unvisited_neighbors(snap, q, cur, me,
+					   riskfactor, riskbias,
+					   fuzz, base_seed, costfn);
+	}
+}
+
+/* One direction of the graph, for working out landmark distances: the
+ * edges leaving node n are edge[first[n]] to edge[first[n+1]-1], and
+ * other[e] is the node at the far end of snap->edges[e]. */
+struct lm_graph {
+	const u32 *first;
+	const u32 *edge;
+	const u32 *other;
+};
+
+/* Least base fees from start to each node following g, into
+ * dist[n * stride].  We use every edge, even disabled ones, as they
+ * could be enabled later. */
+static void landmark_distances(const struct routing_snapshot *snap,
+			       struct snap_query *q,
+			       const struct lm_graph *g,
+			       u32 start, u32 *dist, size_t stride)
+{
+	struct snap_scratch *s;
+	u32 cur;
+
+	new_search(q);
+	s = node_scratch(q, start);
+	s->total = AMOUNT_MSAT(0);
+	unvisited_add(q, s->total, start);
+
+	while ((cur = unvisited_pop(q)) != SNAP_NONE) {
+		struct amount_msat d = q->scratch[cur].total;
+
+		for (u32 i = g->first[cur]; i < g->first[cur+1]; i++) {
+			u32 e = g->edge[i];
+			struct snap_scratch *o = node_scratch(q, g->other[e]);
+			struct amount_msat nd = d;
+
+			if (!amount_msat_add_fee(&nd, snap->edges[e].base_fee, 0)
+			    || !amount_msat_less(nd, o->total))
+				continue;
+
+			/* Non-negative weights: visited nodes can't get here */
+			if (o->heap_index != SNAP_NONE)
+				unvisited_lower(q, g->other[e], nd);
+			else
+				unvisited_add(q, nd, g->other[e]);
+			o->total = nd;
+		}
+	}
+
+	for (size_t n = 0; n < snap->num_nodes; n++) {
+		u64 d = node_scratch(q, n)->total.millisatoshis; /* Raw: landmark distance */
+		dist[n * stride] = d < SNAP_FAR ? d : SNAP_FAR;
+	}
+}
+
+void routing_snapshot_add_landmarks(struct routing_snapshot *snap)
+{
+	struct snap_query *q = snap_query_new(tmpctx);
+	struct snap_landmarks *lm;
+	struct lm_graph in, out;
+	u32 *src, *dst, *ident, *first_out, *out_edge, *fill;
+	u64 *spread;
+	size_t num_nodes = snap->num_nodes;
+	u32 next;
+
+	assert(snap->refs == 0);
+	snap->landmarks = tal_free(snap->landmarks);
+	if (num_nodes == 0)
+		return;
+
+	/* We have the edges into each node, but distances *from* a
+	 * landmark need the edges out of each node too. */
+	src = tal_arr(tmpctx, u32, snap->num_edges);
+	dst = tal_arr(tmpctx, u32, snap->num_edges);
+	ident = tal_arr(tmpctx, u32, snap->num_edges);
+	first_out = tal_arrz(tmpctx, u32, num_nodes + 1);
+	for (size_t n = 0; n < num_nodes; n++) {
+		for (u32 e = snap->first_in[n]; e < snap->first_in[n+1]; e++) {
+			src[e] = snap->edges[e].src;
+			dst[e] = n;
+			ident[e] = e;
+			first_out[src[e] + 1]++;
+		}
+	}
+	for (size_t n = 1; n <= num_nodes; n++)
+		first_out[n] += first_out[n-1];
+	fill = tal_dup_arr(tmpctx, u32, first_out, num_nodes, 0);
+	out_edge = tal_arr(tmpctx, u32, snap->num_edges);
+	for (u32 e = 0; e < snap->num_edges; e++)
+		out_edge[fill[src[e]]++] = e;
+
+	in.first = snap->first_in;
+	in.edge = ident;
+	in.other = src;
+	out.first = first_out;
+	out.edge = out_edge;
+	out.other = dst;
+
+	lm = tal(snap, struct snap_landmarks);
+	lm->num = num_nodes < SNAP_LANDMARKS ? num_nodes : SNAP_LANDMARKS;
+	lm->from = tal_arr(lm, u32, num_nodes * lm->num);
+	lm->to = tal_arr(lm, u32, num_nodes * lm->num);
+
+	/* How far each node is (there and back) from its nearest landmark */
+	spread = tal_arr(tmpctx, u64, num_nodes);
+	for (size_t n = 0; n < num_nodes; n++)
+		spread[n] = UINT64_MAX;
+
+	/* Start anywhere, then pick whichever node is furthest from the
+	 * landmarks so far: landmarks around the edges give the best bounds. */
+	snap_query_reserve(q, snap);
+	next = 0;
+	for (size_t i = 0; i < lm->num; i++) {
+		u64 best = 0;
+
+		lm->nodes[i] = next;
+		landmark_distances(snap, q, &out, next, lm->from + i, lm->num);
+		landmark_distances(snap, q, &in, next, lm->to + i, lm->num);
+
+		for (size_t n = 0; n < num_nodes; n++) {
+			u32 from = lm->from[n * lm->num + i];
+			u32 to = lm->to[n * lm->num + i];
+
+			if (from == SNAP_FAR || to == SNAP_FAR)
+				continue;
+			if ((u64)from + to < spread[n])
+				spread[n] = (u64)from + to;
+			if (spread[n] != UINT64_MAX && spread[n] > best) {
+				best = spread[n];
+				next = n;
+			}
+		}
+
+		/* Everything's next to a landmark?  Rest are no use. */
+		if (best == 0) {
+			for (size_t j = i + 1; j < lm->num; j++)
+				lm->nodes[j] = SNAP_NONE;
+			for (size_t n = 0; n < num_nodes; n++) {
+				for (size_t j = i + 1; j < lm->num; j++) {
+					lm->from[n * lm->num + j] = SNAP_FAR;
+					lm->to[n * lm->num + j] = SNAP_FAR;
+				}
+			}
+			break;
+		}
+	}
+
+	snap->landmarks = lm;
+	tal_free(q);
+}
+
+/* Note that we calculated route *backwards*, for fees.  So "from"
+ * here has a high cost, "to" has a cost of exact amount sent.
+ * Returns number of edges put in route, 0 if none. */
+static size_t build_route(const struct routing_snapshot *snap,
+			  struct snap_query *q,
+			  u32 from, u32 to,
+			  struct amount_msat *fee,
+			  u32 *route)
+{
+	const struct snap_scratch *s = q->scratch;
+	size_t len = 0;
+
+	SUPERVERBOSE("Building route from %s (%s) -> %s (%s)",
+		     type_to_string(tmpctx, struct node_id, &snap->ids[from]),
+		     type_to_string(tmpctx, struct amount_msat,
+				    &s[from].total),
+		     type_to_string(tmpctx, struct node_id, &snap->ids[to]),
+		     type_to_string(tmpctx, struct amount_msat,
+				    &s[to].total));
+	/* Never reached? */
+	if (amount_msat_eq(node_scratch(q, from)->total, INFINITE))
+		return 0;
+
+	/* Follow the edges we recorded on the way. */
+	for (u32 i = from; i != to; i = s[i].next)
+		route[len++] = s[i].edge;
+
+	/* We don't charge ourselves fees, so skip first hop */
+	if (!amount_msat_sub(fee, s[s[from].next].total, s[to].total)) {
+		snap_log(q, LOG_BROKEN,
+			 "Could not subtract %"PRIu64"msat - %"PRIu64"msat"
+			 " for fee",
+			 s[s[from].next].total.millisatoshis, /* Raw: logging */
+			 s[to].total.millisatoshis); /* Raw: logging */
+		return 0;
+	}
+
+	return len;
+}
+
+/* Which node does this edge lead to? */
+static u32 edge_dst(const struct routing_snapshot *snap, u32 e)
+{
+	size_t lo = 0, hi = snap->num_nodes;
+
+	/* Last node whose edges start at or before e */
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (snap->first_in[mid] <= e)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Fees paid along route (not counting the first hop, like build_route) */
+static bool route_fee(const struct routing_snapshot *snap,
+		      struct snap_query *q,
+		      u32 me,
+		      struct amount_msat msat,
+		      double riskfactor,
+		      double fuzz, const struct siphash_seed *base_seed,
+		      struct amount_msat *fee)
+{
+	struct amount_msat total = msat, risk = AMOUNT_MSAT(0);
+
+	for (size_t i = q->route_len - 1; i > 0; i--) {
+		const struct snap_edge *edge = &snap->edges[q->route[i]];
+
+		if (!can_reach(edge, edge->src == me, total, risk,
+			       riskfactor, 1, fuzz, base_seed, &total, &risk)) {
+			snap_log(q, LOG_BROKEN,
+				 "Route step %zu no longer reachable?", i);
+			return false;
+		}
+	}
+
+	return amount_msat_sub(fee, total, msat);
+}
+
+/* The cheapest route is too long.  Find the cheapest with at most max_hops:
+ * like Bellman-Ford, each round extends the nodes which got cheaper in the
+ * last round by one more hop, and we remember which edge did it. */
+static bool find_route_max_hops(const struct routing_snapshot *snap,
+				struct snap_query *q,
+				u32 source, u32 dest, u32 me,
+				struct amount_msat msat,
+				double riskfactor,
+				double fuzz, const struct siphash_seed *base_seed,
+				size_t max_hops,
+				struct amount_msat *fee)
+{
+	struct snap_scratch *s;
+	size_t num_layer, hop;
+	struct node_str src_str, dst_str;
+
+	snap_query_reserve_hops(q, max_hops);
+	/* Nothing here uses the bounds: don't waste time on them. */
+	q->lm = NULL;
+	new_search(q);
+	for (size_t i = q->num_nodes; i < (max_hops + 1) * q->num_nodes; i++)
+		q->hop_edge[i] = SNAP_NONE;
+
+	s = node_scratch(q, dest);
+	s->total = msat;
+	s->risk = AMOUNT_MSAT(0);
+	q->layer[0].node = dest;
+	q->layer[0].total = s->total;
+	q->layer[0].risk = s->risk;
+	num_layer = 1;
+
+	for (hop = 1; hop <= max_hops && num_layer; hop++) {
+		u32 *hop_edge = q->hop_edge + hop * q->num_nodes;
+		size_t num_changed = 0;
+
+		for (size_t i = 0; i < num_layer; i++) {
+			const struct snap_layer_entry *cur = &q->layer[i];
+
+			for (u32 e = snap->first_in[cur->node];
+			     e < snap->first_in[cur->node+1];
+			     e++) {
+				const struct snap_edge *edge = &snap->edges[e];
+				struct snap_scratch *peer;
+				struct amount_msat total, risk;
+
+				if (!edge->enabled
+				    || bitmap_test_bit(q->excluded, e))
+					continue;
+
+				if (!can_reach(edge, edge->src == me,
+					       cur->total, cur->risk,
+					       riskfactor, 1, fuzz, base_seed,
+					       &total, &risk))
+					continue;
+
+				peer = node_scratch(q, edge->src);
+				if (!costs_less(q, total, risk, NULL,
+						peer->total, peer->risk, NULL,
+						normal_cost_function))
+					continue;
+
+				peer->total = total;
+				peer->risk = risk;
+				hop_edge[edge->src] = e;
+				/* heap_index marks it changed this round. */
+				if (peer->heap_index == SNAP_NONE) {
+					peer->heap_index = num_changed;
+					q->changed[num_changed++] = edge->src;
+				}
+			}
+		}
+
+		/* Take a copy, as the next round changes them again. */
+		for (size_t i = 0; i < num_changed; i++) {
+			s = &q->scratch[q->changed[i]];
+			q->layer[i].node = q->changed[i];
+			q->layer[i].total = s->total;
+			q->layer[i].risk = s->risk;
+			s->heap_index = SNAP_NONE;
+		}
+		num_layer = num_changed;
+	}
+
+	if (amount_msat_eq(node_scratch(q, source)->total, INFINITE)) {
+		snap_log(q, LOG_INFORM, "No route %s->%s within %zu hops",
+			 fmt_node(&src_str, &snap->ids[source]),
+			 fmt_node(&dst_str, &snap->ids[dest]),
+			 max_hops);
+		return false;
+	}
+
+	/* Each node's edge is in the last round it got cheaper, and the
+	 * node it leads to was as cheap as it got in an earlier round. */
+	q->route_len = 0;
+	hop = max_hops;
+	for (u32 n = source; n != dest; hop--) {
+		u32 e;
+
+		while ((e = q->hop_edge[hop * q->num_nodes + n]) == SNAP_NONE)
+			hop--;
+		q->route[q->route_len++] = e;
+		n = edge_dst(snap, e);
+	}
+
+	return route_fee(snap, q, me, msat, riskfactor, fuzz, base_seed, fee);
+}
+
+bool routing_snapshot_find_route(const struct routing_snapshot *snap,
+				 struct snap_query *q,
+				 u32 source, u32 dest, u32 me,
+				 struct amount_msat msat,
+				 double riskfactor,
+				 double fuzz,
+				 const struct siphash_seed *base_seed,
+				 size_t max_hops,
+				 const u32 *excluded, size_t num_excluded,
+				 struct amount_msat *fee)
+{
+	bool found;
+
+	q->num_log = 0;
+	snap_query_reserve(q, snap);
+
+	for (size_t i = 0; i < num_excluded; i++)
+		bitmap_set_bit(q->excluded, excluded[i]);
+
+	q->lm = snap->landmarks;
+	q->lm_src = source;
+	q->lm_scale = fuzz < 1.0 ? 1.0 - fuzz : 0.0;
+
+	/* Note: we map backwards, since we know the amount of satoshi we want
+	 * at the end, and need to derive how much we need to send. */
+	dijkstra_prepare(snap, q, dest, msat, normal_cost_function);
+	dijkstra(snap, q, source, me, riskfactor, 1, fuzz, base_seed,
+		 normal_cost_function);
+
+	q->route_len = build_route(snap, q, source, dest, fee, q->route);
+	if (q->route_len == 0)
+		found = false;
+	else if (q->route_len <= max_hops)
+		found = true;
+	else {
+		/* This is the far more unlikely case */
+		found = find_route_max_hops(snap, q, source, dest, me, msat,
+					    riskfactor, fuzz, base_seed,
+					    max_hops, fee);
+	}
+
+	/* Leave the bitmap clear for the next search. */
+	for (size_t i = 0; i < num_excluded; i++)
+		bitmap_clear_bit(q->excluded, excluded[i]);
+	return found;
+}
+
+struct route_hop *routing_snapshot_route_hops(const tal_t *ctx,
+					      const struct routing_snapshot *snap,
+					      const u32 *route, size_t len,
+					      u32 dest,
+					      struct amount_msat msat,
+					      u32 final_cltv)
+{
+	struct route_hop *hops;
+	struct amount_msat total_amount = msat;
+	unsigned int total_delay = final_cltv;
+	u32 n = dest;
+
+	/* Fees, delays need to be calculated backwards along route. */
+	hops = tal_arr(ctx, struct route_hop, len);
+	for (int i = len - 1; i >= 0; i--) {
+		const struct snap_edge *e = &snap->edges[route[i]];
+
+		hops[i].channel_id = e->scid;
+		hops[i].nodeid = snap->ids[n];
+		hops[i].amount = total_amount;
+		hops[i].delay = total_delay;
+		hops[i].direction = e->dir;
+
+		/* Since we calculated this route, it should not overflow! */
+		if (!amount_msat_add_fee(&total_amount,
+					 e->base_fee, e->proportional_fee)) {
+			status_broken("Route overflow step %i: %s + %u/%u!?",
+				      i, type_to_string(tmpctx, struct amount_msat,
+							&total_amount),
+				      e->base_fee, e->proportional_fee);
+			return tal_free(hops);
+		}
+		total_delay += e->delay;
+		n = e->src;
+	}
+
+	return hops;
+}
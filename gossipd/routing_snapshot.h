@@ -0,0 +1,261 @@
+#ifndef LIGHTNING_GOSSIPD_ROUTING_SNAPSHOT_H
+#define LIGHTNING_GOSSIPD_ROUTING_SNAPSHOT_H
+#include "config.h"
+#include <bitcoin/short_channel_id.h>
+#include <ccan/bitmap/bitmap.h>
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <common/amount.h>
+#include <common/node_id.h>
+#include <common/status_levels.h>
+
+struct chan;
+struct route_hop;
+struct routing_state;
+
+/* Index which means "no such node/edge". */
+#define SNAP_NONE UINT32_MAX
+
+/* One direction of a channel, as route finding sees it.  We search backwards
+ * from the payee, so these are grouped by the node they lead *to*. */
+struct snap_edge {
+	/* Node this half-channel leads from. */
+	u32 src;
+	/* millisatoshi. */
+	u32 base_fee;
+	/* millionths */
+	u32 proportional_fee;
+	/* cltv_expiry_delta: only 16 bits on the wire. */
+	u16 delay;
+	/* Which half of the channel this is. */
+	u8 dir;
+	/* Defined, not disabled by its owner, not locally disabled. */
+	bool enabled;
+	/* Minimum and maximum number of msatoshi in an HTLC */
+	struct amount_msat htlc_minimum, htlc_maximum;
+	struct short_channel_id scid;
+};
+
+/* Per-channel lookup so we can patch edges in place. */
+struct snap_chan {
+	struct short_channel_id scid;
+	/* Index into edges[] for each direction. */
+	u32 edge[2];
+};
+
+/* Number of landmarks we try to pick. */
+#define SNAP_LANDMARKS 8
+
+/* Landmark distance which is unknown (unreachable, or too large). */
+#define SNAP_FAR UINT32_MAX
+
+/* Distances to and from a few landmark nodes, counting only base fees.
+ * By the triangle inequality, these give a lower bound on the fees between
+ * any two nodes, which lets the search head towards the payer rather than
+ * spreading out in all directions (A* with landmarks).
+ *
+ * Fees only rising, and channels being disabled, can't make that bound
+ * wrong, but anything else means building new ones. */
+struct snap_landmarks {
+	size_t num;
+	u32 nodes[SNAP_LANDMARKS];
+	/* Least base fees from landmark i to node n: from[n * num + i]. */
+	u32 *from;
+	/* Least base fees from node n to landmark i: to[n * num + i]. */
+	u32 *to;
+};
+
+/* Route-finding state for a node, indexed like ids[]. */
+struct snap_scratch {
+	/* Rest of this is only valid if this matches snap_query.epoch */
+	u32 epoch;
+	/* Total to get to here from target. */
+	struct amount_msat total;
+	/* Total risk premium of this route. */
+	struct amount_msat risk;
+	/* Lower bound on the cost from here to the payer. */
+	struct amount_msat bound;
+	/* Our slot in the unvisited heap (SNAP_NONE if none) */
+	u32 heap_index;
+	/* Edge we leave by towards the target, and node it takes us to. */
+	u32 edge, next;
+};
+
+struct snap_heap_entry {
+	struct amount_msat cost;
+	u32 node;
+};
+
+/* A node which changed in the last round of a hop-limited search. */
+struct snap_layer_entry {
+	u32 node;
+	struct amount_msat total, risk;
+};
+
+/* A compact copy of the routing graph: nodes are dense u32 indices, and
+ * the edges into node n are edges[first_in[n]] to edges[first_in[n+1]-1].
+ * Edge parameters are updated in place; adding channels or nodes requires
+ * building a new one.
+ *
+ * Route finding only reads the snapshot, so several threads can search the
+ * same one at once, as long as each has its own snap_query.  While refs is
+ * non-zero, it must not be changed: update a routing_snapshot_dup() instead.
+ */
+struct routing_snapshot {
+	/* Sorted, so we can bsearch; the position is the node index. */
+	struct node_id *ids;
+	size_t num_nodes;
+	/* tal_count(ids) + 1 entries. */
+	u32 *first_in;
+	struct snap_edge *edges;
+	size_t num_edges;
+	/* Sorted by scid. */
+	struct snap_chan *chans;
+	/* NULL until routing_snapshot_add_landmarks(). */
+	struct snap_landmarks *landmarks;
+
+	/* Queries still using this: only touched by the main thread. */
+	size_t refs;
+};
+
+/* Most messages a single search leaves for its caller. */
+#define SNAP_LOG_MAX 4
+
+/* Something route finding wanted to say. */
+struct snap_log {
+	enum log_level level;
+	char msg[256];
+};
+
+/* Scratch space for route finding, reused across calls.
+ *
+ * Route finding may run outside the main thread, and tal isn't thread-safe,
+ * so the arrays here are plain malloc, and it leaves messages in log[]
+ * rather than calling status_*() itself. */
+struct snap_query {
+	/* Each has num_nodes entries. */
+	size_t num_nodes;
+	struct snap_scratch *scratch;
+	struct snap_heap_entry *heap;
+	size_t heap_num;
+	/* Bumped for each search, so we don't have to reset every node. */
+	u32 epoch;
+
+	/* Edges this search mustn't use (num_edges bits). */
+	size_t num_edges;
+	bitmap *excluded;
+
+	/* Landmarks to guide this search (or NULL), and who we're heading
+	 * for: bounds are scaled down by lm_scale, to allow for fuzz. */
+	const struct snap_landmarks *lm;
+	u32 lm_src;
+	double lm_scale;
+
+	/* For a search limited to max_hops, hop_edge[h * num_nodes + n] is
+	 * the edge we leave n by, if that improved on it in round h. */
+	u32 *hop_edge;
+	size_t max_hops;
+	/* Each has num_nodes entries, but only once we need them. */
+	struct snap_layer_entry *layer;
+	u32 *changed;
+
+	/* The route found, as edge indices from source to dest. */
+	u32 *route;
+	size_t route_len;
+
+	struct snap_log log[SNAP_LOG_MAX];
+	size_t num_log;
+};
+
+/* Build a snapshot of the current graph in rstate. */
+struct routing_snapshot *routing_snapshot_new(const tal_t *ctx,
+					      struct routing_state *rstate);
+
+/* Unshared copy of a snapshot, for updating. */
+struct routing_snapshot *routing_snapshot_dup(const tal_t *ctx,
+					      const struct routing_snapshot *snap);
+
+/* Empty scratch space: it grows to fit whatever snapshot it's used on.
+ * Main thread only (but then it can be handed to another thread). */
+struct snap_query *snap_query_new(const tal_t *ctx);
+
+/* Is this channel in the snapshot?  New ones aren't, until it's rebuilt. */
+bool routing_snapshot_has_chan(const struct routing_snapshot *snap,
+			       const struct short_channel_id *scid);
+
+/* Refresh the edges for this channel (which must be in it) from its
+ * half_chans. */
+void routing_snapshot_update_chan(struct routing_snapshot *snap,
+				  struct routing_state *rstate,
+				  const struct chan *chan);
+
+/* Channel is going away: make sure we never route through it. */
+void routing_snapshot_remove_chan(struct routing_snapshot *snap,
+				  const struct chan *chan);
+
+/* Pick landmarks and work out distances (expensive!).  Route finding is
+ * much faster with them, and just as cheap. */
+void routing_snapshot_add_landmarks(struct routing_snapshot *snap);
+
+/* Returns SNAP_NONE if node isn't in snapshot. */
+u32 routing_snapshot_node(const struct routing_snapshot *snap,
+			  const struct node_id *id);
+
+/* Returns SNAP_NONE if channel isn't in snapshot. */
+u32 routing_snapshot_edge(const struct routing_snapshot *snap,
+			  const struct short_channel_id_dir *scidd);
+
+/**
+ * routing_snapshot_find_route - find cheapest route from source to dest
+ * @snap: the graph snapshot.
+ * @q: scratch space, not shared with any concurrent search.
+ * @source: node index of payer.
+ * @dest: node index of payee.
+ * @me: node index we don't charge fees for (source, or SNAP_NONE).
+ * @msat: amount to deliver to @dest.
+ * @riskfactor: already scaled to per-block amount.
+ * @fuzz: fee fuzzing factor.
+ * @base_seed: seed for fee fuzzing.
+ * @max_hops: longest route to return.
+ * @excluded: edge indices not to use.
+ * @num_excluded: number of @excluded.
+ * @fee: set to total fees paid (excluding to @me), on success.
+ *
+ * Returns false if no route, otherwise the route is in q->route.  Either
+ * way, q->log holds anything worth logging.  Safe in any thread.
+ */
+bool routing_snapshot_find_route(const struct routing_snapshot *snap,
+				 struct snap_query *q,
+				 u32 source, u32 dest, u32 me,
+				 struct amount_msat msat,
+				 double riskfactor,
+				 double fuzz,
+				 const struct siphash_seed *base_seed,
+				 size_t max_hops,
+				 const u32 *excluded, size_t num_excluded,
+				 struct amount_msat *fee);
+
+/**
+ * routing_snapshot_route_hops - turn a route into hops for the payer.
+ * @ctx: context to allocate returned array from.
+ * @snap: the graph snapshot the route was found in.
+ * @route: the edges, from routing_snapshot_find_route().
+ * @len: the number of edges.
+ * @dest: node index of payee.
+ * @msat: amount to deliver to @dest.
+ * @final_cltv: cltv @dest needs.
+ *
+ * Fees and delays are calculated backwards from @dest.  Returns NULL on
+ * overflow.
+ */
+struct route_hop *routing_snapshot_route_hops(const tal_t *ctx,
+					      const struct routing_snapshot *snap,
+					      const u32 *route, size_t len,
+					      u32 dest,
+					      struct amount_msat msat,
+					      u32 final_cltv);
+
+/* Hand messages from a search to status_*(): main thread only! */
+void snap_query_flush_log(const struct snap_log *log, size_t num_log);
+#endif /* LIGHTNING_GOSSIPD_ROUTING_SNAPSHOT_H */
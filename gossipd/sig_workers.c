@@ -0,0 +1,289 @@
+#include "sig_workers.h"
+#include <ccan/io/io.h>
+#include <ccan/list/list.h>
+#include <ccan/time/time.h>
+#include <common/status.h>
+#include <common/utils.h>
+#include <errno.h>
+#include <gossipd/routing.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+/* How many jobs a worker takes at once: fewer trips through the lock, and
+ * one wakeup for the lot. */
+#define SIG_WORKERS_BATCH 16
+
+/* How often (in messages checked) we log our counters. */
+#define SIG_WORKERS_LOG_INTERVAL 10000
+
+/*~ Like route_workers, the main thread allocates everything up front; the
+ * workers only touch the job's own gossip_sigs, and the result fields. */
+struct sig_job {
+	/* In sw->jobs, in the order they were submitted (main thread only) */
+	struct list_node list;
+	/* In sw->todo, until a worker takes it (under sw->lock) */
+	struct list_node todo;
+
+	/* NULL if there's nothing to check */
+	struct gossip_sigs *sigs;
+
+	/* Set by worker, under sw->lock */
+	bool done;
+	bool ok;
+	u64 nsec;
+
+	void (*cb)(const struct gossip_sigs *verified, void *arg);
+	void *arg;
+};
+
+struct sig_workers {
+	/* Protects todo, num_todo, job->done/ok/nsec, wake_pending and
+	 * shutdown */
+	pthread_mutex_t lock;
+	/* Signalled when something is added to todo, or on shutdown. */
+	pthread_cond_t cond;
+	struct list_head todo;
+	size_t num_todo;
+	bool shutdown;
+
+	/* Every job not yet handed back to its caller. */
+	struct list_head jobs;
+
+	pthread_t *threads;
+
+	/* Main thread only. */
+	struct sig_workers_stats stats;
+	u64 logged_checked, logged_nsec;
+
+	/* A byte is written to (nonblocking) wake_fd[1] when a batch is
+	 * done, unless one is already pending. */
+	int wake_fd[2];
+	bool wake_pending;
+	char wake_buf[64];
+	size_t wake_len;
+};
+
+/* Caller holds sw->lock.  There's only ever one byte in the pipe, so the
+ * main thread can never block on it, even handing back its own jobs. */
+static void wake_main(struct sig_workers *sw)
+{
+	if (sw->wake_pending)
+		return;
+	sw->wake_pending = true;
+	/* If this fails, main thread is gone anyway. */
+	if (write(sw->wake_fd[1], "", 1))
+		;
+}
+
+static void *sig_worker_thread(void *arg)
+{
+	struct sig_workers *sw = arg;
+	struct sig_job *batch[SIG_WORKERS_BATCH];
+	sigset_t all;
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	pthread_mutex_lock(&sw->lock);
+	for (;;) {
+		size_t n, max;
+
+		while (!sw->shutdown && list_empty(&sw->todo))
+			pthread_cond_wait(&sw->cond, &sw->lock);
+		if (sw->shutdown)
+			break;
+		/* Don't hog a short queue while other workers sit idle. */
+		max = sw->num_todo / tal_count(sw->threads);
+		if (max == 0)
+			max = 1;
+		else if (max > SIG_WORKERS_BATCH)
+			max = SIG_WORKERS_BATCH;
+		for (n = 0; n < max; n++) {
+			batch[n] = list_pop(&sw->todo, struct sig_job, todo);
+			if (!batch[n])
+				break;
+		}
+		sw->num_todo -= n;
+		pthread_mutex_unlock(&sw->lock);
+
+		for (size_t i = 0; i < n; i++) {
+			struct timemono start = time_mono();
+			bool ok = gossip_sigs_check(batch[i]->sigs);
+			u64 nsec = time_to_nsec(timemono_since(start));
+
+			pthread_mutex_lock(&sw->lock);
+			batch[i]->ok = ok;
+			batch[i]->nsec = nsec;
+			batch[i]->done = true;
+			pthread_mutex_unlock(&sw->lock);
+		}
+
+		pthread_mutex_lock(&sw->lock);
+		wake_main(sw);
+	}
+	pthread_mutex_unlock(&sw->lock);
+	return NULL;
+}
+
+static void log_stats(struct sig_workers *sw)
+{
+	u64 checked = sw->stats.checked - sw->logged_checked;
+	u64 nsec = sw->stats.verify_nsec - sw->logged_nsec;
+
+	if (checked < SIG_WORKERS_LOG_INTERVAL)
+		return;
+
+	status_debug("sig_workers: %"PRIu64" checked (%"PRIu64" bad),"
+		     " %u queued (max %u), %"PRIu64" per thread-second",
+		     sw->stats.checked, sw->stats.failed,
+		     sw->stats.queued, sw->stats.max_queued,
+		     nsec ? checked * 1000000000 / nsec : 0);
+	sw->logged_checked = sw->stats.checked;
+	sw->logged_nsec = sw->stats.verify_nsec;
+}
+
+/* Hand back finished jobs, in order: a later one may finish first. */
+static struct io_plan *jobs_done(struct io_conn *conn, struct sig_workers *sw)
+{
+	struct sig_job *job;
+
+	/* Anything finished after this will wake us again. */
+	pthread_mutex_lock(&sw->lock);
+	sw->wake_pending = false;
+	pthread_mutex_unlock(&sw->lock);
+
+	for (;;) {
+		bool done;
+
+		job = list_top(&sw->jobs, struct sig_job, list);
+		if (!job)
+			break;
+
+		pthread_mutex_lock(&sw->lock);
+		done = job->done;
+		pthread_mutex_unlock(&sw->lock);
+		if (!done)
+			break;
+
+		list_del_from(&sw->jobs, &job->list);
+		sw->stats.queued--;
+		if (job->sigs) {
+			sw->stats.checked++;
+			sw->stats.verify_nsec += job->nsec;
+			if (!job->ok)
+				sw->stats.failed++;
+		}
+		job->cb(job->ok ? job->sigs : NULL, job->arg);
+		tal_free(job);
+	}
+	log_stats(sw);
+
+	return io_read_partial(conn, sw->wake_buf, sizeof(sw->wake_buf),
+			       &sw->wake_len, jobs_done, sw);
+}
+
+static struct io_plan *wake_conn_init(struct io_conn *conn,
+				      struct sig_workers *sw)
+{
+	return jobs_done(conn, sw);
+}
+
+static void destroy_sig_workers(struct sig_workers *sw)
+{
+	pthread_mutex_lock(&sw->lock);
+	sw->shutdown = true;
+	pthread_cond_broadcast(&sw->cond);
+	pthread_mutex_unlock(&sw->lock);
+
+	for (size_t i = 0; i < tal_count(sw->threads); i++)
+		pthread_join(sw->threads[i], NULL);
+
+	close(sw->wake_fd[1]);
+	pthread_cond_destroy(&sw->cond);
+	pthread_mutex_destroy(&sw->lock);
+}
+
+struct sig_workers *sig_workers_new(const tal_t *ctx, size_t num_threads)
+{
+	struct sig_workers *sw = tal(ctx, struct sig_workers);
+
+	assert(num_threads > 0);
+	list_head_init(&sw->todo);
+	sw->num_todo = 0;
+	list_head_init(&sw->jobs);
+	sw->shutdown = false;
+	sw->wake_pending = false;
+	memset(&sw->stats, 0, sizeof(sw->stats));
+	sw->logged_checked = sw->logged_nsec = 0;
+	if (pipe(sw->wake_fd) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "sig_workers: pipe: %s", strerror(errno));
+	io_fd_block(sw->wake_fd[1], false);
+	pthread_mutex_init(&sw->lock, NULL);
+	pthread_cond_init(&sw->cond, NULL);
+
+	sw->threads = tal_arr(sw, pthread_t, num_threads);
+	for (size_t i = 0; i < num_threads; i++) {
+		errno = pthread_create(&sw->threads[i], NULL,
+				       sig_worker_thread, sw);
+		if (errno != 0)
+			status_failed(STATUS_FAIL_INTERNAL_ERROR,
+				      "sig_workers: pthread_create: %s",
+				      strerror(errno));
+	}
+	tal_add_destructor(sw, destroy_sig_workers);
+
+	io_new_conn(sw, sw->wake_fd[0], wake_conn_init, sw);
+	return sw;
+}
+
+void sig_workers_submit_(struct sig_workers *sw,
+			 const struct gossip_sigs *sigs,
+			 void (*cb)(const struct gossip_sigs *verified,
+				    void *arg),
+			 void *arg)
+{
+	struct sig_job *job = tal(sw, struct sig_job);
+
+	job->done = false;
+	job->ok = false;
+	job->nsec = 0;
+	job->cb = cb;
+	job->arg = arg;
+	list_add_tail(&sw->jobs, &job->list);
+
+	sw->stats.submitted++;
+	if (++sw->stats.queued > sw->stats.max_queued)
+		sw->stats.max_queued = sw->stats.queued;
+
+	/* Nothing to do, but it still has to wait its turn. */
+	if (!sigs) {
+		job->sigs = NULL;
+		pthread_mutex_lock(&sw->lock);
+		job->done = true;
+		wake_main(sw);
+		pthread_mutex_unlock(&sw->lock);
+		return;
+	}
+
+	job->sigs = tal_dup(job, struct gossip_sigs, sigs);
+	pthread_mutex_lock(&sw->lock);
+	list_add_tail(&sw->todo, &job->todo);
+	sw->num_todo++;
+	pthread_cond_signal(&sw->cond);
+	pthread_mutex_unlock(&sw->lock);
+}
+
+size_t sig_workers_queued(const struct sig_workers *sw)
+{
+	return sw->stats.queued;
+}
+
+const struct sig_workers_stats *sig_workers_stats(const struct sig_workers *sw)
+{
+	return &sw->stats;
+}
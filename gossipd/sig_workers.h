@@ -0,0 +1,49 @@
+#ifndef LIGHTNING_GOSSIPD_SIG_WORKERS_H
+#define LIGHTNING_GOSSIPD_SIG_WORKERS_H
+#include "config.h"
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+
+struct gossip_sigs;
+
+/* A pool of threads which check gossip signatures in batches, so the
+ * main thread only has to apply messages which are already known good. */
+struct sig_workers;
+
+struct sig_workers_stats {
+	/* Messages submitted, and how many of those had signatures checked */
+	u64 submitted, checked;
+	/* How many of those failed */
+	u64 failed;
+	/* Waiting to be checked or handed back, and the most there has been */
+	u32 queued, max_queued;
+	/* Total time workers spent checking */
+	u64 verify_nsec;
+};
+
+/* Start @num_threads workers (must be > 0). */
+struct sig_workers *sig_workers_new(const tal_t *ctx, size_t num_threads);
+
+/* Copies @sigs and checks them: calls @cb in the main thread with the
+ * copy if they're all good, otherwise NULL.  Callbacks are made in the
+ * order they were submitted; a NULL @sigs (nothing to check) simply waits
+ * its turn. */
+#define sig_workers_submit(sw, sigs, cb, arg)				\
+	sig_workers_submit_((sw), (sigs),				\
+			    typesafe_cb_preargs(void, void *,		\
+						(cb), (arg),		\
+						const struct gossip_sigs *), \
+			    (arg))
+
+void sig_workers_submit_(struct sig_workers *sw,
+			 const struct gossip_sigs *sigs,
+			 void (*cb)(const struct gossip_sigs *verified,
+				    void *arg),
+			 void *arg);
+
+/* How many submitted messages haven't been handed back yet? */
+size_t sig_workers_queued(const struct sig_workers *sw);
+
+const struct sig_workers_stats *sig_workers_stats(const struct sig_workers *sw);
+#endif /* LIGHTNING_GOSSIPD_SIG_WORKERS_H */
@@ -0,0 +1,96 @@
+#include "slab.h"
+#include <assert.h>
+#include <common/utils.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Freed objects are chained through their first bytes. */
+struct slab_free {
+	struct slab_free *next;
+};
+
+struct slab {
+	size_t objsize, align, per_page;
+
+	/* The pages, each room for per_page objects. */
+	char **pages;
+	/* Where the objects in the last page start, and how many of them
+	 * have ever been handed out */
+	char *last_page;
+	size_t last_used;
+
+	struct slab_free *freelist;
+	size_t in_use;
+};
+
+struct slab *slab_new_(const tal_t *ctx, size_t objsize, size_t align,
+		       size_t per_page)
+{
+	struct slab *slab = tal(ctx, struct slab);
+
+	assert(per_page > 0);
+	/* Freed objects hold a pointer, and chans and nodes hold u64s. */
+	if (align < ALIGNOF(struct slab_free))
+		align = ALIGNOF(struct slab_free);
+	if (align < ALIGNOF(u64))
+		align = ALIGNOF(u64);
+	assert((align & (align - 1)) == 0);
+	if (objsize < sizeof(struct slab_free))
+		objsize = sizeof(struct slab_free);
+	/* Round up, so every object in a page stays aligned. */
+	slab->objsize = (objsize + align - 1) & ~(align - 1);
+	slab->align = align;
+	slab->per_page = per_page;
+	slab->pages = tal_arr(slab, char *, 0);
+	slab->last_page = NULL;
+	slab->last_used = per_page;
+	slab->freelist = NULL;
+	slab->in_use = 0;
+	return slab;
+}
+
+void *slab_alloc_(struct slab *slab)
+{
+	void *obj;
+
+	if (slab->freelist) {
+		obj = slab->freelist;
+		slab->freelist = slab->freelist->next;
+	} else {
+		if (slab->last_used == slab->per_page) {
+			/* tal only promises pointer alignment, so leave
+			 * room to line the first object up. */
+			char *page = tal_arr(slab->pages, char,
+					     slab->objsize * slab->per_page
+					     + slab->align - 1);
+			tal_arr_expand(&slab->pages, page);
+			slab->last_page = (char *)(((uintptr_t)page
+						    + slab->align - 1)
+						   & ~(uintptr_t)(slab->align - 1));
+			slab->last_used = 0;
+		}
+		obj = slab->last_page + slab->objsize * slab->last_used++;
+	}
+
+	slab->in_use++;
+	return memset(obj, 0, slab->objsize);
+}
+
+void slab_free(struct slab *slab, void *obj)
+{
+	struct slab_free *f = obj;
+
+	assert(slab->in_use > 0);
+	slab->in_use--;
+	f->next = slab->freelist;
+	slab->freelist = f;
+}
+
+void slab_get_stats(const struct slab *slab, struct slab_stats *stats)
+{
+	stats->objsize = slab->objsize;
+	stats->in_use = slab->in_use;
+	stats->pages = tal_count(slab->pages);
+	stats->capacity = stats->pages * slab->per_page;
+	stats->bytes = stats->capacity * slab->objsize;
+}
@@ -0,0 +1,38 @@
+#ifndef LIGHTNING_GOSSIPD_SLAB_H
+#define LIGHTNING_GOSSIPD_SLAB_H
+#include "config.h"
+#include <ccan/alignof/alignof.h>
+#include <ccan/tal/tal.h>
+
+/* We have a million channels and hundreds of thousands of nodes, all the
+ * same size, which live until we prune them.  A tal allocation each costs a
+ * tal header and a malloc header on top: instead we carve them out of big
+ * pages, and keep a freelist.
+ *
+ * Objects are not tal objects: no destructors, no children, no tal_free. */
+struct slab;
+
+struct slab_stats {
+	/* Size of each object (rounded up to its alignment) */
+	size_t objsize;
+	/* Objects handed out, and room for */
+	size_t in_use, capacity;
+	/* Pages, and total bytes in them */
+	size_t pages, bytes;
+};
+
+/* A slab of @type, allocating @per_page of them at a time. */
+#define slab_new(ctx, type, per_page)				\
+	slab_new_((ctx), sizeof(type), ALIGNOF(type), (per_page))
+struct slab *slab_new_(const tal_t *ctx, size_t objsize, size_t align,
+		       size_t per_page);
+
+/* A zeroed @type from @slab. */
+#define slab_alloc(slab, type) ((type *)slab_alloc_(slab))
+void *slab_alloc_(struct slab *slab);
+
+/* Give it back: it's reused by the next slab_alloc. */
+void slab_free(struct slab *slab, void *obj);
+
+void slab_get_stats(const struct slab *slab, struct slab_stats *stats);
+#endif /* LIGHTNING_GOSSIPD_SLAB_H */
@@ -13,7 +13,12 @@
 #include <unistd.h>
 
 #include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
 #include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
 
 void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
 {
@@ -35,9 +40,6 @@ bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *
 /* Generated stub for fromwire_channel_update_option_channel_htlc_max */
 bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
 { fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
-/* Generated stub for fromwire_fail */
-const void *fromwire_fail(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_fail called!\n"); abort(); }
 /* Generated stub for fromwire_gossipd_local_add_channel */
 bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
 { fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
@@ -50,12 +52,6 @@ bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void
 /* Generated stub for fromwire_node_announcement */
 bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
 { fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
-/* Generated stub for fromwire_peektype */
-int fromwire_peektype(const u8 *cursor UNNEEDED)
-{ fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
-/* Generated stub for fromwire_u16 */
-u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
 /* Generated stub for fromwire_wireaddr */
 bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
 { fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
@@ -127,8 +123,8 @@ static void add_connection(struct routing_state *rstate,
 	c->channel_flags = node_id_idx(&nodes[from], &nodes[to]);
 	/* This must be non-zero, otherwise we consider it disabled! */
 	c->bcast.index = 1;
-	c->htlc_maximum = AMOUNT_MSAT(-1ULL);
-	c->htlc_minimum = AMOUNT_MSAT(0);
+	set_half_chan_htlc_limits(rstate, chan, idx,
+				  AMOUNT_MSAT(0), AMOUNT_MSAT(-1ULL));
 }
 
 static struct node_id nodeid(size_t n)
@@ -193,6 +189,9 @@ int main(int argc, char *argv[])
 	size_t route_lengths[ROUTING_MAX_HOPS+1];
 	struct node_id me;
 	struct node_id *nodes;
+	struct node_id *from, *to;
+	struct amount_msat *amount, *fees;
+	bool *found;
 	bool perfme = false;
 	const double riskfactor = 0.01 / BLOCKS_PER_YEAR / 10000;
 	struct siphash_seed base_seed;
@@ -225,6 +224,17 @@ int main(int argc, char *argv[])
 	for (size_t i = 0; i < num_nodes; i++)
 		populate_random_node(rstate, nodes, i);
 
+	from = tal_arr(rstate, struct node_id, num_runs);
+	to = tal_arr(rstate, struct node_id, num_runs);
+	amount = tal_arr(rstate, struct amount_msat, num_runs);
+	fees = tal_arr(rstate, struct amount_msat, num_runs);
+	found = tal_arr(rstate, bool, num_runs);
+	for (size_t i = 0; i < num_runs; i++) {
+		from[i] = nodes[pseudorand(num_nodes)];
+		to[i] = nodes[pseudorand(num_nodes)];
+		amount[i].millisatoshis = pseudorand(100000); /* Raw: test */
+	}
+
 	if (perfme)
 		run("perfme-start");
 
@@ -232,21 +242,19 @@ int main(int argc, char *argv[])
 	memset(route_lengths, 0, sizeof(route_lengths));
 	start = time_mono();
 	for (size_t i = 0; i < num_runs; i++) {
-		const struct node_id *from = &nodes[pseudorand(num_nodes)];
-		const struct node_id *to = &nodes[pseudorand(num_nodes)];
-		struct amount_msat fee;
 		struct chan **route;
 		size_t num_hops;
 
-		route = find_route(tmpctx, rstate, from, to,
-				   (struct amount_msat){pseudorand(100000)},
+		route = find_route(tmpctx, rstate, &from[i], &to[i],
+				   amount[i],
 				   riskfactor,
 				   0.75, &base_seed,
 				   ROUTING_MAX_HOPS,
-				   &fee);
+				   &fees[i]);
 		num_hops = tal_count(route);
 		assert(num_hops < ARRAY_SIZE(route_lengths));
 		route_lengths[num_hops]++;
+		found[i] = (route != NULL);
 		tal_free(route);
 	}
 	end = time_mono();
@@ -258,10 +266,41 @@ int main(int argc, char *argv[])
 	       num_runs, num_runs - route_lengths[0], num_nodes,
 	       time_to_msec(timemono_between(end, start)),
 	       time_to_nsec(time_divide(timemono_between(end, start), num_runs)));
+	printf("%.0f routes per second\n",
+	       num_runs * 1000000000.0
+	       / time_to_nsec(timemono_between(end, start)));
 	for (size_t i = 0; i < ARRAY_SIZE(route_lengths); i++)
 		if (route_lengths[i])
 			printf(" Length %zu: %zu\n", i, route_lengths[i]);
 
+	/* Landmarks should make it faster, but not change the answers. */
+	start = time_mono();
+	routing_refresh_landmarks(rstate);
+	end = time_mono();
+	assert(rstate->snapshot->landmarks);
+	printf("Landmarks took %"PRIu64" msec\n",
+	       time_to_msec(timemono_between(end, start)));
+
+	start = time_mono();
+	for (size_t i = 0; i < num_runs; i++) {
+		struct amount_msat fee;
+		struct chan **route;
+
+		route = find_route(tmpctx, rstate, &from[i], &to[i],
+				   amount[i],
+				   riskfactor,
+				   0.75, &base_seed,
+				   ROUTING_MAX_HOPS,
+				   &fee);
+		assert((route != NULL) == found[i]);
+		assert(!route || amount_msat_eq(fee, fees[i]));
+		tal_free(route);
+	}
+	end = time_mono();
+	printf("%.0f routes per second with landmarks\n",
+	       num_runs * 1000000000.0
+	       / time_to_nsec(timemono_between(end, start)));
+
 	tal_free(tmpctx);
 	secp256k1_context_destroy(secp256k1_ctx);
 	opt_free_table();
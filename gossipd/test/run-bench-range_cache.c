@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <bitcoin/short_channel_id.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/decode_short_channel_ids.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <wire/wire.h>
+#include <zlib.h>
+
+#include "../range_cache.c"
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+/* What queue_channel_ranges() fits into a reply_channel_range */
+#define MAX_ENCODED_BYTES (65535 - 2 - (32 + 4 + 4 + 1 + 2))
+
+/* Our "chanmap": sorted short_channel_ids. */
+static struct short_channel_id *scids;
+
+struct reply {
+	u32 first_blocknum, number_of_blocks;
+	const u8 *encoded;
+};
+
+/* Same as encode_short_channel_ids_end() does, zlib or uncompressed. */
+static u8 *encode_range(const tal_t *ctx, u32 first_blocknum,
+			u32 number_of_blocks)
+{
+	u8 *raw = tal_arr(tmpctx, u8, 0), *encoded;
+	unsigned long len;
+	size_t lo = 0, hi = tal_count(scids);
+
+	/* Like uintmap_after(), go straight to the first one. */
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (short_channel_id_blocknum(&scids[mid]) < first_blocknum)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (size_t i = lo; i < tal_count(scids); i++) {
+		u32 blocknum = short_channel_id_blocknum(&scids[i]);
+		if (blocknum >= first_blocknum + number_of_blocks)
+			break;
+		towire_short_channel_id(&raw, &scids[i]);
+	}
+
+	len = tal_count(raw);
+	encoded = tal_arr(ctx, u8, 1 + len);
+	if (compress2(encoded + 1, &len, raw, tal_count(raw),
+		      Z_BEST_COMPRESSION) == Z_OK) {
+		encoded[0] = SHORTIDS_ZLIB;
+		tal_resize(&encoded, 1 + len);
+	} else {
+		encoded[0] = SHORTIDS_UNCOMPRESSED;
+		memcpy(encoded + 1, raw, tal_count(raw));
+	}
+
+	if (tal_count(encoded) > MAX_ENCODED_BYTES)
+		return tal_free(encoded);
+	return encoded;
+}
+
+/* The shape of queue_channel_ranges(), with and without a cache. */
+static void reply_ranges(struct range_cache *rc,
+			 u32 first_blocknum, u32 number_of_blocks,
+			 struct reply **replies)
+{
+	const u8 *encoded;
+	struct reply r;
+
+	if (!rc || !range_cache_get(rc, SHORTIDS_ZLIB,
+				    first_blocknum, number_of_blocks,
+				    MAX_ENCODED_BYTES, &encoded)) {
+		encoded = encode_range(tmpctx, first_blocknum,
+				       number_of_blocks);
+		if (rc)
+			range_cache_add(rc, SHORTIDS_ZLIB,
+					first_blocknum, number_of_blocks,
+					MAX_ENCODED_BYTES, encoded);
+	}
+
+	if (encoded) {
+		r.first_blocknum = first_blocknum;
+		r.number_of_blocks = number_of_blocks;
+		r.encoded = encoded;
+		tal_arr_expand(replies, r);
+		return;
+	}
+
+	assert(number_of_blocks > 1);
+	reply_ranges(rc, first_blocknum, number_of_blocks / 2, replies);
+	reply_ranges(rc, first_blocknum + number_of_blocks / 2,
+		     number_of_blocks - number_of_blocks / 2, replies);
+}
+
+static void check_same(const struct reply *a, const struct reply *b)
+{
+	assert(tal_count(a) == tal_count(b));
+	for (size_t i = 0; i < tal_count(a); i++) {
+		assert(a[i].first_blocknum == b[i].first_blocknum);
+		assert(a[i].number_of_blocks == b[i].number_of_blocks);
+		assert(tal_count(a[i].encoded) == tal_count(b[i].encoded));
+		assert(memcmp(a[i].encoded, b[i].encoded,
+			      tal_count(a[i].encoded)) == 0);
+	}
+}
+
+/* Add a channel in this block, keeping scids[] sorted. */
+static void add_chan(struct range_cache *rc, u32 blocknum, u32 txnum)
+{
+	struct short_channel_id scid;
+	size_t i, n = tal_count(scids);
+
+	assert(mk_short_channel_id(&scid, blocknum, txnum, 0));
+	for (i = 0; i < n; i++)
+		if (scids[i].u64 > scid.u64)
+			break;
+	tal_resize(&scids, n + 1);
+	memmove(scids + i + 1, scids + i, (n - i) * sizeof(scids[0]));
+	scids[i] = scid;
+	range_cache_chan_added(rc, blocknum);
+}
+
+/* Remove the last channel. */
+static void remove_last_chan(struct range_cache *rc)
+{
+	size_t n = tal_count(scids);
+
+	range_cache_chan_removed(rc, short_channel_id_blocknum(&scids[n-1]));
+	tal_resize(&scids, n - 1);
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	struct range_cache *rc;
+	struct reply *cached, *uncached;
+	struct timemono start;
+	const struct range_cache_stats *stats;
+	size_t num_chans = 100000, num_queries = 5, num_blocks = 50000;
+	const u32 first_block = 500000;
+	u64 msec, misses;
+
+	setup_tmpctx();
+	opt_register_noarg("-h|--help", opt_usage_and_exit,
+			   "[num_chans [num_queries]]",
+			   "This message");
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_chans = atoi(argv[1]);
+	if (argc > 2)
+		num_queries = atoi(argv[2]);
+	if (argc > 3)
+		opt_usage_and_exit("[num_chans [num_queries]]");
+
+	/* Channels spread over the blocks, clustered like the real thing. */
+	scids = tal_arr(tmpctx, struct short_channel_id, num_chans);
+	for (size_t i = 0; i < num_chans; i++)
+		assert(mk_short_channel_id(&scids[i],
+					   first_block
+					   + i * num_blocks / num_chans,
+					   i % 2000, i % 2));
+
+	rc = range_cache_new(tmpctx);
+	stats = range_cache_stats(rc);
+
+	/* First time, it's all misses, but the same answer. */
+	uncached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(NULL, first_block, num_blocks, &uncached);
+	cached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(rc, first_block, num_blocks, &cached);
+	check_same(cached, uncached);
+	assert(stats->hits == 0);
+	assert(stats->misses == stats->entries);
+	/* Big enough that we had to split. */
+	assert(tal_count(cached) > 1);
+
+	/* Second time, all served from the cache: the top just says "split" */
+	cached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(rc, first_block, num_blocks, &cached);
+	check_same(cached, uncached);
+	assert(stats->hits == stats->entries);
+
+	/* A new channel in the last block only invalidates what covers it. */
+	add_chan(rc, first_block + num_blocks - 1, 2001);
+	uncached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(NULL, first_block, num_blocks, &uncached);
+	cached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(rc, first_block, num_blocks, &cached);
+	check_same(cached, uncached);
+	assert(stats->invalidations > 0);
+	assert(stats->invalidations < stats->entries);
+
+	/* Blocks nobody has asked about yet invalidate nothing. */
+	add_chan(rc, first_block + num_blocks + 10000, 0);
+	cached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(rc, first_block, num_blocks, &cached);
+	check_same(cached, uncached);
+
+	/* Removing one can make a range fit, so that drops the splits too.
+	 * (The last one is the one past the blocks we ask about.) */
+	remove_last_chan(rc);
+	remove_last_chan(rc);
+	uncached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(NULL, first_block, num_blocks, &uncached);
+	misses = stats->misses;
+	cached = tal_arr(tmpctx, struct reply, 0);
+	reply_ranges(rc, first_block, num_blocks, &cached);
+	check_same(cached, uncached);
+	/* Including the top one, which says "split". */
+	assert(stats->misses > misses + 1);
+
+	/* Now, how long does a peer's query_channel_range take? */
+	start = time_mono();
+	for (size_t i = 0; i < num_queries; i++) {
+		uncached = tal_arr(tmpctx, struct reply, 0);
+		reply_ranges(NULL, first_block, num_blocks, &uncached);
+		tal_free(uncached);
+	}
+	msec = time_to_msec(timemono_since(start));
+	printf("%zu channels, %zu queries uncached: %"PRIu64" msec\n",
+	       num_chans, num_queries, msec);
+
+	start = time_mono();
+	for (size_t i = 0; i < num_queries; i++) {
+		/* A new channel at the tip every time, as blocks come in */
+		add_chan(rc, first_block + num_blocks - 1, 3000 + i);
+		cached = tal_arr(tmpctx, struct reply, 0);
+		reply_ranges(rc, first_block, num_blocks, &cached);
+		tal_free(cached);
+	}
+	msec = time_to_msec(timemono_since(start));
+	printf("%zu channels, %zu queries cached: %"PRIu64" msec"
+	       " (%"PRIu64" hits, %"PRIu64" misses, %"PRIu64" invalidated)\n",
+	       num_chans, num_queries, msec,
+	       stats->hits, stats->misses, stats->invalidations);
+
+	tal_free(tmpctx);
+	opt_free_table();
+	return 0;
+}
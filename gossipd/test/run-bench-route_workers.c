@@ -0,0 +1,337 @@
+#include <assert.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/io/io.h>
+#include <ccan/opt/opt.h>
+#include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
+#include <common/pseudorand.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
+#include "../route_workers.c"
+#include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *node_id_1 UNNEEDED, struct node_id *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update_option_channel_htlc_max */
+bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* Generated stub for wire_type_name */
+const char *wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "wire_type_name called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+/* Updates existing route if required. */
+static void add_connection(struct routing_state *rstate,
+			   const struct node_id *nodes,
+			   u32 from, u32 to,
+			   u32 base_fee, s32 proportional_fee,
+			   u32 delay)
+{
+	struct short_channel_id scid;
+	struct half_chan *c;
+	struct chan *chan;
+	int idx = node_id_idx(&nodes[from], &nodes[to]);
+
+	/* Encode src and dst in scid. */
+	memcpy((char *)&scid + idx * sizeof(from), &from, sizeof(from));
+	memcpy((char *)&scid + (!idx) * sizeof(to), &to, sizeof(to));
+
+	chan = get_channel(rstate, &scid);
+	if (!chan) {
+		chan = new_chan(rstate, &scid, &nodes[from], &nodes[to],
+				AMOUNT_SAT(1000000));
+	}
+
+	c = &chan->half[idx];
+	c->base_fee = base_fee;
+	c->proportional_fee = proportional_fee;
+	c->delay = delay;
+	c->channel_flags = node_id_idx(&nodes[from], &nodes[to]);
+	/* This must be non-zero, otherwise we consider it disabled! */
+	c->bcast.index = 1;
+	set_half_chan_htlc_limits(rstate, chan, idx,
+				  AMOUNT_MSAT(0), AMOUNT_MSAT(-1ULL));
+}
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+static void populate_random_node(struct routing_state *rstate,
+				 const struct node_id *nodes,
+				 u32 n)
+{
+	/* Create 2 random channels. */
+	if (n < 1)
+		return;
+
+	for (size_t i = 0; i < 2; i++) {
+		u32 randnode = pseudorand(n);
+
+		add_connection(rstate, nodes, n, randnode,
+			       pseudorand(1000),
+			       pseudorand(1000),
+			       pseudorand(144));
+		add_connection(rstate, nodes, randnode, n,
+			       pseudorand(1000),
+			       pseudorand(1000),
+			       pseudorand(144));
+	}
+}
+
+static void change_every_chan(struct routing_state *rstate, int delta)
+{
+	struct chan *chan;
+	u64 idx;
+
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx)) {
+		chan->half[0].base_fee += delta;
+		routing_chan_updated(rstate, chan);
+	}
+}
+
+struct bench {
+	/* What get_route() said, for comparison. */
+	struct route_hop **expected;
+	size_t num_done;
+};
+
+static void route_done(const struct route_hop *hops, struct bench *b)
+{
+	const struct route_hop *expected = b->expected[b->num_done];
+
+	/* Must come back in order, and match what we did alone. */
+	assert(tal_count(hops) == tal_count(expected));
+	for (size_t i = 0; i < tal_count(hops); i++) {
+		assert(short_channel_id_eq(&hops[i].channel_id,
+					   &expected[i].channel_id));
+		assert(amount_msat_eq(hops[i].amount, expected[i].amount));
+		assert(hops[i].delay == expected[i].delay);
+	}
+
+	if (++b->num_done == tal_count(b->expected))
+		io_break(b);
+}
+
+static void nothing_done(const struct route_hop *hops, size_t *left)
+{
+	assert(!hops);
+	if (--*left == 0)
+		io_break(left);
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	size_t num_nodes = 100, num_runs = 1, max_threads = 2;
+	struct timemono start, end;
+	struct node_id me;
+	struct node_id *nodes, *from, *to;
+	struct amount_msat *amount;
+	u64 *seed;
+	struct bench b;
+	const double riskfactor = 0.01 / 10000;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	me = nodeid(0);
+	rstate = new_routing_state(tmpctx, NULL, &me, 0, NULL, NULL);
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+
+	if (argc > 1)
+		num_nodes = atoi(argv[1]);
+	if (argc > 2)
+		num_runs = atoi(argv[2]);
+	if (argc > 3)
+		max_threads = atoi(argv[3]);
+	if (argc > 4)
+		opt_usage_and_exit("[num_nodes [num_runs [max_threads]]]");
+
+	printf("Creating nodes...\n");
+	nodes = tal_arr(rstate, struct node_id, num_nodes);
+	for (size_t i = 0; i < num_nodes; i++)
+		nodes[i] = nodeid(i);
+
+	printf("Populating nodes...\n");
+	for (size_t i = 0; i < num_nodes; i++)
+		populate_random_node(rstate, nodes, i);
+
+	from = tal_arr(rstate, struct node_id, num_runs);
+	to = tal_arr(rstate, struct node_id, num_runs);
+	amount = tal_arr(rstate, struct amount_msat, num_runs);
+	seed = tal_arr(rstate, u64, num_runs);
+	b.expected = tal_arr(rstate, struct route_hop *, num_runs);
+
+	start = time_mono();
+	for (size_t i = 0; i < num_runs; i++) {
+		from[i] = nodes[pseudorand(num_nodes)];
+		to[i] = nodes[pseudorand(num_nodes)];
+		amount[i].millisatoshis = 1 + pseudorand(100000); /* Raw: test */
+		seed[i] = pseudorand_u64();
+		b.expected[i] = get_route(b.expected, rstate,
+					  &from[i], &to[i], amount[i],
+					  riskfactor, 9, 0.75, seed[i],
+					  NULL, ROUTING_MAX_HOPS);
+	}
+	end = time_mono();
+
+	/* get_route() is a thin layer over find_route(). */
+	if (num_runs) {
+		struct siphash_seed base_seed;
+		struct amount_msat fee;
+
+		base_seed.u.u64[0] = base_seed.u.u64[1] = seed[0];
+		assert(tal_count(find_route(tmpctx, rstate, &from[0], &to[0],
+					    amount[0],
+					    riskfactor / BLOCKS_PER_YEAR / 100,
+					    0.75, &base_seed,
+					    ROUTING_MAX_HOPS, &fee))
+		       == tal_count(b.expected[0]));
+	}
+
+	printf("main loop: %.0f routes per second\n",
+	       num_runs * 1000000000.0
+	       / time_to_nsec(timemono_between(end, start)));
+
+	for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+		struct route_workers *rw;
+
+		rw = route_workers_new(tmpctx, rstate, threads);
+		b.num_done = 0;
+
+		start = time_mono();
+		for (size_t i = 0; i < num_runs; i++) {
+			struct route_query rq;
+
+			if (route_query_init(tmpctx, &rq, rstate, &from[i], &to[i],
+					     amount[i], riskfactor, 9, 0.75,
+					     seed[i], NULL, ROUTING_MAX_HOPS))
+				route_workers_submit(rw, &rq, route_done, &b);
+			else
+				route_workers_submit(rw, NULL, route_done, &b);
+		}
+		/* Queries don't see changes made after they were submitted. */
+		change_every_chan(rstate, 1);
+		io_loop(NULL, NULL);
+		end = time_mono();
+		change_every_chan(rstate, -1);
+
+		assert(b.num_done == num_runs);
+		printf("%zu threads: %.0f routes per second\n",
+		       threads,
+		       num_runs * 1000000000.0
+		       / time_to_nsec(timemono_between(end, start)));
+		tal_free(rw);
+	}
+
+	/* Far more than fit in a pipe, before we get back to the io_loop:
+	 * we mustn't block waking ourselves. */
+	{
+		struct route_workers *rw = route_workers_new(tmpctx, rstate, 1);
+		size_t left = 200000;
+
+		for (size_t i = 0; i < left; i++)
+			route_workers_submit(rw, NULL, nothing_done, &left);
+		io_loop(NULL, NULL);
+		assert(left == 0);
+		tal_free(rw);
+	}
+
+	/* Every query let go of its snapshot. */
+	assert(rstate->snapshot->refs == 0);
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
@@ -0,0 +1,303 @@
+#include <assert.h>
+#include <bitcoin/privkey.h>
+#include <bitcoin/pubkey.h>
+#include <bitcoin/signature.h>
+#include <ccan/err/err.h>
+#include <ccan/io/io.h>
+#include <ccan/opt/opt.h>
+#include <ccan/tal/str/str.h>
+#include <ccan/time/time.h>
+#include <common/pseudorand.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
+#include "../sig_workers.c"
+#include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *node_id_1 UNNEEDED, struct node_id *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update_option_channel_htlc_max */
+bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for update_peers_broadcast_index */
+void update_peers_broadcast_index(struct list_head *peers UNNEEDED, u32 offset UNNEEDED)
+{ fprintf(stderr, "update_peers_broadcast_index called!\n"); abort(); }
+/* Generated stub for wire_type_name */
+const char *wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "wire_type_name called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+static struct privkey privkey(size_t n)
+{
+	struct privkey p;
+
+	memset(&p, 0xFF, sizeof(p));
+	memcpy(&p, &n, sizeof(n));
+	return p;
+}
+
+/* Like a channel_announcement (4 signatures) or anything else (1), with
+ * every 7th one bad. */
+static void make_sigs(struct gossip_sigs *sigs, size_t n)
+{
+	sigs->num = (n % 3 == 0) ? 4 : 1;
+	memset(&sigs->hash, 0, sizeof(sigs->hash));
+	memcpy(&sigs->hash, &n, sizeof(n));
+	for (size_t i = 0; i < sigs->num; i++) {
+		struct privkey p = privkey(n % 100 + i);
+
+		pubkey_from_privkey(&p, &sigs->key[i]);
+		sign_hash(&p, &sigs->hash, &sigs->sig[i]);
+	}
+	if (n % 7 == 0)
+		sigs->sig[sigs->num - 1].data[0] ^= 1;
+}
+
+struct bench {
+	struct gossip_sigs *sigs;
+	bool *expected;
+	size_t num_done;
+};
+
+static void sigs_done(const struct gossip_sigs *verified, struct bench *b)
+{
+	size_t n = b->num_done;
+
+	/* Must come back in order; we don't submit every 10th. */
+	if (n % 10 == 0)
+		assert(!verified);
+	else if (b->expected[n]) {
+		assert(verified);
+		assert(memcmp(verified, &b->sigs[n], sizeof(*verified)) == 0);
+	} else
+		assert(!verified);
+
+	if (++b->num_done == tal_count(b->expected))
+		io_break(b);
+}
+
+static void nothing_done(const struct gossip_sigs *verified, size_t *left)
+{
+	assert(!verified);
+	if (--*left == 0)
+		io_break(left);
+}
+
+int main(int argc, char *argv[])
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	size_t num_msgs = 1000, max_threads = 2;
+	struct timemono start, end;
+	struct node_id me, id[2], signer;
+	struct pubkey key;
+	struct short_channel_id scid;
+	struct siphash_seed base_seed;
+	struct amount_msat fee;
+	struct bench b;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+
+	if (argc > 1)
+		num_msgs = atoi(argv[1]);
+	if (argc > 2)
+		max_threads = atoi(argv[2]);
+	if (argc > 3)
+		opt_usage_and_exit("[num_msgs [max_threads]]");
+
+	b.sigs = tal_arr(tmpctx, struct gossip_sigs, num_msgs);
+	b.expected = tal_arr(tmpctx, bool, num_msgs);
+	for (size_t i = 0; i < num_msgs; i++)
+		make_sigs(&b.sigs[i], i);
+
+	start = time_mono();
+	for (size_t i = 0; i < num_msgs; i++)
+		b.expected[i] = gossip_sigs_check(&b.sigs[i]);
+	end = time_mono();
+
+	for (size_t i = 0; i < num_msgs; i++)
+		assert(b.expected[i] == (i % 7 != 0));
+
+	printf("main loop: %.0f messages per second\n",
+	       num_msgs * 1000000000.0
+	       / time_to_nsec(timemono_between(end, start)));
+
+	for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+		struct sig_workers *sw;
+
+		sw = sig_workers_new(tmpctx, threads);
+		b.num_done = 0;
+
+		start = time_mono();
+		for (size_t i = 0; i < num_msgs; i++) {
+			if (i % 10 == 0)
+				sig_workers_submit(sw, NULL, sigs_done, &b);
+			else
+				sig_workers_submit(sw, &b.sigs[i],
+						   sigs_done, &b);
+		}
+		assert(sig_workers_queued(sw) == num_msgs);
+		if (num_msgs)
+			io_loop(NULL, NULL);
+		end = time_mono();
+
+		assert(b.num_done == num_msgs);
+		assert(sig_workers_queued(sw) == 0);
+		assert(sig_workers_stats(sw)->submitted == num_msgs);
+		assert(sig_workers_stats(sw)->max_queued == num_msgs);
+		printf("%zu threads: %.0f messages per second\n",
+		       threads,
+		       num_msgs * 1000000000.0
+		       / time_to_nsec(timemono_between(end, start)));
+		tal_free(sw);
+	}
+
+	/* Far more than fit in a pipe, before we get back to the io_loop:
+	 * we mustn't block waking ourselves. */
+	{
+		struct sig_workers *sw = sig_workers_new(tmpctx, 1);
+		size_t left = 200000;
+
+		for (size_t i = 0; i < left; i++)
+			sig_workers_submit(sw, NULL, nothing_done, &left);
+		io_loop(NULL, NULL);
+		assert(left == 0);
+		tal_free(sw);
+	}
+
+	/* The routing code trusts exactly what was verified, and nothing
+	 * else. */
+	me = nodeid(0);
+	rstate = new_routing_state(tmpctx, NULL, &me, 0, NULL, NULL);
+	for (size_t i = 0; i < 2; i++) {
+		struct privkey p = privkey(1 + i);
+
+		pubkey_from_privkey(&p, &key);
+		node_id_from_pubkey(&id[i], &key);
+	}
+	if (node_id_cmp(&id[0], &id[1]) > 0) {
+		struct node_id tmp = id[0];
+		id[0] = id[1];
+		id[1] = tmp;
+	}
+	memset(&scid, 0, sizeof(scid));
+	new_chan(rstate, &scid, &id[0], &id[1], AMOUNT_SAT(1000000));
+
+	/* #1 is good (signed by privkey(1)), and we cache its key. */
+	node_id_from_pubkey(&signer, &b.sigs[1].key[0]);
+	assert(!get_node(rstate, &signer)->key_valid);
+	assert(check_signed_hash_nodeid(rstate, &b.sigs[1].hash,
+					&b.sigs[1].sig[0], &signer));
+	assert(get_node(rstate, &signer)->key_valid);
+	assert(check_signed_hash_nodeid(rstate, &b.sigs[1].hash,
+					&b.sigs[1].sig[0], &signer));
+
+	/* #7 is bad, so only believed if it's exactly what's "verified". */
+	rstate->verified = &b.sigs[7];
+	assert(check_signed_hash_rstate(rstate, &b.sigs[7].hash,
+					&b.sigs[7].sig[0], &b.sigs[7].key[0]));
+	assert(!check_signed_hash_rstate(rstate, &b.sigs[7].hash,
+					 &b.sigs[7].sig[0], &b.sigs[1].key[0]));
+	assert(!check_signed_hash_nodeid(rstate, &b.sigs[1].hash,
+					 &b.sigs[7].sig[0], &signer));
+	rstate->verified = NULL;
+	assert(!check_signed_hash_rstate(rstate, &b.sigs[7].hash,
+					 &b.sigs[7].sig[0], &b.sigs[7].key[0]));
+
+	/* No channel_update yet, so it's not usable. */
+	memset(&base_seed, 0, sizeof(base_seed));
+	assert(!find_route(tmpctx, rstate, &id[0], &id[1], AMOUNT_MSAT(1000),
+			   0, 0.75, &base_seed, ROUTING_MAX_HOPS, &fee));
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
@@ -12,7 +12,12 @@
 	do { printf((fmt) ,##__VA_ARGS__); printf("\n"); } while(0)
 
 #include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
 #include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
 
 /* AUTOGENERATED MOCKS START */
 /* Generated stub for fromwire_channel_announcement */
@@ -24,9 +29,6 @@ bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *
 /* Generated stub for fromwire_channel_update_option_channel_htlc_max */
 bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
 { fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
-/* Generated stub for fromwire_fail */
-const void *fromwire_fail(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_fail called!\n"); abort(); }
 /* Generated stub for fromwire_gossipd_local_add_channel */
 bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
 { fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
@@ -39,12 +41,6 @@ bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void
 /* Generated stub for fromwire_node_announcement */
 bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
 { fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
-/* Generated stub for fromwire_peektype */
-int fromwire_peektype(const u8 *cursor UNNEEDED)
-{ fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
-/* Generated stub for fromwire_u16 */
-u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
 /* Generated stub for fromwire_wireaddr */
 bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
 { fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
@@ -98,6 +94,7 @@ get_or_make_connection(struct routing_state *rstate,
 {
 	struct short_channel_id scid;
 	struct chan *chan;
+	struct amount_msat htlc_maximum;
 	const int idx = node_id_idx(from_id, to_id);
 
 	if (!short_channel_id_from_str(shortid, strlen(shortid), &scid,
@@ -109,13 +106,33 @@ get_or_make_connection(struct routing_state *rstate,
 
 	/* Make sure it's seen as initialized (index non-zero). */
 	chan->half[idx].bcast.index = 1;
-	chan->half[idx].htlc_minimum = AMOUNT_MSAT(0);
-	if (!amount_sat_to_msat(&chan->half[idx].htlc_maximum, satoshis))
+	if (!amount_sat_to_msat(&htlc_maximum, satoshis))
 		abort();
+	set_half_chan_htlc_limits(rstate, chan, idx,
+				  AMOUNT_MSAT(0), htlc_maximum);
 
 	return &chan->half[idx];
 }
 
+static void set_htlc_limits(struct routing_state *rstate,
+			    const struct node_id *from_id,
+			    const struct node_id *to_id,
+			    const char *shortid,
+			    struct amount_msat htlc_minimum,
+			    struct amount_msat htlc_maximum)
+{
+	struct short_channel_id scid;
+	struct chan *chan;
+
+	if (!short_channel_id_from_str(shortid, strlen(shortid), &scid,
+				       false))
+		abort();
+	chan = get_channel(rstate, &scid);
+	set_half_chan_htlc_limits(rstate, chan, node_id_idx(from_id, to_id),
+				  htlc_minimum, htlc_maximum);
+	routing_chan_updated(rstate, chan);
+}
+
 static bool channel_is_between(const struct chan *chan,
 			       const struct node_id *a, const struct node_id *b)
 {
@@ -187,7 +204,8 @@ int main(void)
 	nc->channel_flags = 0;
 	nc->message_flags = 0;
 	nc->bcast.timestamp = 1504064344;
-	nc->htlc_minimum = AMOUNT_MSAT(100);
+	set_htlc_limits(rstate, &b, &c, "6990x2x1",
+			AMOUNT_MSAT(100), AMOUNT_MSAT(1000 * 1000));
 
 	/* {'active': True, 'short_id': '6989:2:1/1', 'fee_per_kw': 10, 'delay': 5, 'message_flags': 0, 'channel_flags': 1, 'destination': '0230ad0e74ea03976b28fda587bb75bdd357a1938af4424156a18265167f5e40ae', 'source': '03c173897878996287a8100469f954dd820fcd8941daed91c327f168f3329be0bf', 'last_update': 1504064344}]} */
 	nc = get_or_make_connection(rstate, &a, &b, "6989x2x1", AMOUNT_SAT(1000));
@@ -231,8 +249,9 @@ int main(void)
 	nc->channel_flags = 0;
 	nc->message_flags = 1;
 	nc->bcast.timestamp = 1504064344;
-	nc->htlc_minimum = AMOUNT_MSAT(100);
-	nc->htlc_maximum = AMOUNT_MSAT(500000); /* half capacity */
+	/* half capacity */
+	set_htlc_limits(rstate, &a, &d, "6991x2x1",
+			AMOUNT_MSAT(100), AMOUNT_MSAT(500000));
 
 	/* This should route correctly at the max_msat level */
 	route = find_route(tmpctx, rstate, &a, &d, AMOUNT_MSAT(500000), riskfactor, 0.0, NULL,
@@ -1,5 +1,10 @@
 #include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
 #include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
 #include <stdio.h>
 
 void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
@@ -22,9 +27,6 @@ bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *
 /* Generated stub for fromwire_channel_update_option_channel_htlc_max */
 bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
 { fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
-/* Generated stub for fromwire_fail */
-const void *fromwire_fail(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_fail called!\n"); abort(); }
 /* Generated stub for fromwire_gossipd_local_add_channel */
 bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
 { fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
@@ -37,12 +39,6 @@ bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void
 /* Generated stub for fromwire_node_announcement */
 bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
 { fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
-/* Generated stub for fromwire_peektype */
-int fromwire_peektype(const u8 *cursor UNNEEDED)
-{ fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
-/* Generated stub for fromwire_u16 */
-u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
 /* Generated stub for fromwire_wireaddr */
 bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
 { fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
@@ -119,8 +115,9 @@ static void add_connection(struct routing_state *rstate,
 	c->proportional_fee = proportional_fee;
 	c->delay = delay;
 	c->channel_flags = node_id_idx(from, to);
-	c->htlc_minimum = AMOUNT_MSAT(0);
-	c->htlc_maximum = AMOUNT_MSAT(100000 * 1000);
+	set_half_chan_htlc_limits(rstate, chan, node_id_idx(from, to),
+				  AMOUNT_MSAT(0), AMOUNT_MSAT(100000 * 1000));
+	routing_chan_updated(rstate, chan);
 }
 
 /* Returns chan connecting from and to: *idx set to refer
@@ -144,7 +141,8 @@ static struct chan *find_channel(struct routing_state *rstate UNUSED,
 
 static struct half_chan *get_connection(struct routing_state *rstate,
 					       const struct node_id *from_id,
-					       const struct node_id *to_id)
+					       const struct node_id *to_id,
+					       struct chan **chan)
 {
 	int idx;
 	struct node *from, *to;
@@ -158,6 +156,7 @@ static struct half_chan *get_connection(struct routing_state *rstate,
 	c = find_channel(rstate, from, to, &idx);
 	if (!c)
 		return NULL;
+	*chan = c;
 	return &c->half[idx];
 }
 
@@ -175,6 +174,28 @@ static bool channel_is_between(const struct chan *chan,
 	return false;
 }
 
+static bool half_chan_eq(const struct routing_state *rstate_a,
+			 const struct chan *chan_a,
+			 const struct routing_state *rstate_b,
+			 const struct chan *chan_b,
+			 int dir)
+{
+	const struct half_chan *a = &chan_a->half[dir], *b = &chan_b->half[dir];
+
+	return a->bcast.index == b->bcast.index
+		&& a->bcast.timestamp == b->bcast.timestamp
+		&& a->base_fee == b->base_fee
+		&& a->proportional_fee == b->proportional_fee
+		&& a->delay == b->delay
+		&& a->channel_flags == b->channel_flags
+		&& a->message_flags == b->message_flags
+		&& a->htlc_minimum_msat == b->htlc_minimum_msat
+		&& amount_msat_eq(half_chan_htlc_minimum(rstate_a, chan_a, dir),
+				  half_chan_htlc_minimum(rstate_b, chan_b, dir))
+		&& amount_msat_eq(half_chan_htlc_maximum(rstate_a, chan_a, dir),
+				  half_chan_htlc_maximum(rstate_b, chan_b, dir));
+}
+
 int main(void)
 {
 	setup_locale();
@@ -183,8 +204,17 @@ int main(void)
 	struct node_id a, b, c, d;
 	struct privkey tmp;
 	struct amount_msat fee;
-	struct chan **route;
+	struct chan **route, *chan;
+	struct route_hop *hops, **routes;
+	struct short_channel_id_dir *excluded;
+	struct short_channel_id scid;
+	struct routing_snapshot *snap;
 	const double riskfactor = 1.0 / BLOCKS_PER_YEAR / 10000;
+	struct routing_state *rstate2;
+	struct gossip_store_index *idx;
+	u8 store[100] = { 0 };
+	u64 scidx;
+	int fd;
 
 	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
 						 | SECP256K1_CONTEXT_SIGN);
@@ -226,12 +256,21 @@ int main(void)
 	assert(amount_msat_eq(fee, AMOUNT_MSAT(1)));
 
 	/* A<->D<->C: Lower base, higher percentage. */
+	snap = rstate->snapshot;
+	assert(snap);
 	memset(&tmp, 'd', sizeof(tmp));
 	node_id_from_privkey(&tmp, &d);
 	new_node(rstate, &d);
 	status_trace("D = %s", type_to_string(tmpctx, struct node_id, &d));
 
+	/* Nobody can use a channel before its first update, so the snapshot
+	 * doesn't need rebuilding until then. */
+	memcpy(&scid, &a, sizeof(scid) / 2);
+	memcpy((char *)&scid + sizeof(scid) / 2, &d, sizeof(scid) / 2);
+	new_chan(rstate, &scid, &a, &d, AMOUNT_SAT(100000));
+	assert(rstate->snapshot == snap);
 	add_connection(rstate, &a, &d, 0, 2, 1);
+	assert(!rstate->snapshot);
 	add_connection(rstate, &d, &c, 0, 2, 1);
 
 	/* Will go via D for small amounts. */
@@ -252,8 +291,25 @@ int main(void)
 	assert(channel_is_between(route[1], &b, &c));
 	assert(amount_msat_eq(fee, AMOUNT_MSAT(1 + 3)));
 
-	/* Make B->C inactive, force it back via D */
-	get_connection(rstate, &b, &c)->channel_flags |= ROUTING_FLAGS_DISABLED;
+	/* Asking for more routes gives the one via D too, then runs out. */
+	routes = get_routes(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			    0.0, 0, NULL, ROUTING_MAX_HOPS, 3);
+	assert(tal_count(routes) == 2);
+	assert(tal_count(routes[0]) == 2);
+	assert(node_id_eq(&routes[0][0].nodeid, &b));
+	assert(tal_count(routes[1]) == 2);
+	assert(node_id_eq(&routes[1][0].nodeid, &d));
+
+	/* From us, our own channel can be in every route: but if that's all
+	 * there is, it's the only route. */
+	routes = get_routes(tmpctx, rstate, NULL, &b, AMOUNT_MSAT(1000), 1.0, 9,
+			    0.0, 0, NULL, ROUTING_MAX_HOPS, 3);
+	assert(tal_count(routes) == 1);
+	assert(tal_count(routes[0]) == 1);
+
+		/* Make B->C inactive, force it back via D */
+	get_connection(rstate, &b, &c, &chan)->channel_flags |= ROUTING_FLAGS_DISABLED;
+	routing_chan_updated(rstate, chan);
 	route = find_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), riskfactor, 0.0, NULL,
 			   ROUTING_MAX_HOPS, &fee);
 	assert(route);
@@ -262,6 +318,136 @@ int main(void)
 	assert(channel_is_between(route[1], &d, &c));
 	assert(amount_msat_eq(fee, AMOUNT_MSAT(0 + 6)));
 
+	/* Excluding A->D leaves no route at all. */
+	get_connection(rstate, &a, &d, &chan);
+	excluded = tal_arr(tmpctx, struct short_channel_id_dir, 1);
+	excluded[0].scid = chan->scid;
+	excluded[0].dir = node_id_idx(&a, &d);
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.0, 0, excluded, ROUTING_MAX_HOPS);
+	assert(!hops);
+
+	/* Exclusions only apply to that query. */
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.0, 0, NULL, ROUTING_MAX_HOPS);
+	assert(hops);
+	assert(tal_count(hops) == 2);
+	assert(short_channel_id_eq(&hops[0].channel_id, &chan->scid));
+
+	/* Second time around, the route cache answers. */
+	rstate->route_cache = route_cache_new(rstate, 10);
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.0, 0, NULL, ROUTING_MAX_HOPS);
+	assert(route_cache_stats(rstate->route_cache)->misses == 1);
+	assert(route_cache_stats(rstate->route_cache)->entries == 1);
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000001), 1.0, 9,
+			 0.0, 0, NULL, ROUTING_MAX_HOPS);
+	assert(route_cache_stats(rstate->route_cache)->hits == 1);
+	assert(tal_count(hops) == 2);
+	assert(short_channel_id_eq(&hops[0].channel_id, &chan->scid));
+	assert(amount_msat_eq(hops[1].amount, AMOUNT_MSAT(3000001)));
+
+	/* Different exclusions are a different route. */
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.0, 0, excluded, ROUTING_MAX_HOPS);
+	assert(!hops);
+	assert(route_cache_stats(rstate->route_cache)->misses == 2);
+
+	/* Each payment gets a random seed: any route fuzzed as much will do. */
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.5, 1, NULL, ROUTING_MAX_HOPS);
+	assert(route_cache_stats(rstate->route_cache)->misses == 3);
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.5, 2, NULL, ROUTING_MAX_HOPS);
+	assert(route_cache_stats(rstate->route_cache)->hits == 2);
+	assert(tal_count(hops) == 2);
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.0, 7, NULL, ROUTING_MAX_HOPS);
+	assert(route_cache_stats(rstate->route_cache)->hits == 3);
+	assert(route_cache_stats(rstate->route_cache)->entries == 2);
+
+	/* Changing D->C forgets the routes through it. */
+	add_connection(rstate, &d, &c, 0, 3, 1);
+	assert(route_cache_stats(rstate->route_cache)->invalidations == 2);
+	assert(route_cache_stats(rstate->route_cache)->entries == 0);
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.0, 0, NULL, ROUTING_MAX_HOPS);
+	assert(route_cache_stats(rstate->route_cache)->misses == 4);
+	assert(tal_count(hops) == 2);
+	assert(amount_msat_eq(hops[0].amount, AMOUNT_MSAT(3000000 + 9)));
+
+	/* So does disabling it locally. */
+	local_disable_chan(rstate, chan);
+	assert(route_cache_stats(rstate->route_cache)->invalidations == 3);
+	hops = get_route(tmpctx, rstate, &a, &c, AMOUNT_MSAT(3000000), 1.0, 9,
+			 0.0, 0, NULL, ROUTING_MAX_HOPS);
+	assert(!hops);
+
+	/* Usual htlc limits live in the half_chan, the rest elsewhere. */
+	set_half_chan_htlc_limits(rstate, chan, 0,
+				  AMOUNT_MSAT(1000), AMOUNT_MSAT(100000 * 1000));
+	assert(chan->half[0].htlc_minimum_msat == 1000);
+	set_half_chan_htlc_limits(rstate, chan, 1,
+				  AMOUNT_MSAT(0x100000000ULL),
+				  AMOUNT_MSAT(100000 * 1000));
+	assert(chan->half[1].htlc_minimum_msat
+	       == HALF_CHAN_HTLC_LIMITS_ELSEWHERE);
+	assert(amount_msat_eq(half_chan_htlc_minimum(rstate, chan, 1),
+			      AMOUNT_MSAT(0x100000000ULL)));
+	set_half_chan_htlc_limits(rstate, chan, 1,
+				  AMOUNT_MSAT(1), AMOUNT_MSAT(5000));
+	assert(amount_msat_eq(half_chan_htlc_minimum(rstate, chan, 1),
+			      AMOUNT_MSAT(1)));
+	assert(amount_msat_eq(half_chan_htlc_maximum(rstate, chan, 1),
+			      AMOUNT_MSAT(5000)));
+
+	/* An index restores the graph exactly, as long as the store it
+	 * describes hasn't changed. */
+	store[0] = GOSSIP_STORE_VERSION;
+	fd = open("run-find_route.store", O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	assert(write_all(fd, store, sizeof(store)));
+	close(fd);
+	get_node(rstate, &b)->bcast.index = 7;
+	get_node(rstate, &b)->bcast.timestamp = 100;
+	assert(gossip_store_index_write("run-find_route.index", rstate,
+					store, sizeof(store), 10, 2));
+	/* There's no real node_announcement to delete when we free it. */
+	get_node(rstate, &b)->bcast.index = 0;
+	idx = gossip_store_index_open(tmpctx, "run-find_route.index",
+				      "run-find_route.store");
+	assert(idx);
+	assert(idx->store_len == sizeof(store));
+	assert(idx->count == 10);
+	assert(idx->deleted == 2);
+
+	rstate2 = new_routing_state(tmpctx, NULL, &a, 0, NULL, NULL);
+	assert(gossip_store_index_restore(rstate2, idx));
+	for (chan = uintmap_first(&rstate->chanmap, &scidx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &scidx)) {
+		struct chan *chan2 = get_channel(rstate2, &chan->scid);
+		assert(chan2);
+		assert(node_id_eq(&chan2->nodes[0]->id, &chan->nodes[0]->id));
+		assert(node_id_eq(&chan2->nodes[1]->id, &chan->nodes[1]->id));
+		assert(amount_sat_eq(chan2->sat, chan->sat));
+		assert(half_chan_eq(rstate2, chan2, rstate, chan, 0));
+		assert(half_chan_eq(rstate2, chan2, rstate, chan, 1));
+	}
+	assert(get_node(rstate2, &b)->bcast.index == 7);
+	assert(get_node(rstate2, &b)->bcast.timestamp == 100);
+	assert(get_node(rstate2, &c)->bcast.index == 0);
+	get_node(rstate2, &b)->bcast.index = 0;
+
+	/* If the store changes under it, it's ignored. */
+	store[1]++;
+	fd = open("run-find_route.store", O_WRONLY|O_TRUNC, 0600);
+	assert(write_all(fd, store, sizeof(store)));
+	close(fd);
+	assert(!gossip_store_index_open(tmpctx, "run-find_route.index",
+					"run-find_route.store"));
+	unlink("run-find_route.store");
+	unlink("run-find_route.index");
+
 	tal_free(tmpctx);
 	secp256k1_context_destroy(secp256k1_ctx);
 	return 0;
@@ -0,0 +1,265 @@
+#include <assert.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/tal/str/str.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
+#include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *node_id_1 UNNEEDED, struct node_id *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update_option_channel_htlc_max */
+bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for wire_type_name */
+const char *wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "wire_type_name called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+static u32 peers_offset;
+
+void update_peers_broadcast_index(struct list_head *peers UNUSED, u32 offset)
+{
+	peers_offset = offset;
+}
+
+/* What each half_chan's update should say. */
+static u8 expect[100][2];
+
+static u64 add_msg(struct gossip_store *gs, int type, u8 fill)
+{
+	u8 *msg = tal_arr(tmpctx, u8, 0);
+
+	towire_u16(&msg, type);
+	for (size_t i = 0; i < 50 + fill; i++)
+		towire_u8(&msg, fill);
+	return gossip_store_add(gs, msg, 0, NULL);
+}
+
+static void check_chans(struct routing_state *rstate,
+			struct short_channel_id *scids)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(expect); i++) {
+		struct chan *chan = get_channel(rstate, &scids[i]);
+
+		for (int dir = 0; dir < 2; dir++) {
+			const u8 *msg;
+
+			msg = gossip_store_get(tmpctx, rstate->gs,
+					       chan->half[dir].bcast.index);
+			assert(fromwire_peektype(msg) == WIRE_CHANNEL_UPDATE);
+			assert(tal_count(msg) == 2 + 50 + expect[i][dir]);
+			assert(msg[2] == expect[i][dir]);
+		}
+	}
+}
+
+/* Replace the update for this half_chan. */
+static void update_chan(struct routing_state *rstate,
+			struct short_channel_id *scids, size_t i, int dir)
+{
+	struct chan *chan = get_channel(rstate, &scids[i]);
+
+	gossip_store_delete(rstate->gs, &chan->half[dir].bcast,
+			    WIRE_CHANNEL_UPDATE);
+	expect[i][dir]++;
+	chan->half[dir].bcast.index = add_msg(rstate->gs, WIRE_CHANNEL_UPDATE,
+					      expect[i][dir]);
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct node_id me, ids[ARRAY_SIZE(expect) + 1];
+	struct short_channel_id scids[ARRAY_SIZE(expect)];
+	struct siphash_seed base_seed;
+	struct amount_msat fee;
+	char *dir;
+	size_t steps;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	/* The store lives in the current directory. */
+	dir = tal_strdup(tmpctx, "/tmp/run-gossip_store_compact.XXXXXX");
+	assert(mkdtemp(dir));
+	assert(chdir(dir) == 0);
+
+	me = nodeid(0);
+	rstate = new_routing_state(tmpctx, NULL, &me, 0, NULL, NULL);
+
+	/* A star, every channel with both updates. */
+	for (size_t i = 0; i < ARRAY_SIZE(ids); i++)
+		ids[i] = nodeid(i + 1);
+	for (size_t i = 0; i < ARRAY_SIZE(expect); i++) {
+		struct chan *chan;
+
+		memset(&scids[i], 0, sizeof(scids[i]));
+		scids[i].u64 = i + 1;
+		if (node_id_cmp(&ids[0], &ids[i + 1]) < 0)
+			chan = new_chan(rstate, &scids[i], &ids[0], &ids[i + 1],
+					AMOUNT_SAT(1000000));
+		else
+			chan = new_chan(rstate, &scids[i], &ids[i + 1], &ids[0],
+					AMOUNT_SAT(1000000));
+		for (int d = 0; d < 2; d++) {
+			struct half_chan *hc = &chan->half[d];
+
+			hc->bcast.index = add_msg(rstate->gs,
+						  WIRE_CHANNEL_UPDATE,
+						  expect[i][d]);
+			hc->base_fee = hc->proportional_fee = 0;
+			hc->delay = 6;
+			set_half_chan_htlc_limits(rstate, chan, d, AMOUNT_MSAT(0),
+							  AMOUNT_MSAT(-1ULL));
+		}
+	}
+
+	/* Replace every update a few times, so 3/4 of the store is dead. */
+	for (size_t n = 0; n < 3; n++)
+		for (size_t i = 0; i < ARRAY_SIZE(expect); i++)
+			for (int d = 0; d < 2; d++)
+				update_chan(rstate, scids, i, d);
+	check_chans(rstate, scids);
+	assert(rstate->gs->count == 800);
+	assert(rstate->gs->deleted == 600);
+
+	/* Not worth it yet. */
+	assert(!gossip_store_maybe_compact_start(rstate->gs));
+	for (size_t n = 0; n < 2; n++)
+		for (size_t i = 0; i < ARRAY_SIZE(expect); i++)
+			for (int d = 0; d < 2; d++)
+				update_chan(rstate, scids, i, d);
+	assert(rstate->gs->count == 1200);
+	assert(rstate->gs->deleted == 1000);
+
+	/* Now compact a little at a time, changing things as we go: each
+	 * step, we replace one which is probably copied already, and one
+	 * which probably isn't. */
+	assert(gossip_store_maybe_compact_start(rstate->gs));
+	assert(gossip_store_compacting(rstate->gs));
+	assert(!gossip_store_compact_start(rstate->gs));
+	steps = 0;
+	while (gossip_store_compact_step(rstate->gs, 1000)) {
+		update_chan(rstate, scids, steps % ARRAY_SIZE(expect), 0);
+		update_chan(rstate, scids, ARRAY_SIZE(expect) - 1
+			    - steps % ARRAY_SIZE(expect), 1);
+		check_chans(rstate, scids);
+		steps++;
+	}
+	assert(steps > 10);
+	assert(!gossip_store_compacting(rstate->gs));
+	assert(peers_offset > 0);
+	check_chans(rstate, scids);
+
+	/* Only things deleted after they were copied are left. */
+	assert(rstate->gs->count - rstate->gs->deleted == 200);
+	assert(rstate->gs->deleted > 0);
+
+	/* And the synchronous version gets rid of those. */
+	assert(gossip_store_compact(rstate->gs));
+	assert(rstate->gs->count == 200);
+	assert(rstate->gs->deleted == 0);
+	check_chans(rstate, scids);
+
+	/* Still routable through the hub. */
+	memset(&base_seed, 0, sizeof(base_seed));
+	assert(tal_count(find_route(tmpctx, rstate, &ids[1], &ids[2],
+				    AMOUNT_MSAT(1000), 0, 0.75, &base_seed,
+				    ROUTING_MAX_HOPS, &fee)) == 2);
+
+	/* The chans point into the store, so we must free first. */
+	tal_free(rstate);
+	unlink("gossip_store");
+	assert(chdir("/") == 0);
+	rmdir(dir);
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
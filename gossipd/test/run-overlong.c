@@ -1,5 +1,10 @@
 #include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
 #include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
 #include <stdio.h>
 
 void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
@@ -22,9 +27,6 @@ bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *
 /* Generated stub for fromwire_channel_update_option_channel_htlc_max */
 bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
 { fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
-/* Generated stub for fromwire_fail */
-const void *fromwire_fail(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_fail called!\n"); abort(); }
 /* Generated stub for fromwire_gossipd_local_add_channel */
 bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
 { fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
@@ -37,12 +39,6 @@ bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void
 /* Generated stub for fromwire_node_announcement */
 bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
 { fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
-/* Generated stub for fromwire_peektype */
-int fromwire_peektype(const u8 *cursor UNNEEDED)
-{ fprintf(stderr, "fromwire_peektype called!\n"); abort(); }
-/* Generated stub for fromwire_u16 */
-u16 fromwire_u16(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
-{ fprintf(stderr, "fromwire_u16 called!\n"); abort(); }
 /* Generated stub for fromwire_wireaddr */
 bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
 { fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
@@ -138,8 +134,10 @@ int main(void)
 		hc->proportional_fee = 0;
 		hc->delay = 0;
 		hc->channel_flags = node_id_idx(&ids[i-1], &ids[i]);
-		hc->htlc_minimum = AMOUNT_MSAT(0);
-		hc->htlc_maximum = AMOUNT_MSAT(1000000 * 1000);
+		set_half_chan_htlc_limits(rstate, chan,
+					  node_id_idx(&ids[i-1], &ids[i]),
+					  AMOUNT_MSAT(0),
+					  AMOUNT_MSAT(1000000 * 1000));
 		SUPERVERBOSE("Joining %s to %s, fee %u",
 			     type_to_string(tmpctx, struct node_id, &ids[i-1]),
 			     type_to_string(tmpctx, struct node_id, &ids[i]),
@@ -157,8 +155,10 @@ int main(void)
 		hc->proportional_fee = 0;
 		hc->delay = 0;
 		hc->channel_flags = node_id_idx(&ids[1], &ids[i]);
-		hc->htlc_minimum = AMOUNT_MSAT(0);
-		hc->htlc_maximum = AMOUNT_MSAT(1000000 * 1000);
+		set_half_chan_htlc_limits(rstate, chan,
+					  node_id_idx(&ids[1], &ids[i]),
+					  AMOUNT_MSAT(0),
+					  AMOUNT_MSAT(1000000 * 1000));
 		SUPERVERBOSE("Joining %s to %s, fee %u",
 			     type_to_string(tmpctx, struct node_id, &ids[1]),
 			     type_to_string(tmpctx, struct node_id, &ids[i]),
@@ -0,0 +1,348 @@
+#include <assert.h>
+#include <bitcoin/pubkey.h>
+#include <ccan/err/err.h>
+#include <ccan/tal/str/str.h>
+#include <common/status.h>
+#include <common/type_to_string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../routing.c"
+#include "../range_cache.c"
+#include "../route_cache.c"
+#include "../routing_snapshot.c"
+#include "../gossip_store.c"
+#include "../gossip_store_index.c"
+#include "../slab.c"
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *node_id_1 UNNEEDED, struct node_id *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update_option_channel_htlc_max */
+bool fromwire_channel_update_option_channel_htlc_max(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u8 *message_flags UNNEEDED, u8 *channel_flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, struct amount_msat *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED, struct amount_msat *htlc_maximum_msat UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update_option_channel_htlc_max called!\n"); abort(); }
+/* Generated stub for fromwire_gossipd_local_add_channel */
+bool fromwire_gossipd_local_add_channel(const void *p UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct node_id *remote_node_id UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossipd_local_add_channel called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_channel_amount */
+bool fromwire_gossip_store_channel_amount(const void *p UNNEEDED, struct amount_sat *satoshis UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_store_private_update */
+bool fromwire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u8 **update UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct node_id *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for onion_type_name */
+const char *onion_type_name(int e UNNEEDED)
+{ fprintf(stderr, "onion_type_name called!\n"); abort(); }
+/* Generated stub for sanitize_error */
+char *sanitize_error(const tal_t *ctx UNNEEDED, const u8 *errmsg UNNEEDED,
+		     struct channel_id *channel_id UNNEEDED)
+{ fprintf(stderr, "sanitize_error called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* Generated stub for towire_errorfmt */
+u8 *towire_errorfmt(const tal_t *ctx UNNEEDED,
+		    const struct channel_id *channel UNNEEDED,
+		    const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "towire_errorfmt called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_channel_amount */
+u8 *towire_gossip_store_channel_amount(const tal_t *ctx UNNEEDED, struct amount_sat satoshis UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_channel_amount called!\n"); abort(); }
+/* Generated stub for towire_gossip_store_private_update */
+u8 *towire_gossip_store_private_update(const tal_t *ctx UNNEEDED, const u8 *update UNNEEDED)
+{ fprintf(stderr, "towire_gossip_store_private_update called!\n"); abort(); }
+/* Generated stub for wire_type_name */
+const char *wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "wire_type_name called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+#if DEVELOPER
+/* Generated stub for memleak_remove_htable */
+void memleak_remove_htable(struct htable *memtable UNNEEDED, const struct htable *ht UNNEEDED)
+{ fprintf(stderr, "memleak_remove_htable called!\n"); abort(); }
+/* Generated stub for memleak_remove_intmap_ */
+void memleak_remove_intmap_(struct htable *memtable UNNEEDED, const struct intmap *m UNNEEDED)
+{ fprintf(stderr, "memleak_remove_intmap_ called!\n"); abort(); }
+#endif
+
+static struct node_id nodeid(size_t n)
+{
+	struct node_id id;
+	struct pubkey k;
+	struct secret s;
+
+	memset(&s, 0xFF, sizeof(s));
+	memcpy(&s, &n, sizeof(n));
+	pubkey_from_secret(&s, &k);
+	node_id_from_pubkey(&id, &k);
+	return id;
+}
+
+void update_peers_broadcast_index(struct list_head *peers UNUSED, u32 offset UNUSED)
+{
+}
+
+static u32 add_msg(struct gossip_store *gs, int type, u32 timestamp)
+{
+	u8 *msg = tal_arr(tmpctx, u8, 0);
+
+	towire_u16(&msg, type);
+	towire_u32(&msg, timestamp);
+	return gossip_store_add(gs, msg, timestamp, NULL);
+}
+
+/* A public channel from the hub, with updates of these ages (0 == none) */
+static struct short_channel_id add_test_chan(struct routing_state *rstate,
+					     const struct node_id *hub,
+					     size_t n, u32 now,
+					     u32 age0, u32 age1)
+{
+	struct short_channel_id scid;
+	struct node_id other = nodeid(n + 100);
+	const u32 ages[2] = { age0, age1 };
+	struct chan *chan;
+
+	assert(mk_short_channel_id(&scid, n + 1, 0, 0));
+	if (node_id_cmp(hub, &other) < 0)
+		chan = new_chan(rstate, &scid, hub, &other, AMOUNT_SAT(100000));
+	else
+		chan = new_chan(rstate, &scid, &other, hub, AMOUNT_SAT(100000));
+	chan->bcast.timestamp = now;
+	chan->bcast.index = add_msg(rstate->gs, WIRE_CHANNEL_ANNOUNCEMENT, now);
+	add_msg(rstate->gs, WIRE_GOSSIP_STORE_CHANNEL_AMOUNT, now);
+
+	for (int d = 0; d < 2; d++) {
+		struct half_chan *hc = &chan->half[d];
+
+		if (!ages[d])
+			continue;
+		hc->bcast.timestamp = now - ages[d];
+		hc->bcast.index = add_msg(rstate->gs, WIRE_CHANNEL_UPDATE,
+					  hc->bcast.timestamp);
+		hc->base_fee = hc->proportional_fee = 0;
+		hc->delay = 6;
+		set_half_chan_htlc_limits(rstate, chan, d, AMOUNT_MSAT(0),
+						  AMOUNT_MSAT(-1ULL));
+	}
+	routing_chan_timestamps_changed(rstate, chan);
+	return scid;
+}
+
+static size_t num_buckets(const struct routing_state *rstate)
+{
+	size_t n = 0;
+	u64 idx;
+
+	for (struct prune_bucket *b = uintmap_first(&rstate->prune_buckets,
+						    &idx);
+	     b;
+	     b = uintmap_after(&rstate->prune_buckets, &idx))
+		n++;
+	return n;
+}
+
+static size_t num_update_tokens(const struct routing_state *rstate)
+{
+	size_t n = 0;
+	u64 idx;
+
+	for (int dir = 0; dir < 2; dir++) {
+		for (struct update_tokens *ut
+			     = uintmap_first(&rstate->update_tokens[dir], &idx);
+		     ut;
+		     ut = uintmap_after(&rstate->update_tokens[dir], &idx))
+			n++;
+	}
+	return n;
+}
+
+int main(void)
+{
+	setup_locale();
+
+	struct routing_state *rstate;
+	struct node_id me, hub, dst;
+	struct short_channel_id old, half_old, fresh, one_old, refreshed,
+		local;
+	struct siphash_seed base_seed;
+	struct amount_msat fee;
+	struct chan *chan;
+	struct node **nodes;
+	char *dir;
+	u32 now, tokens_time;
+	int d;
+	u64 idx;
+	/* Two weeks */
+	const u32 prune_timeout = 1209600;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+	setup_tmpctx();
+
+	/* The store lives in the current directory. */
+	dir = tal_strdup(tmpctx, "/tmp/run-route_prune.XXXXXX");
+	assert(mkdtemp(dir));
+	assert(chdir(dir) == 0);
+
+	me = nodeid(0);
+	hub = nodeid(1);
+	rstate = new_routing_state(tmpctx, NULL, &me, prune_timeout,
+				   NULL, NULL);
+	now = time_now().ts.tv_sec;
+
+	old = add_test_chan(rstate, &hub, 0, now,
+		       prune_timeout + 100, prune_timeout + 7200);
+	half_old = add_test_chan(rstate, &hub, 1, now, prune_timeout + 100, 100);
+	fresh = add_test_chan(rstate, &hub, 2, now, 100, 200);
+	one_old = add_test_chan(rstate, &hub, 3, now, 0, prune_timeout + 100);
+	refreshed = add_test_chan(rstate, &hub, 4, now,
+			     prune_timeout + 100, prune_timeout + 100);
+	/* Not announced, so never pruned. */
+	local = add_test_chan(rstate, &hub, 5, now,
+			 prune_timeout * 2, prune_timeout * 2);
+	chan = get_channel(rstate, &local);
+	gossip_store_delete(rstate->gs, &chan->bcast,
+			    WIRE_CHANNEL_ANNOUNCEMENT);
+	chan->bcast.timestamp = 0;
+
+	/* A new update moves it to a newer bucket. */
+	chan = get_channel(rstate, &refreshed);
+	chan->half[1].bcast.timestamp = now - 10;
+	routing_chan_timestamps_changed(rstate, chan);
+	assert(chan->prune_bucket->key == (now - 10) / PRUNE_BUCKET_SECS);
+
+	route_prune(rstate);
+	assert(!get_channel(rstate, &old));
+	assert(!get_channel(rstate, &one_old));
+	assert(get_channel(rstate, &half_old));
+	assert(get_channel(rstate, &fresh));
+	assert(get_channel(rstate, &refreshed));
+	assert(get_channel(rstate, &local));
+
+	/* Pruned channels leave their buckets, and empty buckets go. */
+	for (struct chan *c = uintmap_first(&rstate->chanmap, &idx);
+	     c;
+	     c = uintmap_after(&rstate->chanmap, &idx)) {
+		assert(c->prune_bucket);
+		assert(c->prune_bucket->key
+		       == chan_newest_timestamp(c) / PRUNE_BUCKET_SECS);
+	}
+	assert(num_buckets(rstate) <= 3);
+
+	/* Pruning took some nodes: listnodes sees the rest, in order. */
+	nodes = routing_nodes_by_id(rstate);
+	assert(tal_count(nodes) > 2);
+	for (size_t i = 1; i < tal_count(nodes); i++)
+		assert(node_id_cmp(&nodes[i-1]->id, &nodes[i]->id) < 0);
+	for (size_t i = 0; i < tal_count(nodes); i++)
+		assert(get_node(rstate, &nodes[i]->id) == nodes[i]);
+	assert(routing_nodes_from(nodes, &nodes[0]->id) == 0);
+	assert(routing_nodes_from(nodes, &nodes[2]->id) == 2);
+	memset(&dst, 0xFF, sizeof(dst));
+	assert(routing_nodes_from(nodes, &dst) == tal_count(nodes));
+	/* It's kept until nodes come or go. */
+	assert(routing_nodes_by_id(rstate) == nodes);
+
+	/* What's left is still routable. */
+	memset(&base_seed, 0, sizeof(base_seed));
+	dst = nodeid(102);
+	assert(tal_count(find_route(tmpctx, rstate, &hub, &dst,
+				    AMOUNT_MSAT(1000), 0, 0.75, &base_seed,
+				    ROUTING_MAX_HOPS, &fee)) == 1);
+
+	/* Four tokens over 400 seconds: 100 seconds each, and part-earned
+	 * tokens aren't lost. */
+	tokens_time = 1000;
+	assert(refill_tokens(4, &tokens_time, 1150, 4, 400) == 3);
+	assert(tokens_time == 1100);
+	assert(refill_tokens(3, &tokens_time, 1199, 4, 400) == 3);
+	assert(refill_tokens(3, &tokens_time, 1200, 4, 400) == 2);
+	assert(refill_tokens(2, &tokens_time, 5000, 4, 400) == 0);
+	assert(tokens_time == 5000);
+	/* A period longer than a u32 is just slow. */
+	assert(refill_tokens(4, &tokens_time, 5000 + 0x80000000, 255,
+			     255ULL * 0xFFFFFFFF) == 4);
+	assert(tokens_time == 5000);
+
+	/* A burst per direction, then the update is held back. */
+	rstate->ratelimit_burst = 2;
+	rstate->ratelimit_node_burst = 3;
+	rstate->ratelimit_refill = 300;
+	chan = get_channel(rstate, &fresh);
+	d = node_id_eq(&chan->nodes[0]->id, &hub) ? 0 : 1;
+	assert(take_update_tokens(rstate, chan, d));
+	assert(take_update_tokens(rstate, chan, d));
+	assert(!take_update_tokens(rstate, chan, d));
+	/* Only the newest is kept. */
+	suppress_update(rstate, chan, d, now, tal_arr(tmpctx, u8, 1));
+	suppress_update(rstate, chan, d, now + 1, tal_arr(tmpctx, u8, 2));
+	suppress_update(rstate, chan, d, now - 1, tal_arr(tmpctx, u8, 3));
+	assert(routing_num_suppressed(rstate) == 1);
+	assert(tal_count(((struct suppressed_update *)
+			  uintmap_get(&rstate->suppressed[d], fresh.u64))
+			 ->update) == 2);
+
+	/* The hub's bucket is shared by its other channels... */
+	chan = get_channel(rstate, &half_old);
+	d = node_id_eq(&chan->nodes[0]->id, &hub) ? 0 : 1;
+	assert(take_update_tokens(rstate, chan, d));
+	assert(!take_update_tokens(rstate, chan, d));
+	/* ... but the other direction is someone else. */
+	assert(take_update_tokens(rstate, chan, !d));
+
+	/* Both refill with time (burst * refill seconds for all of it) */
+	chan = get_channel(rstate, &fresh);
+	d = node_id_eq(&chan->nodes[0]->id, &hub) ? 0 : 1;
+	((struct update_tokens *)uintmap_get(&rstate->update_tokens[d],
+					     fresh.u64))->time -= 300;
+	chan->nodes[d]->tokens_time -= 600;
+	assert(take_update_tokens(rstate, chan, d));
+	assert(!take_update_tokens(rstate, chan, d));
+
+	/* Closing the channel drops what we were holding, and its bucket. */
+	assert(num_update_tokens(rstate) == 3);
+	free_chan(rstate, chan);
+	assert(routing_num_suppressed(rstate) == 0);
+	assert(num_update_tokens(rstate) == 2);
+
+	/* Once they're full again, pruning forgets them. */
+	((struct update_tokens *)uintmap_get(&rstate->update_tokens[0],
+					     half_old.u64))->time -= 600;
+	route_prune(rstate);
+	assert(num_update_tokens(rstate) == 1);
+	((struct update_tokens *)uintmap_get(&rstate->update_tokens[1],
+					     half_old.u64))->time -= 600;
+	route_prune(rstate);
+	assert(num_update_tokens(rstate) == 0);
+
+	/* The chans point into the store, so we must free first. */
+	tal_free(rstate);
+	unlink("gossip_store");
+	assert(chdir("/") == 0);
+	rmdir(dir);
+
+	tal_free(tmpctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <assert.h>
+#include <common/utils.h>
+#include <stdio.h>
+
+#include "../slab.c"
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+/* An awkward size, with something that wants more than pointer alignment
+ * on some platforms. */
+struct odd {
+	char c;
+	u64 u;
+	double d;
+	char tail[3];
+};
+
+static bool aligned(const void *p, size_t align)
+{
+	return ((uintptr_t)p & (align - 1)) == 0;
+}
+
+int main(void)
+{
+	struct slab *slab;
+	struct slab_stats stats;
+	struct odd **objs;
+
+	setup_locale();
+	setup_tmpctx();
+
+	slab = slab_new(tmpctx, struct odd, 7);
+	slab_get_stats(slab, &stats);
+	assert(stats.objsize >= sizeof(struct odd));
+	assert(stats.objsize % ALIGNOF(struct odd) == 0);
+	assert(stats.objsize % ALIGNOF(u64) == 0);
+
+	/* Across several pages, every object is aligned, and zeroed. */
+	objs = tal_arr(tmpctx, struct odd *, 30);
+	for (size_t i = 0; i < tal_count(objs); i++) {
+		objs[i] = slab_alloc(slab, struct odd);
+		assert(aligned(objs[i], ALIGNOF(struct odd)));
+		assert(aligned(&objs[i]->u, ALIGNOF(u64)));
+		assert(aligned(&objs[i]->d, ALIGNOF(double)));
+		assert(objs[i]->u == 0);
+		objs[i]->u = i;
+		objs[i]->d = i;
+		memset(objs[i]->tail, 0xFF, sizeof(objs[i]->tail));
+	}
+	slab_get_stats(slab, &stats);
+	assert(stats.in_use == 30);
+	assert(stats.pages == 5);
+	assert(stats.capacity == 35);
+
+	/* Nothing trod on its neighbours. */
+	for (size_t i = 0; i < tal_count(objs); i++) {
+		assert(objs[i]->u == i);
+		assert(objs[i]->d == i);
+	}
+
+	/* Freed ones come back (zeroed) before we need another page. */
+	slab_free(slab, objs[3]);
+	slab_free(slab, objs[17]);
+	assert(slab_alloc(slab, struct odd) == objs[17]);
+	assert(objs[17]->u == 0);
+	assert(slab_alloc(slab, struct odd) == objs[3]);
+	slab_get_stats(slab, &stats);
+	assert(stats.in_use == 30);
+	assert(stats.pages == 5);
+
+	tal_free(tmpctx);
+	return 0;
+}
@@ -526,22 +526,6 @@ void bitcoind_getblockcount_(struct bitcoind *bitcoind,
 			  "getblockcount", NULL);
 }
 
-struct get_output {
-	unsigned int blocknum, txnum, outnum;
-
-	/* The real callback */
-	void (*cb)(struct bitcoind *bitcoind, const struct bitcoin_tx_output *txout, void *arg);
-
-	/* The real callback arg */
-	void *cbarg;
-};
-
-static void process_get_output(struct bitcoind *bitcoind, const struct bitcoin_tx_output *txout, void *arg)
-{
-	struct get_output *go = arg;
-	go->cb(bitcoind, txout, go->cbarg);
-}
-
 static bool process_gettxout(struct bitcoin_cli *bcli)
 {
 	void (*cb)(struct bitcoind *bitcoind,
@@ -605,20 +589,19 @@ static bool process_gettxout(struct bitcoin_cli *bcli)
 }
 
 /**
- * process_getblock -- Retrieve a block from bitcoind
+ * process_getblock_txids -- Retrieve a block's txids from bitcoind
  *
- * Used to resolve a `txoutput` after identifying the blockhash, and
- * before extracting the outpoint from the UTXO.
+ * Used to resolve `txoutput`s after identifying the blockhash, and
+ * before extracting the outpoints from the UTXO set.
  */
-static bool process_getblock(struct bitcoin_cli *bcli)
+static bool process_getblock_txids(struct bitcoin_cli *bcli)
 {
 	void (*cb)(struct bitcoind *bitcoind,
-		   const struct bitcoin_tx_output *output,
+		   const struct bitcoin_txid *txids,
 		   void *arg) = bcli->cb;
-	struct get_output *go = bcli->cb_arg;
-	void *cbarg = go->cbarg;
 	const jsmntok_t *tokens, *txstok, *txidtok;
-	struct bitcoin_txid txid;
+	struct bitcoin_txid *txids;
+	size_t i;
 	bool valid;
 
 	tokens = json_parse_input(bcli->output, bcli->output, bcli->output_bytes,
@@ -629,8 +612,7 @@ static bool process_getblock(struct bitcoin_cli *bcli)
 		log_debug(bcli->bitcoind->log,
 			  "%s: returned invalid block, is this a pruned node?",
 			  bcli_args(tmpctx, bcli));
-		cb(bcli->bitcoind, NULL, cbarg);
-		tal_free(go);
+		cb(bcli->bitcoind, NULL, bcli->cb_arg);
 		return true;
 	}
 
@@ -645,84 +627,62 @@ static bool process_getblock(struct bitcoin_cli *bcli)
 	    ...
 	*/
 	txstok = json_get_member(bcli->output, tokens, "tx");
-	if (!txstok)
+	if (!txstok || txstok->type != JSMN_ARRAY)
 		fatal("%s: had no tx member (%.*s)?",
 		      bcli_args(tmpctx, bcli),
 		      (int)bcli->output_bytes, bcli->output);
 
-	/* Now, this can certainly happen, if txnum too large. */
-	txidtok = json_get_arr(txstok, go->txnum);
-	if (!txidtok) {
-		log_debug(bcli->bitcoind->log, "%s: no txnum %u",
-			  bcli_args(tmpctx, bcli), go->txnum);
-		cb(bcli->bitcoind, NULL, cbarg);
-		tal_free(go);
-		return true;
+	txids = tal_arr(bcli, struct bitcoin_txid, txstok->size);
+	json_for_each_arr(i, txidtok, txstok) {
+		if (!bitcoin_txid_from_hex(bcli->output + txidtok->start,
+					   txidtok->end - txidtok->start,
+					   &txids[i]))
+			fatal("%s: had bad txid (%.*s)?",
+			      bcli_args(tmpctx, bcli),
+			      json_tok_full_len(txidtok),
+			      json_tok_full(bcli->output, txidtok));
 	}
 
-	if (!bitcoin_txid_from_hex(bcli->output + txidtok->start,
-				   txidtok->end - txidtok->start,
-				   &txid))
-		fatal("%s: had bad txid (%.*s)?",
-		      bcli_args(tmpctx, bcli),
-		      json_tok_full_len(txidtok),
-		      json_tok_full(bcli->output, txidtok));
-
-	go->cb = cb;
-	/* Now get the raw tx output. */
-	bitcoind_gettxout(bcli->bitcoind, &txid, go->outnum, process_get_output, go);
+	cb(bcli->bitcoind, txids, bcli->cb_arg);
 	return true;
 }
 
-static bool process_getblockhash_for_txout(struct bitcoin_cli *bcli)
+static bool process_getblockhash_for_txids(struct bitcoin_cli *bcli)
 {
 	void (*cb)(struct bitcoind *bitcoind,
-		   const struct bitcoin_tx_output *output,
+		   const struct bitcoin_txid *txids,
 		   void *arg) = bcli->cb;
-	struct get_output *go = bcli->cb_arg;
 	char *blockhash;
 
 	if (*bcli->exitstatus != 0) {
-		void *cbarg = go->cbarg;
 		log_debug(bcli->bitcoind->log, "%s: invalid blocknum?",
 			  bcli_args(tmpctx, bcli));
-		tal_free(go);
-		cb(bcli->bitcoind, NULL, cbarg);
+		cb(bcli->bitcoind, NULL, bcli->cb_arg);
 		return true;
 	}
 
 	/* Strip the newline at the end of the previous output */
 	blockhash = tal_strndup(NULL, bcli->output, bcli->output_bytes-1);
 
-	start_bitcoin_cli(bcli->bitcoind, NULL, process_getblock, true,
+	start_bitcoin_cli(bcli->bitcoind, NULL, process_getblock_txids, true,
 			  BITCOIND_LOW_PRIO,
-			  cb, go,
+			  cb, bcli->cb_arg,
 			  "getblock", take(blockhash), NULL);
 	return true;
 }
 
-void bitcoind_getoutput_(struct bitcoind *bitcoind,
-			 unsigned int blocknum, unsigned int txnum,
-			 unsigned int outnum,
-			 void (*cb)(struct bitcoind *bitcoind,
-				    const struct bitcoin_tx_output *output,
-				    void *arg),
-			 void *arg)
+void bitcoind_getblocktxids_(struct bitcoind *bitcoind,
+			     u32 height,
+			     void (*cb)(struct bitcoind *bitcoind,
+					const struct bitcoin_txid *txids,
+					void *arg),
+			     void *arg)
 {
-	struct get_output *go = tal(bitcoind, struct get_output);
-	go->blocknum = blocknum;
-	go->txnum = txnum;
-	go->outnum = outnum;
-	go->cbarg = arg;
-
 	/* We may not have topology ourselves that far back, so ask bitcoind */
-	start_bitcoin_cli(bitcoind, NULL, process_getblockhash_for_txout,
-			  true, BITCOIND_LOW_PRIO, cb, go,
-			  "getblockhash", take(tal_fmt(NULL, "%u", blocknum)),
+	start_bitcoin_cli(bitcoind, NULL, process_getblockhash_for_txids,
+			  true, BITCOIND_LOW_PRIO, cb, arg,
+			  "getblockhash", take(tal_fmt(NULL, "%u", height)),
 			  NULL);
-
-	/* Looks like a leak, but we free it in process_getblock */
-	notleak(go);
 }
 
 static bool process_getblockhash(struct bitcoin_cli *bcli)
@@ -146,20 +146,21 @@ void bitcoind_getrawblock_(struct bitcoind *bitcoind,
 						  struct bitcoin_block *), \
 			      (arg))
 
-void bitcoind_getoutput_(struct bitcoind *bitcoind,
-			 unsigned int blocknum, unsigned int txnum,
-			 unsigned int outnum,
-			 void (*cb)(struct bitcoind *bitcoind,
-				    const struct bitcoin_tx_output *output,
-				    void *arg),
-			 void *arg);
-#define bitcoind_getoutput(bitcoind_, blocknum, txnum, outnum, cb, arg)	\
-	bitcoind_getoutput_((bitcoind_), (blocknum), (txnum), (outnum),	\
-			    typesafe_cb_preargs(void, void *,		\
-						(cb), (arg),		\
-						struct bitcoind *,	\
-						const struct bitcoin_tx_output*), \
-			    (arg))
+/* txids is NULL if the block can't be found (eg. pruned), otherwise
+ * every txid in the block at @height, in order. */
+void bitcoind_getblocktxids_(struct bitcoind *bitcoind,
+			     u32 height,
+			     void (*cb)(struct bitcoind *bitcoind,
+					const struct bitcoin_txid *txids,
+					void *arg),
+			     void *arg);
+#define bitcoind_getblocktxids(bitcoind_, height, cb, arg)		\
+	bitcoind_getblocktxids_((bitcoind_), (height),			\
+				typesafe_cb_preargs(void, void *,	\
+						    (cb), (arg),	\
+						    struct bitcoind *,	\
+						    const struct bitcoin_txid *), \
+				(arg))
 
 void bitcoind_gettxout(struct bitcoind *bitcoind,
 		       const struct bitcoin_txid *txid, const u32 outnum,
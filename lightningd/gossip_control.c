@@ -5,6 +5,7 @@
 #include "peer_control.h"
 #include "subd.h"
 #include <ccan/array_size/array_size.h>
+#include <ccan/cast/cast.h>
 #include <ccan/crypto/siphash24/siphash24.h>
 #include <ccan/err/err.h>
 #include <ccan/fdpass/fdpass.h>
@@ -37,65 +38,228 @@
 #include <wire/gen_peer_wire.h>
 #include <wire/wire_sync.h>
 
+/*~ gossipd asks about channel_announcement outputs in batches, sorted by
+ * block.  Outside the range our utxoset covers, each block means a
+ * getblockhash and a getblock before we can gettxout each one, so we only
+ * fetch each block once per batch, and remember the txids of the last few:
+ * an initial sync asks about the same blocks over and over. */
+#define GOSSIP_BLOCK_TXIDS_CACHE 32
+
+/* Blocks this close to the tip might still be reorganized away. */
+#define GOSSIP_BLOCK_TXIDS_MIN_DEPTH 100
+
+struct block_txids {
+	/* In ld->gossip_block_txids, most recently used first */
+	struct list_node list;
+	u32 height;
+	struct bitcoin_txid *txids;
+};
+
+/* All the outputs from one GOSSIP_GET_TXOUTS, which we reply to at once. */
+struct txouts_request {
+	struct subd *gossip;
+	struct gossip_txout **txouts;
+	/* Lookups still going (plus one while we're starting them) */
+	size_t num_pending;
+};
+
+/* The outputs of one request which are in the same block. */
+struct block_txouts {
+	struct txouts_request *req;
+	u32 height;
+	/* Indices into req->txouts */
+	size_t *idx;
+};
+
+/* One output we're asking bitcoind about. */
+struct txout_lookup {
+	struct txouts_request *req;
+	struct gossip_txout *txout;
+};
+
+static const struct bitcoin_txid *cached_block_txids(struct lightningd *ld,
+						     u32 height)
+{
+	struct block_txids *b;
+
+	list_for_each(&ld->gossip_block_txids, b, list) {
+		if (b->height == height) {
+			list_del_from(&ld->gossip_block_txids, &b->list);
+			list_add(&ld->gossip_block_txids, &b->list);
+			return b->txids;
+		}
+	}
+	return NULL;
+}
+
+static void cache_block_txids(struct lightningd *ld, u32 height,
+			      const struct bitcoin_txid *txids)
+{
+	struct block_txids *b;
+	size_t num = 0;
+
+	if (height + GOSSIP_BLOCK_TXIDS_MIN_DEPTH
+	    > get_block_height(ld->topology))
+		return;
+
+	/* Another batch may have fetched it meanwhile. */
+	if (cached_block_txids(ld, height))
+		return;
+
+	list_for_each(&ld->gossip_block_txids, b, list)
+		num++;
+	if (num >= GOSSIP_BLOCK_TXIDS_CACHE) {
+		b = list_tail(&ld->gossip_block_txids, struct block_txids, list);
+		list_del_from(&ld->gossip_block_txids, &b->list);
+		tal_free(b);
+	}
+
+	b = tal(ld, struct block_txids);
+	b->height = height;
+	b->txids = tal_dup_arr(b, struct bitcoin_txid, txids,
+			       tal_count(txids), 0);
+	list_add(&ld->gossip_block_txids, &b->list);
+}
+
+static void txout_done(struct txouts_request *req)
+{
+	assert(req->num_pending > 0);
+	if (--req->num_pending != 0)
+		return;
+
+	subd_send_msg(req->gossip,
+		      take(towire_gossip_get_txouts_reply(NULL,
+				cast_const2(const struct gossip_txout **,
+					    req->txouts))));
+	tal_free(req);
+}
+
 static void got_txout(struct bitcoind *bitcoind,
 		      const struct bitcoin_tx_output *output,
-		      struct short_channel_id *scid)
+		      void *arg)
 {
-	const u8 *script;
-	struct amount_sat sat;
+	struct txout_lookup *lookup = arg;
+	struct txouts_request *req = lookup->req;
 
 	/* output will be NULL if it wasn't found */
 	if (output) {
-		script = output->script;
-		sat = output->amount;
-	} else {
-		script = NULL;
-		sat = AMOUNT_SAT(0);
+		lookup->txout->outscript = tal_dup_arr(lookup->txout, u8,
+						       output->script,
+						       tal_count(output->script),
+						       0);
+		lookup->txout->sat = output->amount;
 	}
+	tal_free(lookup);
+	txout_done(req);
+}
 
-	subd_send_msg(
-	    bitcoind->ld->gossip,
-	    towire_gossip_get_txout_reply(scid, scid, sat, script));
-	tal_free(scid);
+/* txids is NULL if we couldn't get the block. */
+static void resolve_block_txouts(struct bitcoind *bitcoind,
+				 const struct bitcoin_txid *txids,
+				 struct block_txouts *bt)
+{
+	struct txouts_request *req = bt->req;
+
+	for (size_t i = 0; i < tal_count(bt->idx); i++) {
+		struct gossip_txout *txout = req->txouts[bt->idx[i]];
+		u32 txnum = short_channel_id_txnum(&txout->scid);
+		struct txout_lookup *lookup;
+
+		/* Now, this can certainly happen, if txnum too large. */
+		if (!txids || txnum >= tal_count(txids))
+			continue;
+
+		lookup = tal(req, struct txout_lookup);
+		lookup->req = req;
+		lookup->txout = txout;
+		req->num_pending++;
+		bitcoind_gettxout(bitcoind, &txids[txnum],
+				  short_channel_id_outnum(&txout->scid),
+				  got_txout, lookup);
+	}
+	tal_free(bt);
+	txout_done(req);
+}
+
+static void got_block_txids(struct bitcoind *bitcoind,
+			    const struct bitcoin_txid *txids,
+			    struct block_txouts *bt)
+{
+	if (txids)
+		cache_block_txids(bitcoind->ld, bt->height, txids);
+	resolve_block_txouts(bitcoind, txids, bt);
 }
 
-static void get_txout(struct subd *gossip, const u8 *msg)
+static void lookup_block_txouts(struct lightningd *ld, struct block_txouts *bt)
 {
-	struct short_channel_id *scid = tal(gossip, struct short_channel_id);
-	struct outpoint *op;
-	u32 blockheight;
-	struct chain_topology *topo = gossip->ld->topology;
+	const struct bitcoin_txid *txids = cached_block_txids(ld, bt->height);
 
-	if (!fromwire_gossip_get_txout(msg, scid))
-		fatal("Gossip gave bad GOSSIP_GET_TXOUT message %s",
+	if (txids)
+		resolve_block_txouts(ld->topology->bitcoind, txids, bt);
+	else
+		bitcoind_getblocktxids(ld->topology->bitcoind, bt->height,
+				       got_block_txids, bt);
+}
+
+static void get_txouts(struct subd *gossip, const u8 *msg)
+{
+	struct lightningd *ld = gossip->ld;
+	struct chain_topology *topo = ld->topology;
+	struct short_channel_id *scids;
+	struct txouts_request *req;
+	struct block_txouts *bt = NULL;
+
+	if (!fromwire_gossip_get_txouts(tmpctx, msg, &scids))
+		fatal("Gossip gave bad GOSSIP_GET_TXOUTS message %s",
 		      tal_hex(msg, msg));
 
-	/* FIXME: Block less than 6 deep? */
-	blockheight = short_channel_id_blocknum(scid);
-
-	op = wallet_outpoint_for_scid(gossip->ld->wallet, scid, scid);
-
-	if (op) {
-		subd_send_msg(gossip,
-			      towire_gossip_get_txout_reply(
-				  scid, scid, op->sat, op->scriptpubkey));
-		tal_free(scid);
-	} else if (blockheight >= topo->min_blockheight &&
-		   blockheight <= topo->max_blockheight) {
-		/* We should have known about this outpoint since it is included
-		 * in the range in the DB. The fact that we don't means that
-		 * this is either a spent outpoint or an invalid one. Return a
-		 * failure. */
-		subd_send_msg(gossip, take(towire_gossip_get_txout_reply(
-						   NULL, scid, AMOUNT_SAT(0), NULL)));
-		tal_free(scid);
-	} else {
-		bitcoind_getoutput(topo->bitcoind,
-				   short_channel_id_blocknum(scid),
-				   short_channel_id_txnum(scid),
-				   short_channel_id_outnum(scid),
-				   got_txout, scid);
+	req = tal(gossip, struct txouts_request);
+	req->gossip = gossip;
+	req->txouts = tal_arr(req, struct gossip_txout *, tal_count(scids));
+	req->num_pending = 1;
+
+	for (size_t i = 0; i < tal_count(scids); i++) {
+		struct gossip_txout *txout;
+		struct outpoint *op;
+		/* FIXME: Block less than 6 deep? */
+		u32 blockheight = short_channel_id_blocknum(&scids[i]);
+
+		txout = req->txouts[i] = tal(req->txouts, struct gossip_txout);
+		txout->scid = scids[i];
+		txout->sat = AMOUNT_SAT(0);
+		txout->outscript = NULL;
+
+		op = wallet_outpoint_for_scid(ld->wallet, txout, &scids[i]);
+		if (op) {
+			txout->sat = op->sat;
+			txout->outscript = op->scriptpubkey;
+			continue;
+		}
+
+		/* We should have known about this outpoint since it is
+		 * included in the range in the DB. The fact that we don't
+		 * means that this is either a spent outpoint or an invalid
+		 * one. Return a failure. */
+		if (blockheight >= topo->min_blockheight &&
+		    blockheight <= topo->max_blockheight)
+			continue;
+
+		/* They're sorted, so each block's outputs are together. */
+		if (!bt || bt->height != blockheight) {
+			if (bt)
+				lookup_block_txouts(ld, bt);
+			bt = tal(req, struct block_txouts);
+			bt->req = req;
+			bt->height = blockheight;
+			bt->idx = tal_arr(bt, size_t, 0);
+			req->num_pending++;
+		}
+		tal_arr_expand(&bt->idx, i);
 	}
+	if (bt)
+		lookup_block_txouts(ld, bt);
+
+	txout_done(req);
 }
 
 static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
@@ -107,10 +271,11 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIPCTL_INIT:
 	case WIRE_GOSSIP_GETNODES_REQUEST:
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 	case WIRE_GOSSIP_PING:
 	case WIRE_GOSSIP_GET_CHANNEL_PEER:
-	case WIRE_GOSSIP_GET_TXOUT_REPLY:
+	case WIRE_GOSSIP_GET_TXOUTS_REPLY:
 	case WIRE_GOSSIP_OUTPOINT_SPENT:
 	case WIRE_GOSSIP_PAYMENT_FAILURE:
 	case WIRE_GOSSIP_QUERY_SCIDS:
@@ -122,9 +287,13 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIP_LOCAL_CHANNEL_CLOSE:
 	case WIRE_GOSSIP_DEV_MEMLEAK:
 	case WIRE_GOSSIP_DEV_COMPACT_STORE:
+	case WIRE_GOSSIP_ROUTE_CACHE_STATS:
+	case WIRE_GOSSIP_VERIFY_STATS:
+	case WIRE_GOSSIP_PEER_STATS:
 	/* This is a reply, so never gets through to here. */
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_SCIDS_REPLY:
 	case WIRE_GOSSIP_QUERY_CHANNEL_RANGE_REPLY:
@@ -132,14 +301,17 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIP_GET_INCOMING_CHANNELS_REPLY:
 	case WIRE_GOSSIP_DEV_MEMLEAK_REPLY:
 	case WIRE_GOSSIP_DEV_COMPACT_STORE_REPLY:
+	case WIRE_GOSSIP_ROUTE_CACHE_STATS_REPLY:
+	case WIRE_GOSSIP_VERIFY_STATS_REPLY:
+	case WIRE_GOSSIP_PEER_STATS_REPLY:
 		break;
 
 	case WIRE_GOSSIP_PING_REPLY:
 		ping_reply(gossip, msg);
 		break;
 
-	case WIRE_GOSSIP_GET_TXOUT:
-		get_txout(gossip, msg);
+	case WIRE_GOSSIP_GET_TXOUTS:
+		get_txouts(gossip, msg);
 		break;
 	}
 	return 0;
@@ -152,6 +324,7 @@ void gossip_init(struct lightningd *ld, int connectd_fd)
 	u8 *msg;
 	int hsmfd;
 
+	list_head_init(&ld->gossip_block_txids);
 	hsmfd = hsm_get_global_fd(ld, HSM_CAP_SIGN_GOSSIP);
 
 	ld->gossip = new_global_subd(ld, "lightning_gossipd",
@@ -167,6 +340,14 @@ void gossip_init(struct lightningd *ld, int connectd_fd)
 	    ld->rgb,
 	    ld->alias, ld->config.channel_update_interval,
 	    ld->announcable,
+	    ld->config.gossip_route_threads,
+	    ld->config.gossip_route_cache,
+	    ld->config.gossip_store_crc_once,
+	    ld->config.gossip_store_index,
+	    ld->config.gossip_verify_threads,
+	    ld->config.gossip_ratelimit_burst,
+	    ld->config.gossip_ratelimit_node_burst,
+	    ld->config.gossip_ratelimit_refill,
 #if DEVELOPER
 	    ld->dev_gossip_time ? &ld->dev_gossip_time: NULL
 #else
@@ -183,52 +364,75 @@ void gossipd_notify_spend(struct lightningd *ld,
 	subd_send_msg(ld->gossip, msg);
 }
 
+static void json_add_node(struct json_stream *response,
+			  const struct gossip_getnodes_entry *node)
+{
+	struct json_escape *esc;
+
+	json_object_start(response, NULL);
+	json_add_node_id(response, "nodeid", &node->nodeid);
+	if (node->last_timestamp < 0) {
+		json_object_end(response);
+		return;
+	}
+	esc = json_escape(NULL,
+			  take(tal_strndup(NULL,
+					   (const char *)node->alias,
+					   ARRAY_SIZE(node->alias))));
+	json_add_escaped_string(response, "alias", take(esc));
+	json_add_hex(response, "color",
+		     node->color, ARRAY_SIZE(node->color));
+	json_add_u64(response, "last_timestamp",
+		     node->last_timestamp);
+	json_add_hex_talarr(response, "globalfeatures",
+			    node->globalfeatures);
+	json_array_start(response, "addresses");
+	for (size_t i = 0; i < tal_count(node->addresses); i++)
+		json_add_address(response, NULL, &node->addresses[i]);
+	json_array_end(response);
+	json_object_end(response);
+}
+
+struct listnodes_info {
+	struct command *cmd;
+	struct json_stream *response;
+	/* How many more nodes they want */
+	u32 remaining;
+};
+
+/* Called upon receiving a getnodes_reply from `gossipd` */
 static void json_getnodes_reply(struct subd *gossip UNUSED, const u8 *reply,
 				const int *fds UNUSED,
-				struct command *cmd)
+				struct listnodes_info *linfo)
 {
 	struct gossip_getnodes_entry **nodes;
-	struct json_stream *response;
-	size_t i, j;
+	struct node_id *next;
 
-	if (!fromwire_gossip_getnodes_reply(reply, reply, &nodes)) {
-		was_pending(command_fail(cmd, LIGHTNINGD,
-					 "Malformed gossip_getnodes response"));
+	if (!fromwire_gossip_getnodes_reply(reply, reply, &next, &nodes)) {
+		/* Shouldn't happen: just end json stream. */
+		log_broken(linfo->cmd->ld->log, "Invalid reply from gossipd");
+		was_pending(command_raw_complete(linfo->cmd, linfo->response));
 		return;
 	}
 
-	response = json_stream_success(cmd);
-	json_array_start(response, "nodes");
-
-	for (i = 0; i < tal_count(nodes); i++) {
-		struct json_escape *esc;
+	for (size_t i = 0; i < tal_count(nodes); i++)
+		json_add_node(linfo->response, nodes[i]);
+	linfo->remaining -= tal_count(nodes);
 
-		json_object_start(response, NULL);
-		json_add_node_id(response, "nodeid", &nodes[i]->nodeid);
-		if (nodes[i]->last_timestamp < 0) {
-			json_object_end(response);
-			continue;
-		}
-		esc = json_escape(NULL,
-				  take(tal_strndup(NULL,
-						   (const char *)nodes[i]->alias,
-						   ARRAY_SIZE(nodes[i]->alias))));
-		json_add_escaped_string(response, "alias", take(esc));
-		json_add_hex(response, "color",
-			     nodes[i]->color, ARRAY_SIZE(nodes[i]->color));
-		json_add_u64(response, "last_timestamp",
-			     nodes[i]->last_timestamp);
-		json_add_hex_talarr(response, "globalfeatures",
-				    nodes[i]->globalfeatures);
-		json_array_start(response, "addresses");
-		for (j=0; j<tal_count(nodes[i]->addresses); j++) {
-			json_add_address(response, NULL, &nodes[i]->addresses[j]);
-		}
-		json_array_end(response);
-		json_object_end(response);
+	/* More coming?  Ask from that point on. */
+	if (next && linfo->remaining) {
+		u8 *req = towire_gossip_getnodes_request(linfo->cmd, NULL,
+							 next,
+							 linfo->remaining);
+		subd_req(linfo->cmd->ld->gossip, linfo->cmd->ld->gossip,
+			 req, -1, 0, json_getnodes_reply, linfo);
+		return;
 	}
-	json_array_end(response);
-	was_pending(command_success(cmd, response));
+
+	json_array_end(linfo->response);
+	if (next)
+		json_add_node_id(linfo->response, "next_id", next);
+	was_pending(command_success(linfo->cmd, linfo->response));
 }
 
 static struct command_result *json_listnodes(struct command *cmd,
@@ -237,15 +441,31 @@ static struct command_result *json_listnodes(struct command *cmd,
 					     const jsmntok_t *params)
 {
 	u8 *req;
-	struct node_id *id;
+	struct node_id *id, *start;
+	u32 *limit;
+	struct listnodes_info *linfo = tal(cmd, struct listnodes_info);
 
 	if (!param(cmd, buffer, params,
 		   p_opt("id", param_node_id, &id),
+		   p_opt("start_id", param_node_id, &start),
+		   p_opt("limit", param_number, &limit),
 		   NULL))
 		return command_param_failed();
 
-	req = towire_gossip_getnodes_request(cmd, id);
-	subd_req(cmd, cmd->ld->gossip, req, -1, 0, json_getnodes_reply, cmd);
+	if (id && (start || limit))
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "Cannot specify start_id or limit with id");
+
+	linfo->cmd = cmd;
+	linfo->remaining = limit ? *limit : UINT32_MAX;
+
+	/* Start JSON response, then we stream. */
+	linfo->response = json_stream_success(cmd);
+	json_array_start(linfo->response, "nodes");
+
+	req = towire_gossip_getnodes_request(cmd, id, start, linfo->remaining);
+	subd_req(cmd->ld->gossip, cmd->ld->gossip,
+		 req, -1, 0, json_getnodes_reply, linfo);
 	return command_still_pending(cmd);
 }
 
@@ -253,7 +473,8 @@ static const struct json_command listnodes_command = {
 	"listnodes",
 	"network",
 	json_listnodes,
-	"Show node {id} (or all, if no {id}), in our local network view"
+	"Show node {id} (or all, if no {id}), in our local network view; "
+	"or up to {limit} nodes starting at {start_id}"
 };
 AUTODATA(json_command, &listnodes_command);
 
@@ -276,6 +497,38 @@ static void json_getroute_reply(struct subd *gossip UNUSED, const u8 *reply, con
 	was_pending(command_success(cmd, response));
 }
 
+/* Parse an array of short_channel_id/direction to avoid. */
+static struct command_result *parse_excludes(struct command *cmd,
+					     const char *buffer,
+					     const jsmntok_t *excludetok,
+					     struct short_channel_id_dir **excluded)
+{
+	const jsmntok_t *t;
+	size_t i;
+
+	if (!excludetok) {
+		*excluded = NULL;
+		return NULL;
+	}
+
+	*excluded = tal_arr(cmd, struct short_channel_id_dir,
+			    excludetok->size);
+
+	json_for_each_arr(i, t, excludetok) {
+		if (!short_channel_id_dir_from_str(buffer + t->start,
+						   t->end - t->start,
+						   &(*excluded)[i],
+						   deprecated_apis)) {
+			return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+					    "%.*s is not a valid"
+					    " short_channel_id/direction",
+					    t->end - t->start,
+					    buffer + t->start);
+		}
+	}
+	return NULL;
+}
+
 static struct command_result *json_getroute(struct command *cmd,
 					    const char *buffer,
 					    const jsmntok_t *obj UNNEEDED,
@@ -290,6 +543,7 @@ static struct command_result *json_getroute(struct command *cmd,
 	double *riskfactor;
 	struct short_channel_id_dir *excluded;
 	u32 *max_hops;
+	struct command_result *ret;
 
 	/* Higher fuzz means that some high-fee paths can be discounted
 	 * for an even larger value, increasing the scope for route
@@ -314,28 +568,9 @@ static struct command_result *json_getroute(struct command *cmd,
 	/* Convert from percentage */
 	*fuzz = *fuzz / 100.0;
 
-	if (excludetok) {
-		const jsmntok_t *t;
-		size_t i;
-
-		excluded = tal_arr(cmd, struct short_channel_id_dir,
-				   excludetok->size);
-
-		json_for_each_arr(i, t, excludetok) {
-			if (!short_channel_id_dir_from_str(buffer + t->start,
-							   t->end - t->start,
-							   &excluded[i],
-							   deprecated_apis)) {
-				return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
-						    "%.*s is not a valid"
-						    " short_channel_id/direction",
-						    t->end - t->start,
-						    buffer + t->start);
-			}
-		}
-	} else {
-		excluded = NULL;
-	}
+	ret = parse_excludes(cmd, buffer, excludetok, &excluded);
+	if (ret)
+		return ret;
 
 	u8 *req = towire_gossip_getroute_request(cmd, source, destination,
 						 *msat,
@@ -360,6 +595,107 @@ static const struct json_command getroute_command = {
 };
 AUTODATA(json_command, &getroute_command);
 
+static void json_getroutes_reply(struct subd *gossip UNUSED, const u8 *reply,
+				 const int *fds UNUSED,
+				 struct command *cmd)
+{
+	struct json_stream *response;
+	struct route_hop *hops;
+	u16 *route_lens;
+	size_t off = 0;
+
+	if (!fromwire_gossip_getroutes_reply(reply, reply,
+					     &route_lens, &hops)) {
+		was_pending(command_fail(cmd, LIGHTNINGD,
+					 "Gossip gave bad getroutes_reply"));
+		return;
+	}
+
+	if (tal_count(route_lens) == 0) {
+		was_pending(command_fail(cmd, PAY_ROUTE_NOT_FOUND,
+					 "Could not find a route"));
+		return;
+	}
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "routes");
+	for (size_t i = 0; i < tal_count(route_lens); i++) {
+		if (off + route_lens[i] > tal_count(hops)) {
+			log_broken(cmd->ld->log, "getroutes_reply too short");
+			break;
+		}
+		json_object_start(response, NULL);
+		json_add_route(response, "route", hops + off, route_lens[i]);
+		json_object_end(response);
+		off += route_lens[i];
+	}
+	json_array_end(response);
+	was_pending(command_success(cmd, response));
+}
+
+static struct command_result *json_getroutes(struct command *cmd,
+					     const char *buffer,
+					     const jsmntok_t *obj UNNEEDED,
+					     const jsmntok_t *params)
+{
+	struct lightningd *ld = cmd->ld;
+	struct node_id *destination;
+	struct node_id *source;
+	const jsmntok_t *excludetok;
+	struct amount_msat *msat;
+	unsigned *cltv;
+	double *riskfactor;
+	struct short_channel_id_dir *excluded;
+	u32 *max_hops, *max_routes;
+	double *fuzz;
+	struct command_result *ret;
+
+	if (!param(cmd, buffer, params,
+		   p_req("id", param_node_id, &destination),
+		   p_req("msatoshi", param_msat, &msat),
+		   p_req("riskfactor", param_double, &riskfactor),
+		   p_opt_def("maxroutes", param_number, &max_routes, 4),
+		   p_opt_def("cltv", param_number, &cltv, 9),
+		   p_opt("fromid", param_node_id, &source),
+		   p_opt_def("fuzzpercent", param_percent, &fuzz, 5.0),
+		   p_opt("exclude", param_array, &excludetok),
+		   p_opt_def("maxhops", param_number, &max_hops,
+			     ROUTING_MAX_HOPS),
+		   NULL))
+		return command_param_failed();
+
+	if (*max_routes == 0 || *max_routes > 100)
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "maxroutes must be between 1 and 100");
+
+	/* Convert from percentage */
+	*fuzz = *fuzz / 100.0;
+
+	ret = parse_excludes(cmd, buffer, excludetok, &excluded);
+	if (ret)
+		return ret;
+
+	u8 *req = towire_gossip_getroutes_request(cmd, source, destination,
+						  *msat,
+						  *riskfactor * 1000000.0,
+						  *cltv, fuzz,
+						  excluded,
+						  *max_hops,
+						  *max_routes);
+	subd_req(ld->gossip, ld->gossip, req, -1, 0, json_getroutes_reply, cmd);
+	return command_still_pending(cmd);
+}
+
+static const struct json_command getroutes_command = {
+	"getroutes",
+	"channels",
+	json_getroutes,
+	"Show up to {maxroutes} (default 4) routes to {id} for {msatoshi}, "
+	"cheapest first, each avoiding the channels of those before it. "
+	"Other parameters are as for getroute."
+};
+AUTODATA(json_command, &getroutes_command);
+
 static void json_add_halfchan(struct json_stream *response,
 			      const struct gossip_getchannels_entry *e,
 			      int idx)
@@ -395,6 +731,8 @@ struct listchannels_info {
 	struct json_stream *response;
 	struct short_channel_id *id;
 	struct node_id *source;
+	/* How many more channels they want */
+	u32 remaining;
 };
 
 /* Called upon receiving a getchannels_reply from `gossipd` */
@@ -404,10 +742,10 @@ static void json_listchannels_reply(struct subd *gossip UNUSED, const u8 *reply,
 {
 	size_t i;
 	struct gossip_getchannels_entry **entries;
-	bool complete;
+	struct short_channel_id *next;
 
 	if (!fromwire_gossip_getchannels_reply(reply, reply,
-					       &complete, &entries)) {
+					       &next, &entries)) {
 		/* Shouldn't happen: just end json stream. */
 		log_broken(linfo->cmd->ld->log, "Invalid reply from gossipd");
 		was_pending(command_raw_complete(linfo->cmd, linfo->response));
@@ -418,20 +756,23 @@ static void json_listchannels_reply(struct subd *gossip UNUSED, const u8 *reply,
 		json_add_halfchan(linfo->response, entries[i], 0);
 		json_add_halfchan(linfo->response, entries[i], 1);
 	}
+	linfo->remaining -= tal_count(entries);
 
-	/* More coming?  Ask from this point on.. */
-	if (!complete) {
+	/* More coming?  Ask from that point on. */
+	if (next && linfo->remaining) {
 		u8 *req;
-		assert(tal_count(entries) != 0);
 		req = towire_gossip_getchannels_request(linfo->cmd,
 							linfo->id,
 							linfo->source,
-							&entries[i-1]
-							->short_channel_id);
+							next,
+							linfo->remaining);
 		subd_req(linfo->cmd->ld->gossip, linfo->cmd->ld->gossip,
 			 req, -1, 0, json_listchannels_reply, linfo);
 	} else {
 		json_array_end(linfo->response);
+		if (next)
+			json_add_short_channel_id(linfo->response,
+						  "next_scid", next);
 		was_pending(command_success(linfo->cmd, linfo->response));
 	}
 }
@@ -443,11 +784,15 @@ static struct command_result *json_listchannels(struct command *cmd,
 {
 	u8 *req;
 	struct listchannels_info *linfo = tal(cmd, struct listchannels_info);
+	struct short_channel_id *start;
+	u32 *limit;
 
 	linfo->cmd = cmd;
 	if (!param(cmd, buffer, params,
 		   p_opt("short_channel_id", param_short_channel_id, &linfo->id),
 		   p_opt("source", param_node_id, &linfo->source),
+		   p_opt("start_scid", param_short_channel_id, &start),
+		   p_opt("limit", param_number, &limit),
 		   NULL))
 		return command_param_failed();
 
@@ -455,12 +800,19 @@ static struct command_result *json_listchannels(struct command *cmd,
 		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
 				    "Cannot specify both source and short_channel_id");
 
+	if ((linfo->id || linfo->source) && (start || limit))
+		return command_fail(cmd, JSONRPC2_INVALID_PARAMS,
+				    "Cannot specify start_scid or limit with"
+				    " source or short_channel_id");
+
+	linfo->remaining = limit ? *limit : UINT32_MAX;
+
 	/* Start JSON response, then we stream. */
 	linfo->response = json_stream_success(cmd);
 	json_array_start(linfo->response, "channels");
 
 	req = towire_gossip_getchannels_request(cmd, linfo->id, linfo->source,
-						NULL);
+						start, linfo->remaining);
 	subd_req(cmd->ld->gossip, cmd->ld->gossip,
 		 req, -1, 0, json_listchannels_reply, linfo);
 
@@ -471,10 +823,170 @@ static const struct json_command listchannels_command = {
 	"listchannels",
 	"channels",
 	json_listchannels,
-	"Show channel {short_channel_id} or {source} (or all known channels, if not specified)"
+	"Show channel {short_channel_id} or {source} (or all known channels, if not specified); "
+	"or up to {limit} channels starting at {start_scid}"
 };
 AUTODATA(json_command, &listchannels_command);
 
+static void json_getroutecachestats_reply(struct subd *gossip UNUSED,
+					  const u8 *reply,
+					  const int *fds UNUSED,
+					  struct command *cmd)
+{
+	u64 hits, misses, invalidations, evictions;
+	u32 entries, max_entries;
+	struct json_stream *response;
+
+	if (!fromwire_gossip_route_cache_stats_reply(reply, &hits, &misses,
+						     &invalidations,
+						     &evictions, &entries,
+						     &max_entries)) {
+		was_pending(command_fail(cmd, LIGHTNINGD,
+					 "Gossip gave bad route_cache_stats_reply"));
+		return;
+	}
+
+	response = json_stream_success(cmd);
+	json_add_u64(response, "hits", hits);
+	json_add_u64(response, "misses", misses);
+	json_add_u64(response, "invalidations", invalidations);
+	json_add_u64(response, "evictions", evictions);
+	json_add_u32(response, "entries", entries);
+	json_add_u32(response, "max_entries", max_entries);
+	was_pending(command_success(cmd, response));
+}
+
+static struct command_result *json_getroutecachestats(struct command *cmd,
+						      const char *buffer,
+						      const jsmntok_t *obj UNNEEDED,
+						      const jsmntok_t *params)
+{
+	u8 *req;
+
+	if (!param(cmd, buffer, params, NULL))
+		return command_param_failed();
+
+	req = towire_gossip_route_cache_stats(cmd);
+	subd_req(cmd->ld->gossip, cmd->ld->gossip,
+		 req, -1, 0, json_getroutecachestats_reply, cmd);
+	return command_still_pending(cmd);
+}
+
+static const struct json_command getroutecachestats_command = {
+	"getroutecachestats",
+	"channels",
+	json_getroutecachestats,
+	"Show how often getroute was answered from gossipd's route cache"
+};
+AUTODATA(json_command, &getroutecachestats_command);
+
+static void json_getgossipverifystats_reply(struct subd *gossip UNUSED,
+					    const u8 *reply,
+					    const int *fds UNUSED,
+					    struct command *cmd)
+{
+	u64 submitted, checked, failed, verify_nsec;
+	u32 queued, max_queued;
+	struct json_stream *response;
+
+	if (!fromwire_gossip_verify_stats_reply(reply, &submitted, &checked,
+						&failed, &queued, &max_queued,
+						&verify_nsec)) {
+		was_pending(command_fail(cmd, LIGHTNINGD,
+					 "Gossip gave bad verify_stats_reply"));
+		return;
+	}
+
+	response = json_stream_success(cmd);
+	json_add_u64(response, "submitted", submitted);
+	json_add_u64(response, "checked", checked);
+	json_add_u64(response, "failed", failed);
+	json_add_u32(response, "queued", queued);
+	json_add_u32(response, "max_queued", max_queued);
+	json_add_u64(response, "verify_msec", verify_nsec / 1000000);
+	was_pending(command_success(cmd, response));
+}
+
+static struct command_result *json_getgossipverifystats(struct command *cmd,
+							const char *buffer,
+							const jsmntok_t *obj UNNEEDED,
+							const jsmntok_t *params)
+{
+	u8 *req;
+
+	if (!param(cmd, buffer, params, NULL))
+		return command_param_failed();
+
+	req = towire_gossip_verify_stats(cmd);
+	subd_req(cmd->ld->gossip, cmd->ld->gossip,
+		 req, -1, 0, json_getgossipverifystats_reply, cmd);
+	return command_still_pending(cmd);
+}
+
+static const struct json_command getgossipverifystats_command = {
+	"getgossipverifystats",
+	"channels",
+	json_getgossipverifystats,
+	"Show how gossipd's signature checking threads are keeping up"
+};
+AUTODATA(json_command, &getgossipverifystats_command);
+
+static void json_getgossippeerstats_reply(struct subd *gossip UNUSED,
+					  const u8 *reply,
+					  const int *fds UNUSED,
+					  struct command *cmd)
+{
+	struct node_id *ids;
+	u64 *accepted, *suppressed, *invalid;
+	u32 held;
+	struct json_stream *response;
+
+	if (!fromwire_gossip_peer_stats_reply(reply, reply, &ids, &accepted,
+					      &suppressed, &invalid, &held)) {
+		was_pending(command_fail(cmd, LIGHTNINGD,
+					 "Gossip gave bad peer_stats_reply"));
+		return;
+	}
+
+	response = json_stream_success(cmd);
+	json_array_start(response, "peers");
+	for (size_t i = 0; i < tal_count(ids); i++) {
+		json_object_start(response, NULL);
+		json_add_node_id(response, "id", &ids[i]);
+		json_add_u64(response, "accepted", accepted[i]);
+		json_add_u64(response, "suppressed", suppressed[i]);
+		json_add_u64(response, "invalid", invalid[i]);
+		json_object_end(response);
+	}
+	json_array_end(response);
+	json_add_u32(response, "held", held);
+	was_pending(command_success(cmd, response));
+}
+
+static struct command_result *json_getgossippeerstats(struct command *cmd,
+						      const char *buffer,
+						      const jsmntok_t *obj UNNEEDED,
+						      const jsmntok_t *params)
+{
+	u8 *req;
+
+	if (!param(cmd, buffer, params, NULL))
+		return command_param_failed();
+
+	req = towire_gossip_peer_stats(cmd);
+	subd_req(cmd->ld->gossip, cmd->ld->gossip,
+		 req, -1, 0, json_getgossippeerstats_reply, cmd);
+	return command_still_pending(cmd);
+}
+
+static const struct json_command getgossippeerstats_command = {
+	"getgossippeerstats",
+	"channels",
+	json_getgossippeerstats,
+	"Show how much gossip each peer has sent, and how much was rate limited"
+};
+AUTODATA(json_command, &getgossippeerstats_command);
+
 #if DEVELOPER
 static void json_scids_reply(struct subd *gossip UNUSED, const u8 *reply,
 			     const int *fds UNUSED, struct command *cmd)
@@ -195,3 +195,28 @@ void towire_peer_features(u8 **pptr, const struct peer_features *pf)
 	towire_u16(pptr, tal_count(pf->globalfeatures));
 	towire_u8_array(pptr, pf->globalfeatures, tal_count(pf->globalfeatures));
 }
+
+struct gossip_txout *fromwire_gossip_txout(const tal_t *ctx,
+					   const u8 **pptr, size_t *max)
+{
+	struct gossip_txout *txout = tal(ctx, struct gossip_txout);
+	u16 len;
+
+	fromwire_short_channel_id(pptr, max, &txout->scid);
+	txout->sat = fromwire_amount_sat(pptr, max);
+	len = fromwire_u16(pptr, max);
+	if (len) {
+		txout->outscript = tal_arr(txout, u8, len);
+		fromwire_u8_array(pptr, max, txout->outscript, len);
+	} else
+		txout->outscript = NULL;
+	return txout;
+}
+
+void towire_gossip_txout(u8 **pptr, const struct gossip_txout *txout)
+{
+	towire_short_channel_id(pptr, &txout->scid);
+	towire_amount_sat(pptr, txout->sat);
+	towire_u16(pptr, tal_count(txout->outscript));
+	towire_u8_array(pptr, txout->outscript, tal_count(txout->outscript));
+}
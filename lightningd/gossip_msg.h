@@ -40,6 +40,13 @@ struct gossip_getchannels_entry {
 	struct gossip_halfchannel_entry *e[2];
 };
 
+struct gossip_txout {
+	struct short_channel_id scid;
+	struct amount_sat sat;
+	/* NULL if it's not an unspent output */
+	u8 *outscript;
+};
+
 struct gossip_getnodes_entry *
 fromwire_gossip_getnodes_entry(const tal_t *ctx, const u8 **pptr, size_t *max);
 void towire_gossip_getnodes_entry(u8 **pptr,
@@ -61,4 +68,8 @@ fromwire_gossip_getchannels_entry(const tal_t *ctx,
 void towire_gossip_getchannels_entry(
     u8 **pptr, const struct gossip_getchannels_entry *entry);
 
+struct gossip_txout *fromwire_gossip_txout(const tal_t *ctx,
+					   const u8 **pptr, size_t *max);
+void towire_gossip_txout(u8 **pptr, const struct gossip_txout *txout);
+
 #endif /* LIGHTNING_LIGHTNINGD_GOSSIP_MSG_H */
@@ -81,6 +81,15 @@ void json_stream_log_suppress(struct json_stream *js, const char *cmd_name)
 	js->log = NULL;
 }
 
+const char *json_stream_contents(const struct json_stream *js, size_t *len)
+{
+	if (!js->jout) {
+		*len = 0;
+		return NULL;
+	}
+	return json_out_contents(js->jout, len);
+}
+
 /* If we have an allocation failure. */
 static void COLD js_oom(struct json_stream *js)
 {
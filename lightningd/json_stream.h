@@ -52,6 +52,9 @@ void json_stream_close(struct json_stream *js, struct command *writer);
 /* For low-level JSON stream access: */
 void json_stream_log_suppress(struct json_stream *js, const char *cmd_name);
 
+/* What's been written and not yet output (NULL if nothing, or OOM). */
+const char *json_stream_contents(const struct json_stream *js, size_t *len);
+
 /**
  * json_stream_still_writing - is someone currently writing to this stream?
  * @js: the json_stream.
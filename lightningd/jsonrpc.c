@@ -11,6 +11,10 @@
  * the struct command owns it since they're writing into it.  When they're
  * done, the `json_connection` needs to drain it (if it's still around).  At
  * that point, the `json_connection` becomes the owner (or it's simply freed).
+ *
+ * A batch request (a JSON array of requests) is answered with a JSON array of
+ * responses: each `struct command` in it writes into its own `json_stream`,
+ * and the `struct json_batch` puts them together once they're all done.
  */
 /* eg: { "jsonrpc":"2.0", "method" : "dev-echo", "params" : [ "hello", "Arabella!" ], "id" : "1" } */
 #include "ccan/config.h"
@@ -25,6 +29,7 @@
 #include <ccan/json_escape/json_escape.h>
 #include <ccan/json_out/json_out.h>
 #include <ccan/str/hex/hex.h>
+#include <ccan/str/str.h>
 #include <ccan/strmap/strmap.h>
 #include <ccan/tal/str/str.h>
 #include <common/bech32.h>
@@ -88,6 +93,8 @@ struct json_connection {
 	size_t used;
 	/* How much has just been filled. */
 	size_t len_read;
+	/* How far we've parsed buffer. */
+	struct json_parser *parser;
 
 	/* Our commands */
 	struct list_head commands;
@@ -98,6 +105,19 @@ struct json_connection {
 	struct json_stream **js_arr;
 };
 
+/* A JSON-RPC batch: an array of requests, answered with one array. */
+struct json_batch {
+	/* The connection, or NULL if it closed. */
+	struct json_connection *jcon;
+
+	/* The response to each request: NULL until it's done. */
+	struct json_stream **responses;
+	size_t num_remaining;
+
+	/* Does it contain something we shouldn't log (ie. getlog)? */
+	bool log_suppress;
+};
+
 /**
  * `jsonrpc` encapsulates the entire state of the JSON-RPC interface,
  * including a list of methods that the interface supports (can be
@@ -151,6 +171,8 @@ static void destroy_jcon(struct json_connection *jcon)
 	list_for_each(&jcon->commands, c, list) {
 		log_debug(jcon->log, "Abandoning command %s", c->json_cmd->name);
 		c->jcon = NULL;
+		if (c->batch)
+			c->batch->jcon = NULL;
 	}
 
 	/* Make sure this happens last! */
@@ -454,13 +476,56 @@ static void destroy_command(struct command *cmd)
 	list_del_from(&cmd->jcon->commands, &cmd->list);
 }
 
+/* Trailing whitespace (which separates responses), so we can put them in an
+ * array. */
+static size_t json_trim_len(const char *p, size_t len)
+{
+	while (len && cisspace(p[len-1]))
+		len--;
+	return len;
+}
+
+/* Once every request in the batch is answered, send the lot. */
+static void batch_response(struct json_batch *batch, size_t idx,
+			   struct json_stream *js)
+{
+	struct json_stream *out;
+
+	assert(!batch->responses[idx]);
+	batch->responses[idx] = tal_steal(batch, js);
+	if (--batch->num_remaining != 0)
+		return;
+
+	if (batch->jcon) {
+		out = jcon_new_json_stream(batch->jcon, batch->jcon, NULL);
+		if (batch->log_suppress)
+			json_stream_log_suppress(out, "getlog");
+		json_stream_append(out, "[", 1);
+		for (size_t i = 0; i < tal_count(batch->responses); i++) {
+			size_t len;
+			const char *p;
+
+			if (i)
+				json_stream_append(out, ",", 1);
+			p = json_stream_contents(batch->responses[i], &len);
+			if (p)
+				json_stream_append(out, p, json_trim_len(p, len));
+		}
+		json_stream_append(out, "]", 1);
+		json_stream_close(out, NULL);
+	}
+	tal_free(batch);
+}
+
 struct command_result *command_raw_complete(struct command *cmd,
 					    struct json_stream *result)
 {
 	json_stream_close(result, cmd);
 
-	/* If we have a jcon, it will free result for us. */
-	if (cmd->jcon)
+	/* The batch, or jcon if we have one, will free result for us. */
+	if (cmd->batch)
+		batch_response(cmd->batch, cmd->batch_idx, result);
+	else if (cmd->jcon)
 		tal_steal(cmd->jcon, result);
 
 	tal_free(cmd);
@@ -517,11 +582,17 @@ struct command_result *command_still_pending(struct command *cmd)
 }
 
 static void json_command_malformed(struct json_connection *jcon,
+				   struct json_batch *batch, size_t idx,
 				   const char *id,
 				   const char *error)
 {
+	struct json_stream *js;
+
 	/* NULL writer is OK here, since we close it immediately. */
-	struct json_stream *js = jcon_new_json_stream(jcon, jcon, NULL);
+	if (batch)
+		js = new_json_stream(batch, NULL, jcon->log);
+	else
+		js = jcon_new_json_stream(jcon, jcon, NULL);
 
 	json_object_start(js, NULL);
 	json_add_string(js, "jsonrpc", "2.0");
@@ -533,15 +604,20 @@ static void json_command_malformed(struct json_connection *jcon,
 	json_object_compat_end(js);
 
 	json_stream_close(js, NULL);
+	if (batch)
+		batch_response(batch, idx, js);
 }
 
 struct json_stream *json_stream_raw_for_cmd(struct command *cmd)
 {
 	struct json_stream *js;
 
-	/* If they still care about the result, attach it to them. */
-	if (cmd->jcon)
+	/* If they still care about the result, attach it to them (a batch
+	 * sends them all at once, so logs them then). */
+	if (cmd->jcon && !cmd->batch)
 		js = jcon_new_json_stream(cmd, cmd->jcon, cmd);
+	else if (cmd->jcon)
+		js = new_json_stream(cmd, cmd, cmd->jcon->log);
 	else
 		js = new_json_stream(cmd, cmd, NULL);
 
@@ -557,6 +633,8 @@ void json_stream_log_suppress_for_cmd(struct json_stream *js,
 	const char *s = tal_fmt(tmpctx, "Suppressing logging of %s command", nm);
 	log_io(cmd->jcon->log, LOG_IO_OUT, s, NULL, 0);
 	json_stream_log_suppress(js, strdup(nm));
+	if (cmd->batch)
+		cmd->batch->log_suppress = true;
 
 }
 
@@ -605,14 +683,16 @@ struct json_stream *json_stream_fail(struct command *cmd,
 /* We return struct command_result so command_fail return value has a natural
  * sink; we don't actually use the result. */
 static struct command_result *
-parse_request(struct json_connection *jcon, const jsmntok_t tok[])
+parse_request(struct json_connection *jcon,
+	      struct json_batch *batch, size_t batch_idx,
+	      const jsmntok_t tok[])
 {
 	const jsmntok_t *method, *id, *params;
 	struct command *c;
 	struct command_result *res;
 
 	if (tok[0].type != JSMN_OBJECT) {
-		json_command_malformed(jcon, "null",
+		json_command_malformed(jcon, batch, batch_idx, "null",
 				       "Expected {} for json command");
 		return NULL;
 	}
@@ -622,11 +702,12 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 	id = json_get_member(jcon->buffer, tok, "id");
 
 	if (!id) {
-		json_command_malformed(jcon, "null", "No id");
+		json_command_malformed(jcon, batch, batch_idx, "null",
+				       "No id");
 		return NULL;
 	}
 	if (id->type != JSMN_STRING && id->type != JSMN_PRIMITIVE) {
-		json_command_malformed(jcon, "null",
+		json_command_malformed(jcon, batch, batch_idx, "null",
 				       "Expected string/primitive for id");
 		return NULL;
 	}
@@ -642,6 +723,8 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 			    json_tok_full(jcon->buffer, id),
 			    json_tok_full_len(id));
 	c->mode = CMD_NORMAL;
+	c->batch = batch;
+	c->batch_idx = batch_idx;
 	list_add_tail(&jcon->commands, &c->list);
 	tal_add_destructor(c, destroy_command);
 
@@ -686,6 +769,58 @@ parse_request(struct json_connection *jcon, const jsmntok_t tok[])
 	return res;
 }
 
+/* JSON-RPC 2.0 batch: we run them all at once, and answer with an array
+ * (in the same order, though the spec doesn't require that). */
+static void parse_batch(struct json_connection *jcon, const jsmntok_t tok[])
+{
+	struct json_batch *batch;
+	const jsmntok_t *t;
+	size_t i;
+
+	if (tok[0].size == 0) {
+		json_command_malformed(jcon, NULL, 0, "null",
+				       "Empty batch");
+		return;
+	}
+
+	/* Each request counts against the inflight limit, so it can't be
+	 * too large (read_json waits until there's room for the rest). */
+	if (tok[0].size > jcon->ld->config.rpc_max_inflight) {
+		json_command_malformed(jcon, NULL, 0, "null",
+				       tal_fmt(tmpctx, "Batch of %u requests"
+					       " is more than rpc-max-inflight"
+					       " %u",
+					       tok[0].size,
+					       jcon->ld->config.rpc_max_inflight));
+		return;
+	}
+
+	/* Like commands, this may outlive the connection. */
+	batch = tal(jcon->ld->jsonrpc, struct json_batch);
+	batch->jcon = jcon;
+	batch->responses = tal_arrz(batch, struct json_stream *, tok[0].size);
+	batch->num_remaining = tok[0].size;
+	batch->log_suppress = false;
+
+	/* Once the last one completes, batch is freed: don't touch it! */
+	json_for_each_arr(i, t, tok)
+		parse_request(jcon, batch, i, t);
+}
+
+/* How many requests haven't been answered (completely) yet? */
+static size_t jcon_inflight(const struct json_connection *jcon)
+{
+	const struct command *c;
+	size_t num = tal_count(jcon->js_arr);
+
+	/* Those which have started answering are already counted, unless
+	 * they're in a batch, which doesn't answer until they're all done. */
+	list_for_each(&jcon->commands, c, list)
+		if (!c->json_stream || c->batch)
+			num++;
+	return num;
+}
+
 /* Mutual recursion */
 static struct io_plan *stream_out_complete(struct io_conn *conn,
 					   struct json_stream *js,
@@ -721,6 +856,9 @@ static struct io_plan *stream_out_complete(struct io_conn *conn,
 	jcon_remove_json_stream(jcon, js);
 	tal_free(js);
 
+	/* Reader may be waiting for inflight to drop. */
+	io_wake(conn);
+
 	/* Wait for more output. */
 	return start_json_stream(conn, jcon);
 }
@@ -728,7 +866,8 @@ static struct io_plan *stream_out_complete(struct io_conn *conn,
 static struct io_plan *read_json(struct io_conn *conn,
 				 struct json_connection *jcon)
 {
-	jsmntok_t *toks;
+	const jsmntok_t *toks;
+	size_t consumed;
 	bool valid;
 
 	if (jcon->len_read)
@@ -740,20 +879,23 @@ static struct io_plan *read_json(struct io_conn *conn,
 	if (jcon->used == tal_count(jcon->buffer))
 		tal_resize(&jcon->buffer, jcon->used * 2);
 
-	/* We wait for pending output to be consumed, to avoid DoS */
-	if (tal_count(jcon->js_arr) != 0) {
+	/* We wait for enough pending commands and output to be consumed, to
+	 * avoid DoS */
+	if (jcon_inflight(jcon) >= jcon->ld->config.rpc_max_inflight) {
 		jcon->len_read = 0;
 		return io_wait(conn, conn, read_json, jcon);
 	}
 
-	toks = json_parse_input(jcon->buffer, jcon->buffer, jcon->used, &valid);
+	/* This only parses what's new since last time. */
+	toks = json_parser_parse(jcon->parser, jcon->buffer, jcon->used,
+				 &valid);
 	if (!toks) {
 		if (!valid) {
 			log_unusual(jcon->log,
 				    "Invalid token in json input: '%.*s'",
 				    (int)jcon->used, jcon->buffer);
 			json_command_malformed(
-			    jcon, "null",
+			    jcon, NULL, 0, "null",
 			    "Invalid token in json input");
 			return io_halfclose(conn);
 		}
@@ -761,31 +903,39 @@ static struct io_plan *read_json(struct io_conn *conn,
 		goto read_more;
 	}
 
-	/* Empty buffer? (eg. just whitespace). */
-	if (tal_count(toks) == 1) {
-		jcon->used = 0;
-		goto read_more;
+	/* A batch adds all its requests at once: wait until there's room for
+	 * them all (unless it's too big ever to fit, which is an error). */
+	if (toks[0].type == JSMN_ARRAY
+	    && toks[0].size <= jcon->ld->config.rpc_max_inflight
+	    && jcon_inflight(jcon) + toks[0].size
+	    > jcon->ld->config.rpc_max_inflight) {
+		jcon->len_read = 0;
+		return io_wait(conn, conn, read_json, jcon);
 	}
 
-	parse_request(jcon, toks);
+	if (toks[0].type == JSMN_ARRAY)
+		parse_batch(jcon, toks);
+	else
+		parse_request(jcon, NULL, 0, toks);
 
-	/* Remove first {}. */
-	memmove(jcon->buffer, jcon->buffer + toks[0].end,
-		tal_count(jcon->buffer) - toks[0].end);
-	jcon->used -= toks[0].end;
+	/* We leave it in the buffer until we need to read more: the parser
+	 * has already seen any requests after it. */
+	json_parser_consume(jcon->parser);
 
 	/* If we have more to process, try again.  FIXME: this still gets
 	 * first priority in io_loop, so can starve others.  Hack would be
 	 * a (non-zero) timer, but better would be to have io_loop avoid
 	 * such livelock */
-	if (jcon->used) {
-		tal_free(toks);
+	if (jcon->used > jcon->parser->consumed) {
 		jcon->len_read = 0;
 		return io_always(conn, read_json, jcon);
 	}
 
 read_more:
-	tal_free(toks);
+	/* Now remove all the requests we've handled, at once. */
+	consumed = json_parser_compact(jcon->parser);
+	memmove(jcon->buffer, jcon->buffer + consumed, jcon->used - consumed);
+	jcon->used -= consumed;
 	return io_read_partial(conn, jcon->buffer + jcon->used,
 			       tal_count(jcon->buffer) - jcon->used,
 			       &jcon->len_read, read_json, jcon);
@@ -802,6 +952,7 @@ static struct io_plan *jcon_connected(struct io_conn *conn,
 	jcon->ld = ld;
 	jcon->used = 0;
 	jcon->buffer = tal_arr(jcon, char, 64);
+	jcon->parser = json_parser_new(jcon);
 	jcon->js_arr = tal_arr(jcon, struct json_stream *, 0);
 	jcon->len_read = 0;
 	list_head_init(&jcon->commands);
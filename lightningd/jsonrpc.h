@@ -8,6 +8,7 @@
 #include <lightningd/json_stream.h>
 #include <stdarg.h>
 
+struct json_batch;
 struct jsonrpc;
 
 /* The command mode tells param() how to process. */
@@ -39,6 +40,9 @@ struct command {
 	enum command_mode mode;
 	/* Have we started a json stream already?  For debugging. */
 	struct json_stream *json_stream;
+	/* If it's part of a batch request, which one, and where. */
+	struct json_batch *batch;
+	size_t batch_idx;
 };
 
 /**
@@ -75,6 +75,7 @@
 #include <lightningd/log.h>
 #include <lightningd/onchain_control.h>
 #include <lightningd/options.h>
+#include <lightningd/plugin_hook.h>
 #include <onchaind/onchain_wire.h>
 #include <signal.h>
 #include <sys/types.h>
@@ -571,6 +572,10 @@ static int io_poll_lightningd(struct pollfd *fds, nfds_t nfds, int timeout)
 	 * open! */
 	db_assert_no_outstanding_statements();
 
+	/*~ If we're grouping db_write hook calls, this is where we send them:
+	 * whatever we've queued for peers can't go out until we poll. */
+	plugin_hook_db_flush();
+
 	/* The other checks and freeing tmpctx are common to all daemons. */
 	return daemon_poll(fds, nfds, timeout);
 }
@@ -834,6 +839,12 @@ int main(int argc, char *argv[])
 	 */
 	assert(io_loop_ret == ld);
 
+	/* Anything committed since we last polled.  We don't poll again, but
+	 * shutdown_subdaemons() still writes to the db: hand the db_write
+	 * hook those as they're committed, like we used to. */
+	plugin_hook_db_flush();
+	ld->config.db_write_group = false;
+
 	/* Keep this fd around, to write final response at the end. */
 	stop_fd = io_conn_fd(ld->stop_conn);
 	io_close_taken_fd(ld->stop_conn);
@@ -70,6 +70,32 @@ struct config {
 
 	/* Minimal amount of effective funding_satoshis for accepting channels */
 	u64 min_capacity_sat;
+
+	/* Threads gossipd uses to find routes (0 = none) */
+	u32 gossip_route_threads;
+
+	/* Routes gossipd remembers (0 = none) */
+	u32 gossip_route_cache;
+
+	/* Does gossipd only check gossip_store checksums at startup? */
+	bool gossip_store_crc_once;
+
+	/* Does gossipd keep an index so it can start quickly? */
+	bool gossip_store_index;
+
+	/* Number of threads gossipd uses to check signatures (0 = none) */
+	u32 gossip_verify_threads;
+
+	/* channel_updates gossipd takes at once per channel direction
+	 * (0 = unlimited) and per node, and seconds to earn another. */
+	u32 gossip_ratelimit_burst, gossip_ratelimit_node_burst;
+	u32 gossip_ratelimit_refill;
+
+	/* How many requests a JSON-RPC connection can have unanswered. */
+	u32 rpc_max_inflight;
+
+	/* Do we save up db_write hook calls until we're about to poll? */
+	bool db_write_group;
 };
 
 struct lightningd {
@@ -141,6 +167,8 @@ struct lightningd {
 
 	/* Daemon for routing */
  	struct subd *gossip;
+	/* Blocks we've recently looked up outputs in for gossipd */
+	struct list_head gossip_block_txids;
 
 	/* Daemon looking after peers during init / before channel. */
 	struct subd *connectd;
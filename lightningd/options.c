@@ -491,6 +491,29 @@ static const struct config testnet_config = {
 
 	/* Sets min_effective_htlc_capacity - at 1000$/BTC this is 10ct */
 	.min_capacity_sat = 10000,
+
+	/* Find routes in gossipd's main thread */
+	.gossip_route_threads = 0,
+
+	/* Don't remember routes gossipd finds */
+	.gossip_route_cache = 0,
+
+	/* Check gossip_store checksums on every read */
+	.gossip_store_crc_once = false,
+
+	/* Replay the whole gossip_store on startup */
+	.gossip_store_index = false,
+	.gossip_verify_threads = 0,
+
+	/* Don't hold back channel_updates: we relay what we always have */
+	.gossip_ratelimit_burst = 0,
+	.gossip_ratelimit_node_burst = 1000,
+	.gossip_ratelimit_refill = 300,
+
+	/* Enough to pipeline, without letting a client hog us. */
+	.rpc_max_inflight = 64,
+
+	.db_write_group = false,
 };
 
 /* aka. "Dude, where's my coins?" */
@@ -557,6 +580,29 @@ static const struct config mainnet_config = {
 
 	/* Sets min_effective_htlc_capacity - at 1000$/BTC this is 10ct */
 	.min_capacity_sat = 10000,
+
+	/* Find routes in gossipd's main thread */
+	.gossip_route_threads = 0,
+
+	/* Don't remember routes gossipd finds */
+	.gossip_route_cache = 0,
+
+	/* Check gossip_store checksums on every read */
+	.gossip_store_crc_once = false,
+
+	/* Replay the whole gossip_store on startup */
+	.gossip_store_index = false,
+	.gossip_verify_threads = 0,
+
+	/* Don't hold back channel_updates: we relay what we always have */
+	.gossip_ratelimit_burst = 0,
+	.gossip_ratelimit_node_burst = 1000,
+	.gossip_ratelimit_refill = 300,
+
+	/* Enough to pipeline, without letting a client hog us. */
+	.rpc_max_inflight = 64,
+
+	.db_write_group = false,
 };
 
 static void check_config(struct lightningd *ld)
@@ -574,6 +620,20 @@ static void check_config(struct lightningd *ld)
 
 	if (ld->use_proxy_always && !ld->proxyaddr)
 		fatal("--always-use-proxy needs --proxy");
+
+	/* gossipd keeps these in a u8 and u16 */
+	if (ld->config.gossip_ratelimit_burst > 255)
+		fatal("--gossip-ratelimit-burst must be at most 255");
+	if (ld->config.gossip_ratelimit_node_burst > 65535)
+		fatal("--gossip-ratelimit-node-burst must be at most 65535");
+	if (ld->config.gossip_ratelimit_burst
+	    && ld->config.gossip_ratelimit_node_burst == 0)
+		fatal("--gossip-ratelimit-node-burst must be greater than zero");
+	if (ld->config.gossip_ratelimit_refill == 0)
+		fatal("--gossip-ratelimit-refill must be greater than zero");
+
+	if (ld->config.rpc_max_inflight == 0)
+		fatal("--rpc-max-inflight must be greater than zero");
 }
 
 static void setup_default_config(struct lightningd *ld)
@@ -802,6 +862,14 @@ static void register_opts(struct lightningd *ld)
 	opt_register_arg("--rpc-file", opt_set_talstr, opt_show_charp,
 			 &ld->rpc_filename,
 			 "Set JSON-RPC socket (or /dev/tty)");
+	opt_register_arg("--rpc-max-inflight", opt_set_u32, opt_show_u32,
+			 &ld->config.rpc_max_inflight,
+			 "Number of JSON-RPC requests a connection can have "
+			 "unanswered before we stop reading more");
+	opt_register_arg("--db-write-group", opt_set_bool_arg, opt_show_bool,
+			 &ld->config.db_write_group,
+			 "Combine database commits into one db_write hook "
+			 "call, until we're about to talk to anyone");
 	opt_register_noarg("--help|-h", opt_lightningd_usage, ld,
 				 "Print this message.");
 	opt_register_arg("--bitcoin-datadir", opt_set_talstr, NULL,
@@ -883,6 +951,41 @@ static void register_opts(struct lightningd *ld)
 	opt_register_arg("--min-capacity-sat", opt_set_u64, opt_show_u64,
 			 &ld->config.min_capacity_sat,
 			 "Minimum capacity in satoshis for accepting channels");
+	opt_register_arg("--gossip-route-threads", opt_set_u32, opt_show_u32,
+			 &ld->config.gossip_route_threads,
+			 "Number of threads gossipd uses to find routes "
+			 "(0 to find them in its main loop)");
+	opt_register_arg("--gossip-route-cache", opt_set_u32, opt_show_u32,
+			 &ld->config.gossip_route_cache,
+			 "Number of routes gossipd remembers (0 for none)");
+	opt_register_arg("--gossip-store-crc-once",
+			 opt_set_bool_arg, opt_show_bool,
+			 &ld->config.gossip_store_crc_once,
+			 "Only check gossip_store checksums when gossipd "
+			 "first loads it");
+	opt_register_arg("--gossip-store-index",
+			 opt_set_bool_arg, opt_show_bool,
+			 &ld->config.gossip_store_index,
+			 "Keep an index of gossip, so gossipd doesn't have to "
+			 "replay all the gossip_store on startup");
+	opt_register_arg("--gossip-verify-threads", opt_set_u32, opt_show_u32,
+			 &ld->config.gossip_verify_threads,
+			 "Number of threads gossipd uses to check gossip "
+			 "signatures (0 to check them in its main loop)");
+	opt_register_arg("--gossip-ratelimit-burst", opt_set_u32, opt_show_u32,
+			 &ld->config.gossip_ratelimit_burst,
+			 "Number of channel_updates gossipd takes at once for "
+			 "each channel direction (0 for no limit)");
+	opt_register_arg("--gossip-ratelimit-node-burst",
+			 opt_set_u32, opt_show_u32,
+			 &ld->config.gossip_ratelimit_node_burst,
+			 "Number of channel_updates gossipd takes at once for "
+			 "all of a node's channels");
+	opt_register_arg("--gossip-ratelimit-refill",
+			 opt_set_u32, opt_show_u32,
+			 &ld->config.gossip_ratelimit_refill,
+			 "Seconds before gossipd takes another channel_update "
+			 "for a channel direction, once it's had a burst");
 	opt_register_arg("--addr", opt_add_addr, NULL,
 			 ld,
 			 "Set an IP address (v4 or v6) to listen on and announce to the network for incoming connections");
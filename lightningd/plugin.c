@@ -69,8 +69,11 @@ void plugin_register(struct plugins *plugins, const char* path TAKES)
 	p->plugin_state = UNCONFIGURED;
 	p->js_arr = tal_arr(p, struct json_stream *, 0);
 	p->used = 0;
+	p->consumed = 0;
 	p->subscriptions = NULL;
 	p->signal_startup = false;
+	p->length_framing = false;
+	p->frame_len = 0;
 
 	p->log = new_log(p, plugins->log_book, "plugin-%s",
 			 path_basename(tmpctx, p->cmd));
@@ -236,6 +239,44 @@ static void plugin_response_handle(struct plugin *plugin,
 	tal_free(request);
 }
 
+/**
+ * Is the next message in the plugin's buffer length-prefixed?
+ *
+ * Returns false if it's plain JSON (or we can't tell yet).  Otherwise, once
+ * the header is all there, consumes it (and any whitespace before it), and
+ * sets plugin->frame_len.
+ */
+static bool plugin_read_frame_hdr(struct plugin *plugin)
+{
+	size_t skip = plugin->consumed;
+
+	if (plugin->frame_len)
+		return true;
+
+	while (skip < plugin->used && cisspace(plugin->buffer[skip]))
+		skip++;
+	if (skip == plugin->used || plugin->buffer[skip] != '\0')
+		return false;
+
+	/* We need all the header. */
+	if (plugin->used - skip < JSON_FRAME_HDR_LEN)
+		return true;
+
+	json_frame_len(plugin->buffer + skip, &plugin->frame_len);
+	if (plugin->frame_len == 0) {
+		plugin_kill(plugin, "Zero-length message");
+		return true;
+	}
+
+	plugin->consumed = skip + JSON_FRAME_HDR_LEN;
+
+	/* Make room for all of it at once. */
+	if (tal_count(plugin->buffer) <= plugin->consumed + plugin->frame_len)
+		tal_resize(&plugin->buffer,
+			   plugin->consumed + plugin->frame_len + 1);
+	return true;
+}
+
 /**
  * Try to parse a complete message from the plugin's buffer.
  *
@@ -246,26 +287,43 @@ static bool plugin_read_json_one(struct plugin *plugin)
 {
 	bool valid;
 	const jsmntok_t *toks, *jrtok, *idtok;
+	jsmntok_t *frame_toks = NULL;
 
-	/* FIXME: This could be done more efficiently by storing the
-	 * toks and doing an incremental parse, like lightning-cli
-	 * does. */
-	toks = json_parse_input(plugin->buffer, plugin->buffer, plugin->used,
-				&valid);
-	if (!toks) {
-		if (!valid) {
-			plugin_kill(plugin, "Failed to parse JSON response '%.*s'",
-				    (int)plugin->used, plugin->buffer);
+	if (plugin_read_frame_hdr(plugin)) {
+		/* We know how long it is: parse it once it's all here. */
+		if (plugin->stop || !plugin->frame_len
+		    || plugin->used - plugin->consumed < plugin->frame_len)
+			return false;
+		frame_toks = json_parse_input(plugin,
+					      plugin->buffer + plugin->consumed,
+					      plugin->frame_len, &valid);
+		if (!frame_toks) {
+			plugin_kill(plugin, "Bad length-prefixed message '%.*s'",
+				    (int)plugin->frame_len,
+				    plugin->buffer + plugin->consumed);
+			return false;
+		}
+		/* The handlers want offsets into plugin->buffer. */
+		for (size_t i = 0; i < tal_count(frame_toks); i++) {
+			frame_toks[i].start += plugin->consumed;
+			frame_toks[i].end += plugin->consumed;
+		}
+		toks = frame_toks;
+	} else {
+		/* A big response comes in many reads: this only parses what's
+		 * new since last time. */
+		toks = json_parser_parse(plugin->parser, plugin->buffer,
+					 plugin->used, &valid);
+		if (!toks) {
+			if (!valid) {
+				plugin_kill(plugin,
+					    "Failed to parse JSON response '%.*s'",
+					    (int)plugin->used, plugin->buffer);
+				return false;
+			}
+			/* We need more. */
 			return false;
 		}
-		/* We need more. */
-		return false;
-	}
-
-	/* Empty buffer? (eg. just whitespace). */
-	if (tal_count(toks) == 1) {
-		plugin->used = 0;
-		return false;
 	}
 
 	jrtok = json_get_member(plugin->buffer, toks, "jsonrpc");
@@ -323,14 +381,36 @@ static bool plugin_read_json_one(struct plugin *plugin)
 		plugin_response_handle(plugin, toks, idtok);
 	}
 
-	/* Move this object out of the buffer */
-	memmove(plugin->buffer, plugin->buffer + toks[0].end,
-		tal_count(plugin->buffer) - toks[0].end);
-	plugin->used -= toks[0].end;
-	tal_free(toks);
+	/* Leave it in the buffer until we read more: the parser has already
+	 * seen whatever follows it. */
+	if (frame_toks) {
+		plugin->consumed += plugin->frame_len;
+		plugin->frame_len = 0;
+		tal_free(frame_toks);
+		/* Plain JSON may follow it in the same read. */
+		json_parser_skip_to(plugin->parser, plugin->consumed);
+	} else {
+		json_parser_consume(plugin->parser);
+		plugin->consumed = plugin->parser->consumed;
+	}
 	return true;
 }
 
+/* Remove all the messages we've handled from the front of the buffer. */
+static void plugin_compact_buffer(struct plugin *plugin)
+{
+	/* The parser has skipped the length-prefixed messages we handled, but
+	 * not the header of one we're still waiting for: then it starts
+	 * again after it. */
+	if (json_parser_compact(plugin->parser) != plugin->consumed)
+		json_parser_reset(plugin->parser);
+
+	memmove(plugin->buffer, plugin->buffer + plugin->consumed,
+		plugin->used - plugin->consumed);
+	plugin->used -= plugin->consumed;
+	plugin->consumed = 0;
+}
+
 static struct io_plan *plugin_read_json(struct io_conn *conn UNUSED,
 					struct plugin *plugin)
 {
@@ -354,6 +434,7 @@ static struct io_plan *plugin_read_json(struct io_conn *conn UNUSED,
 	} while (success);
 
 	/* Now read more from the connection */
+	plugin_compact_buffer(plugin);
 	return io_read_partial(plugin->stdout_conn,
 			       plugin->buffer + plugin->used,
 			       tal_count(plugin->buffer) - plugin->used,
@@ -376,11 +457,27 @@ static struct io_plan *plugin_stream_complete(struct io_conn *conn, struct json_
 	return plugin_write_json(conn, plugin);
 }
 
+static struct io_plan *plugin_write_json_body(struct io_conn *conn,
+					      struct plugin *plugin)
+{
+	return json_stream_output(plugin->js_arr[0], plugin->stdin_conn, plugin_stream_complete, plugin);
+}
+
 static struct io_plan *plugin_write_json(struct io_conn *conn,
 					 struct plugin *plugin)
 {
 	if (tal_count(plugin->js_arr)) {
-		return json_stream_output(plugin->js_arr[0], plugin->stdin_conn, plugin_stream_complete, plugin);
+		size_t len;
+
+		if (!plugin->length_framing)
+			return plugin_write_json_body(conn, plugin);
+
+		/* Requests and notifications are complete before they're
+		 * queued, so we know how long it is. */
+		json_stream_contents(plugin->js_arr[0], &len);
+		json_frame_hdr(plugin->frame_hdr, len);
+		return io_write(conn, plugin->frame_hdr, sizeof(plugin->frame_hdr),
+				plugin_write_json_body, plugin);
 	} else if (plugin->stop) {
 		return io_close(conn);
 	}
@@ -791,7 +888,7 @@ static void plugin_manifest_cb(const char *buffer,
 			       const jsmntok_t *idtok,
 			       struct plugin *plugin)
 {
-	const jsmntok_t *resulttok, *dynamictok;
+	const jsmntok_t *resulttok, *dynamictok, *framingtok;
 	bool dynamic_plugin;
 
 	/* Check if all plugins have replied to getmanifest, and break
@@ -815,6 +912,14 @@ static void plugin_manifest_cb(const char *buffer,
 		plugin->dynamic = dynamic_plugin;
 	}
 
+	/* From now on, we can send it length-prefixed messages (we always
+	 * accept them); init tells it it can send them, too. */
+	framingtok = json_get_member(buffer, resulttok, "framing");
+	if (framingtok && json_tok_streq(buffer, framingtok, "length")) {
+		log_debug(plugin->log, "Using length-prefixed messages");
+		plugin->length_framing = true;
+	}
+
 	if (!plugin_opts_add(plugin, buffer, resulttok) ||
 	    !plugin_rpcmethods_add(plugin, buffer, resulttok) ||
 	    !plugin_subscriptions_add(plugin, buffer, resulttok) ||
@@ -948,6 +1053,9 @@ void plugins_start(struct plugins *plugins, const char *dev_plugin_debug)
 		else
 			log_debug(plugins->log, "started(%u) %s", p->pid, p->cmd);
 		p->buffer = tal_arr(p, char, 64);
+		p->parser = json_parser_new(p);
+		p->consumed = 0;
+		p->frame_len = 0;
 		p->stop = false;
 
 		/* Create two connections, one read-only on top of p->stdin, and one
@@ -1027,6 +1135,8 @@ static void plugin_config(struct plugin *plugin)
 	json_add_string(req->stream, "lightning-dir", ld->config_dir);
 	json_add_string(req->stream, "rpc-file", ld->rpc_filename);
 	json_add_bool(req->stream, "startup", plugin->plugins->startup);
+	if (plugin->length_framing)
+		json_add_string(req->stream, "framing", "length");
 	json_object_end(req->stream);
 
 	jsonrpc_request_end(req);
@@ -5,6 +5,7 @@
 #include <ccan/io/io.h>
 #include <ccan/take/take.h>
 #include <ccan/tal/tal.h>
+#include <common/json.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/log.h>
 
@@ -36,6 +37,17 @@ struct plugin {
 	/* Stuff we read */
 	char *buffer;
 	size_t used, len_read;
+	/* How much of buffer we've handled (removed before we read more). */
+	size_t consumed;
+	/* How far we've parsed buffer. */
+	struct json_parser *parser;
+	/* Length of the length-prefixed message we're reading (0 if none). */
+	u32 frame_len;
+
+	/* Did it say (in getmanifest) it can read length-prefixed messages? */
+	bool length_framing;
+	/* If so, the header for the one we're writing. */
+	char frame_hdr[JSON_FRAME_HDR_LEN];
 
 	/* Our json_streams. Since multiple streams could start
 	 * returning data at once, we always service these in order,
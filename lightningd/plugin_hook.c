@@ -1,6 +1,13 @@
+#include <ccan/ilog/ilog.h>
 #include <ccan/io/io.h>
+#include <ccan/time/time.h>
+#include <common/json_command.h>
+#include <common/jsonrpc_errors.h>
 #include <common/memleak.h>
+#include <common/param.h>
+#include <lightningd/json.h>
 #include <lightningd/jsonrpc.h>
+#include <lightningd/lightningd.h>
 #include <lightningd/plugin_hook.h>
 #include <wallet/db.h>
 
@@ -126,6 +133,14 @@ void plugin_hook_call_(struct lightningd *ld, const struct plugin_hook *hook,
 static struct plugin_hook db_write_hook = { "db_write", NULL, NULL, NULL };
 AUTODATA(hooks, &db_write_hook);
 
+/* With --db-write-group, changes wait here (one transaction after another)
+ * until plugin_hook_db_flush(), which we call before we poll: nothing we've
+ * queued for a peer (or anyone else) can be written until then. */
+static const char **db_pending_writes;
+static size_t db_pending_transactions;
+static struct db *db_pending_db;
+static bool db_flushing;
+
 static void db_hook_response(const char *buffer, const jsmntok_t *toks,
 			     const jsmntok_t *idtok,
 			     struct plugin_hook_request *ph_req)
@@ -143,24 +158,40 @@ static void db_hook_response(const char *buffer, const jsmntok_t *toks,
 		fatal("Plugin returned an invalid result to the db_write "
 		      "hook: %s", buffer);
 
-	/* If it fails, we must not commit to our db. */
-	if (!resp)
+	/* If it fails, we must not commit to our db.  With --db-write-group
+	 * we already have: all we can do is stop before anyone acts on
+	 * writes the plugin refused. */
+	if (!resp) {
+		if (db_flushing)
+			fatal("Plugin returned failed db_write for writes we "
+			      "already committed: %s.", buffer);
 		fatal("Plugin returned failed db_write: %s.", buffer);
+	}
 
 	/* We're done, exit exclusive loop. */
 	io_break(ph_req);
 }
 
-void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
+/* Latencies, in buckets of powers of 2 usec: bucket i is < 2^i usec. */
+#define DB_HOOK_LATENCY_BUCKETS 32
+static struct db_hook_stats {
+	u64 calls, transactions, statements;
+	u64 total_usec, max_usec;
+	u64 latency[DB_HOOK_LATENCY_BUCKETS];
+} db_hook_stats;
+
+static void db_hook_call(struct db *db,
+			 const char **changes, const char *final,
+			 size_t num_transactions)
 {
 	const struct plugin_hook *hook = &db_write_hook;
 	struct jsonrpc_request *req;
 	struct plugin_hook_request *ph_req;
+	struct timemono start;
+	size_t bucket;
+	u64 usec;
 	void *ret;
 
-	if (!hook->plugin)
-		return;
-
 	ph_req = notleak(tal(hook->plugin, struct plugin_hook_request));
 	/* FIXME: do IO logging for this! */
 	req = jsonrpc_request_start(NULL, hook->name, NULL, db_hook_response,
@@ -177,6 +208,7 @@ void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
 	json_array_end(req->stream);
 	jsonrpc_request_end(req);
 
+	start = time_mono();
 	plugin_request_send(hook->plugin, req);
 
 	/* We can be called on way out of an io_loop, which is already breaking.
@@ -188,4 +220,107 @@ void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
 		assert(ret2 == ph_req);
 		io_break(ret);
 	}
+
+	usec = time_to_usec(timemono_since(start));
+	db_hook_stats.calls++;
+	db_hook_stats.transactions += num_transactions;
+	db_hook_stats.statements += tal_count(changes) + (final ? 1 : 0);
+	db_hook_stats.total_usec += usec;
+	if (usec > db_hook_stats.max_usec)
+		db_hook_stats.max_usec = usec;
+	bucket = ilog64(usec);
+	if (bucket >= DB_HOOK_LATENCY_BUCKETS)
+		bucket = DB_HOOK_LATENCY_BUCKETS - 1;
+	db_hook_stats.latency[bucket]++;
+}
+
+void plugin_hook_db_sync(struct db *db, const char **changes, const char *final)
+{
+	const struct plugin_hook *hook = &db_write_hook;
+
+	if (!hook->plugin)
+		return;
+
+	if (hook->plugin->plugins->ld->config.db_write_group) {
+		if (!db_pending_writes)
+			db_pending_writes = notleak(tal_arr(NULL, const char *,
+							    0));
+		for (size_t i = 0; i < tal_count(changes); i++)
+			tal_arr_expand(&db_pending_writes,
+				       tal_steal(db_pending_writes,
+						 changes[i]));
+		if (final)
+			tal_arr_expand(&db_pending_writes,
+				       tal_strdup(db_pending_writes, final));
+		db_pending_transactions++;
+		db_pending_db = db;
+		return;
+	}
+
+	db_hook_call(db, changes, final, 1);
+}
+
+void plugin_hook_db_flush(void)
+{
+	const char **writes;
+	size_t num_transactions;
+
+	/* The db_write call runs an io_loop itself, which calls us again.
+	 * Anything committed meanwhile goes in the next call. */
+	if (db_flushing || !db_pending_writes)
+		return;
+
+	writes = db_pending_writes;
+	num_transactions = db_pending_transactions;
+	db_pending_writes = NULL;
+	db_pending_transactions = 0;
+
+	/* These are committed already: if the plugin went away, it can never
+	 * see them, and we can't go on as if it had. */
+	if (!db_write_hook.plugin)
+		fatal("db_write plugin went away before seeing %zu committed "
+		      "transactions", num_transactions);
+
+	db_flushing = true;
+	db_hook_call(db_pending_db, writes, NULL, num_transactions);
+	db_flushing = false;
+	tal_free(writes);
+}
+
+static struct command_result *json_getdbwritestats(struct command *cmd,
+						   const char *buffer,
+						   const jsmntok_t *obj UNNEEDED,
+						   const jsmntok_t *params)
+{
+	struct json_stream *response;
+
+	if (!param(cmd, buffer, params, NULL))
+		return command_param_failed();
+
+	response = json_stream_success(cmd);
+	json_add_bool(response, "group", cmd->ld->config.db_write_group);
+	json_add_u64(response, "calls", db_hook_stats.calls);
+	json_add_u64(response, "transactions", db_hook_stats.transactions);
+	json_add_u64(response, "statements", db_hook_stats.statements);
+	json_add_u64(response, "total_usec", db_hook_stats.total_usec);
+	json_add_u64(response, "max_usec", db_hook_stats.max_usec);
+	json_array_start(response, "latency");
+	for (size_t i = 0; i < DB_HOOK_LATENCY_BUCKETS; i++) {
+		if (!db_hook_stats.latency[i])
+			continue;
+		json_object_start(response, NULL);
+		json_add_u64(response, "below_usec", (u64)1 << i);
+		json_add_u64(response, "count", db_hook_stats.latency[i]);
+		json_object_end(response);
+	}
+	json_array_end(response);
+	return command_success(cmd, response);
 }
+
+static const struct json_command getdbwritestats_command = {
+	"getdbwritestats",
+	"utility",
+	json_getdbwritestats,
+	"Show how many db_write hook calls we've made, and how long they took"
+};
+AUTODATA(json_command, &getdbwritestats_command);
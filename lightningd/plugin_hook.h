@@ -112,4 +112,8 @@ void plugin_hook_unregister_all(struct plugin *plugin);
  * final command appended. */
 void plugin_hook_db_sync(struct db *db, const char **changes, const char *final);
 
+/* With --db-write-group, plugin_hook_db_sync() saves the changes up: this
+ * hands them all to the plugin at once (synchronously). */
+void plugin_hook_db_flush(void);
+
 #endif /* LIGHTNING_LIGHTNINGD_PLUGIN_HOOK_H */
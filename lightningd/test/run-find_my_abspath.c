@@ -143,6 +143,9 @@ void onchaind_replay_channels(struct lightningd *ld UNNEEDED)
 /* Generated stub for per_peer_state_set_fds_arr */
 void per_peer_state_set_fds_arr(struct per_peer_state *pps UNNEEDED, const int *fds UNNEEDED)
 { fprintf(stderr, "per_peer_state_set_fds_arr called!\n"); abort(); }
+/* Generated stub for plugin_hook_db_flush */
+void plugin_hook_db_flush(void)
+{ fprintf(stderr, "plugin_hook_db_flush called!\n"); abort(); }
 /* Generated stub for plugins_config */
 void plugins_config(struct plugins *plugins UNNEEDED)
 { fprintf(stderr, "plugins_config called!\n"); abort(); }
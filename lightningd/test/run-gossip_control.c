@@ -0,0 +1,614 @@
+#include "../gossip_control.c"
+#include <common/utils.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for command_fail */
+struct command_result *command_fail(struct command *cmd UNNEEDED, int code UNNEEDED,
+				    const char *fmt UNNEEDED, ...)
+
+{ fprintf(stderr, "command_fail called!\n"); abort(); }
+/* Generated stub for command_param_failed */
+struct command_result *command_param_failed(void)
+
+{ fprintf(stderr, "command_param_failed called!\n"); abort(); }
+/* Generated stub for command_raw_complete */
+struct command_result *command_raw_complete(struct command *cmd UNNEEDED,
+					    struct json_stream *result UNNEEDED)
+{ fprintf(stderr, "command_raw_complete called!\n"); abort(); }
+/* Generated stub for command_still_pending */
+struct command_result *command_still_pending(struct command *cmd)
+
+{ fprintf(stderr, "command_still_pending called!\n"); abort(); }
+/* Generated stub for command_success */
+struct command_result *command_success(struct command *cmd UNNEEDED,
+				       struct json_stream *response)
+
+{ fprintf(stderr, "command_success called!\n"); abort(); }
+/* Generated stub for fatal */
+void   fatal(const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "fatal called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_dev_compact_store_reply */
+bool fromwire_gossip_dev_compact_store_reply(const void *p UNNEEDED, bool *success UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_dev_compact_store_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_getchannels_reply */
+bool fromwire_gossip_getchannels_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct short_channel_id **next UNNEEDED, struct gossip_getchannels_entry ***nodes UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_getchannels_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_getnodes_reply */
+bool fromwire_gossip_getnodes_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct node_id **next UNNEEDED, struct gossip_getnodes_entry ***nodes UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_getnodes_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_getroute_reply */
+bool fromwire_gossip_getroute_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct route_hop **hops UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_getroute_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_getroutes_reply */
+bool fromwire_gossip_getroutes_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u16 **route_lens UNNEEDED, struct route_hop **hops UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_getroutes_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_peer_stats_reply */
+bool fromwire_gossip_peer_stats_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, struct node_id **ids UNNEEDED, u64 **accepted UNNEEDED, u64 **suppressed UNNEEDED, u64 **invalid UNNEEDED, u32 *held UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_peer_stats_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_query_channel_range_reply */
+bool fromwire_gossip_query_channel_range_reply(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, u32 *final_first_block UNNEEDED, u32 *final_num_blocks UNNEEDED, bool *final_complete UNNEEDED, struct short_channel_id **scids UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_query_channel_range_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_route_cache_stats_reply */
+bool fromwire_gossip_route_cache_stats_reply(const void *p UNNEEDED, u64 *hits UNNEEDED, u64 *misses UNNEEDED, u64 *invalidations UNNEEDED, u64 *evictions UNNEEDED, u32 *entries UNNEEDED, u32 *max_entries UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_route_cache_stats_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_scids_reply */
+bool fromwire_gossip_scids_reply(const void *p UNNEEDED, bool *ok UNNEEDED, bool *complete UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_scids_reply called!\n"); abort(); }
+/* Generated stub for fromwire_gossip_verify_stats_reply */
+bool fromwire_gossip_verify_stats_reply(const void *p UNNEEDED, u64 *submitted UNNEEDED, u64 *checked UNNEEDED, u64 *failed UNNEEDED, u32 *queued UNNEEDED, u32 *max_queued UNNEEDED, u64 *verify_nsec UNNEEDED)
+{ fprintf(stderr, "fromwire_gossip_verify_stats_reply called!\n"); abort(); }
+/* Generated stub for get_chainparams */
+const struct chainparams *get_chainparams(const struct lightningd *ld UNNEEDED)
+{ fprintf(stderr, "get_chainparams called!\n"); abort(); }
+/* Generated stub for get_offered_globalfeatures */
+u8 *get_offered_globalfeatures(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "get_offered_globalfeatures called!\n"); abort(); }
+/* Generated stub for gossip_wire_type_name */
+const char *gossip_wire_type_name(int e UNNEEDED)
+{ fprintf(stderr, "gossip_wire_type_name called!\n"); abort(); }
+/* Generated stub for hsm_get_global_fd */
+int hsm_get_global_fd(struct lightningd *ld UNNEEDED, int capabilities UNNEEDED)
+{ fprintf(stderr, "hsm_get_global_fd called!\n"); abort(); }
+/* Generated stub for json_add_address */
+void json_add_address(struct json_stream *response UNNEEDED, const char *fieldname UNNEEDED,
+		      const struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "json_add_address called!\n"); abort(); }
+/* Generated stub for json_add_amount_msat_only */
+void json_add_amount_msat_only(struct json_stream *result UNNEEDED,
+			  const char *msatfieldname UNNEEDED,
+			  struct amount_msat msat)
+
+{ fprintf(stderr, "json_add_amount_msat_only called!\n"); abort(); }
+/* Generated stub for json_add_amount_sat_compat */
+void json_add_amount_sat_compat(struct json_stream *result UNNEEDED,
+				struct amount_sat sat UNNEEDED,
+				const char *rawfieldname UNNEEDED,
+				const char *msatfieldname)
+
+{ fprintf(stderr, "json_add_amount_sat_compat called!\n"); abort(); }
+/* Generated stub for json_add_bool */
+void json_add_bool(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		   bool value UNNEEDED)
+{ fprintf(stderr, "json_add_bool called!\n"); abort(); }
+/* Generated stub for json_add_escaped_string */
+void json_add_escaped_string(struct json_stream *result UNNEEDED,
+			     const char *fieldname UNNEEDED,
+			     const struct json_escape *esc TAKES UNNEEDED)
+{ fprintf(stderr, "json_add_escaped_string called!\n"); abort(); }
+/* Generated stub for json_add_hex */
+void json_add_hex(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		  const void *data UNNEEDED, size_t len UNNEEDED)
+{ fprintf(stderr, "json_add_hex called!\n"); abort(); }
+/* Generated stub for json_add_hex_talarr */
+void json_add_hex_talarr(struct json_stream *result UNNEEDED,
+			 const char *fieldname UNNEEDED,
+			 const tal_t *data UNNEEDED)
+{ fprintf(stderr, "json_add_hex_talarr called!\n"); abort(); }
+/* Generated stub for json_add_node_id */
+void json_add_node_id(struct json_stream *response UNNEEDED,
+				const char *fieldname UNNEEDED,
+				const struct node_id *id UNNEEDED)
+{ fprintf(stderr, "json_add_node_id called!\n"); abort(); }
+/* Generated stub for json_add_num */
+void json_add_num(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		  unsigned int value UNNEEDED)
+{ fprintf(stderr, "json_add_num called!\n"); abort(); }
+/* Generated stub for json_add_route */
+void json_add_route(struct json_stream *r UNNEEDED, char const *n UNNEEDED,
+		    const struct route_hop *hops UNNEEDED, size_t hops_len UNNEEDED)
+{ fprintf(stderr, "json_add_route called!\n"); abort(); }
+/* Generated stub for json_add_short_channel_id */
+void json_add_short_channel_id(struct json_stream *response UNNEEDED,
+			       const char *fieldname UNNEEDED,
+			       const struct short_channel_id *id UNNEEDED)
+{ fprintf(stderr, "json_add_short_channel_id called!\n"); abort(); }
+/* Generated stub for json_add_u32 */
+void json_add_u32(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		  uint32_t value UNNEEDED)
+{ fprintf(stderr, "json_add_u32 called!\n"); abort(); }
+/* Generated stub for json_add_u64 */
+void json_add_u64(struct json_stream *result UNNEEDED, const char *fieldname UNNEEDED,
+		  uint64_t value UNNEEDED)
+{ fprintf(stderr, "json_add_u64 called!\n"); abort(); }
+/* Generated stub for json_array_end */
+void json_array_end(struct json_stream *js UNNEEDED)
+{ fprintf(stderr, "json_array_end called!\n"); abort(); }
+/* Generated stub for json_array_start */
+void json_array_start(struct json_stream *js UNNEEDED, const char *fieldname UNNEEDED)
+{ fprintf(stderr, "json_array_start called!\n"); abort(); }
+/* Generated stub for json_object_end */
+void json_object_end(struct json_stream *js UNNEEDED)
+{ fprintf(stderr, "json_object_end called!\n"); abort(); }
+/* Generated stub for json_object_start */
+void json_object_start(struct json_stream *ks UNNEEDED, const char *fieldname UNNEEDED)
+{ fprintf(stderr, "json_object_start called!\n"); abort(); }
+/* Generated stub for json_stream_success */
+struct json_stream *json_stream_success(struct command *cmd UNNEEDED)
+{ fprintf(stderr, "json_stream_success called!\n"); abort(); }
+/* Generated stub for json_to_short_channel_id */
+bool json_to_short_channel_id(const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
+			      struct short_channel_id *scid UNNEEDED,
+			      bool may_be_deprecated_form UNNEEDED)
+{ fprintf(stderr, "json_to_short_channel_id called!\n"); abort(); }
+/* Generated stub for log_ */
+void log_(struct log *log UNNEEDED, enum log_level level UNNEEDED, bool call_notifier UNNEEDED, const char *fmt UNNEEDED, ...)
+
+{ fprintf(stderr, "log_ called!\n"); abort(); }
+/* Generated stub for new_global_subd */
+struct subd *new_global_subd(struct lightningd *ld UNNEEDED,
+			     const char *name UNNEEDED,
+			     const char *(*msgname)(int msgtype) UNNEEDED,
+			     unsigned int (*msgcb)(struct subd * UNNEEDED, const u8 * UNNEEDED,
+						   const int *fds) UNNEEDED,
+			     ...)
+{ fprintf(stderr, "new_global_subd called!\n"); abort(); }
+/* Generated stub for param */
+bool param(struct command *cmd UNNEEDED, const char *buffer UNNEEDED,
+	   const jsmntok_t params[] UNNEEDED, ...)
+{ fprintf(stderr, "param called!\n"); abort(); }
+/* Generated stub for param_array */
+struct command_result *param_array(struct command *cmd UNNEEDED, const char *name UNNEEDED,
+				   const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
+				   const jsmntok_t **arr UNNEEDED)
+{ fprintf(stderr, "param_array called!\n"); abort(); }
+/* Generated stub for param_double */
+struct command_result *param_double(struct command *cmd UNNEEDED, const char *name UNNEEDED,
+				    const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
+				    double **num UNNEEDED)
+{ fprintf(stderr, "param_double called!\n"); abort(); }
+/* Generated stub for param_msat */
+struct command_result *param_msat(struct command *cmd UNNEEDED, const char *name UNNEEDED,
+				  const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
+				  struct amount_msat **msat UNNEEDED)
+{ fprintf(stderr, "param_msat called!\n"); abort(); }
+/* Generated stub for param_node_id */
+struct command_result *param_node_id(struct command *cmd UNNEEDED,
+					       const char *name UNNEEDED,
+					       const char *buffer UNNEEDED,
+					       const jsmntok_t *tok UNNEEDED,
+					       struct node_id **id UNNEEDED)
+{ fprintf(stderr, "param_node_id called!\n"); abort(); }
+/* Generated stub for param_number */
+struct command_result *param_number(struct command *cmd UNNEEDED, const char *name UNNEEDED,
+				    const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
+				    unsigned int **num UNNEEDED)
+{ fprintf(stderr, "param_number called!\n"); abort(); }
+/* Generated stub for param_percent */
+struct command_result *param_percent(struct command *cmd UNNEEDED, const char *name UNNEEDED,
+				     const char *buffer UNNEEDED, const jsmntok_t *tok UNNEEDED,
+				     double **num UNNEEDED)
+{ fprintf(stderr, "param_percent called!\n"); abort(); }
+/* Generated stub for param_short_channel_id */
+struct command_result *param_short_channel_id(struct command *cmd UNNEEDED,
+					      const char *name UNNEEDED,
+					      const char *buffer UNNEEDED,
+					      const jsmntok_t *tok UNNEEDED,
+					      struct short_channel_id **scid UNNEEDED)
+{ fprintf(stderr, "param_short_channel_id called!\n"); abort(); }
+/* Generated stub for ping_reply */
+void ping_reply(struct subd *subd UNNEEDED, const u8 *msg UNNEEDED)
+{ fprintf(stderr, "ping_reply called!\n"); abort(); }
+/* Generated stub for subd_req_ */
+void subd_req_(const tal_t *ctx UNNEEDED,
+	       struct subd *sd UNNEEDED,
+	       const u8 *msg_out UNNEEDED,
+	       int fd_out UNNEEDED, size_t num_fds_in UNNEEDED,
+	       void (*replycb)(struct subd * UNNEEDED, const u8 * UNNEEDED, const int * UNNEEDED, void *) UNNEEDED,
+	       void *replycb_data UNNEEDED)
+{ fprintf(stderr, "subd_req_ called!\n"); abort(); }
+/* Generated stub for towire_gossip_dev_compact_store */
+u8 *towire_gossip_dev_compact_store(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "towire_gossip_dev_compact_store called!\n"); abort(); }
+/* Generated stub for towire_gossip_dev_set_max_scids_encode_size */
+u8 *towire_gossip_dev_set_max_scids_encode_size(const tal_t *ctx UNNEEDED, u32 max UNNEEDED)
+{ fprintf(stderr, "towire_gossip_dev_set_max_scids_encode_size called!\n"); abort(); }
+/* Generated stub for towire_gossip_dev_suppress */
+u8 *towire_gossip_dev_suppress(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "towire_gossip_dev_suppress called!\n"); abort(); }
+/* Generated stub for towire_gossip_getchannels_request */
+u8 *towire_gossip_getchannels_request(const tal_t *ctx UNNEEDED, const struct short_channel_id *short_channel_id UNNEEDED, const struct node_id *source UNNEEDED, const struct short_channel_id *start UNNEEDED, u32 limit UNNEEDED)
+{ fprintf(stderr, "towire_gossip_getchannels_request called!\n"); abort(); }
+/* Generated stub for towire_gossip_getnodes_request */
+u8 *towire_gossip_getnodes_request(const tal_t *ctx UNNEEDED, const struct node_id *id UNNEEDED, const struct node_id *start UNNEEDED, u32 limit UNNEEDED)
+{ fprintf(stderr, "towire_gossip_getnodes_request called!\n"); abort(); }
+/* Generated stub for towire_gossip_getroute_request */
+u8 *towire_gossip_getroute_request(const tal_t *ctx UNNEEDED, const struct node_id *source UNNEEDED, const struct node_id *destination UNNEEDED, struct amount_msat msatoshi UNNEEDED, u64 riskfactor_by_million UNNEEDED, u32 final_cltv UNNEEDED, const double *fuzz UNNEEDED, const struct short_channel_id_dir *excluded UNNEEDED, u32 max_hops UNNEEDED)
+{ fprintf(stderr, "towire_gossip_getroute_request called!\n"); abort(); }
+/* Generated stub for towire_gossip_getroutes_request */
+u8 *towire_gossip_getroutes_request(const tal_t *ctx UNNEEDED, const struct node_id *source UNNEEDED, const struct node_id *destination UNNEEDED, struct amount_msat msatoshi UNNEEDED, u64 riskfactor_by_million UNNEEDED, u32 final_cltv UNNEEDED, const double *fuzz UNNEEDED, const struct short_channel_id_dir *excluded UNNEEDED, u32 max_hops UNNEEDED, u16 num_routes UNNEEDED)
+{ fprintf(stderr, "towire_gossip_getroutes_request called!\n"); abort(); }
+/* Generated stub for towire_gossip_outpoint_spent */
+u8 *towire_gossip_outpoint_spent(const tal_t *ctx UNNEEDED, const struct short_channel_id *short_channel_id UNNEEDED)
+{ fprintf(stderr, "towire_gossip_outpoint_spent called!\n"); abort(); }
+/* Generated stub for towire_gossip_peer_stats */
+u8 *towire_gossip_peer_stats(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "towire_gossip_peer_stats called!\n"); abort(); }
+/* Generated stub for towire_gossip_query_channel_range */
+u8 *towire_gossip_query_channel_range(const tal_t *ctx UNNEEDED, const struct node_id *id UNNEEDED, u32 first_blocknum UNNEEDED, u32 number_of_blocks UNNEEDED)
+{ fprintf(stderr, "towire_gossip_query_channel_range called!\n"); abort(); }
+/* Generated stub for towire_gossip_query_scids */
+u8 *towire_gossip_query_scids(const tal_t *ctx UNNEEDED, const struct node_id *id UNNEEDED, const struct short_channel_id *ids UNNEEDED)
+{ fprintf(stderr, "towire_gossip_query_scids called!\n"); abort(); }
+/* Generated stub for towire_gossip_route_cache_stats */
+u8 *towire_gossip_route_cache_stats(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "towire_gossip_route_cache_stats called!\n"); abort(); }
+/* Generated stub for towire_gossip_send_timestamp_filter */
+u8 *towire_gossip_send_timestamp_filter(const tal_t *ctx UNNEEDED, const struct node_id *id UNNEEDED, u32 first_timestamp UNNEEDED, u32 timestamp_range UNNEEDED)
+{ fprintf(stderr, "towire_gossip_send_timestamp_filter called!\n"); abort(); }
+/* Generated stub for towire_gossip_verify_stats */
+u8 *towire_gossip_verify_stats(const tal_t *ctx UNNEEDED)
+{ fprintf(stderr, "towire_gossip_verify_stats called!\n"); abort(); }
+/* Generated stub for towire_gossipctl_init */
+u8 *towire_gossipctl_init(const tal_t *ctx UNNEEDED, const struct bitcoin_blkid *chain_hash UNNEEDED, const struct node_id *id UNNEEDED, const u8 *globalfeatures UNNEEDED, const u8 rgb[3] UNNEEDED, const u8 alias[32] UNNEEDED, u32 update_channel_interval UNNEEDED, const struct wireaddr *announcable UNNEEDED, u32 route_threads UNNEEDED, u32 route_cache_size UNNEEDED, bool store_crc_once UNNEEDED, bool store_index UNNEEDED, u32 verify_threads UNNEEDED, u32 ratelimit_burst UNNEEDED, u32 ratelimit_node_burst UNNEEDED, u32 ratelimit_refill UNNEEDED, u32 *dev_gossip_time UNNEEDED)
+{ fprintf(stderr, "towire_gossipctl_init called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+bool deprecated_apis;
+
+/* Each block has this many transactions, and each one is unspent. */
+#define TXS_PER_BLOCK 3
+
+static u32 tip;
+static size_t num_getblocktxids, num_gettxout, num_replies;
+/* The last reply we sent. */
+static const struct gossip_txout **reply;
+
+/* Block fetches we haven't answered yet, so batches can overlap. */
+struct pending_block {
+	struct bitcoind *bitcoind;
+	u32 height;
+	void (*cb)(struct bitcoind *bitcoind,
+		   const struct bitcoin_txid *txids,
+		   void *arg);
+	void *arg;
+};
+static struct pending_block *pending_blocks;
+
+/* The txid encodes where it is, so the output can say where it came from. */
+static void fake_txid(struct bitcoin_txid *txid, u32 height, u32 txnum)
+{
+	memset(txid, 0, sizeof(*txid));
+	memcpy(txid->shad.sha.u.u8, &height, sizeof(height));
+	memcpy(txid->shad.sha.u.u8 + sizeof(height), &txnum, sizeof(txnum));
+}
+
+static struct amount_sat fake_amount(u32 height, u32 txnum, u32 outnum)
+{
+	struct amount_sat sat;
+
+	sat.satoshis = height * 10000 + txnum * 100 + outnum; /* Raw: test */
+	return sat;
+}
+
+void bitcoind_getblocktxids_(struct bitcoind *bitcoind,
+			     u32 height,
+			     void (*cb)(struct bitcoind *bitcoind,
+					const struct bitcoin_txid *txids,
+					void *arg),
+			     void *arg)
+{
+	struct pending_block pb;
+
+	num_getblocktxids++;
+	pb.bitcoind = bitcoind;
+	pb.height = height;
+	pb.cb = cb;
+	pb.arg = arg;
+	tal_arr_expand(&pending_blocks, pb);
+}
+
+void bitcoind_gettxout(struct bitcoind *bitcoind,
+		       const struct bitcoin_txid *txid, const u32 outnum,
+		       void (*cb)(struct bitcoind *bitcoind,
+				  const struct bitcoin_tx_output *txout,
+				  void *arg),
+		       void *arg)
+{
+	struct bitcoin_tx_output out;
+	u32 height, txnum;
+
+	num_gettxout++;
+	memcpy(&height, txid->shad.sha.u.u8, sizeof(height));
+	memcpy(&txnum, txid->shad.sha.u.u8 + sizeof(height), sizeof(txnum));
+	out.amount = fake_amount(height, txnum, outnum);
+	out.script = tal_arrz(tmpctx, u8, 1);
+	cb(bitcoind, &out, arg);
+}
+
+u32 get_block_height(const struct chain_topology *topo UNNEEDED)
+{
+	return tip;
+}
+
+/* Only 990x0x0 is in our utxoset (950 to 1000): the rest there are spent. */
+struct outpoint *wallet_outpoint_for_scid(struct wallet *w UNNEEDED,
+					  tal_t *ctx,
+					  const struct short_channel_id *scid)
+{
+	struct outpoint *op;
+
+	if (short_channel_id_blocknum(scid) != 990
+	    || short_channel_id_txnum(scid) != 0
+	    || short_channel_id_outnum(scid) != 0)
+		return NULL;
+
+	op = tal(ctx, struct outpoint);
+	op->sat = fake_amount(990, 0, 0);
+	op->scriptpubkey = tal_arrz(op, u8, 1);
+	return op;
+}
+
+bool fromwire_gossip_get_txouts(const tal_t *ctx, const void *p,
+				struct short_channel_id **scids)
+{
+	*scids = tal_dup_arr(ctx, struct short_channel_id,
+			     (const struct short_channel_id *)p,
+			     tal_count((const struct short_channel_id *)p), 0);
+	return true;
+}
+
+u8 *towire_gossip_get_txouts_reply(const tal_t *ctx,
+				   const struct gossip_txout **txouts)
+{
+	num_replies++;
+	tal_free(reply);
+	reply = tal_dup_arr(NULL, const struct gossip_txout *,
+			    txouts, tal_count(txouts), 0);
+	/* Keep the txouts themselves around too. */
+	for (size_t i = 0; i < tal_count(reply); i++)
+		tal_steal(reply, reply[i]);
+	return tal_arr(ctx, u8, 0);
+}
+
+void subd_send_msg(struct subd *sd UNNEEDED, const u8 *msg_out)
+{
+	if (taken(msg_out))
+		tal_free(msg_out);
+}
+
+static struct short_channel_id scid(u32 blocknum, u32 txnum, u16 outnum)
+{
+	struct short_channel_id scid;
+
+	if (!mk_short_channel_id(&scid, blocknum, txnum, outnum))
+		abort();
+	return scid;
+}
+
+/* Answer every block fetch we've been asked for, oldest first. */
+static void answer_blocks(void)
+{
+	struct pending_block *pbs = pending_blocks;
+
+	pending_blocks = tal_arr(NULL, struct pending_block, 0);
+	for (size_t i = 0; i < tal_count(pbs); i++) {
+		struct bitcoin_txid *txids;
+
+		txids = tal_arr(tmpctx, struct bitcoin_txid, TXS_PER_BLOCK);
+		for (size_t t = 0; t < TXS_PER_BLOCK; t++)
+			fake_txid(&txids[t], pbs[i].height, t);
+		pbs[i].cb(pbs[i].bitcoind, txids, pbs[i].arg);
+	}
+	tal_free(pbs);
+}
+
+/* Asks for the txouts of @scids, answering block fetches at once: returns
+ * how many blocks it had to fetch. */
+static size_t ask(struct subd *gossip, const struct short_channel_id *scids)
+{
+	size_t before = num_getblocktxids, replies = num_replies;
+
+	get_txouts(gossip, (const u8 *)scids);
+	answer_blocks();
+	assert(num_replies == replies + 1);
+	assert(tal_count(reply) == tal_count(scids));
+	return num_getblocktxids - before;
+}
+
+static size_t num_cached(struct lightningd *ld)
+{
+	struct block_txids *b;
+	size_t num = 0;
+
+	list_for_each(&ld->gossip_block_txids, b, list)
+		num++;
+	return num;
+}
+
+static bool is_cached(struct lightningd *ld, u32 height)
+{
+	struct block_txids *b;
+
+	list_for_each(&ld->gossip_block_txids, b, list) {
+		if (b->height == height)
+			return true;
+	}
+	return false;
+}
+
+static void forget_blocks(struct lightningd *ld)
+{
+	struct block_txids *b, *next;
+
+	list_for_each_safe(&ld->gossip_block_txids, b, next, list) {
+		list_del_from(&ld->gossip_block_txids, &b->list);
+		tal_free(b);
+	}
+}
+
+static struct short_channel_id *scids_arr(void)
+{
+	return tal_arr(tmpctx, struct short_channel_id, 0);
+}
+
+static void test_batch(struct subd *gossip)
+{
+	struct short_channel_id *scids = scids_arr();
+
+	/* Sorted, as gossipd sends them. */
+	tal_arr_expand(&scids, scid(100, 0, 0));
+	tal_arr_expand(&scids, scid(100, 1, 1));
+	tal_arr_expand(&scids, scid(100, 2, 0));
+	tal_arr_expand(&scids, scid(200, 0, 0));
+	/* No such transaction. */
+	tal_arr_expand(&scids, scid(200, TXS_PER_BLOCK, 0));
+	/* In our utxoset's range: spent, then unspent. */
+	tal_arr_expand(&scids, scid(960, 0, 0));
+	tal_arr_expand(&scids, scid(990, 0, 0));
+
+	num_gettxout = 0;
+	/* One fetch per block, one gettxout per real output elsewhere. */
+	assert(ask(gossip, scids) == 2);
+	assert(num_gettxout == 4);
+
+	for (size_t i = 0; i < tal_count(reply); i++) {
+		const struct short_channel_id *s = &reply[i]->scid;
+		u32 height = short_channel_id_blocknum(s);
+
+		assert(short_channel_id_eq(s, &scids[i]));
+		if (short_channel_id_txnum(s) >= TXS_PER_BLOCK || height == 960) {
+			assert(!reply[i]->outscript);
+			continue;
+		}
+		assert(reply[i]->outscript);
+		assert(amount_sat_eq(reply[i]->sat,
+				     fake_amount(height,
+						 short_channel_id_txnum(s),
+						 short_channel_id_outnum(s))));
+	}
+	reply = tal_free(reply);
+
+	/* Both blocks were remembered, so this needs no fetches. */
+	scids = scids_arr();
+	tal_arr_expand(&scids, scid(100, 1, 0));
+	tal_arr_expand(&scids, scid(200, 2, 0));
+	num_gettxout = 0;
+	assert(ask(gossip, scids) == 0);
+	assert(num_gettxout == 2);
+	assert(reply[0]->outscript && reply[1]->outscript);
+	reply = tal_free(reply);
+}
+
+static void test_depth(struct subd *gossip)
+{
+	struct short_channel_id *scids;
+
+	forget_blocks(gossip->ld);
+
+	/* 900 is 100 deep, 901 could still be reorganized away. */
+	scids = scids_arr();
+	tal_arr_expand(&scids, scid(900, 0, 0));
+	tal_arr_expand(&scids, scid(901, 0, 0));
+	assert(ask(gossip, scids) == 2);
+	reply = tal_free(reply);
+	assert(is_cached(gossip->ld, 900));
+	assert(!is_cached(gossip->ld, 901));
+
+	assert(ask(gossip, scids) == 1);
+	reply = tal_free(reply);
+	assert(num_cached(gossip->ld) == 1);
+}
+
+static void test_eviction(struct subd *gossip)
+{
+	struct short_channel_id *scids;
+
+	forget_blocks(gossip->ld);
+
+	/* Fill it up: most recently used ends up first. */
+	scids = scids_arr();
+	for (u32 h = 1; h <= GOSSIP_BLOCK_TXIDS_CACHE; h++)
+		tal_arr_expand(&scids, scid(h, 0, 0));
+	assert(ask(gossip, scids) == GOSSIP_BLOCK_TXIDS_CACHE);
+	reply = tal_free(reply);
+	assert(num_cached(gossip->ld) == GOSSIP_BLOCK_TXIDS_CACHE);
+
+	/* Using block 1 again makes block 2 the least recently used... */
+	scids = scids_arr();
+	tal_arr_expand(&scids, scid(1, 0, 0));
+	assert(ask(gossip, scids) == 0);
+	reply = tal_free(reply);
+
+	/* ... so that's what makes room for a new one. */
+	scids = scids_arr();
+	tal_arr_expand(&scids, scid(GOSSIP_BLOCK_TXIDS_CACHE + 1, 0, 0));
+	assert(ask(gossip, scids) == 1);
+	reply = tal_free(reply);
+	assert(num_cached(gossip->ld) == GOSSIP_BLOCK_TXIDS_CACHE);
+	assert(is_cached(gossip->ld, 1));
+	assert(!is_cached(gossip->ld, 2));
+	assert(is_cached(gossip->ld, 3));
+}
+
+static void test_overlap(struct subd *gossip)
+{
+	struct short_channel_id *scids;
+	size_t replies = num_replies;
+
+	forget_blocks(gossip->ld);
+
+	/* Two batches both fetch the same block before either gets it. */
+	scids = scids_arr();
+	tal_arr_expand(&scids, scid(500, 0, 0));
+	get_txouts(gossip, (const u8 *)scids);
+	get_txouts(gossip, (const u8 *)scids);
+	assert(tal_count(pending_blocks) == 2);
+	assert(num_replies == replies);
+
+	answer_blocks();
+	assert(num_replies == replies + 2);
+	assert(reply[0]->outscript);
+	reply = tal_free(reply);
+	assert(num_cached(gossip->ld) == 1);
+}
+
+int main(void)
+{
+	struct lightningd *ld;
+	struct subd *gossip;
+
+	setup_locale();
+	setup_tmpctx();
+
+	ld = tal(tmpctx, struct lightningd);
+	ld->topology = tal(ld, struct chain_topology);
+	ld->topology->bitcoind = tal(ld, struct bitcoind);
+	ld->topology->bitcoind->ld = ld;
+	ld->topology->min_blockheight = 950;
+	ld->topology->max_blockheight = 1000;
+	ld->wallet = NULL;
+	list_head_init(&ld->gossip_block_txids);
+	gossip = tal(ld, struct subd);
+	gossip->ld = ld;
+	pending_blocks = tal_arr(ld, struct pending_block, 0);
+	tip = 1000;
+
+	test_batch(gossip);
+	test_depth(gossip);
+	test_eviction(gossip);
+	test_overlap(gossip);
+
+	tal_free(pending_blocks);
+	tal_free(tmpctx);
+	take_cleanup();
+}
@@ -1710,14 +1710,6 @@ static u8 *handle_master_in(struct state *state)
 		      "Unknown msg %s", tal_hex(tmpctx, msg));
 }
 
-static void try_read_gossip_store(struct state *state)
-{
-	u8 *msg = gossip_store_next(tmpctx, state->pps);
-
-	if (msg)
-		sync_crypto_write(state->pps, take(msg));
-}
-
 int main(int argc, char *argv[])
 {
 	setup_locale();
@@ -1823,7 +1815,7 @@ int main(int argc, char *argv[])
 		else if (pollfd[1].revents & POLLIN)
 			handle_gossip_in(state);
 		else
-			try_read_gossip_store(state);
+			gossip_store_send(state->pps);
 
 		/* Since we're the top-level event loop, we clean up */
 		clean_tmpctx();
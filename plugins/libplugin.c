@@ -1,15 +1,16 @@
 #include <ccan/err/err.h>
 #include <ccan/intmap/intmap.h>
+#include <ccan/io/io.h>
 #include <ccan/json_out/json_out.h>
 #include <ccan/membuf/membuf.h>
 #include <ccan/read_write_all/read_write_all.h>
+#include <ccan/str/str.h>
 #include <ccan/strmap/strmap.h>
 #include <ccan/tal/str/str.h>
 #include <ccan/timer/timer.h>
 #include <common/daemon.h>
 #include <common/utils.h>
 #include <errno.h>
-#include <poll.h>
 #include <plugins/libplugin.h>
 #include <stdarg.h>
 #include <string.h>
@@ -34,23 +35,47 @@ static size_t in_timer;
 
 bool deprecated_apis;
 
+/* Did lightningd say (in init) we can send it length-prefixed messages? */
+static bool length_framing;
+
 struct plugin_timer {
 	struct timer timer;
 	struct command_result *(*cb)(void);
 };
 
 struct plugin_conn {
-	int fd;
+	/* We read from fd, and write to out_fd (the same, for rpc). */
+	int fd, out_fd;
 	MEMBUF(char) mb;
+	size_t len_read;
+
+	/* Once we're in the io_loop, we queue output here; before that (or
+	 * if we're dying) we write it straight out. */
+	struct io_conn *out_conn;
+	char **outq;
+	/* How much of outq[0] we've written. */
+	size_t out_off, len_written;
+
+	/* Called for each message, of @len bytes at the start of mb. */
+	void (*handle)(struct plugin_conn *conn, size_t len);
 };
 
 /* Connection to make RPC requests. */
 static struct plugin_conn rpc_conn;
 
+/* Connection on which lightningd sends us commands (stdin/stdout). */
+static struct plugin_conn request_conn;
+
+/* The commands we handle. */
+static const struct plugin_command *plugin_commands;
+static size_t plugin_num_commands;
+
 struct command {
 	u64 id;
 	const char *methodname;
 	bool usage_only;
+	/* Our own copy of the request, so it outlives the input buffer. */
+	const char *buffer;
 };
 
 struct out_req {
@@ -108,66 +133,134 @@ static void *membuf_tal_realloc(struct membuf *mb, void *rawelems,
 	return p;
 }
 
-static int read_json(struct plugin_conn *conn)
+static void read_more(struct plugin_conn *conn)
 {
-	char *end;
+	ssize_t r;
+
+	/* Make sure we've room for at least READ_CHUNKSIZE. */
+	membuf_prepare_space(&conn->mb, READ_CHUNKSIZE);
+	r = read(conn->fd, membuf_space(&conn->mb),
+		 membuf_num_space(&conn->mb));
+	/* lightningd goes away, we go away. */
+	if (r == 0)
+		exit(0);
+	if (r < 0)
+		plugin_err("Reading JSON input: %s", strerror(errno));
+	membuf_added(&conn->mb, r);
+}
 
-	/* We rely on the double-\n marker which only terminates JSON top
-	 * levels.  Thanks lightningd! */
-	while ((end = memmem(membuf_elems(&conn->mb),
-			     membuf_num_elems(&conn->mb), "\n\n", 2))
-	       == NULL) {
-		ssize_t r;
-
-		/* Make sure we've room for at least READ_CHUNKSIZE. */
-		membuf_prepare_space(&conn->mb, READ_CHUNKSIZE);
-		r = read(conn->fd, membuf_space(&conn->mb),
-			 membuf_num_space(&conn->mb));
-		/* lightningd goes away, we go away. */
-		if (r == 0)
-			exit(0);
-		if (r < 0)
-			plugin_err("Reading JSON input: %s", strerror(errno));
-		membuf_added(&conn->mb, r);
+/* If there's a whole message at the start of the buffer, return its length
+ * (removing any frame header first), otherwise 0. */
+static size_t next_json(struct plugin_conn *conn)
+{
+	const char *p;
+	char *end;
+	size_t skip = 0;
+	u32 len;
+
+	/* Whitespace between messages is just noise. */
+	p = membuf_elems(&conn->mb);
+	while (skip < membuf_num_elems(&conn->mb) && cisspace(p[skip]))
+		skip++;
+	membuf_consume(&conn->mb, skip);
+	if (membuf_num_elems(&conn->mb) == 0)
+		return 0;
+
+	/* Once we've told lightningd we can take them, it tells us how long
+	 * each message is. */
+	if (membuf_elems(&conn->mb)[0] == '\0') {
+		/* Don't look at the length until it's all there. */
+		if (membuf_num_elems(&conn->mb) < JSON_FRAME_HDR_LEN)
+			return 0;
+		json_frame_len(membuf_elems(&conn->mb), &len);
+		if (len == 0)
+			plugin_err("Zero-length message");
+		if (membuf_num_elems(&conn->mb) - JSON_FRAME_HDR_LEN < len)
+			return 0;
+		membuf_consume(&conn->mb, JSON_FRAME_HDR_LEN);
+		return len;
 	}
 
+	/* Otherwise we rely on the double-\n marker which only terminates
+	 * JSON top levels.  Thanks lightningd! */
+	end = memmem(membuf_elems(&conn->mb), membuf_num_elems(&conn->mb),
+		     "\n\n", 2);
+	if (!end)
+		return 0;
 	return end + 2 - membuf_elems(&conn->mb);
 }
 
+/* Synchronous read, for before we're in the io_loop. */
+static int read_json(struct plugin_conn *conn)
+{
+	size_t len;
+
+	while ((len = next_json(conn)) == 0)
+		read_more(conn);
+	return len;
+}
+
 static struct command *read_json_request(const tal_t *ctx,
-					 struct plugin_conn *conn,
-					 struct plugin_conn *rpc,
-					 const jsmntok_t **params,
-					 int *reqlen)
+					 const char *buf, int len,
+					 const jsmntok_t **params)
 {
 	const jsmntok_t *toks, *id, *method;
 	bool valid;
 	struct command *cmd = tal(ctx, struct command);
 
-	*reqlen = read_json(conn);
-	toks = json_parse_input(cmd, membuf_elems(&conn->mb), *reqlen, &valid);
-	if (!valid)
-		plugin_err("Malformed JSON input '%.*s'",
-			   *reqlen, membuf_elems(&conn->mb));
+	/* The handler may still be using it after we've read more. */
+	cmd->buffer = tal_dup_arr(cmd, char, buf, len, 0);
+	buf = cmd->buffer;
+	toks = json_parse_input(cmd, buf, len, &valid);
+	if (!toks)
+		plugin_err("Malformed JSON input '%.*s'", len, buf);
 
 	if (toks[0].type != JSMN_OBJECT)
 		plugin_err("Malformed JSON command '%*.s' is not an object",
-			   *reqlen, membuf_elems(&conn->mb));
+			   len, buf);
 
-	method = json_get_member(membuf_elems(&conn->mb), toks, "method");
-	*params = json_get_member(membuf_elems(&conn->mb), toks, "params");
+	method = json_get_member(buf, toks, "method");
+	*params = json_get_member(buf, toks, "params");
 	/* FIXME: Notifications don't have id! */
-	id = json_get_member(membuf_elems(&conn->mb), toks, "id");
-	if (!json_to_u64(membuf_elems(&conn->mb), id, &cmd->id))
+	id = json_get_member(buf, toks, "id");
+	if (!json_to_u64(buf, id, &cmd->id))
 		plugin_err("JSON id '%*.s' is not a number",
 			   id->end - id->start,
-			   membuf_elems(&conn->mb) + id->start);
+			   buf + id->start);
 	cmd->usage_only = false;
-	cmd->methodname = json_strdup(cmd, membuf_elems(&conn->mb), method);
+	cmd->methodname = json_strdup(cmd, buf, method);
 
 	return cmd;
 }
 
+/* Write it now, or queue it for the io_loop. */
+static void conn_send(struct plugin_conn *conn, const char *p, size_t len)
+{
+	if (!conn->out_conn) {
+		write_all(conn->out_fd, p, len);
+		return;
+	}
+
+	tal_arr_expand(&conn->outq, tal_dup_arr(conn->outq, char, p, len, 0));
+	io_wake(&conn->outq);
+}
+
+/* We're dying: write out everything we queued, and anything else
+ * directly. */
+static void conn_flush(struct plugin_conn *conn)
+{
+	if (!conn->out_conn)
+		return;
+
+	conn->out_conn = NULL;
+	io_fd_block(conn->out_fd, true);
+	for (size_t i = 0; i < tal_count(conn->outq); i++) {
+		size_t off = i == 0 ? conn->out_off : 0;
+		write_all(conn->out_fd, conn->outq[i] + off,
+			  tal_count(conn->outq[i]) - off);
+	}
+}
+
 /* This starts a JSON RPC message with boilerplate */
 static struct json_out *start_json_rpc(const tal_t *ctx, u64 id)
 {
@@ -181,7 +274,8 @@ static struct json_out *start_json_rpc(const tal_t *ctx, u64 id)
 }
 
 /* This closes a JSON response and writes it out. */
-static void finish_and_send_json(int fd, struct json_out *jout)
+static void finish_and_send_json(struct plugin_conn *conn,
+				 struct json_out *jout)
 {
 	size_t len;
 	const char *p;
@@ -192,7 +286,13 @@ static void finish_and_send_json(int fd, struct json_out *jout)
 	json_out_finished(jout);
 
 	p = json_out_contents(jout, &len);
-	write_all(fd, p, len);
+	if (conn == &request_conn && length_framing) {
+		char hdr[JSON_FRAME_HDR_LEN];
+
+		json_frame_hdr(hdr, len);
+		conn_send(conn, hdr, sizeof(hdr));
+	}
+	conn_send(conn, p, len);
 	json_out_consume(jout, len);
 }
 
@@ -214,7 +314,7 @@ command_done_raw(struct command *cmd,
 
 	memcpy(json_out_member_direct(jout, label, size), str, size);
 
-	finish_and_send_json(STDOUT_FILENO, jout);
+	finish_and_send_json(&request_conn, jout);
 	return end_cmd(cmd);
 }
 
@@ -224,7 +324,7 @@ command_success(struct command *cmd, const struct json_out *result)
 	struct json_out *jout = start_json_rpc(cmd, cmd->id);
 
 	json_out_add_splice(jout, "result", result);
-	finish_and_send_json(STDOUT_FILENO, jout);
+	finish_and_send_json(&request_conn, jout);
 	return end_cmd(cmd);
 }
 
@@ -240,7 +340,7 @@ command_success_str(struct command *cmd, const char *str)
 		json_out_start(jout, "result", '{');
 		json_out_end(jout, '}');
 	}
-	finish_and_send_json(STDOUT_FILENO, jout);
+	finish_and_send_json(&request_conn, jout);
 	return end_cmd(cmd);
 }
 
@@ -259,7 +359,7 @@ struct command_result *command_done_err(struct command *cmd,
 		json_out_add_splice(jout, "data", data);
 	json_out_end(jout, '}');
 
-	finish_and_send_json(STDOUT_FILENO, jout);
+	finish_and_send_json(&request_conn, jout);
 	return end_cmd(cmd);
 }
 
@@ -322,33 +422,28 @@ void command_set_usage(struct command *cmd, const char *usage TAKES)
 		plugin_err("Two usages for command %s?", cmd->methodname);
 }
 
-/* Reads rpc reply and returns tokens, setting contents to 'error' or
+/* Parses rpc reply and returns tokens, setting contents to 'error' or
  * 'result' (depending on *error). */
-static const jsmntok_t *read_rpc_reply(const tal_t *ctx,
-				       struct plugin_conn *rpc,
-				       const jsmntok_t **contents,
-				       bool *error,
-				       int *reqlen)
+static const jsmntok_t *parse_rpc_reply(const tal_t *ctx,
+					const char *buf, int reqlen,
+					const jsmntok_t **contents,
+					bool *error)
 {
 	const jsmntok_t *toks;
 	bool valid;
 
-	*reqlen = read_json(rpc);
-
-	toks = json_parse_input(ctx, membuf_elems(&rpc->mb), *reqlen, &valid);
-	if (!valid)
-		plugin_err("Malformed JSON reply '%.*s'",
-			   *reqlen, membuf_elems(&rpc->mb));
+	toks = json_parse_input(ctx, buf, reqlen, &valid);
+	if (!toks)
+		plugin_err("Malformed JSON reply '%.*s'", reqlen, buf);
 
-	*contents = json_get_member(membuf_elems(&rpc->mb), toks, "error");
+	*contents = json_get_member(buf, toks, "error");
 	if (*contents)
 		*error = true;
 	else {
-		*contents = json_get_member(membuf_elems(&rpc->mb), toks,
-					    "result");
+		*contents = json_get_member(buf, toks, "result");
 		if (!*contents)
 			plugin_err("JSON reply with no 'result' nor 'error'? '%.*s'",
-				   *reqlen, membuf_elems(&rpc->mb));
+				   reqlen, buf);
 		*error = false;
 	}
 	return toks;
@@ -382,10 +477,17 @@ const char *rpc_delve(const tal_t *ctx,
 	const char *ret;
 	struct json_out *jout;
 
+	/* Once we're in the io_loop, replies are read (and dispatched by id)
+	 * there, so we can't wait for this one. */
+	if (rpc->out_conn)
+		plugin_err("rpc_delve(%s) can only be used in init", method);
+
 	jout = start_json_request(tmpctx, 0, method, params);
-	finish_and_send_json(rpc->fd, jout);
+	finish_and_send_json(rpc, jout);
 
-	read_rpc_reply(tmpctx, rpc, &contents, &error, &reqlen);
+	reqlen = read_json(rpc);
+	parse_rpc_reply(tmpctx, membuf_elems(&rpc->mb), reqlen,
+			&contents, &error);
 	if (error)
 		plugin_err("Got error reply to %s: '%.*s'",
 		     method, reqlen, membuf_elems(&rpc->mb));
@@ -400,42 +502,38 @@ const char *rpc_delve(const tal_t *ctx,
 	return ret;
 }
 
-static void handle_rpc_reply(struct plugin_conn *rpc)
+static void handle_rpc_reply(struct plugin_conn *rpc, size_t reqlen)
 {
-	int reqlen;
+	const char *buf = membuf_elems(&rpc->mb);
 	const jsmntok_t *toks, *contents, *t;
 	struct out_req *out;
 	struct command_result *res;
 	u64 id;
 	bool error;
 
-	toks = read_rpc_reply(tmpctx, rpc, &contents, &error, &reqlen);
+	toks = parse_rpc_reply(tmpctx, buf, reqlen, &contents, &error);
 
-	t = json_get_member(membuf_elems(&rpc->mb), toks, "id");
+	t = json_get_member(buf, toks, "id");
 	if (!t)
-		plugin_err("JSON reply without id '%.*s'",
-			   reqlen, membuf_elems(&rpc->mb));
-	if (!json_to_u64(membuf_elems(&rpc->mb), t, &id))
+		plugin_err("JSON reply without id '%.*s'", (int)reqlen, buf);
+	if (!json_to_u64(buf, t, &id))
 		plugin_err("JSON reply without numeric id '%.*s'",
-			   reqlen, membuf_elems(&rpc->mb));
+			   (int)reqlen, buf);
 	out = uintmap_get(&out_reqs, id);
 	if (!out)
 		plugin_err("JSON reply with unknown id '%.*s' (%"PRIu64")",
-			   reqlen, membuf_elems(&rpc->mb), id);
+			   (int)reqlen, buf, id);
 
 	/* We want to free this if callback doesn't. */
 	tal_steal(tmpctx, out);
 	uintmap_del(&out_reqs, out->id);
 
 	if (error)
-		res = out->errcb(out->cmd, membuf_elems(&rpc->mb), contents,
-				 out->arg);
+		res = out->errcb(out->cmd, buf, contents, out->arg);
 	else
-		res = out->cb(out->cmd, membuf_elems(&rpc->mb), contents,
-			      out->arg);
+		res = out->cb(out->cmd, buf, contents, out->arg);
 
 	assert(res == &pending || res == &complete);
-	membuf_consume(&rpc->mb, reqlen);
 }
 
 struct command_result *
@@ -464,7 +562,7 @@ send_outreq_(struct command *cmd,
 	uintmap_add(&out_reqs, out->id, out);
 
 	jout = start_json_request(tmpctx, out->id, method, params);
-	finish_and_send_json(rpc_conn.fd, jout);
+	finish_and_send_json(&rpc_conn, jout);
 
 	return &pending;
 }
@@ -501,6 +599,9 @@ handle_getmanifest(struct command *getmanifest_cmd,
 		json_out_end(params, '}');
 	}
 	json_out_end(params, ']');
+	/* We can read length-prefixed messages (and we can send them, if
+	 * init says lightningd can read them). */
+	json_out_addstr(params, "framing", "length");
 	json_out_end(params, '}');
 	json_out_finished(params);
 
@@ -513,12 +614,16 @@ static struct command_result *handle_init(struct command *init_cmd,
 					  const struct plugin_option *opts,
 					  void (*init)(struct plugin_conn *))
 {
-	const jsmntok_t *rpctok, *dirtok, *opttok, *t;
+	const jsmntok_t *rpctok, *dirtok, *opttok, *framingtok, *t;
 	struct sockaddr_un addr;
 	size_t i;
 	char *dir;
 	struct json_out *param_obj;
 
+	framingtok = json_delve(buf, params, ".configuration.framing");
+	if (framingtok && json_tok_streq(buf, framingtok, "length"))
+		length_framing = true;
+
 	/* Move into lightning directory: other files are relative */
 	dirtok = json_delve(buf, params, ".configuration.lightning-dir");
 	dir = json_strdup(tmpctx, buf, dirtok);
@@ -539,6 +644,7 @@ static struct command_result *handle_init(struct command *init_cmd,
 		plugin_err("Connecting to '%.*s': %s",
 			   rpctok->end - rpctok->start, buf + rpctok->start,
 			   strerror(errno));
+	rpc_conn.out_fd = rpc_conn.fd;
 
 	param_obj = json_out_obj(NULL, "config", "allow-deprecated-apis");
 	deprecated_apis = streq(rpc_delve(tmpctx, "listconfigs",
@@ -589,22 +695,19 @@ char *charp_option(const char *arg, char **p)
 	return NULL;
 }
 
-static void handle_new_command(const tal_t *ctx,
-			       struct plugin_conn *request_conn,
-			       struct plugin_conn *rpc_conn,
-			       const struct plugin_command *commands,
-			       size_t num_commands)
+static void handle_new_command(struct plugin_conn *request_conn,
+			       size_t reqlen)
 {
 	struct command *cmd;
 	const jsmntok_t *params;
-	int reqlen;
 
-	cmd = read_json_request(ctx, request_conn, rpc_conn, &params, &reqlen);
-	for (size_t i = 0; i < num_commands; i++) {
-		if (streq(cmd->methodname, commands[i].name)) {
-			commands[i].handle(cmd, membuf_elems(&request_conn->mb),
-					   params);
-			membuf_consume(&request_conn->mb, reqlen);
+	/* Each command lives until it's completed: others can arrive (and
+	 * complete) while it's waiting for its rpc replies. */
+	cmd = read_json_request(NULL, membuf_elems(&request_conn->mb), reqlen,
+				&params);
+	for (size_t i = 0; i < plugin_num_commands; i++) {
+		if (streq(cmd->methodname, plugin_commands[i].name)) {
+			plugin_commands[i].handle(cmd, cmd->buffer, params);
 			return;
 		}
 	}
@@ -673,13 +776,17 @@ static void plugin_logv(enum log_level l, const char *fmt, va_list ap)
 	json_out_end(jout, '}');
 
 	/* Last '}' is done by finish_and_send_json */
-	finish_and_send_json(STDOUT_FILENO, jout);
+	finish_and_send_json(&request_conn, jout);
 }
 
 void NORETURN plugin_err(const char *fmt, ...)
 {
 	va_list ap;
 
+	/* Get anything we've queued out first, so this is the last thing
+	 * lightningd hears from us. */
+	conn_flush(&request_conn);
+
 	va_start(ap, fmt);
 	plugin_logv(LOG_BROKEN, fmt, ap);
 	va_end(ap);
@@ -697,17 +804,120 @@ void plugin_log(enum log_level l, const char *fmt, ...)
 	va_end(ap);
 }
 
+static struct io_plan *conn_read(struct io_conn *conn,
+				 struct plugin_conn *pc);
+
+static struct io_plan *conn_read_done(struct io_conn *conn,
+				      struct plugin_conn *pc)
+{
+	size_t len;
+
+	membuf_added(&pc->mb, pc->len_read);
+	while ((len = next_json(pc)) != 0) {
+		pc->handle(pc, len);
+		membuf_consume(&pc->mb, len);
+		/* Whatever that message left on tmpctx (its tokens, the
+		 * out_req it completed, replies we queued) is done with. */
+		clean_tmpctx();
+	}
+	return conn_read(conn, pc);
+}
+
+static struct io_plan *conn_read(struct io_conn *conn,
+				 struct plugin_conn *pc)
+{
+	/* Make sure we've room for at least READ_CHUNKSIZE. */
+	membuf_prepare_space(&pc->mb, READ_CHUNKSIZE);
+	return io_read_partial(conn, membuf_space(&pc->mb),
+			       membuf_num_space(&pc->mb), &pc->len_read,
+			       conn_read_done, pc);
+}
+
+static struct io_plan *conn_write(struct io_conn *conn,
+				  struct plugin_conn *pc);
+
+static struct io_plan *conn_write_done(struct io_conn *conn,
+				       struct plugin_conn *pc)
+{
+	size_t n = tal_count(pc->outq);
+
+	pc->out_off += pc->len_written;
+	if (pc->out_off == tal_count(pc->outq[0])) {
+		tal_free(pc->outq[0]);
+		memmove(pc->outq, pc->outq + 1, (n - 1) * sizeof(pc->outq[0]));
+		tal_resize(&pc->outq, n - 1);
+		pc->out_off = 0;
+	}
+	return conn_write(conn, pc);
+}
+
+static struct io_plan *conn_write(struct io_conn *conn,
+				  struct plugin_conn *pc)
+{
+	if (tal_count(pc->outq) == 0)
+		return io_out_wait(conn, &pc->outq, conn_write, pc);
+
+	return io_write_partial(conn, pc->outq[0] + pc->out_off,
+				tal_count(pc->outq[0]) - pc->out_off,
+				&pc->len_written, conn_write_done, pc);
+}
+
+/* lightningd goes away, we go away. */
+static void conn_finished(struct io_conn *conn, struct plugin_conn *pc)
+{
+	exit(0);
+}
+
+/* We may have read more than init while we were synchronous. */
+static struct io_plan *conn_read_init(struct io_conn *conn,
+				      struct plugin_conn *pc)
+{
+	io_set_finish(conn, conn_finished, pc);
+	pc->len_read = 0;
+	return conn_read_done(conn, pc);
+}
+
+static struct io_plan *conn_write_init(struct io_conn *conn,
+				       struct plugin_conn *pc)
+{
+	io_set_finish(conn, conn_finished, pc);
+	pc->out_conn = conn;
+	return conn_write(conn, pc);
+}
+
+static struct io_plan *rpc_conn_init(struct io_conn *conn,
+				     struct plugin_conn *pc)
+{
+	pc->out_conn = conn;
+	return io_duplex(conn,
+			 conn_read_init(conn, pc),
+			 conn_write(conn, pc));
+}
+
+static void plugin_conn_init(const tal_t *ctx, struct plugin_conn *pc,
+			     int fd, int out_fd,
+			     void (*handle)(struct plugin_conn *, size_t))
+{
+	pc->fd = fd;
+	pc->out_fd = out_fd;
+	membuf_init(&pc->mb,
+		    tal_arr(ctx, char, READ_CHUNKSIZE), READ_CHUNKSIZE,
+		    membuf_tal_realloc);
+	pc->out_conn = NULL;
+	pc->outq = tal_arr(ctx, char *, 0);
+	pc->out_off = 0;
+	pc->handle = handle;
+}
+
 void plugin_main(char *argv[],
 		 void (*init)(struct plugin_conn *rpc),
 		 const struct plugin_command *commands,
 		 size_t num_commands, ...)
 {
-	struct plugin_conn request_conn;
 	const tal_t *ctx = tal(NULL, char);
 	struct command *cmd;
 	const jsmntok_t *params;
 	int reqlen;
-	struct pollfd fds[2];
 	struct plugin_option *opts = tal_arr(ctx, struct plugin_option, 0);
 	va_list ap;
 	const char *optname;
@@ -720,15 +930,14 @@ void plugin_main(char *argv[],
 	daemon_setup(argv[0], NULL, NULL);
 
 	setup_command_usage(commands, num_commands);
+	plugin_commands = commands;
+	plugin_num_commands = num_commands;
 
 	timers_init(&timers, time_mono());
-	membuf_init(&rpc_conn.mb,
-		    tal_arr(ctx, char, READ_CHUNKSIZE), READ_CHUNKSIZE,
-		    membuf_tal_realloc);
-	request_conn.fd = STDIN_FILENO;
-	membuf_init(&request_conn.mb,
-		    tal_arr(ctx, char, READ_CHUNKSIZE), READ_CHUNKSIZE,
-		    membuf_tal_realloc);
+	/* handle_init connects the rpc fd. */
+	plugin_conn_init(ctx, &rpc_conn, -1, -1, handle_rpc_reply);
+	plugin_conn_init(ctx, &request_conn, STDIN_FILENO, STDOUT_FILENO,
+			 handle_new_command);
 	uintmap_init(&out_reqs);
 
 	va_start(ap, num_commands);
@@ -743,68 +952,37 @@ void plugin_main(char *argv[],
 	}
 	va_end(ap);
 
-	cmd = read_json_request(tmpctx, &request_conn, NULL,
-				&params, &reqlen);
+	/* getmanifest and init come first, and we answer them in order. */
+	reqlen = read_json(&request_conn);
+	cmd = read_json_request(tmpctx, membuf_elems(&request_conn.mb), reqlen,
+				&params);
+	membuf_consume(&request_conn.mb, reqlen);
 	if (!streq(cmd->methodname, "getmanifest"))
 		plugin_err("Expected getmanifest not %s", cmd->methodname);
 
-	membuf_consume(&request_conn.mb, reqlen);
 	handle_getmanifest(cmd, commands, num_commands, opts);
 
-	cmd = read_json_request(tmpctx, &request_conn, &rpc_conn,
-				&params, &reqlen);
+	reqlen = read_json(&request_conn);
+	cmd = read_json_request(tmpctx, membuf_elems(&request_conn.mb), reqlen,
+				&params);
+	membuf_consume(&request_conn.mb, reqlen);
 	if (!streq(cmd->methodname, "init"))
 		plugin_err("Expected init not %s", cmd->methodname);
 
-	handle_init(cmd, membuf_elems(&request_conn.mb),
-		    params, opts, init);
-	membuf_consume(&request_conn.mb, reqlen);
+	handle_init(cmd, cmd->buffer, params, opts, init);
 
-	/* Set up fds for poll. */
-	fds[0].fd = STDIN_FILENO;
-	fds[0].events = POLLIN;
-	fds[1].fd = rpc_conn.fd;
-	fds[1].events = POLLIN;
+	/* From now on we don't block: replies are queued, and we handle
+	 * commands and rpc replies as they arrive. */
+	io_new_conn(ctx, STDOUT_FILENO, conn_write_init, &request_conn);
+	io_new_conn(ctx, rpc_conn.fd, rpc_conn_init, &rpc_conn);
+	io_new_conn(ctx, STDIN_FILENO, conn_read_init, &request_conn);
 
 	for (;;) {
-		struct timer *expired;
-		struct timemono now, first;
-		int t;
+		struct timer *expired = NULL;
 
 		clean_tmpctx();
-
-		/* If we already have some input, process now. */
-		if (membuf_num_elems(&request_conn.mb) != 0) {
-			handle_new_command(ctx, &request_conn, &rpc_conn,
-					   commands, num_commands);
-			continue;
-		}
-		if (membuf_num_elems(&rpc_conn.mb) != 0) {
-			handle_rpc_reply(&rpc_conn);
-			continue;
-		}
-
-		/* Handle any timeouts */
-		now = time_mono();
-		expired = timers_expire(&timers, now);
-		if (expired) {
+		io_loop(&timers, &expired);
+		if (expired)
 			call_plugin_timer(&rpc_conn, expired);
-			continue;
-		}
-
-		/* If we have a pending timer, timeout then */
-		if (timer_earliest(&timers, &first))
-			t = time_to_msec(timemono_between(first, now));
-		else
-			t = -1;
-
-		/* Otherwise, we poll. */
-		poll(fds, 2, t);
-
-		if (fds[0].revents & POLLIN)
-			handle_new_command(ctx, &request_conn, &rpc_conn,
-					   commands, num_commands);
-		if (fds[1].revents & POLLIN)
-			handle_rpc_reply(&rpc_conn);
 	}
 }
@@ -17,6 +17,9 @@ static struct node_id my_id;
 static unsigned int maxdelay_default;
 static LIST_HEAD(pay_status);
 
+/* How many routes to ask for at once. */
+#define PAY_ROUTES 4
+
 struct pay_attempt {
 	/* What we changed when starting this attempt. */
 	const char *why;
@@ -103,6 +106,9 @@ struct pay_command {
 	/* Any remaining routehints to try. */
 	struct route_info **routehints;
 
+	/* Other routes getroutes gave us, to try before asking again. */
+	const char **alternatives;
+
 	/* Current node during shadow route calculation. */
 	const char *shadow_dest;
 };
@@ -267,6 +273,9 @@ static struct command_result *next_routehint(struct command *cmd,
 		if (!routehint_excluded(pc->routehints[0], pc->excludes)) {
 			pc->current_routehint = pc->routehints[0];
 			tal_arr_remove(&pc->routehints, 0);
+			/* Those went to the old destination. */
+			tal_free(pc->alternatives);
+			pc->alternatives = tal_arr(pc, const char *, 0);
 			return start_pay_attempt(cmd, pc, "Trying route hint");
 		}
 		tal_free(pc->routehints[0]);
@@ -494,22 +503,41 @@ static bool maybe_exclude(struct pay_command *pc,
 	return true;
 }
 
-static struct command_result *getroute_done(struct command *cmd,
-					    const char *buf,
-					    const jsmntok_t *result,
-					    struct pay_command *pc)
+/* Does this route use a channel we've excluded since getting it? */
+static bool route_excluded(const char *buf, const jsmntok_t *route,
+			   const char **excludes)
+{
+	const jsmntok_t *t;
+	size_t i;
+
+	json_for_each_arr(i, t, route) {
+		const jsmntok_t *scid, *dir;
+		const char *scidd;
+
+		scid = json_get_member(buf, t, "channel");
+		dir = json_get_member(buf, t, "direction");
+		scidd = tal_fmt(tmpctx, "%.*s/%c",
+				scid->end - scid->start, buf + scid->start,
+				buf[dir->start]);
+		for (size_t j = 0; j < tal_count(excludes); j++)
+			if (streq(excludes[j], scidd))
+				return true;
+	}
+	return false;
+}
+
+/* We have a route (t) for this attempt: check it and send. */
+static struct command_result *route_found(struct command *cmd,
+					  struct pay_command *pc,
+					  const char *buf,
+					  const jsmntok_t *t)
 {
 	struct pay_attempt *attempt = current_attempt(pc);
-	const jsmntok_t *t = json_get_member(buf, result, "route");
 	struct amount_msat fee;
 	u32 delay;
 	double feepercent;
 	struct json_out *params;
 
-	if (!t)
-		plugin_err("getroute gave no 'route'? '%.*s'",
-			   result->end - result->start, buf);
-
 	if (pc->current_routehint) {
 		attempt->route = join_routehint(pc->ps->attempts, buf, t,
 						pc, pc->current_routehint);
@@ -525,7 +553,7 @@ static struct command_result *getroute_done(struct command *cmd,
 
 	if (!json_to_msat(buf, json_delve(buf, t, "[0].msatoshi"), &fee))
 		plugin_err("getroute with invalid msatoshi? %.*s",
-			   result->end - result->start, buf);
+			   t->end - t->start, buf + t->start);
 	if (!amount_msat_sub(&fee, fee, pc->msat))
 		plugin_err("final amount %s less than paid %s",
 			   type_to_string(tmpctx, struct amount_msat, &fee),
@@ -533,7 +561,7 @@ static struct command_result *getroute_done(struct command *cmd,
 
 	if (!json_to_number(buf, json_delve(buf, t, "[0].delay"), &delay))
 		plugin_err("getroute with invalid delay? %.*s",
-			   result->end - result->start, buf);
+			   t->end - t->start, buf + t->start);
 
 	/* Casting u64 to double will lose some precision. The loss of precision
 	 * in feepercent will be like 3.0000..(some dots)..1 % - 3.0 %.
@@ -618,7 +646,37 @@ static struct command_result *getroute_done(struct command *cmd,
 
 }
 
-static struct command_result *getroute_error(struct command *cmd,
+static struct command_result *getroutes_done(struct command *cmd,
+					     const char *buf,
+					     const jsmntok_t *result,
+					     struct pay_command *pc)
+{
+	const jsmntok_t *routes = json_get_member(buf, result, "routes");
+	const jsmntok_t *t, *route = NULL;
+	size_t i;
+
+	if (!routes || routes->type != JSMN_ARRAY || routes->size == 0)
+		plugin_err("getroutes gave no 'routes'? '%.*s'",
+			   result->end - result->start, buf + result->start);
+
+	/* Use the first, keep the rest for if it fails. */
+	json_for_each_arr(i, t, routes) {
+		const jsmntok_t *r = json_get_member(buf, t, "route");
+
+		if (!r)
+			plugin_err("getroutes gave no 'route'? '%.*s'",
+				   t->end - t->start, buf + t->start);
+		if (i == 0)
+			route = r;
+		else
+			tal_arr_expand(&pc->alternatives,
+				       json_strdup(pc->alternatives, buf, r));
+	}
+
+	return route_found(cmd, pc, buf, route);
+}
+
+static struct command_result *getroutes_error(struct command *cmd,
 					     const char *buf,
 					     const jsmntok_t *error,
 					     struct pay_command *pc)
@@ -626,14 +684,14 @@ static struct command_result *getroute_error(struct command *cmd,
 	int code;
 	const jsmntok_t *codetok;
 
-	attempt_failed_tok(pc, "getroute", buf, error);
+	attempt_failed_tok(pc, "getroutes", buf, error);
 
 	codetok = json_get_member(buf, error, "code");
 	if (!json_to_int(buf, codetok, &code))
-		plugin_err("getroute error gave no 'code'? '%.*s'",
+		plugin_err("getroutes error gave no 'code'? '%.*s'",
 			   error->end - error->start, buf + error->start);
 
-	/* Strange errors from getroute should be forwarded. */
+	/* Strange errors from getroutes should be forwarded. */
 	if (code != PAY_ROUTE_NOT_FOUND)
 		return forward_error(cmd, buf, error, pc);
 
@@ -709,7 +767,21 @@ static struct command_result *start_pay_attempt(struct command *cmd,
 		attempt->routehint = NULL;
 	}
 
-	/* OK, ask for route to destination */
+	/* Try what's left from last time before asking again. */
+	while (tal_count(pc->alternatives) > 0) {
+		const char *route = tal_steal(tmpctx, pc->alternatives[0]);
+		const jsmntok_t *toks;
+		bool valid;
+
+		tal_arr_remove(&pc->alternatives, 0);
+		toks = json_parse_input(tmpctx, route, strlen(route), &valid);
+		if (!toks || !valid)
+			plugin_err("Bad saved route '%s'", route);
+		if (!route_excluded(route, toks, pc->excludes))
+			return route_found(cmd, pc, route, toks);
+	}
+
+	/* OK, ask for routes to destination */
 	params = json_out_new(NULL);
 	json_out_start(params, NULL, '{');
 	json_out_addstr(params, "id", dest);
@@ -717,6 +789,7 @@ static struct command_result *start_pay_attempt(struct command *cmd,
 			type_to_string(tmpctx, struct amount_msat, &msat));
 	json_out_add_u64(params, "cltv", cltv);
 	json_out_add_u64(params, "maxhops", max_hops);
+	json_out_add_u64(params, "maxroutes", PAY_ROUTES);
 	json_out_add(params, "riskfactor", false, "%f", pc->riskfactor);
 	if (tal_count(pc->excludes) != 0) {
 		json_out_start(params, "exclude", '[');
@@ -726,8 +799,8 @@ static struct command_result *start_pay_attempt(struct command *cmd,
 	}
 	json_out_end(params, '}');
 
-	return send_outreq(cmd, "getroute", getroute_done, getroute_error, pc,
-			   take(params));
+	return send_outreq(cmd, "getroutes", getroutes_done, getroutes_error,
+			   pc, take(params));
 }
 
 /* BOLT #7:
@@ -1046,6 +1119,7 @@ static struct command_result *json_pay(struct command *cmd,
 					  &b11->payment_hash);
 	pc->stoptime = timeabs_add(time_now(), time_from_sec(*retryfor));
 	pc->excludes = tal_arr(cmd, const char *, 0);
+	pc->alternatives = tal_arr(pc, const char *, 0);
 	pc->ps = add_pay_status(pc, b11str);
 	/* We try first without using routehint */
 	pc->current_routehint = NULL;
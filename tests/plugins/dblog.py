@@ -25,6 +25,11 @@ def init(configuration, options, plugin):
 
 @plugin.hook('db_write')
 def db_write(plugin, writes):
+    refuse = plugin.get_option('dblog-refuse')
+    if refuse and any(refuse in w for w in writes):
+        plugin.log("refusing {} commands".format(len(writes)))
+        return False
+
     if not plugin.initted:
         plugin.log("deferring {} commands".format(len(writes)))
         plugin.sqlite_pre_init_cmds += writes
@@ -36,4 +41,5 @@ def db_write(plugin, writes):
 
 
 plugin.add_option('dblog-file', None, 'The db file to create.')
+plugin.add_option('dblog-refuse', None, 'Fail any writes containing this.')
 plugin.run()
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Plugin which talks the stdio protocol by hand, so it can answer with a
+length-prefixed message and a plain one in the same write.
+"""
+import json
+import os
+import struct
+import sys
+
+
+buf = b''
+
+
+def read_more():
+    global buf
+    data = os.read(sys.stdin.fileno(), 4096)
+    if not data:
+        sys.exit(0)
+    buf += data
+
+
+def read_msg():
+    """Reads a plain or a length-prefixed message from lightningd"""
+    global buf
+    while True:
+        stripped = buf.lstrip()
+        if stripped[:1] == b'\0':
+            if len(stripped) >= 5:
+                length = struct.unpack('>I', stripped[1:5])[0]
+                if len(stripped) >= 5 + length:
+                    buf = stripped[5 + length:]
+                    return json.loads(stripped[5:5 + length].decode('utf-8'))
+        elif stripped:
+            try:
+                text = stripped.decode('utf-8')
+                msg, end = json.JSONDecoder().raw_decode(text)
+                buf = text[end:].encode('utf-8')
+                return msg
+            except ValueError:
+                # Not all there yet.
+                pass
+        read_more()
+
+
+def plain(obj):
+    return json.dumps(obj).encode('utf-8') + b'\n\n'
+
+
+def framed(obj):
+    js = json.dumps(obj).encode('utf-8')
+    return b'\0' + struct.pack('>I', len(js)) + js
+
+
+def reply(req, result):
+    return {'jsonrpc': '2.0', 'id': req['id'], 'result': result}
+
+
+def write(data):
+    while data:
+        data = data[os.write(sys.stdout.fileno(), data):]
+
+
+while True:
+    req = read_msg()
+    if req['method'] == 'getmanifest':
+        write(plain(reply(req, {
+            'options': [],
+            'rpcmethods': [{
+                'name': 'mixedframes',
+                'usage': '',
+                'description': 'Answer after a length-prefixed log message',
+            }],
+            'framing': 'length',
+        })))
+    elif req['method'] == 'init':
+        assert req['params']['configuration']['framing'] == 'length'
+        write(plain(reply(req, None)))
+    elif req['method'] == 'mixedframes':
+        log = {'jsonrpc': '2.0', 'method': 'log',
+               'params': {'level': 'info', 'message': 'framed log message'}}
+        # Both in one write: lightningd must not wait for more to answer.
+        write(framed(log) + plain(reply(req, 'plain reply')))
@@ -2,7 +2,7 @@ from collections import namedtuple
 from fixtures import *  # noqa: F401,F403
 from flaky import flaky  # noqa: F401
 from lightning import RpcError
-from utils import DEVELOPER, only_one, wait_for, sync_blockheight, VALGRIND, TIMEOUT
+from utils import DEVELOPER, only_one, wait_for, sync_blockheight, VALGRIND, TIMEOUT, expected_localfeatures
 from bitcoin.core import CMutableTransaction, CMutableTxOut
 
 import binascii
@@ -1313,7 +1313,7 @@ def test_forget_channel(node_factory):
 
 def test_peerinfo(node_factory, bitcoind):
     l1, l2 = node_factory.line_graph(2, fundchannel=False, opts={'may_reconnect': True})
-    lfeatures = 'aa'
+    lfeatures = expected_localfeatures()
     # Gossiping but no node announcement yet
     assert l1.rpc.getpeer(l2.info['id'])['connected']
     assert len(l1.rpc.getpeer(l2.info['id'])['channels']) == 0
@@ -1566,13 +1566,13 @@ def test_dataloss_protection(node_factory, bitcoind):
 
     l1.rpc.connect(l2.info['id'], 'localhost', l2.port)
     # l1 should send out WIRE_INIT (0010)
+    lfeatures = expected_localfeatures()
     l1.daemon.wait_for_log(r"\[OUT\] 0010"
                            # gflen == 0
                            "0000"
-                           # lflen == 1
-                           "0001"
-                           # Local features 1, 3, 5 and 7 (0xaa).
-                           "aa")
+                           # lflen, then our local features
+                           + "{:04x}".format(len(lfeatures) // 2)
+                           + lfeatures)
 
     l1.fund_channel(l2, 10**6)
     l2.stop()
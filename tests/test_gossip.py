@@ -324,6 +324,17 @@ def test_gossip_jsonrpc(node_factory):
     assert [c['active'] for c in l2.rpc.listchannels()['channels']] == [True, True]
     assert [c['public'] for c in l2.rpc.listchannels()['channels']] == [True, True]
 
+    # Paging through gives the same answer, in order.
+    first = l1.rpc.listnodes(limit=1)
+    assert len(first['nodes']) == 1
+    rest = l1.rpc.listnodes(start_id=first['next_id'])
+    assert 'next_id' not in rest
+    assert [n['nodeid'] for n in first['nodes'] + rest['nodes']] == sorted([l1.info['id'], l2.info['id']])
+
+    page = l1.rpc.listchannels(limit=1)
+    assert 'next_scid' not in page
+    assert page['channels'] == l1.rpc.listchannels(start_scid=page['channels'][0]['short_channel_id'])['channels']
+
 
 @unittest.skipIf(not DEVELOPER, "needs DEVELOPER=1 for --dev-broadcast-interval")
 def test_gossip_badsig(node_factory):
@@ -1292,3 +1303,86 @@ def test_gossip_store_compact_on_load(node_factory, bitcoind):
 
     wait_for(lambda: l2.daemon.is_in_log('gossip_store_compact_offline: 9 deleted, 9 copied'))
     wait_for(lambda: l2.daemon.is_in_log(r'gossip_store: Read 1/4/2/0 cannounce/cupdate/nannounce/cdelete from store \(0 deleted\) in 1446 bytes'))
+
+
+def test_gossip_ratelimit(node_factory):
+    """A channel_update flood is held back, and the latest let through later"""
+    l1, l2 = node_factory.line_graph(2, wait_for_announce=True,
+                                     opts=[{},
+                                           {'gossip-ratelimit-burst': 1,
+                                            'gossip-ratelimit-refill': 5}])
+    scid = l1.get_channel_scid(l2)
+
+    def l2_fee():
+        return [c['base_fee_millisatoshi']
+                for c in l2.rpc.listchannels(scid)['channels']
+                if c['source'] == l1.info['id']]
+
+    def l2_received():
+        stats = only_one(l2.rpc.getgossippeerstats()['peers'])
+        return stats['accepted'] + stats['suppressed']
+
+    for fee in range(10, 15):
+        received = l2_received()
+        l1.rpc.setchannelfee(l2.info['id'], fee, 1000)
+        # Let it reach l2 on its own, not merged with the next one.
+        wait_for(lambda: l2_received() == received + 1)
+
+    stats = only_one(l2.rpc.getgossippeerstats()['peers'])
+    assert stats['id'] == l1.info['id']
+    assert stats['suppressed'] > 0
+    assert stats['invalid'] == 0
+
+    # The last one gets through once there's a token for it.
+    wait_for(lambda: l2_fee() == [14])
+    wait_for(lambda: l2.rpc.getgossippeerstats()['held'] == 0)
+
+
+def test_gossip_txouts_batched(node_factory, bitcoind):
+    """A new node looks up every channel funded in a block with one fetch"""
+    nodes = node_factory.line_graph(6, wait_for_announce=True)
+    scids = [nodes[i].get_channel_scid(nodes[i + 1])
+             for i in range(len(nodes) - 1)]
+    # line_graph funds them all in the same block.
+    height = int(scids[0].split('x')[0])
+    assert all(int(s.split('x')[0]) == height for s in scids)
+
+    # Deep enough that lightningd also remembers the block's txids.
+    bitcoind.generate_block(100)
+
+    # It only has the last block or so in its utxoset, so it has to ask.
+    l7 = node_factory.get_node()
+    fetched = []
+
+    def count_getblockhash(req):
+        if req['params'][0] == height:
+            fetched.append(height)
+        return {'result': bitcoind.rpc.getblockhash(req['params'][0]),
+                'error': None, 'id': req['id']}
+
+    l7.daemon.rpcproxy.mock_rpc('getblockhash', count_getblockhash)
+    l7.rpc.connect(nodes[0].info['id'], 'localhost', nodes[0].port)
+    wait_for(lambda: len(l7.rpc.listchannels()['channels']) == 2 * len(scids))
+
+    # Without batching, that would be one fetch per channel.
+    assert 1 <= len(fetched) < len(scids)
+
+
+def test_getroute_cache(node_factory, bitcoind):
+    """Repeated getroutes hit the route cache, despite the default fuzz"""
+    l1, l2, l3 = node_factory.line_graph(3, wait_for_announce=True,
+                                         opts={'gossip-route-cache': 10})
+
+    # Each call fuzzes with a new random seed.
+    first = l1.rpc.getroute(l3.info['id'], 1000, 1)['route']
+    stats = l1.rpc.getroutecachestats()
+    assert stats['misses'] == 1
+    assert stats['hits'] == 0
+
+    # A similar amount is close enough.
+    second = l1.rpc.getroute(l3.info['id'], 1001, 1)['route']
+    stats = l1.rpc.getroutecachestats()
+    assert stats['hits'] == 1
+    assert stats['entries'] == 1
+    assert [h['channel'] for h in second] == [h['channel'] for h in first]
+    assert second[-1]['msatoshi'] == 1001
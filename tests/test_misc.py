@@ -8,6 +8,7 @@ import json
 import os
 import pytest
 import re
+import select
 import shutil
 import signal
 import socket
@@ -568,6 +569,63 @@ def test_malformed_rpc(node_factory):
     sock.close()
 
 
+def test_batch_rpc(node_factory):
+    """Test that we answer JSON-RPC batches, and pipeline requests"""
+    l1 = node_factory.get_node(options={'rpc-max-inflight': 3})
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(l1.rpc.socket_path)
+
+    # Answered in order, with malformed ones in place.
+    sock.sendall(b'[{"id":1, "jsonrpc":"2.0","method":"getinfo","params":[]},'
+                 b'{"id":2, "jsonrpc":"2.0","method":"unknown","params":[]},'
+                 b'{"jsonrpc":"2.0","method":"getinfo","params":[]}]')
+    obj, _ = l1.rpc._readobj(sock, b'')
+    assert len(obj) == 3
+    assert obj[0]['id'] == 1
+    assert obj[0]['result']['id'] == l1.info['id']
+    assert obj[1]['id'] == 2
+    assert obj[1]['error']['code'] == -32601
+    assert obj[2]['error']['code'] == -32600
+
+    # Empty batch is invalid.
+    sock.sendall(b'[]')
+    obj, _ = l1.rpc._readobj(sock, b'')
+    assert obj['error']['code'] == -32600
+
+    # So is one larger than rpc-max-inflight.
+    sock.sendall(b'[' + b','.join([b'{"id":1, "jsonrpc":"2.0","method":"getinfo","params":[]}'] * 4) + b']')
+    obj, _ = l1.rpc._readobj(sock, b'')
+    assert obj['error']['code'] == -32600
+
+    # Several at once get answered.
+    sock.sendall(b''.join([b'{"id":%d, "jsonrpc":"2.0","method":"getinfo","params":[]}' % i for i in range(10)]))
+    buff = b''
+    ids = []
+    for i in range(10):
+        obj, buff = l1.rpc._readobj(sock, buff)
+        ids.append(obj['id'])
+    assert sorted(ids) == list(range(10))
+
+    # Requests still waiting count too: with two waitinvoice outstanding, a
+    # batch of two has to wait until one of them is answered.
+    l1.rpc.invoice(1000, 'wait1', 'wait1')
+    l1.rpc.invoice(1000, 'wait2', 'wait2')
+    sock.sendall(b'{"id":100, "jsonrpc":"2.0","method":"waitinvoice","params":["wait1"]}'
+                 b'{"id":101, "jsonrpc":"2.0","method":"waitinvoice","params":["wait2"]}'
+                 b'[' + b','.join([b'{"id":%d, "jsonrpc":"2.0","method":"getinfo","params":[]}' % i for i in range(2)]) + b']')
+    assert select.select([sock], [], [], 1) == ([], [], [])
+
+    l1.rpc.delinvoice('wait1', 'unpaid')
+    obj, buff = l1.rpc._readobj(sock, buff)
+    assert obj['id'] == 100
+    assert 'error' in obj
+    obj, buff = l1.rpc._readobj(sock, buff)
+    assert [o['id'] for o in obj] == [0, 1]
+
+    sock.close()
+
+
 def test_cli(node_factory):
     l1 = node_factory.get_node()
 
@@ -1,11 +1,12 @@
 from fixtures import *  # noqa: F401,F403
 from flaky import flaky  # noqa: F401
 from lightning import RpcError, Millisatoshi
-from utils import DEVELOPER, wait_for, only_one, sync_blockheight, SLOW_MACHINE, TIMEOUT
+from utils import DEVELOPER, wait_for, only_one, sync_blockheight, SLOW_MACHINE, TIMEOUT, VALGRIND
 
 
 import copy
 import concurrent.futures
+import os
 import pytest
 import random
 import re
@@ -2187,3 +2188,67 @@ def test_channel_drainage(node_factory, bitcoind):
     route = l2.rpc.getroute(l1.info['id'], amount, riskfactor=1, fuzzpercent=0)['route']
     l2.rpc.sendpay(route, payment_hash)
     l2.rpc.waitsendpay(payment_hash, TIMEOUT)
+
+
+def test_pay_concurrent(node_factory, executor):
+    """The pay plugin handles a new command while another is still waiting"""
+    # l1->l2->l3, where l3 sits on its payment for a while.
+    opts = [{}, {}, {'plugin': 'tests/plugins/hold_invoice.py',
+                     'holdtime': TIMEOUT / 2}]
+    l1, l2, l3 = node_factory.line_graph(3, wait_for_announce=True,
+                                         opts=opts)
+
+    inv3 = l3.rpc.invoice(123000, 'held', 'held')['bolt11']
+    fut = executor.submit(l1.rpc.pay, inv3)
+    wait_for(lambda: len(l1.rpc.listsendpays(inv3)['payments']) == 1)
+
+    # pay to l2 completes while the pay to l3 is still held.
+    inv2 = l2.rpc.invoice(123000, 'quick', 'quick')['bolt11']
+    assert l1.rpc.pay(inv2)['status'] == 'complete'
+    assert not fut.done()
+    assert only_one(l1.rpc.listpays(inv3)['pays'])['status'] == 'pending'
+
+    assert fut.result(TIMEOUT)['status'] == 'complete'
+
+
+def plugin_rss(node, name):
+    """Resident set size (in kB) of @node's plugin called @name"""
+    for pid in os.listdir('/proc'):
+        if not pid.isdigit():
+            continue
+        try:
+            with open('/proc/{}/status'.format(pid)) as f:
+                status = dict(line.split(':', 1) for line in f if ':' in line)
+            with open('/proc/{}/cmdline'.format(pid), 'rb') as f:
+                cmdline = f.read().split(b'\0')
+        except (IOError, ValueError):
+            continue
+        if (int(status['PPid']) == node.daemon.proc.pid
+                and any(c.endswith(name.encode()) for c in cmdline)):
+            return int(status['VmRSS'].split()[0])
+    raise ValueError("No plugin {}".format(name))
+
+
+@unittest.skipIf(VALGRIND, "valgrind distorts RSS")
+def test_pay_plugin_memory(node_factory):
+    """The pay plugin doesn't grow over many commands and rpc round trips"""
+    l1, l2 = node_factory.line_graph(2)
+
+    for i in range(20):
+        inv = l2.rpc.invoice(1000, 'warmup{}'.format(i), 'warmup')['bolt11']
+        l1.rpc.pay(inv)
+        l1.rpc.listpays()
+    before = plugin_rss(l1, 'pay')
+
+    # Each listpays is a listsendpays round trip plus a reply; each pay is
+    # many more.  None of that may stay allocated once it's done.
+    for i in range(100):
+        inv = l2.rpc.invoice(1000, 'pay{}'.format(i), 'pay')['bolt11']
+        l1.rpc.pay(inv)
+        for _ in range(10):
+            l1.rpc.listpays()
+            l1.rpc.paystatus()
+
+    # 100 pays and 2000 listpays/paystatus over 120 payments leaked
+    # megabytes before tmpctx was cleaned; allow some allocator slack.
+    assert plugin_rss(l1, 'pay') - before < 1024
@@ -8,6 +8,7 @@ import json
 import os
 import pytest
 import re
+import socket
 import sqlite3
 import subprocess
 import time
@@ -312,6 +313,83 @@ def test_db_hook(node_factory, executor):
     assert [x for x in db1.iterdump()] == [x for x in db2.iterdump()]
 
 
+def test_db_hook_group(node_factory):
+    """This tests the db hook, with calls grouped."""
+    dbfile = os.path.join(node_factory.directory, "dblog.sqlite3")
+    l1 = node_factory.get_node(options={'plugin': 'tests/plugins/dblog.py',
+                                        'dblog-file': dbfile,
+                                        'db-write-group': 'true'})
+
+    l1.daemon.logsearch_start = 0
+    l1.daemon.wait_for_log('plugin-dblog.py initialized')
+
+    for i in range(5):
+        l1.rpc.invoice(1000 + i, 'inv{}'.format(i), 'description')
+
+    # A batch is dispatched all at once, so its five transactions are
+    # committed before we poll again, and go to the hook in one call.
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(l1.rpc.socket_path)
+    sock.sendall(b'[' + b','.join([b'{"id":%d, "jsonrpc":"2.0","method":"delexpiredinvoice","params":[]}' % i for i in range(5)]) + b']')
+    obj, _ = l1.rpc._readobj(sock, b'')
+    assert len(obj) == 5
+    sock.close()
+
+    stats = l1.rpc.getdbwritestats()
+    assert stats['group'] is True
+    assert stats['calls'] > 0
+    assert stats['transactions'] > stats['calls']
+    assert stats['statements'] > stats['transactions']
+    assert sum([b['count'] for b in stats['latency']]) == stats['calls']
+
+    l1.stop()
+
+    # Databases should still be identical.
+    db1 = sqlite3.connect(os.path.join(l1.daemon.lightning_dir, 'lightningd.sqlite3'))
+    db2 = sqlite3.connect(dbfile)
+
+    assert [x for x in db1.iterdump()] == [x for x in db2.iterdump()]
+
+
+def test_db_hook_group_refused(node_factory):
+    """A refused group of writes was already committed: we must stop."""
+    dbfile = os.path.join(node_factory.directory, "dblog.sqlite3")
+    l1 = node_factory.get_node(options={'plugin': 'tests/plugins/dblog.py',
+                                        'dblog-file': dbfile,
+                                        'dblog-refuse': 'refuseme',
+                                        'db-write-group': 'true'},
+                               may_fail=True, allow_broken_log=True)
+
+    with pytest.raises(RpcError):
+        l1.rpc.invoice(1000, 'refuseme', 'description')
+
+    l1.daemon.wait_for_log('plugin-dblog.py refusing')
+    l1.daemon.wait_for_log('Plugin returned failed db_write for writes we already committed')
+    wait_for(lambda: l1.daemon.proc.poll() is not None)
+
+
+def test_plugin_length_framing(node_factory):
+    """C plugins use length-prefixed messages, Python ones don't."""
+    l1 = node_factory.get_node(options={'plugin': 'contrib/plugins/helloworld.py'})
+
+    l1.daemon.logsearch_start = 0
+    l1.daemon.wait_for_log('plugin-autoclean: Using length-prefixed messages')
+    assert not l1.daemon.is_in_log('plugin-helloworld.py: Using length-prefixed messages')
+
+    # Both still work.
+    l1.daemon.wait_for_log('plugin-autoclean: autocleaning not active')
+    assert l1.rpc.autocleaninvoice(cycle_seconds=0) == "Autoclean timer disabled"
+    assert l1.rpc.call('hello', {'name': 'World'}) == "Hello World"
+
+
+
+def test_plugin_mixed_framing(node_factory):
+    """A plain reply right behind a length-prefixed message, in one write"""
+    l1 = node_factory.get_node(options={'plugin': 'tests/plugins/mixed_framing.py'})
+
+    assert l1.rpc.call('mixedframes') == "plain reply"
+    l1.daemon.wait_for_log('plugin-mixed_framing.py: framed log message')
+
 def test_utf8_passthrough(node_factory, executor):
     l1 = node_factory.get_node(options={'plugin': 'tests/plugins/utf8.py',
                                         'log-level': 'io'})
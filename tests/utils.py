@@ -44,6 +44,15 @@ VALGRIND = os.getenv("VALGRIND", config['VALGRIND']) == "1"
 SLOW_MACHINE = os.getenv("SLOW_MACHINE", "0") == "1"
 
 
+def expected_localfeatures():
+    """Return the localfeatures hexstring we offer in this configuration"""
+    if EXPERIMENTAL_FEATURES:
+        # Local features 1, 3, 5, 7 and 101 (gossip_queries_rice)
+        return "20" + "00" * 11 + "aa"
+    # Local features 1, 3, 5 and 7 (0xaa).
+    return "aa"
+
+
 def wait_for(success, timeout=TIMEOUT):
     start_time = time.time()
     interval = 0.25
@@ -211,6 +211,7 @@ class Type(FieldSet):
         'peer_features',
         'gossip_getnodes_entry',
         'gossip_getchannels_entry',
+        'gossip_txout',
         'failed_htlc',
         'utxo',
         'bitcoin_tx',